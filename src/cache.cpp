@@ -0,0 +1,488 @@
+/*
+ *    This file is part of Restream.
+ *
+ *    Restream is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    Restream is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with Restream.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "restream.hpp"
+#include "conf.hpp"
+#include "util.hpp"
+#include "logger.hpp"
+#include "channel.hpp"
+#include "infile.hpp"
+#include "pktarray.hpp"
+#include "ratectl.hpp"
+#include "rendition.hpp"
+#include "cache.hpp"
+#include "workpool.hpp"
+#include "pretrans.hpp"
+#include "pacer.hpp"
+#include "reactor.hpp"
+#include "inread.hpp"
+#include "uring.hpp"
+#include "timeshift.hpp"
+#include "recorder.hpp"
+#include "tsmux.hpp"
+#include "localout.hpp"
+#include "webu.hpp"
+#include "webu_ans.hpp"
+#include "webu_mpegts.hpp"
+#include "webu_mpts.hpp"
+
+/* Profiles need the decoded frames so those channels always decode */
+bool cls_cache::enabled()
+{
+    return ((app->conf->cache_dir != "") && (chitm->renditions.size() == 0));
+}
+
+/* FNV-1a */
+void cls_cache::hash_add(uint64_t &hash, const void *data, size_t len)
+{
+    const uint8_t *ptr;
+    size_t indx;
+
+    ptr = (const uint8_t *)data;
+    for (indx=0; indx < len; indx++) {
+        hash ^= ptr[indx];
+        hash *= 1099511628211ULL;
+    }
+}
+
+/* The key covers the source file and every setting that changes the
+ * encoded output.  Only the start of the source is read so the key is
+ * cheap to compute; its size and time stamp cover the rest
+*/
+uint64_t cls_cache::key_get(std::string fnm)
+{
+    uint64_t hash;
+    struct stat statbuf;
+    std::string parms;
+    uint8_t *buf;
+    size_t buf_len;
+    FILE *fp;
+
+    if (stat(fnm.c_str(), &statbuf) != 0) {
+        return 0;
+    }
+
+    hash = 14695981039346656037ULL;
+    hash_add(hash, fnm.c_str(), fnm.length());
+    hash_add(hash, &statbuf.st_size, sizeof(statbuf.st_size));
+    hash_add(hash, &statbuf.st_mtime, sizeof(statbuf.st_mtime));
+
+    fp = myfopen(fnm.c_str(), "rbe");
+    if (fp == nullptr) {
+        return 0;
+    }
+    buf = (uint8_t *)mymalloc(CACHE_HASH_BYTES);
+    buf_len = fread(buf, 1, CACHE_HASH_BYTES, fp);
+    hash_add(hash, buf, buf_len);
+    free(buf);
+    myfclose(fp);
+
+    parms = std::to_string(CACHE_VERSION) +
+        ":" + chitm->ch_encode +
+        ":" + std::to_string(chitm->ch_gop) +
+        ":" + std::to_string(chitm->ch_intrarefresh) +
+        ":" + std::to_string(chitm->ch_maxwidth) +
+        "x" + std::to_string(chitm->ch_maxheight) +
+        ":" + std::to_string(chitm->ch_maxfps) +
+        ":" + std::to_string(chitm->ch_ratectl) +
+        ":" + std::to_string(chitm->ch_shed) +
+        ":" + chitm->ch_preset_fast +
+        ":" + chitm->ch_preset_slow +
+        ":" + std::to_string(chitm->ch_crf_min) +
+        ":" + std::to_string(chitm->ch_crf_max) +
+        ":" + app->conf->language_code;
+    hash_add(hash, parms.c_str(), parms.length());
+
+    return hash;
+}
+
+std::string cls_cache::path_get(uint64_t key)
+{
+    char keystr[32];
+
+    snprintf(keystr, sizeof(keystr), "%016llx", (unsigned long long)key);
+
+    return app->conf->cache_dir + "/" + keystr + CACHE_EXT;
+}
+
+/* Remove the least recently played files until the cache fits the
+ * quota.  Playing a file refreshes its modification time
+*/
+void cls_cache::evict()
+{
+    DIR *d;
+    struct dirent *ent;
+    struct stat statbuf;
+    std::vector<ctx_cache_file> files;
+    ctx_cache_file fitm;
+    std::string nm;
+    int64_t total;
+    int indx;
+    size_t ext_len;
+
+    d = opendir(app->conf->cache_dir.c_str());
+    if (d == nullptr) {
+        return;
+    }
+    ext_len = strlen(CACHE_EXT);
+    total = 0;
+    while ((ent = readdir(d)) != nullptr) {
+        nm = ent->d_name;
+        if ((nm.length() <= ext_len) ||
+            (nm.substr(nm.length() - ext_len) != CACHE_EXT)) {
+            continue;
+        }
+        fitm.path = app->conf->cache_dir + "/" + nm;
+        if (stat(fitm.path.c_str(), &statbuf) != 0) {
+            continue;
+        }
+        fitm.size = (int64_t)statbuf.st_size;
+        fitm.mtime = statbuf.st_mtime;
+        total += fitm.size;
+        files.push_back(fitm);
+    }
+    closedir(d);
+
+    if (total <= app->conf->cache_size) {
+        return;
+    }
+
+    std::sort(files.begin(), files.end()
+        , [](const ctx_cache_file &a, const ctx_cache_file &b) {
+            return a.mtime < b.mtime;
+        });
+
+    for (indx=0; indx < (int)files.size(); indx++) {
+        if (total <= app->conf->cache_size) {
+            break;
+        }
+        if (remove(files[indx].path.c_str()) == 0) {
+            total -= files[indx].size;
+            LOG_MSG(DBG, NO_ERRNO
+                , "Ch%s: Evicted %s from the cache"
+                , ch_nbr.c_str(), files[indx].path.c_str());
+            pthread_mutex_lock(&chitm->mtx_stats);
+                chitm->stats.cache_evicted++;
+            pthread_mutex_unlock(&chitm->mtx_stats);
+        }
+    }
+}
+
+/* Open the cache file of fnm when there is a valid one.  The header
+ * and the tail are checked here and every packet as it is read
+*/
+bool cls_cache::play_open(std::string fnm)
+{
+    ctx_cache_head head;
+    ctx_cache_tail tail;
+    uint64_t key;
+    int64_t file_sz;
+
+    play_close(false);
+
+    if (enabled() == false) {
+        return false;
+    }
+
+    key = key_get(fnm);
+    if (key == 0) {
+        return false;
+    }
+    play_path = path_get(key);
+
+    play_file = myfopen(play_path.c_str(), "rbe");
+    if (play_file == nullptr) {
+        pthread_mutex_lock(&chitm->mtx_stats);
+            chitm->stats.cache_misses++;
+        pthread_mutex_unlock(&chitm->mtx_stats);
+        return false;
+    }
+
+    file_sz = -1;
+    if ((fread(&head, sizeof(head), 1, play_file) == 1) &&
+        (fseeko(play_file, -(off_t)sizeof(tail), SEEK_END) == 0) &&
+        (fread(&tail, sizeof(tail), 1, play_file) == 1)) {
+        file_sz = (int64_t)ftello(play_file);
+    }
+
+    if ((file_sz == -1) ||
+        (memcmp(head.magic, CACHE_MAGIC, 4) != 0) ||
+        (memcmp(tail.magic, CACHE_MAGIC, 4) != 0) ||
+        (head.version != CACHE_VERSION) ||
+        (head.key != key) ||
+        (tail.pkt_cnt == 0) ||
+        (tail.index_pos < (int64_t)sizeof(head)) ||
+        ((tail.index_pos + (int64_t)(tail.key_cnt * sizeof(int64_t)) +
+            (int64_t)sizeof(tail)) != file_sz) ||
+        (fseeko(play_file, (off_t)sizeof(head), SEEK_SET) != 0)) {
+        LOG_MSG(NTC, NO_ERRNO
+            , "Ch%s: Discarding invalid cache file %s"
+            , ch_nbr.c_str(), play_path.c_str());
+        play_close(true);
+        return false;
+    }
+
+    play_left = tail.pkt_cnt;
+    play_crc = 0;
+    play_crc_tail = tail.crc;
+
+    /* Refresh the time used for the eviction order */
+    utimes(play_path.c_str(), NULL);
+
+    pthread_mutex_lock(&chitm->mtx_stats);
+        chitm->stats.cache_hits++;
+    pthread_mutex_unlock(&chitm->mtx_stats);
+
+    LOG_MSG(NTC, NO_ERRNO
+        , "Ch%s: Playing from cache %s"
+        , ch_nbr.c_str(), play_path.c_str());
+
+    return true;
+}
+
+/* Returns 0 with the next packet, AVERROR_EOF at the end or -1 when the
+ * file is damaged
+*/
+int cls_cache::play_read(AVPacket *pkt)
+{
+    ctx_cache_rec rec;
+
+    if (play_file == nullptr) {
+        return -1;
+    }
+    if (play_left == 0) {
+        if (play_crc != play_crc_tail) {
+            return -1;
+        }
+        return AVERROR_EOF;
+    }
+
+    if ((fread(&rec, sizeof(rec), 1, play_file) != 1) ||
+        (rec.size <= 0) || (rec.size > CACHE_PKT_MAX)) {
+        return -1;
+    }
+    if (av_new_packet(pkt, rec.size) < 0) {
+        return -1;
+    }
+    if (fread(pkt->data, 1, (size_t)rec.size, play_file) != (size_t)rec.size) {
+        return -1;
+    }
+    if (av_crc(crc_tbl, 0, pkt->data, (size_t)rec.size) != rec.crc) {
+        return -1;
+    }
+    play_crc = av_crc(crc_tbl, play_crc, (const uint8_t *)&rec.crc, sizeof(rec.crc));
+
+    pkt->pts = rec.pts;
+    pkt->dts = rec.dts;
+    pkt->duration = rec.duration;
+    pkt->stream_index = rec.stream_index;
+    pkt->flags = rec.flags;
+    play_left--;
+
+    return 0;
+}
+
+void cls_cache::play_close(bool discard)
+{
+    if (play_file != nullptr) {
+        myfclose(play_file);
+        play_file = nullptr;
+    }
+    if (discard == true) {
+        remove(play_path.c_str());
+        pthread_mutex_lock(&chitm->mtx_stats);
+            chitm->stats.cache_corrupt++;
+        pthread_mutex_unlock(&chitm->mtx_stats);
+    }
+    play_left = 0;
+}
+
+/* Start capturing the encoded packets of fnm.  The file is written
+ * under a temporary name and only renamed once it is complete
+*/
+void cls_cache::record_open(std::string fnm)
+{
+    ctx_cache_head head;
+    uint64_t key;
+
+    record_abort();
+
+    if (enabled() == false) {
+        return;
+    }
+
+    key = key_get(fnm);
+    if (key == 0) {
+        return;
+    }
+    rec_path = path_get(key);
+    rec_tmp = rec_path + ".ch" + ch_nbr + ".tmp";
+
+    rec_file = myfopen(rec_tmp.c_str(), "wbe");
+    if (rec_file == nullptr) {
+        LOG_MSG(NTC, SHOW_ERRNO
+            , "Ch%s: Could not create cache file %s"
+            , ch_nbr.c_str(), rec_tmp.c_str());
+        return;
+    }
+
+    memcpy(head.magic, CACHE_MAGIC, 4);
+    head.version = CACHE_VERSION;
+    head.key = key;
+    if (fwrite(&head, sizeof(head), 1, rec_file) != 1) {
+        record_abort();
+        return;
+    }
+    rec_bytes = sizeof(head);
+    rec_cnt = 0;
+    rec_crc = 0;
+    rec_keys.clear();
+}
+
+void cls_cache::record_add(AVPacket *pkt)
+{
+    ctx_cache_rec rec;
+
+    if (rec_file == nullptr) {
+        return;
+    }
+
+    rec.pts = pkt->pts;
+    rec.dts = pkt->dts;
+    rec.duration = pkt->duration;
+    rec.size = pkt->size;
+    rec.stream_index = pkt->stream_index;
+    rec.flags = pkt->flags;
+    rec.crc = av_crc(crc_tbl, 0, pkt->data, (size_t)pkt->size);
+
+    if ((pkt->flags & AV_PKT_FLAG_KEY) &&
+        (pkt->stream_index == chitm->infile->ofile.video.index)) {
+        rec_keys.push_back(rec_bytes);
+    }
+
+    if ((fwrite(&rec, sizeof(rec), 1, rec_file) != 1) ||
+        (fwrite(pkt->data, 1, (size_t)pkt->size, rec_file) != (size_t)pkt->size)) {
+        LOG_MSG(NTC, SHOW_ERRNO
+            , "Ch%s: Could not write cache file %s"
+            , ch_nbr.c_str(), rec_tmp.c_str());
+        record_abort();
+        return;
+    }
+    rec_crc = av_crc(crc_tbl, rec_crc, (const uint8_t *)&rec.crc, sizeof(rec.crc));
+    rec_bytes += (int64_t)sizeof(rec) + pkt->size;
+    rec_cnt++;
+
+    /* A file that can never fit is not worth writing */
+    if (rec_bytes > app->conf->cache_size) {
+        LOG_MSG(NTC, NO_ERRNO
+            , "Ch%s: File is larger than the cache_size"
+            , ch_nbr.c_str());
+        record_abort();
+    }
+}
+
+/* The whole file was encoded.  Add the keyframe index and tail and
+ * move the file into place
+*/
+void cls_cache::record_close()
+{
+    ctx_cache_tail tail;
+    bool ok;
+
+    if (rec_file == nullptr) {
+        return;
+    }
+    if (rec_cnt == 0) {
+        record_abort();
+        return;
+    }
+
+    tail.pkt_cnt = rec_cnt;
+    tail.key_cnt = rec_keys.size();
+    tail.index_pos = rec_bytes;
+    tail.crc = rec_crc;
+    memcpy(tail.magic, CACHE_MAGIC, 4);
+
+    ok = true;
+    if (rec_keys.size() > 0) {
+        ok = (fwrite(rec_keys.data(), sizeof(int64_t)
+            , rec_keys.size(), rec_file) == rec_keys.size());
+    }
+    if (ok == true) {
+        ok = (fwrite(&tail, sizeof(tail), 1, rec_file) == 1);
+    }
+    if (myfclose(rec_file) != 0) {
+        ok = false;
+    }
+    rec_file = nullptr;
+    rec_keys.clear();
+
+    if ((ok == false) || (rename(rec_tmp.c_str(), rec_path.c_str()) != 0)) {
+        LOG_MSG(NTC, SHOW_ERRNO
+            , "Ch%s: Could not complete cache file %s"
+            , ch_nbr.c_str(), rec_path.c_str());
+        remove(rec_tmp.c_str());
+        return;
+    }
+
+    pthread_mutex_lock(&chitm->mtx_stats);
+        chitm->stats.cache_stored++;
+    pthread_mutex_unlock(&chitm->mtx_stats);
+
+    LOG_MSG(NTC, NO_ERRNO
+        , "Ch%s: Stored %ld packets in cache %s"
+        , ch_nbr.c_str(), (long)tail.pkt_cnt, rec_path.c_str());
+
+    evict();
+}
+
+/* Part of the file was not encoded so the capture is thrown away */
+void cls_cache::record_abort()
+{
+    if (rec_file == nullptr) {
+        return;
+    }
+    myfclose(rec_file);
+    rec_file = nullptr;
+    remove(rec_tmp.c_str());
+    rec_keys.clear();
+}
+
+cls_cache::cls_cache(cls_channel *p_chitm)
+{
+    chitm = p_chitm;
+    ch_nbr = chitm->ch_nbr;
+    crc_tbl = av_crc_get_table(AV_CRC_32_IEEE);
+    rec_file = nullptr;
+    rec_path = "";
+    rec_tmp = "";
+    rec_bytes = 0;
+    rec_cnt = 0;
+    rec_crc = 0;
+    play_file = nullptr;
+    play_path = "";
+    play_left = 0;
+    play_crc = 0;
+    play_crc_tail = 0;
+}
+
+cls_cache::~cls_cache()
+{
+    record_abort();
+    play_close(false);
+}
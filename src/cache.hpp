@@ -0,0 +1,69 @@
+/*
+ *    This file is part of Restream.
+ *
+ *    Restream is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    Restream is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with Restream.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef _INCLUDE_CACHE_HPP_
+#define _INCLUDE_CACHE_HPP_
+    #define CACHE_VERSION       1
+    #define CACHE_MAGIC         "RSTC"
+    #define CACHE_EXT           ".rsc"
+    #define CACHE_HASH_BYTES    (64 * 1024)         /* Bytes of the source hashed into the key */
+    #define CACHE_PKT_MAX       (64 * 1024 * 1024)  /* Largest packet accepted when reading */
+
+    /* Disk cache of the encoded packets of each file so that a file that
+     * comes around again in the playlist is only paced and not encoded
+    */
+    class cls_cache {
+        public:
+            cls_cache(cls_channel *p_chitm);
+            ~cls_cache();
+
+            bool    play_open(std::string fnm);
+            int     play_read(AVPacket *pkt);
+            void    play_close(bool discard);
+            void    record_open(std::string fnm);
+            void    record_add(AVPacket *pkt);
+            void    record_close();
+            void    record_abort();
+
+        private:
+            cls_channel     *chitm;
+            std::string     ch_nbr;
+            const AVCRC     *crc_tbl;
+
+            FILE            *rec_file;
+            std::string     rec_path;
+            std::string     rec_tmp;
+            int64_t         rec_bytes;
+            uint64_t        rec_cnt;
+            uint32_t        rec_crc;
+            std::vector<int64_t>    rec_keys;
+
+            FILE            *play_file;
+            std::string     play_path;
+            uint64_t        play_left;
+            uint32_t        play_crc;
+            uint32_t        play_crc_tail;
+
+            bool        enabled();
+            void        hash_add(uint64_t &hash, const void *data, size_t len);
+            uint64_t    key_get(std::string fnm);
+            std::string path_get(uint64_t key);
+            void        evict();
+    };
+
+#endif
@@ -23,9 +23,23 @@
 #include "channel.hpp"
 #include "infile.hpp"
 #include "pktarray.hpp"
+#include "ratectl.hpp"
+#include "rendition.hpp"
+#include "cache.hpp"
+#include "workpool.hpp"
+#include "pretrans.hpp"
+#include "pacer.hpp"
+#include "reactor.hpp"
+#include "inread.hpp"
+#include "uring.hpp"
+#include "timeshift.hpp"
+#include "recorder.hpp"
+#include "tsmux.hpp"
+#include "localout.hpp"
 #include "webu.hpp"
 #include "webu_ans.hpp"
 #include "webu_mpegts.hpp"
+#include "webu_mpts.hpp"
 
 
 
@@ -34,6 +48,132 @@ bool playlist_cmp(const ctx_playlist_item& a, const ctx_playlist_item& b)
     return a.fullnm < b.fullnm;
 }
 
+ctx_stream_desc::ctx_stream_desc()
+{
+    generation = 0;
+    video_index = -1;
+    audio_index = -1;
+    video_par = nullptr;
+    audio_par = nullptr;
+    video_tb = AVRational{0, 1};
+    video_strm_tb = AVRational{0, 1};
+    framerate = AVRational{0, 1};
+    gop_size = 0;
+    max_b_frames = 0;
+    keyint_min = 0;
+    sw_pix_fmt = AV_PIX_FMT_NONE;
+    audio_tb = AVRational{0, 1};
+    audio_pkt_tb = AVRational{0, 1};
+}
+
+ctx_stream_desc::~ctx_stream_desc()
+{
+    if (video_par != nullptr) {
+        avcodec_parameters_free(&video_par);
+    }
+    if (audio_par != nullptr) {
+        avcodec_parameters_free(&audio_par);
+    }
+}
+
+/* Copy what the clients need from the video encoder into dsc */
+int stream_desc_video(ctx_stream_desc *dsc, AVCodecContext *enc_ctx
+    , int indx, AVRational strm_tb)
+{
+    if (dsc->video_par == nullptr) {
+        dsc->video_par = avcodec_parameters_alloc();
+        if (dsc->video_par == nullptr) {
+            return -1;
+        }
+    }
+    if (avcodec_parameters_from_context(dsc->video_par, enc_ctx) < 0) {
+        return -1;
+    }
+    dsc->video_index = indx;
+    dsc->video_tb = enc_ctx->time_base;
+    dsc->video_strm_tb = strm_tb;
+    dsc->framerate = enc_ctx->framerate;
+    dsc->gop_size = enc_ctx->gop_size;
+    dsc->max_b_frames = enc_ctx->max_b_frames;
+    dsc->keyint_min = enc_ctx->keyint_min;
+    dsc->sw_pix_fmt = enc_ctx->sw_pix_fmt;
+
+    return 0;
+}
+
+/* Copy what the clients need from the audio encoder into dsc */
+int stream_desc_audio(ctx_stream_desc *dsc, AVCodecContext *enc_ctx, int indx)
+{
+    if (dsc->audio_par == nullptr) {
+        dsc->audio_par = avcodec_parameters_alloc();
+        if (dsc->audio_par == nullptr) {
+            return -1;
+        }
+    }
+    if (avcodec_parameters_from_context(dsc->audio_par, enc_ctx) < 0) {
+        return -1;
+    }
+    dsc->audio_index = indx;
+    dsc->audio_tb = enc_ctx->time_base;
+    dsc->audio_pkt_tb = enc_ctx->pkt_timebase;
+
+    return 0;
+}
+
+/* Publish the output streams after a file or encoder change.  The
+ * caller holds the infile mtx so the encoders can not go away
+*/
+void cls_channel::desc_publish()
+{
+    std::shared_ptr<ctx_stream_desc> dsc;
+    cls_infile *inf;
+
+    inf = infile;
+    dsc = std::make_shared<ctx_stream_desc>();
+    dsc->generation = desc_gen + 1;
+
+    if ((inf->ofile.video.index != -1) &&
+        (inf->ofile.video.codec_ctx != nullptr) &&
+        (inf->ofile.video.strm != nullptr)) {
+        if (stream_desc_video(dsc.get(), inf->ofile.video.codec_ctx
+            , inf->ofile.video.index, inf->ofile.video.strm->time_base) != 0) {
+            LOG_MSG(NTC, NO_ERRNO
+                , "Ch%s: Could not describe the video stream"
+                , ch_nbr.c_str());
+            return;
+        }
+    }
+    if ((inf->ofile.audio.index != -1) &&
+        (inf->ofile.audio.codec_ctx != nullptr)) {
+        if (stream_desc_audio(dsc.get(), inf->ofile.audio.codec_ctx
+            , inf->ofile.audio.index) != 0) {
+            LOG_MSG(NTC, NO_ERRNO
+                , "Ch%s: Could not describe the audio stream"
+                , ch_nbr.c_str());
+            return;
+        }
+    }
+
+    std::atomic_store(&strm_desc, ptr_stream_desc(dsc));
+    desc_gen = dsc->generation;
+}
+
+/* The newest stream description or nullptr before the first file */
+ptr_stream_desc cls_channel::desc_get()
+{
+    return std::atomic_load(&strm_desc);
+}
+
+/* Whether the packets are needed by clients, local readers, a recording
+ * or the timeshift store
+*/
+bool cls_channel::active()
+{
+    return ((cnct_cnt > 0) || (timeshift != nullptr) ||
+        (recorder->recording == true) ||
+        ((localout != nullptr) && (localout->clients_cnt > 0)));
+}
+
 void cls_channel::playlist_load()
 {
     DIR           *d;
@@ -259,6 +399,134 @@ void cls_channel::process()
     LOG_MSG(NTC, NO_ERRNO, "Ch%s: Finished",ch_nbr.c_str());
 }
 
+/* One step of process() for the reactor engine.  Returns the monotonic
+ * time in ns when the channel next needs to run, 0 to run again now or
+ * -1 once the channel has finished
+*/
+int64_t cls_channel::step()
+{
+    int64_t wake_ns;
+
+    if ((ch_finish == true) && (ch_state != CH_STATE_DONE)) {
+        pthread_mutex_lock(&infile->mtx);
+            infile->stop();
+        pthread_mutex_unlock(&infile->mtx);
+        ch_state = CH_STATE_DONE;
+        ch_running = false;
+        LOG_MSG(NTC, NO_ERRNO, "Ch%s: Finished",ch_nbr.c_str());
+    }
+
+    switch (ch_state) {
+    case CH_STATE_LOAD:
+        playlist_load();
+        playlist_index = 0;
+        if (playlist_count == 0) {
+            return pacer->now_ns() + 1000000000L;
+        }
+        ch_state = CH_STATE_OPEN;
+        return 0;
+    case CH_STATE_OPEN:
+        if (playlist_index >= playlist_count) {
+            ch_state = CH_STATE_LOAD;
+            return 0;
+        }
+        LOG_MSG(NTC, NO_ERRNO, "Ch%s: Playing: %s"
+            , ch_nbr.c_str(), playlist[playlist_index].filenm.c_str());
+        guide_process();
+        pthread_mutex_lock(&infile->mtx);
+            infile->start(playlist[playlist_index].fullnm);
+        pthread_mutex_unlock(&infile->mtx);
+        ch_state = CH_STATE_READ;
+        return 0;
+    case CH_STATE_READ:
+        wake_ns = infile->step();
+        if (wake_ns < 0) {
+            pthread_mutex_lock(&infile->mtx);
+                infile->stop();
+            pthread_mutex_unlock(&infile->mtx);
+            playlist_index++;
+            ch_state = CH_STATE_OPEN;
+            return 0;
+        }
+        return wake_ns;
+    case CH_STATE_DONE:
+        break;
+    }
+
+    return -1;
+}
+
+/* Fill the cache with every file of the playlist when the channel
+ * plays the directory given to --pretranscode
+*/
+bool cls_channel::pretranscode(cls_workpool *pool)
+{
+    int indx;
+    char path_ch[PATH_MAX], path_req[PATH_MAX];
+    cls_pretrans *pretrans;
+
+    if ((realpath(ch_dir.c_str(), path_ch) == NULL) ||
+        (realpath(app->pretrans_dir.c_str(), path_req) == NULL) ||
+        (mystrne(path_ch, path_req))) {
+        return false;
+    }
+
+    if (ch_encode != "h264") {
+        LOG_MSG(NTC, NO_ERRNO
+            , "Ch%s: Pretranscode requires enc=h264"
+            , ch_nbr.c_str());
+        return true;
+    }
+    if (renditions.size() > 0) {
+        LOG_MSG(NTC, NO_ERRNO
+            , "Ch%s: Pretranscode is not available with profiles"
+            , ch_nbr.c_str());
+        return true;
+    }
+
+    LOG_MSG(NTC, NO_ERRNO, "Ch%s: Pretranscoding %s"
+        , ch_nbr.c_str(), ch_dir.c_str());
+
+    ch_sort = "alpha";
+    playlist_load();
+    pretrans = new cls_pretrans(this, pool);
+    for (indx=0; indx < playlist_count; indx++) {
+        if (app->finish == true) {
+            break;
+        }
+        LOG_MSG(NTC, NO_ERRNO, "Ch%s: Pretranscoding: %s"
+            , ch_nbr.c_str(), playlist[indx].filenm.c_str());
+        pretrans->file(playlist[indx].fullnm);
+    }
+    delete pretrans;
+
+    return true;
+}
+
+/* maxres is given as WIDTHxHEIGHT or as just a height such as 720 */
+void cls_channel::maxres_parse(std::string parm)
+{
+    size_t pos;
+
+    ch_maxwidth = 0;
+    ch_maxheight = 0;
+    pos = parm.find("x");
+    if (pos == std::string::npos) {
+        ch_maxheight = atoi(parm.c_str());
+        ch_maxwidth = (ch_maxheight * 16) / 9;
+    } else {
+        ch_maxwidth = atoi(parm.substr(0, pos).c_str());
+        ch_maxheight = atoi(parm.substr(pos + 1).c_str());
+    }
+    if ((ch_maxwidth <= 0) || (ch_maxheight <= 0)) {
+        LOG_MSG(NTC, NO_ERRNO
+            , "Ch%d: Invalid maxres %s"
+            , ch_index, parm.c_str());
+        ch_maxwidth = 0;
+        ch_maxheight = 0;
+    }
+}
+
 cls_channel::cls_channel(int p_index, std::string p_conf)
 {
     std::list<ctx_params_item>::iterator    it;
@@ -270,7 +538,39 @@ cls_channel::cls_channel(int p_index, std::string p_conf)
     ch_running = true;
     ch_tvhguide = true;
     ch_encode = "";
+    ch_ringbytes = 0;
+    ch_ringsecs = 0;
+    ch_ringhuge = false;
+    ch_readahead = 0;
+    ch_readmmap = false;
+    ch_timeshift = 0;
+    ch_timeshift_bytes = 0;
+    ch_record = "";
+    ch_record_fmt = "ts";
+    ch_record_direct = false;
+    ch_tsmux = false;
+    ch_lowlatency = false;
+    ch_localsock = "";
+    ch_fifo = "";
+    ch_joinkey = 0;
+    ch_burst = 0;
+    ch_gop = 250;
+    ch_gop_set = false;
+    ch_intrarefresh = false;
+    ch_idr = false;
+    ch_ratectl = true;
+    ch_shed = true;
+    ch_maxwidth = 0;
+    ch_maxheight = 0;
+    ch_maxfps = 0;
+    ch_preset_fast = "ultrafast";
+    ch_preset_slow = "veryfast";
+    ch_crf_min = 17;
+    ch_crf_max = 23;
+    memset(&stats, 0, sizeof(ctx_channel_stats));
+    pthread_mutex_init(&mtx_stats, NULL);
     ch_index = p_index;
+    ch_state = CH_STATE_LOAD;
     ch_conf = p_conf;
     cnct_cnt = 0;
     file_cnt = 0;
@@ -297,17 +597,189 @@ cls_channel::cls_channel(int p_index, std::string p_conf)
         if (it->param_name == "enc") {
             ch_encode = it->param_value;
         }
+        if (it->param_name == "ringbytes") {
+            ch_ringbytes = util_parms_bytes(it->param_value);
+            if (ch_ringbytes < 0) {
+                LOG_MSG(NTC, NO_ERRNO
+                    , "Ch%d: Invalid ringbytes %s"
+                    , ch_index, it->param_value.c_str());
+                ch_ringbytes = 0;
+            }
+        }
+        if (it->param_name == "ringsecs") {
+            ch_ringsecs = atoi(it->param_value.c_str());
+        }
+        if (it->param_name == "ringhuge") {
+            app->conf->parm_set_bool(ch_ringhuge, it->param_value);
+        }
+        if (it->param_name == "readahead") {
+            ch_readahead = util_parms_bytes(it->param_value);
+            if (ch_readahead < 0) {
+                LOG_MSG(NTC, NO_ERRNO
+                    , "Ch%d: Invalid readahead %s"
+                    , ch_index, it->param_value.c_str());
+                ch_readahead = 0;
+            }
+        }
+        if (it->param_name == "readmmap") {
+            app->conf->parm_set_bool(ch_readmmap, it->param_value);
+        }
+        if (it->param_name == "timeshift") {
+            ch_timeshift = atoi(it->param_value.c_str());
+            if (ch_timeshift < 0) {
+                ch_timeshift = 0;
+            }
+        }
+        if (it->param_name == "timeshift_bytes") {
+            ch_timeshift_bytes = util_parms_bytes(it->param_value);
+            if (ch_timeshift_bytes < 0) {
+                LOG_MSG(NTC, NO_ERRNO
+                    , "Ch%d: Invalid timeshift_bytes %s"
+                    , ch_index, it->param_value.c_str());
+                ch_timeshift_bytes = 0;
+            }
+        }
+        if (it->param_name == "record") {
+            ch_record = it->param_value;
+        }
+        if (it->param_name == "record_fmt") {
+            if ((it->param_value == "ts") || (it->param_value == "mkv")) {
+                ch_record_fmt = it->param_value;
+            } else {
+                LOG_MSG(NTC, NO_ERRNO
+                    , "Ch%d: Invalid record_fmt %s"
+                    , ch_index, it->param_value.c_str());
+            }
+        }
+        if (it->param_name == "record_direct") {
+            app->conf->parm_set_bool(ch_record_direct, it->param_value);
+        }
+        if (it->param_name == "tsmux") {
+            if (it->param_value == "native") {
+                ch_tsmux = true;
+            } else if (it->param_value == "lavf") {
+                ch_tsmux = false;
+            } else {
+                LOG_MSG(NTC, NO_ERRNO
+                    , "Ch%d: Invalid tsmux %s"
+                    , ch_index, it->param_value.c_str());
+            }
+        }
+        if (it->param_name == "lowlatency") {
+            app->conf->parm_set_bool(ch_lowlatency, it->param_value);
+        }
+        if (it->param_name == "localsock") {
+            ch_localsock = it->param_value;
+        }
+        if (it->param_name == "fifo") {
+            ch_fifo = it->param_value;
+        }
+        if (it->param_name == "burst") {
+            ch_burst = atoi(it->param_value.c_str());
+            if (ch_burst < 0) {
+                ch_burst = 0;
+            }
+        }
+        if (it->param_name == "joinkey") {
+            ch_joinkey = atoi(it->param_value.c_str());
+            if (ch_joinkey < 0) {
+                ch_joinkey = 0;
+            }
+        }
+        if (it->param_name == "gop") {
+            ch_gop = atoi(it->param_value.c_str());
+            ch_gop_set = true;
+            if (ch_gop < 1) {
+                ch_gop = 250;
+                ch_gop_set = false;
+            }
+        }
+        if (it->param_name == "intrarefresh") {
+            app->conf->parm_set_bool(ch_intrarefresh, it->param_value);
+        }
+        if (it->param_name == "ratectl") {
+            app->conf->parm_set_bool(ch_ratectl, it->param_value);
+        }
+        if (it->param_name == "shed") {
+            app->conf->parm_set_bool(ch_shed, it->param_value);
+        }
+        if (it->param_name == "maxres") {
+            maxres_parse(it->param_value);
+        }
+        if (it->param_name == "maxfps") {
+            ch_maxfps = atoi(it->param_value.c_str());
+        }
+        if (it->param_name == "preset_fast") {
+            ch_preset_fast = it->param_value;
+        }
+        if (it->param_name == "preset_slow") {
+            ch_preset_slow = it->param_value;
+        }
+        if (it->param_name == "crf_min") {
+            ch_crf_min = atoi(it->param_value.c_str());
+        }
+        if (it->param_name == "crf_max") {
+            ch_crf_max = atoi(it->param_value.c_str());
+        }
     }
 
+    ratectl = new cls_ratectl(this);
     infile = new cls_infile(this);
     pktarray = new cls_pktarray(this);
+    cache = new cls_cache(this);
+    pacer = new cls_pacer(this);
+    inread = new cls_inread(this);
+    timeshift = nullptr;
+    if (ch_timeshift > 0) {
+        timeshift = new cls_timeshift(this);
+        if (timeshift->ok == false) {
+            delete timeshift;
+            timeshift = nullptr;
+        }
+    }
+    pktarray->timeshift = timeshift;
+    recorder = new cls_recorder(this);
+    localout = nullptr;
+    if ((ch_localsock != "") || (ch_fifo != "")) {
+        localout = new cls_localout(this);
+    }
+    strand = nullptr;
+    desc_gen = 0;
+
+    for (it  = ch_params.params_array.begin();
+         it != ch_params.params_array.end(); it++) {
+        if (it->param_name.substr(0, 8) == "profile_") {
+            renditions.push_back(new cls_rendition(this
+                , it->param_name.substr(8), it->param_value));
+        }
+    }
 
 }
 
 cls_channel::~cls_channel()
 {
+    int indx;
 
+    for (indx=0; indx < (int)renditions.size(); indx++) {
+        delete renditions[indx];
+    }
+    renditions.clear();
+    if (localout != nullptr) {
+        delete localout;
+    }
+    delete recorder;
+    if (strand != nullptr) {
+        delete strand;
+    }
+    delete pacer;
+    delete cache;
     delete pktarray;
+    if (timeshift != nullptr) {
+        delete timeshift;
+    }
     delete infile;
+    delete inread;
+    delete ratectl;
+    pthread_mutex_destroy(&mtx_stats);
 
 }
\ No newline at end of file
@@ -18,6 +18,43 @@
 
 #ifndef _INCLUDE_CHANNEL_HPP_
 #define _INCLUDE_CHANNEL_HPP_
+    /* Where a channel run by the reactor engine is in its playlist */
+    enum CH_STATE {
+        CH_STATE_LOAD,      /* Read the playlist directory */
+        CH_STATE_OPEN,      /* Open the next file */
+        CH_STATE_READ,      /* Send the packets of the open file */
+        CH_STATE_DONE
+    };
+
+    /* The output streams of a channel or profile as the clients need
+     * them to set up their muxer.  A description is never changed once
+     * published so clients keep it without holding any lock
+    */
+    struct ctx_stream_desc {
+        int64_t             generation;
+        int                 video_index;
+        int                 audio_index;
+        AVCodecParameters   *video_par;
+        AVCodecParameters   *audio_par;
+        AVRational          video_tb;       /* Time base of the video encoder */
+        AVRational          video_strm_tb;  /* Time base of the video output stream */
+        AVRational          framerate;
+        int                 gop_size;
+        int                 max_b_frames;
+        int                 keyint_min;
+        enum AVPixelFormat  sw_pix_fmt;
+        AVRational          audio_tb;
+        AVRational          audio_pkt_tb;
+
+        ctx_stream_desc();
+        ~ctx_stream_desc();
+    };
+    typedef std::shared_ptr<const ctx_stream_desc> ptr_stream_desc;
+
+    int stream_desc_video(ctx_stream_desc *dsc, AVCodecContext *enc_ctx
+        , int indx, AVRational strm_tb);
+    int stream_desc_audio(ctx_stream_desc *dsc, AVCodecContext *enc_ctx, int indx);
+
     class cls_channel {
         public:
             cls_channel(int p_indx, std::string p_conf);
@@ -25,6 +62,15 @@
 
             cls_infile      *infile;
             cls_pktarray    *pktarray;
+            cls_ratectl     *ratectl;
+            cls_cache       *cache;
+            cls_pacer       *pacer;
+            cls_inread      *inread;
+            cls_timeshift   *timeshift;     /* Disk store of past packets when set */
+            cls_recorder    *recorder;
+            cls_localout    *localout;      /* Local socket and pipe output when set */
+            cls_strand      *strand;    /* Runs the encodes on the shared pool when set */
+            std::vector<cls_rendition*>  renditions;     /* Secondary profiles from profile_<name> */
             int64_t         file_cnt;
             int             cnct_cnt;
 
@@ -32,21 +78,62 @@
             bool            ch_running;
             std::string     ch_nbr;
             std::string     ch_encode;
+            int64_t         ch_ringbytes;
+            int             ch_ringsecs;
+            bool            ch_ringhuge;
+            int64_t         ch_readahead;   /* Bytes read ahead of the demuxer or 0 */
+            bool            ch_readmmap;
+            int64_t         ch_timeshift;   /* Seconds kept in the timeshift store or 0 */
+            int64_t         ch_timeshift_bytes;
+            std::string     ch_record;      /* Daily recording windows */
+            std::string     ch_record_fmt;
+            bool            ch_record_direct;
+            bool            ch_tsmux;       /* Clients use the native TS packetizer */
+            bool            ch_lowlatency;  /* Clients are muxed without interleaving */
+            std::string     ch_localsock;   /* Unix socket serving the stream to local readers */
+            std::string     ch_fifo;        /* Named pipe serving the stream */
+            int             ch_joinkey;
+            int             ch_burst;
+            int             ch_gop;
+            bool            ch_gop_set;
+            bool            ch_intrarefresh;
+            std::atomic<bool>   ch_idr;     /* Ask the encoder for an IDR on the next frame */
+            bool            ch_ratectl;
+            bool            ch_shed;
+            int             ch_maxwidth;
+            int             ch_maxheight;
+            int             ch_maxfps;
+            std::string     ch_preset_fast;
+            std::string     ch_preset_slow;
+            int             ch_crf_min;
+            int             ch_crf_max;
+
+            pthread_mutex_t     mtx_stats;
+            ctx_channel_stats   stats;
+            std::atomic<int64_t>    desc_gen;   /* Generation of the newest stream description */
 
             void    process();
+            int64_t step();
+            bool    pretranscode(cls_workpool *pool);
+            void    desc_publish();
+            ptr_stream_desc desc_get();
+            bool    active();
 
         private:
+            ptr_stream_desc strm_desc;
             std::string     ch_conf;
             ctx_params      ch_params;
             bool            ch_tvhguide;
             std::string     ch_sort;
             std::string     ch_dir;
             int             ch_index;
+            enum CH_STATE   ch_state;
 
             std::vector<ctx_playlist_item>    playlist;
             int             playlist_index;
             int             playlist_count;
             void            playlist_load();
+            void            maxres_parse(std::string parm);
 
             void guide_times(
                 std::string f1, std::string &st1,std::string &en1,
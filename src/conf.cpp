@@ -23,9 +23,23 @@
 #include "channel.hpp"
 #include "infile.hpp"
 #include "pktarray.hpp"
+#include "ratectl.hpp"
+#include "rendition.hpp"
+#include "cache.hpp"
+#include "workpool.hpp"
+#include "pretrans.hpp"
+#include "pacer.hpp"
+#include "reactor.hpp"
+#include "inread.hpp"
+#include "uring.hpp"
+#include "timeshift.hpp"
+#include "recorder.hpp"
+#include "tsmux.hpp"
+#include "localout.hpp"
 #include "webu.hpp"
 #include "webu_ans.hpp"
 #include "webu_mpegts.hpp"
+#include "webu_mpts.hpp"
 
 
 void cls_config::parm_set_bool(bool &parm_dest, std::string &parm_in)
@@ -125,6 +139,40 @@ void cls_config::edit_language_code(std::string &parm, enum PARM_ACT pact)
     return;
 }
 
+void cls_config::edit_cache_dir(std::string &parm, enum PARM_ACT pact)
+{
+    if (pact == PARM_ACT_DFLT) {
+        cache_dir = "";
+    } else if (pact == PARM_ACT_SET) {
+        if ((parm.length() > 1) && (parm.substr(parm.length() - 1) == "/")) {
+            cache_dir = parm.substr(0, parm.length() - 1);
+        } else {
+            cache_dir = parm;
+        }
+    } else if (pact == PARM_ACT_GET) {
+        parm = cache_dir;
+    }
+    return;
+}
+
+void cls_config::edit_cache_size(std::string &parm, enum PARM_ACT pact)
+{
+    int64_t parm_in;
+    if (pact == PARM_ACT_DFLT) {
+        cache_size = (int64_t)4 * 1024 * 1024 * 1024;
+    } else if (pact == PARM_ACT_SET) {
+        parm_in = util_parms_bytes(parm);
+        if (parm_in <= 0) {
+            LOG_MSG(NTC,  NO_ERRNO, "Invalid cache_size %s",parm.c_str());
+        } else {
+            cache_size = parm_in;
+        }
+    } else if (pact == PARM_ACT_GET) {
+        parm = std::to_string(cache_size);
+    }
+    return;
+}
+
 void cls_config::edit_log_fflevel(std::string &parm, enum PARM_ACT pact)
 {
     int parm_in;
@@ -149,6 +197,120 @@ void cls_config::edit_log_fflevel(std::string &parm, enum PARM_ACT pact)
     return;
 }
 
+void cls_config::edit_engine(std::string &parm, enum PARM_ACT pact)
+{
+    if (pact == PARM_ACT_DFLT) {
+        engine = "thread";
+    } else if (pact == PARM_ACT_SET) {
+        if ((parm == "thread") || (parm == "reactor"))  {
+            engine = parm;
+        } else if (parm == "") {
+            engine = "thread";
+        } else {
+            LOG_MSG(NTC, NO_ERRNO, "Invalid engine %s", parm.c_str());
+        }
+    } else if (pact == PARM_ACT_GET) {
+        parm = engine;
+    } else if (pact == PARM_ACT_LIST) {
+        parm = "[";
+        parm = parm +  "\"thread\",\"reactor\"";
+        parm = parm + "]";
+    }
+    return;
+}
+
+void cls_config::edit_reactor_threads(std::string &parm, enum PARM_ACT pact)
+{
+    int parm_in;
+    if (pact == PARM_ACT_DFLT) {
+        reactor_threads = 1;
+    } else if (pact == PARM_ACT_SET) {
+        parm_in = atoi(parm.c_str());
+        if ((parm_in < 1) || (parm_in > 64)) {
+            LOG_MSG(NTC, NO_ERRNO, "Invalid reactor_threads %d",parm_in);
+        } else {
+            reactor_threads = parm_in;
+        }
+    } else if (pact == PARM_ACT_GET) {
+        parm = std::to_string(reactor_threads);
+    }
+    return;
+}
+
+void cls_config::edit_pool_workers(std::string &parm, enum PARM_ACT pact)
+{
+    int parm_in;
+    if (pact == PARM_ACT_DFLT) {
+        pool_workers = 0;
+    } else if (pact == PARM_ACT_SET) {
+        parm_in = atoi(parm.c_str());
+        if ((parm_in < 0) || (parm_in > 1024)) {
+            LOG_MSG(NTC, NO_ERRNO, "Invalid pool_workers %d",parm_in);
+        } else {
+            pool_workers = parm_in;
+        }
+    } else if (pact == PARM_ACT_GET) {
+        parm = std::to_string(pool_workers);
+    }
+    return;
+}
+
+void cls_config::edit_encode_pool(std::string &parm, enum PARM_ACT pact)
+{
+    if (pact == PARM_ACT_DFLT) {
+        encode_pool = false;
+    } else if (pact == PARM_ACT_SET) {
+        parm_set_bool(encode_pool, parm);
+    } else if (pact == PARM_ACT_GET) {
+        parm_get_bool(parm, encode_pool);
+    }
+    return;
+}
+
+void cls_config::edit_io_uring(std::string &parm, enum PARM_ACT pact)
+{
+    if (pact == PARM_ACT_DFLT) {
+        io_uring = false;
+    } else if (pact == PARM_ACT_SET) {
+        parm_set_bool(io_uring, parm);
+    } else if (pact == PARM_ACT_GET) {
+        parm_get_bool(parm, io_uring);
+    }
+    return;
+}
+
+void cls_config::edit_timeshift_dir(std::string &parm, enum PARM_ACT pact)
+{
+    if (pact == PARM_ACT_DFLT) {
+        timeshift_dir = "/var/tmp";
+    } else if (pact == PARM_ACT_SET) {
+        if ((parm.length() > 1) && (parm.substr(parm.length() - 1) == "/")) {
+            timeshift_dir = parm.substr(0, parm.length() - 1);
+        } else {
+            timeshift_dir = parm;
+        }
+    } else if (pact == PARM_ACT_GET) {
+        parm = timeshift_dir;
+    }
+    return;
+}
+
+void cls_config::edit_record_dir(std::string &parm, enum PARM_ACT pact)
+{
+    if (pact == PARM_ACT_DFLT) {
+        record_dir = "/var/tmp";
+    } else if (pact == PARM_ACT_SET) {
+        if ((parm.length() > 1) && (parm.substr(parm.length() - 1) == "/")) {
+            record_dir = parm.substr(0, parm.length() - 1);
+        } else {
+            record_dir = parm;
+        }
+    } else if (pact == PARM_ACT_GET) {
+        parm = record_dir;
+    }
+    return;
+}
+
 void cls_config::edit_webcontrol_port(std::string &parm, enum PARM_ACT pact)
 {
     int parm_in;
@@ -446,6 +608,15 @@ void cls_config::edit_cat00(std::string parm_nm
     } else if (parm_nm == "log_fflevel") {  edit_log_fflevel(parm_val, pact);
     } else if (parm_nm == "epg_socket") {   edit_epg_socket(parm_val, pact);
     } else if (parm_nm == "language_code"){ edit_language_code(parm_val, pact);
+    } else if (parm_nm == "cache_dir") {    edit_cache_dir(parm_val, pact);
+    } else if (parm_nm == "cache_size") {   edit_cache_size(parm_val, pact);
+    } else if (parm_nm == "engine") {       edit_engine(parm_val, pact);
+    } else if (parm_nm == "reactor_threads") { edit_reactor_threads(parm_val, pact);
+    } else if (parm_nm == "pool_workers") { edit_pool_workers(parm_val, pact);
+    } else if (parm_nm == "encode_pool") {  edit_encode_pool(parm_val, pact);
+    } else if (parm_nm == "io_uring") {     edit_io_uring(parm_val, pact);
+    } else if (parm_nm == "timeshift_dir") { edit_timeshift_dir(parm_val, pact);
+    } else if (parm_nm == "record_dir") {   edit_record_dir(parm_val, pact);
     }
 }
 
@@ -576,6 +747,7 @@ void cls_config::usage()
     printf("-c config\t\tFull path and filename of config file.\n");
     printf("-d level\t\tLog level (1-9) (EMG, ALR, CRT, ERR, WRN, NTC, INF, DBG, ALL). default: 6 / NTC.\n");
     printf("-l log file \t\tFull path and filename of log file.\n");
+    printf("--pretranscode dir\tEncode the files of the channels playing dir into the cache and exit.\n");
     printf("-h\t\t\tShow this screen.\n");
     printf("\n");
 }
@@ -583,8 +755,13 @@ void cls_config::usage()
 void cls_config::process_cmdline()
 {
     int c;
+    static struct option long_opts[] = {
+        {"pretranscode", required_argument, NULL, 'p'},
+        {NULL, 0, NULL, 0}
+    };
 
-    while ((c = getopt(c_app->argc, c_app->argv, "cdlh:")) != -1)
+    while ((c = getopt_long(c_app->argc, c_app->argv, "c:d:l:h"
+        , long_opts, NULL)) != -1)
         switch (c) {
         case 'c':
             c_app->conf_file.assign(optarg);
@@ -595,6 +772,9 @@ void cls_config::process_cmdline()
         case 'l':
             cmd_log_file.assign(optarg);
             break;
+        case 'p':
+            c_app->pretrans_dir.assign(optarg);
+            break;
         case 'h':
         case '?':
         default:
@@ -794,6 +974,15 @@ void cls_config::parms_init()
     parms_add("log_fflevel",               PARM_TYP_INT,    PARM_CAT_00, WEBUI_LEVEL_LIMITED);
     parms_add("epg_socket",                PARM_TYP_STRING, PARM_CAT_00, WEBUI_LEVEL_LIMITED);
     parms_add("language_code",             PARM_TYP_STRING, PARM_CAT_00, WEBUI_LEVEL_LIMITED);
+    parms_add("cache_dir",                 PARM_TYP_STRING, PARM_CAT_00, WEBUI_LEVEL_ADVANCED);
+    parms_add("cache_size",                PARM_TYP_STRING, PARM_CAT_00, WEBUI_LEVEL_ADVANCED);
+    parms_add("engine",                    PARM_TYP_LIST,   PARM_CAT_00, WEBUI_LEVEL_ADVANCED);
+    parms_add("reactor_threads",           PARM_TYP_INT,    PARM_CAT_00, WEBUI_LEVEL_ADVANCED);
+    parms_add("pool_workers",              PARM_TYP_INT,    PARM_CAT_00, WEBUI_LEVEL_ADVANCED);
+    parms_add("encode_pool",               PARM_TYP_BOOL,   PARM_CAT_00, WEBUI_LEVEL_ADVANCED);
+    parms_add("io_uring",                  PARM_TYP_BOOL,   PARM_CAT_00, WEBUI_LEVEL_ADVANCED);
+    parms_add("timeshift_dir",             PARM_TYP_STRING, PARM_CAT_00, WEBUI_LEVEL_ADVANCED);
+    parms_add("record_dir",                PARM_TYP_STRING, PARM_CAT_00, WEBUI_LEVEL_ADVANCED);
     parms_add("webcontrol_port",           PARM_TYP_INT,    PARM_CAT_01, WEBUI_LEVEL_ADVANCED);
     parms_add("webcontrol_port2",          PARM_TYP_INT,    PARM_CAT_01, WEBUI_LEVEL_ADVANCED);
     parms_add("webcontrol_base_path",      PARM_TYP_STRING, PARM_CAT_01, WEBUI_LEVEL_ADVANCED);
@@ -27,6 +27,15 @@
             int             log_fflevel;
             std::string     epg_socket;
             std::string     language_code;
+            std::string     cache_dir;
+            int64_t         cache_size;
+            std::string     engine;
+            int             reactor_threads;
+            int             pool_workers;
+            bool            encode_pool;
+            bool            io_uring;
+            std::string     timeshift_dir;
+            std::string     record_dir;
             int             webcontrol_port;
             int             webcontrol_port2;
             std::string     webcontrol_base_path;
@@ -60,6 +69,15 @@
             void edit_log_fflevel(std::string &parm, enum PARM_ACT pact);
             void edit_epg_socket(std::string &parm, enum PARM_ACT pact);
             void edit_language_code(std::string &parm, enum PARM_ACT pact);
+            void edit_cache_dir(std::string &parm, enum PARM_ACT pact);
+            void edit_cache_size(std::string &parm, enum PARM_ACT pact);
+            void edit_engine(std::string &parm, enum PARM_ACT pact);
+            void edit_reactor_threads(std::string &parm, enum PARM_ACT pact);
+            void edit_pool_workers(std::string &parm, enum PARM_ACT pact);
+            void edit_encode_pool(std::string &parm, enum PARM_ACT pact);
+            void edit_io_uring(std::string &parm, enum PARM_ACT pact);
+            void edit_timeshift_dir(std::string &parm, enum PARM_ACT pact);
+            void edit_record_dir(std::string &parm, enum PARM_ACT pact);
             void edit_webcontrol_port(std::string &parm, enum PARM_ACT pact);
             void edit_webcontrol_base_path(std::string &parm, enum PARM_ACT pact);
             void edit_webcontrol_ipv6(std::string &parm, enum PARM_ACT pact);
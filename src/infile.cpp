@@ -23,10 +23,32 @@
 #include "channel.hpp"
 #include "infile.hpp"
 #include "pktarray.hpp"
+#include "ratectl.hpp"
+#include "rendition.hpp"
+#include "cache.hpp"
+#include "workpool.hpp"
+#include "pretrans.hpp"
+#include "pacer.hpp"
+#include "reactor.hpp"
+#include "inread.hpp"
+#include "uring.hpp"
+#include "timeshift.hpp"
+#include "recorder.hpp"
+#include "tsmux.hpp"
+#include "localout.hpp"
 #include "webu.hpp"
 #include "webu_ans.hpp"
 #include "webu_mpegts.hpp"
+#include "webu_mpts.hpp"
 
+static int infile_get_encode_buffer(AVCodecContext *ctx, AVPacket *pkt, int flags)
+{
+    cls_infile *infile =(cls_infile *)ctx->opaque;
+
+    return infile->encoder_get_buffer(ctx, pkt, flags);
+}
+
+/**************************************************/
 
 void cls_infile::defaults()
 {
@@ -36,10 +58,12 @@ void cls_infile::defaults()
     ifile.audio.codec_ctx = nullptr;
     ifile.audio.strm = nullptr;
     ifile.audio.base_pdts = 0;
+    myrescale_init(ifile.audio.rs_us, AVRational{0, 1}, AVRational{1, AV_TIME_BASE});
     ifile.video = ifile.audio;
     ifile.fmt_ctx = nullptr;
     ifile.time_start = -1;
     ofile = ifile;
+    ofile.audio.last_pts = AV_NOPTS_VALUE;
 }
 
 int cls_infile::decoder_init_video()
@@ -159,9 +183,16 @@ int cls_infile::decoder_init(std::string fnm)
         , "Ch%s: Opening file '%s'"
         , ch_nbr.c_str(), fnm.c_str());
 
+    if (chitm->inread->open(fnm) == 0) {
+        ifile.fmt_ctx = avformat_alloc_context();
+        ifile.fmt_ctx->pb = chitm->inread->avio;
+        ifile.fmt_ctx->flags |= AVFMT_FLAG_CUSTOM_IO;
+    }
+
     retcd = avformat_open_input(&ifile.fmt_ctx
         , fnm.c_str(), NULL, NULL);
     if (retcd < 0) {
+        chitm->inread->close();
         av_strerror(retcd, errstr, sizeof(errstr));
         LOG_MSG(NTC, NO_ERRNO
             , "Ch%s: Could not open input file '%s': %s"
@@ -214,10 +245,7 @@ int cls_infile::decoder_get_ts()
     ifile.video.start_pts = -1;
     ifile.audio.start_pts = -1;
     while (indx < 100) {
-        av_packet_free(&pkt_in);
-        pkt_in = av_packet_alloc();
-        pkt_in->data = nullptr;
-        pkt_in->size = 0;
+        av_packet_unref(pkt_in);
 
         retcd = av_read_frame(ifile.fmt_ctx, pkt_in);
         if (retcd < 0) {
@@ -249,6 +277,7 @@ int cls_infile::decoder_get_ts()
     }
 
     ifile.time_start = av_gettime_relative();
+    chitm->pacer->start();
     if ((ifile.video.strm != nullptr) &&
         (ifile.audio.strm != nullptr)) {
         temp_pts = av_rescale_q(
@@ -272,67 +301,83 @@ int cls_infile::decoder_get_ts()
     return 0;
 }
 
-void cls_infile::infile_wait()
+/* Work out when the packet in pkt_in is due on the channel's schedule.
+ * Returns the monotonic time in ns to wake for or 0 when it is due now.
+ * Packets from the cache carry the output stream indexes
+*/
+int64_t cls_infile::packet_due()
 {
-    int64_t tm_diff, pts_diff, tot_diff;
-    int64_t sec_full, sec_msec;
+    int64_t dts, pos_us, margin, wake_ns;
+    ctx_av_info *strm_info;
+    bool is_video;
 
     if (chitm->ch_finish == true) {
-        return;
+        return 0;
     }
 
-    if (chitm->pktarray->start > 0)  {
-        chitm->pktarray->start--;
-/*
-        LOG_MSG(NTC, NO_ERRNO
-            , "%s: skipping first packets %d id %d index %d"
-            , ch_nbr.c_str()
-            , chitm->pktarray_start
-            , chitm->pktarray[chitm->pktarray_index].idnbr
-            , chitm->pktarray_index);
-*/
-        /* Slightly adjust time start to consider these skipped packets*/
-        if ((pkt_in->stream_index == ifile.video.index) &&
-            (pkt_in->pts != AV_NOPTS_VALUE)) {
-            tm_diff = av_gettime_relative() - ifile.time_start;
-            pts_diff = av_rescale_q(
-                pkt_in->pts - ifile.video.start_pts
-                , AVRational{1,1}
-                , ifile.video.strm->time_base);
-            tot_diff = pts_diff - tm_diff;
-            ifile.time_start -= tot_diff;
+    if (cache_play == true) {
+        is_video = (pkt_in->stream_index == ofile.video.index);
+        if ((is_video == false) && (pkt_in->stream_index != ofile.audio.index)) {
+            return 0;
+        }
+    } else {
+        is_video = (pkt_in->stream_index == ifile.video.index);
+        if ((is_video == false) && (pkt_in->stream_index != ifile.audio.index)) {
+            return 0;
         }
-        return;
+    }
+    if (is_video == true) {
+        strm_info = &ifile.video;
+    } else {
+        strm_info = &ifile.audio;
     }
 
+    dts = pkt_in->dts;
+    if (dts == AV_NOPTS_VALUE) {
+        dts = pkt_in->pts;
+    }
+    if ((dts == AV_NOPTS_VALUE) || (strm_info->strm == nullptr)) {
+        return 0;
+    }
+    myrescale_check(strm_info->rs_us, strm_info->strm->time_base
+        , AVRational{1, AV_TIME_BASE});
+    pos_us = myrescale(strm_info->rs_us, dts - strm_info->start_pts);
 
-    if ((pkt_in->stream_index != ifile.video.index) ||
-        (pkt_in->pts == AV_NOPTS_VALUE)  ||
-        (pkt_in->pts < ifile.video.last_pts)) {
-        return;
+    /* Packets skipped at the start are sent without waiting */
+    if (chitm->pktarray->start > 0)  {
+        chitm->pktarray->start--;
+        chitm->pacer->rebase(pos_us);
+        return 0;
     }
 
-    ifile.video.last_pts = pkt_in->pts;
+    wake_ns = chitm->pacer->due(pos_us, margin);
 
-    /* How much time has really elapsed since the start of movie*/
-    tm_diff = av_gettime_relative() - ifile.time_start;
+    if ((is_video == true) && (chitm->active() == true) && (cache_play == false)) {
+        if (chitm->strand != nullptr) {
+            chitm->strand->post([this, margin]() { margin_job(margin); });
+        } else {
+            margin_job(margin);
+        }
+    }
 
-    /* How much time the pts wants us to be at since the start of the movie */
-    /* At this point the pkt pts is in ifile timebase.*/
-    pts_diff = av_rescale_q(
-        pkt_in->pts - ifile.video.start_pts
-        , AVRational{1,1}
-        , ifile.video.strm->time_base);
+    return wake_ns;
+}
 
-    /* How much time we need to wait to get in sync*/
-    tot_diff = pts_diff - tm_diff;
+/* The rate controller and encoder settings belong to whoever encodes */
+void cls_infile::margin_job(int64_t margin)
+{
+    if (chitm->ratectl->margin_add(margin) == true) {
+        shed_apply();
+    }
+}
 
-    if (tot_diff > 0) {
-        sec_full = int(tot_diff / 1000000L);
-        sec_msec = (tot_diff % 1000000L);
-        if (sec_full < 100){
-            SLEEP(sec_full, sec_msec * 1000);
-        }
+void cls_infile::infile_wait()
+{
+    int64_t wake_ns;
+
+    wake_ns = packet_due();
+    if (wake_ns > 0) {
+        chitm->pacer->sleep(wake_ns);
     }
 }
 
@@ -365,11 +410,8 @@ void cls_infile::decoder_receive()
     int retcd;
     char errstr[128];
 
-    if (frame != nullptr) {
-        myframe_free(frame);
-        frame = nullptr;
-    }
-    frame = myframe_alloc();
+    av_frame_unref(frame);
+    frame_ready = false;
 
     if (pkt_in->stream_index == ifile.video.index) {
        retcd = avcodec_receive_frame(ifile.video.codec_ctx, frame);
@@ -387,15 +429,13 @@ void cls_infile::decoder_receive()
                 , "Ch%s: Error receiving frame from decoder: %s"
                 , ch_nbr.c_str(), errstr);
         }
-        if (frame != nullptr) {
-            myframe_free(frame);
-            frame = nullptr;
-        }
+        return;
     }
+    frame_ready = true;
 
 }
 
-int cls_infile::encoder_buffer_audio()
+int cls_infile::encoder_buffer_audio(AVFrame *frm_in)
 {
     int frame_size, retcd, bufspc;
     int frmsz_src, frmsz_dst;
@@ -414,18 +454,17 @@ int cls_infile::encoder_buffer_audio()
     }
 
     retcd = av_audio_fifo_write(
-        fifo, (void **)frame->data,frmsz_src);
+        fifo, (void **)frm_in->data,frmsz_src);
     if (retcd < frmsz_src) {
         LOG_MSG(NTC, NO_ERRNO
             , "Ch%s: Could not write data to FIFO"
             , ch_nbr.c_str());
         return -1;
     }
-    pts = frame->pts;
-    dts = frame->pkt_dts;
+    pts = frm_in->pts;
+    dts = frm_in->pkt_dts;
 
-    myframe_free(frame);
-    frame = nullptr;
+    av_frame_unref(frm_in);
 
     retcd = av_audio_fifo_size(fifo);
     if (retcd < frmsz_dst) {
@@ -443,87 +482,207 @@ int cls_infile::encoder_buffer_audio()
     audio_last_pts = pts;
     audio_last_dts = dts;
 
-    frame = av_frame_alloc();
-    if (frame == nullptr) {
-        LOG_MSG(NTC, NO_ERRNO
-            , "Ch%s: Could not allocate output frame"
-            , ch_nbr.c_str());
-        return -1;
-    }
-    frame->nb_samples     = frame_size;
-    av_channel_layout_copy(&frame->ch_layout
-        , &ofile.audio.codec_ctx->ch_layout);
-    frame->format         = ofile.audio.codec_ctx->sample_fmt;
-    frame->sample_rate    = ofile.audio.codec_ctx->sample_rate;
-    frame->pts = pts - ptsadj;
-    frame->pkt_dts = dts-dtsadj;
-
-    retcd = av_frame_get_buffer(frame, 0);
+    /* The fifo frame keeps its buffer between calls.  It only gets
+     * copied when the encoder still holds a reference to it.
+     */
+    retcd = av_frame_make_writable(frame_fifo);
     if (retcd < 0) {
         av_strerror(retcd, errstr, sizeof(errstr));
         LOG_MSG(NTC, NO_ERRNO
             , "Ch%s: Could not allocate output frame buffer %s"
             , ch_nbr.c_str(), errstr);
-        av_frame_free(&frame);
-        frame = nullptr;
         return -1;
     }
+    frame_fifo->nb_samples = frame_size;
+    frame_fifo->pts = pts - ptsadj;
+    frame_fifo->pkt_dts = dts-dtsadj;
 
     retcd = av_audio_fifo_read(fifo
-        , (void **)frame->data, frame_size);
+        , (void **)frame_fifo->data, frame_size);
     if (retcd < frame_size) {
         fprintf(stderr, "Could not read data from FIFO\n");
         LOG_MSG(NTC, NO_ERRNO
             , "Ch%s: Could not read data from fifo"
             , ch_nbr.c_str());
-        av_frame_free(&frame);
-        frame = nullptr;
         return -1;
     }
 
     return 0;
 }
 
-void cls_infile::encoder_send()
+/* Provide the encoders with packet buffers from the channel pools */
+int cls_infile::encoder_get_buffer(AVCodecContext *ctx, AVPacket *pkt, int flags)
+{
+    AVBufferPool *pool;
+    int pool_sz;
+
+    if (ctx == ofile.video.codec_ctx) {
+        pool = pool_video;
+        pool_sz = INFILE_POOL_VIDEO_SZ;
+    } else {
+        pool = pool_audio;
+        pool_sz = INFILE_POOL_AUDIO_SZ;
+    }
+
+    if ((pool == nullptr) ||
+        ((pkt->size + AV_INPUT_BUFFER_PADDING_SIZE) > pool_sz)) {
+        return avcodec_default_get_encode_buffer(ctx, pkt, flags);
+    }
+
+    pkt->buf = av_buffer_pool_get(pool);
+    if (pkt->buf == nullptr) {
+        return AVERROR(ENOMEM);
+    }
+    pkt->data = pkt->buf->data;
+    memset(pkt->data + pkt->size, 0, AV_INPUT_BUFFER_PADDING_SIZE);
+
+    return 0;
+}
+
+/* Send one video frame to the encoder and let the rate controller act
+ * on the GOP that it completes
+*/
+int cls_infile::encoder_send_frame(AVFrame *frm)
 {
     int retcd;
-    char errstr[128];
+    enum RATECTL_ACT act;
 
-    if (frame == nullptr) {
-        return;
+    frm->quality = ofile.video.codec_ctx->global_quality;
+    /* Let the encoder place keyframes unless a client is joining */
+    if (chitm->ch_idr.exchange(false) == true) {
+        frm->pict_type = AV_PICTURE_TYPE_I;
+    } else {
+        frm->pict_type = AV_PICTURE_TYPE_NONE;
     }
+    retcd = avcodec_send_frame(ofile.video.codec_ctx, frm);
+    if ((retcd == 0) && (frm->pts != AV_NOPTS_VALUE)) {
+        act = chitm->ratectl->frame_add(av_rescale_q(
+            frm->pts - ifile.video.start_pts
+            , ifile.video.strm->time_base
+            , AVRational{1, AV_TIME_BASE}));
+        if (act == RATECTL_ACT_CRF) {
+            av_opt_set(ofile.video.codec_ctx->priv_data, "crf"
+                , std::to_string(chitm->ratectl->crf()).c_str(), 0);
+        } else if (act == RATECTL_ACT_PRESET) {
+            encoder_reopen_video();
+        }
+    }
+    /* Only a file encoded throughout at the baseline settings is cached
+     * so a degraded encode is not replayed once the load is gone
+    */
+    if (chitm->ratectl->baseline() == false) {
+        chitm->cache->record_abort();
+    }
+    return retcd;
+}
+
+/* Pass the decoded frame through the filter graph when there is one */
+int cls_infile::encoder_send_video(AVFrame *frm_in)
+{
+    int retcd;
+
+    if (flt_graph == nullptr) {
+        return encoder_send_frame(frm_in);
+    }
+
+    retcd = av_buffersrc_add_frame_flags(flt_src, frm_in, AV_BUFFERSRC_FLAG_KEEP_REF);
+    if (retcd < 0) {
+        return retcd;
+    }
+    return filter_receive();
+}
+
+/* Encode the frames waiting at the end of the filter graph */
+int cls_infile::filter_receive()
+{
+    int retcd;
+
+    while (true) {
+        av_frame_unref(frame_flt);
+        retcd = av_buffersink_get_frame(flt_sink, frame_flt);
+        if ((retcd == AVERROR(EAGAIN)) || (retcd == AVERROR_EOF)) {
+            return 0;
+        } else if (retcd < 0) {
+            return retcd;
+        }
+        if (frame_flt->pts != AV_NOPTS_VALUE) {
+            frame_flt->pts = av_rescale_q(frame_flt->pts
+                , av_buffersink_get_time_base(flt_sink)
+                , ifile.video.strm->time_base);
+        }
+        retcd = encoder_send_frame(frame_flt);
+        av_frame_unref(frame_flt);
+        if (retcd < 0) {
+            return retcd;
+        }
+        /* Collect output so the next filtered frame is accepted */
+        encoder_receive(ifile.video.index);
+    }
+}
+
+/* Encode a decoded frame of stream strm_idx of the input.  With an
+ * encode pool this runs on the channel's strand
+*/
+void cls_infile::encoder_send(AVFrame *frm_in, int strm_idx)
+{
+    int retcd, indx;
+    char errstr[128];
+    AVFrame *frm;
+
     retcd = 0;
-    if (pkt_in->stream_index == ifile.video.index) {
-        if  (frame->pts != AV_NOPTS_VALUE) {
-            if (frame->pts <= ofile.video.last_pts) {
+    frm = frm_in;
+    if (strm_idx == ifile.video.index) {
+        if  (frm_in->pts != AV_NOPTS_VALUE) {
+            if (frm_in->pts <= ofile.video.last_pts) {
                 LOG_MSG(NTC, NO_ERRNO
                     , "Ch%s: PTS Problem %d %d"
                     , ch_nbr.c_str()
-                    ,frame->pts
+                    ,frm_in->pts
                     ,ofile.video.last_pts);
-                myframe_free(frame);
-                frame = nullptr;
+                av_frame_unref(frm_in);
+                return;
+            }
+            ofile.video.last_pts = frm_in->pts;
+        }
+        if (chitm->ratectl->shed >= RATECTL_SHED_HALFRATE) {
+            shed_cnt++;
+            if ((shed_cnt % 2) == 0) {
+                pthread_mutex_lock(&chitm->mtx_stats);
+                    chitm->stats.shed_dropped++;
+                pthread_mutex_unlock(&chitm->mtx_stats);
+                av_frame_unref(frm_in);
                 return;
             }
-            ofile.video.last_pts = frame->pts;
         }
-        frame->quality = ofile.video.codec_ctx->global_quality;
-        retcd = avcodec_send_frame(ofile.video.codec_ctx, frame);
-    } else if (pkt_in->stream_index == ifile.audio.index) {
+        for (indx=0; indx < (int)chitm->renditions.size(); indx++) {
+            chitm->renditions[indx]->frame_send(frm_in);
+        }
+        retcd = encoder_send_video(frm_in);
+    } else if (strm_idx == ifile.audio.index) {
+        /* Audio the cache already sent before it turned out damaged */
+        if ((ofile.audio.last_pts != AV_NOPTS_VALUE) &&
+            (frm_in->pts != AV_NOPTS_VALUE)) {
+            if (av_rescale_q(frm_in->pts, ifile.audio.strm->time_base
+                    , ofile.audio.codec_ctx->time_base) <= ofile.audio.last_pts) {
+                av_frame_unref(frm_in);
+                return;
+            }
+            ofile.audio.last_pts = AV_NOPTS_VALUE;
+        }
         if (ifile.audio.codec_ctx->codec_id == AV_CODEC_ID_AAC) {
-            retcd = encoder_buffer_audio();
+            retcd = encoder_buffer_audio(frm_in);
             if (retcd < 0) {
                 return;
             }
+            frm = frame_fifo;
         }
-        retcd = avcodec_send_frame(ofile.audio.codec_ctx, frame);
+        retcd = avcodec_send_frame(ofile.audio.codec_ctx, frm);
     }
     if (retcd < 0 ) {
         av_strerror(retcd, errstr, sizeof(errstr));
         LOG_MSG(NTC, NO_ERRNO
             , "Ch%s: Error sending %d frame for encoding: %s"
-            , ch_nbr.c_str(), pkt_in->stream_index, errstr);
-        int indx;
+            , ch_nbr.c_str(), strm_idx, errstr);
         for (indx=0;indx<chitm->pktarray->count;indx++) {
             if (chitm->pktarray->array[indx].packet != nullptr) {
                 if (chitm->pktarray->array[indx].packet->stream_index == 0) {
@@ -531,7 +690,7 @@ void cls_infile::encoder_send()
                         , "Ch%s: index %d stream %d frame %d pts %d arrayindex %d"
                         , ch_nbr.c_str(), indx
                         , chitm->pktarray->array[indx].packet->stream_index
-                        , frame->pts
+                        , frm->pts
                         , chitm->pktarray->array[indx].packet->pts
                         , indx);
                 }
@@ -540,31 +699,48 @@ void cls_infile::encoder_send()
         abort();
     }
 
-    myframe_free(frame);
-    frame = nullptr;
+    av_frame_unref(frm_in);
+}
 
+/* Hand an encoded packet to the ring, the running profiles and the cache */
+void cls_infile::packet_add(AVPacket *pkt)
+{
+    int indx;
+    AVPacket *pkt_dup;
+
+    if (capture != nullptr) {
+        pkt_dup = mypacket_dup(pkt);
+        if (pkt_dup != nullptr) {
+            capture->push_back(pkt_dup);
+        }
+        return;
+    }
+
+    chitm->pktarray->add(pkt);
+    if (pkt->stream_index == ofile.audio.index) {
+        for (indx=0; indx < (int)chitm->renditions.size(); indx++) {
+            chitm->renditions[indx]->audio_add(pkt);
+        }
+    }
+    chitm->cache->record_add(pkt);
 }
 
-void cls_infile::encoder_receive()
+void cls_infile::encoder_receive(int strm_idx)
 {
     int retcd;
     char errstr[128];
-    AVPacket *pkt;
 
     retcd = 0;
     while (retcd == 0) {
-        pkt = NULL;
-        pkt = mypacket_alloc(pkt);
-        if (pkt_in->stream_index == ifile.video.index) {
-            retcd = avcodec_receive_packet(ofile.video.codec_ctx, pkt);
-            pkt->stream_index =ofile.video.index;
+        av_packet_unref(pkt_out);
+        if (strm_idx == ifile.video.index) {
+            retcd = avcodec_receive_packet(ofile.video.codec_ctx, pkt_out);
+            pkt_out->stream_index =ofile.video.index;
         } else {
-            retcd = avcodec_receive_packet(ofile.audio.codec_ctx, pkt);
-            pkt->stream_index =ofile.audio.index;
+            retcd = avcodec_receive_packet(ofile.audio.codec_ctx, pkt_out);
+            pkt_out->stream_index =ofile.audio.index;
         }
         if (retcd == AVERROR(EAGAIN)) {
-            mypacket_free(pkt);
-            pkt = NULL;
             return;
         } else if (retcd < 0 ) {
             av_strerror(retcd, errstr, sizeof(errstr));
@@ -576,12 +752,149 @@ void cls_infile::encoder_receive()
             /* Some files start with negative pts values. */
             //LOG_MSG(NTC, NO_ERRNO, "%s: adding pkt sz %d"
             //    , ch_nbr.c_str(), pkt->size);
-            if (pkt->pts > 0) {
-                chitm->pktarray->add(pkt);
+            if (pkt_out->pts > 0) {
+                packet_add(pkt_out);
+            }
+            av_packet_unref(pkt_out);
+        }
+    }
+}
+
+/* Get the next packet from the cache or the file.  A damaged cache
+ * file is dropped and the source is decoded from the last good point
+*/
+int cls_infile::packet_read()
+{
+    int retcd;
+
+    av_packet_unref(pkt_in);
+
+    if (cache_play == true) {
+        retcd = chitm->cache->play_read(pkt_in);
+        if (retcd == 0) {
+            if ((pkt_in->stream_index == ofile.video.index) &&
+                (pkt_in->pts != AV_NOPTS_VALUE)) {
+                cache_pts = pkt_in->pts;
+            } else if ((pkt_in->stream_index == ofile.audio.index) &&
+                (pkt_in->pts != AV_NOPTS_VALUE)) {
+                cache_apts = pkt_in->pts;
             }
-            mypacket_free(pkt);
-            pkt = NULL;
+            return 0;
+        } else if (retcd == AVERROR_EOF) {
+            return AVERROR_EOF;
+        }
+        LOG_MSG(NTC, NO_ERRNO
+            , "Ch%s: Cache file damaged, decoding the source instead"
+            , ch_nbr.c_str());
+        chitm->cache->play_close(true);
+        cache_play = false;
+        if (cache_pts != AV_NOPTS_VALUE) {
+            av_seek_frame(ifile.fmt_ctx, ifile.video.index
+                , cache_pts, AVSEEK_FLAG_BACKWARD);
+            ofile.video.last_pts = cache_pts;
+            ofile.audio.last_pts = cache_apts;
         }
+        av_packet_unref(pkt_in);
+    }
+
+    return av_read_frame(ifile.fmt_ctx, pkt_in);
+}
+
+/* Encode on the strand the frame decoded from stream strm_idx.  The
+ * decode time is added so the rate controller sees the whole cost
+*/
+void cls_infile::encode_job(AVFrame *frm, int strm_idx, int64_t busy_dec)
+{
+    int64_t tm_busy;
+
+    tm_busy = av_gettime_relative();
+    if (frm != nullptr) {
+        encoder_send(frm, strm_idx);
+        myframe_free(frm);
+    }
+    encoder_receive(strm_idx);
+    chitm->ratectl->busy_add(busy_dec + (av_gettime_relative() - tm_busy));
+}
+
+/* Send a packet that is due on to the clients.  With an encode pool
+ * only the decode is done here and the rest is posted to the strand
+*/
+void cls_infile::packet_handle()
+{
+    int64_t tm_busy, busy_dec;
+    int strm_idx;
+    AVFrame *frm;
+    cls_cache *cache;
+
+    if (cache_play == true) {
+        if (chitm->active() == true) {
+            chitm->pktarray->add(pkt_in);
+        }
+        return;
+    }
+
+    /* Output skipped for lack of clients leaves the capture incomplete */
+    if (chitm->active() == false) {
+        if (chitm->strand != nullptr) {
+            cache = chitm->cache;
+            chitm->strand->post([cache]() { cache->record_abort(); });
+        } else {
+            chitm->cache->record_abort();
+        }
+        return;
+    }
+
+    tm_busy = av_gettime_relative();
+    decoder_send();
+    decoder_receive();
+
+    if (chitm->strand == nullptr) {
+        if (frame_ready == true) {
+            encoder_send(frame, pkt_in->stream_index);
+            frame_ready = false;
+        }
+        encoder_receive(pkt_in->stream_index);
+        chitm->ratectl->busy_add(av_gettime_relative() - tm_busy);
+        return;
+    }
+
+    frm = nullptr;
+    if (frame_ready == true) {
+        frm = myframe_alloc();
+        av_frame_move_ref(frm, frame);
+        frame_ready = false;
+    }
+    strm_idx = pkt_in->stream_index;
+    busy_dec = av_gettime_relative() - tm_busy;
+
+    chitm->strand->wait_below(INFILE_STRAND_MAX);
+    chitm->strand->post([this, frm, strm_idx, busy_dec]() {
+        encode_job(frm, strm_idx, busy_dec);
+    });
+}
+
+/* Keep the capture only when the whole file was encoded */
+void cls_infile::read_end(int retcd)
+{
+    av_packet_unref(pkt_in);
+    pkt_pending = false;
+    if ((cache_play == false) && (retcd == AVERROR_EOF)) {
+        if (chitm->strand != nullptr) {
+            chitm->strand->post([this]() { filter_flush(); });
+        } else {
+            filter_flush();
+        }
+    }
+    if (chitm->strand != nullptr) {
+        chitm->strand->wait();
+    }
+    if (cache_play == true) {
+        return;
+    }
+    if (retcd == AVERROR_EOF) {
+        chitm->cache->record_close();
+    } else {
+        chitm->cache->record_abort();
     }
 }
 
@@ -595,42 +908,115 @@ void cls_infile::read()
 
     pthread_mutex_unlock(&mtx);
 
+    retcd = 0;
     while (chitm->ch_finish == false) {
-        av_packet_free(&pkt_in);
-        pkt_in = av_packet_alloc();
+        retcd = packet_read();
+        if (retcd < 0) {
+            break;
+        }
+        infile_wait();
+        packet_handle();
+        if (ifile.fmt_ctx == NULL) {
+            break;
+        }
+    }
+    read_end(retcd);
 
-        pkt_in->data = NULL;
-        pkt_in->size = 0;
+    pthread_mutex_lock(&mtx);
+}
 
-        retcd = av_read_frame(ifile.fmt_ctx, pkt_in);
+/* One step of read() for the reactor engine.  Returns the monotonic
+ * time in ns when the pending packet is due, 0 when a packet was sent
+ * and -1 at the end of the file
+*/
+int64_t cls_infile::step()
+{
+    int retcd;
+
+    if (is_started == false) {
+        return -1;
+    }
+
+    if (pkt_pending == false) {
+        retcd = packet_read();
         if (retcd < 0) {
-            break;
+            read_end(retcd);
+            return -1;
         }
+        pkt_pending = true;
+        pkt_wake = packet_due();
+    }
 
-        infile_wait();
+    if (pkt_wake > chitm->pacer->now_ns()) {
+        return pkt_wake;
+    }
+    if (pkt_wake > 0) {
+        chitm->pacer->woke();
+    }
+
+    packet_handle();
+    pkt_pending = false;
+    if (ifile.fmt_ctx == NULL) {
+        read_end(0);
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Encode all of the audio of the file without pacing and note the pts
+ * of each video keyframe.  Used by pretranscode which encodes the video
+ * on its own.  Returns 1 when the file is already in the cache
+*/
+int cls_infile::read_capture(std::vector<AVPacket*> &audio, std::vector<int64_t> &keys)
+{
+    if (is_started == false) {
+        return -1;
+    }
+    if (cache_play == true) {
+        return 1;
+    }
+
+    /* decoder_get_ts() has already read past the start */
+    if (av_seek_frame(ifile.fmt_ctx, -1, 0, AVSEEK_FLAG_BACKWARD) < 0) {
+        LOG_MSG(NTC, NO_ERRNO
+            , "Ch%s: Could not seek to the start of the file"
+            , ch_nbr.c_str());
+        return -1;
+    }
 
-        if (chitm->cnct_cnt > 0) {
+    capture = &audio;
+    while ((chitm->ch_finish == false) && (app->finish == false)) {
+        av_packet_unref(pkt_in);
+        if (av_read_frame(ifile.fmt_ctx, pkt_in) < 0) {
+            break;
+        }
+        if (pkt_in->stream_index == ifile.video.index) {
+            if ((pkt_in->flags & AV_PKT_FLAG_KEY) &&
+                (pkt_in->pts != AV_NOPTS_VALUE)) {
+                keys.push_back(pkt_in->pts);
+            }
+        } else if (pkt_in->stream_index == ifile.audio.index) {
             decoder_send();
             decoder_receive();
-            encoder_send();
-            encoder_receive();
-        }
-        if (ifile.fmt_ctx == NULL) {
-            break;
+            if (frame_ready == true) {
+                encoder_send(frame, pkt_in->stream_index);
+                frame_ready = false;
+            }
+            encoder_receive(pkt_in->stream_index);
         }
     }
-    av_packet_free(&pkt_in);
-    pthread_mutex_lock(&mtx);
+    av_packet_unref(pkt_in);
+    capture = nullptr;
+
+    std::sort(keys.begin(), keys.end());
+
+    return 0;
 }
 
 int cls_infile::encoder_init_video_h264()
 {
-    const AVCodec *encoder;
     AVStream *stream;
-    AVCodecContext *enc_ctx,*dec_ctx;
-    AVDictionary *opts = NULL;
-    char errstr[128];
-    int retcd;
 
     ofile.video.codec_ctx = nullptr;
     stream = avformat_new_stream(ofile.fmt_ctx, NULL);
@@ -643,6 +1029,23 @@ int cls_infile::encoder_init_video_h264()
     }
     ofile.video.index = stream->index;
 
+    return encoder_open_video_h264();
+}
+
+/* Open the h264 encoder for the existing output stream using the
+ * preset and crf currently chosen by the rate controller
+*/
+int cls_infile::encoder_open_video_h264()
+{
+    const AVCodec *encoder;
+    AVStream *stream;
+    AVCodecContext *enc_ctx,*dec_ctx;
+    AVDictionary *opts = NULL;
+    char errstr[128];
+    int retcd;
+
+    stream = ofile.video.strm;
+
     encoder = avcodec_find_encoder(AV_CODEC_ID_H264);
     if (encoder == nullptr) {
         LOG_MSG(NTC, NO_ERRNO
@@ -679,14 +1082,14 @@ int cls_infile::encoder_init_video_h264()
     }
 
     enc_ctx->codec_type = AVMEDIA_TYPE_VIDEO;
-    enc_ctx->width = dec_ctx->width;
-    enc_ctx->height = dec_ctx->height;
+    enc_ctx->width = enc_width;
+    enc_ctx->height = enc_height;
     enc_ctx->time_base.num = 1;
     enc_ctx->time_base.den = 90000;
     enc_ctx->max_b_frames = 4;
-    enc_ctx->framerate = dec_ctx->framerate;
+    enc_ctx->framerate = enc_framerate;
     enc_ctx->bit_rate = 400000;
-    enc_ctx->gop_size = 4;
+    enc_ctx->gop_size = chitm->ch_gop;
     if (dec_ctx->pix_fmt == -1) {
         enc_ctx->pix_fmt = AV_PIX_FMT_YUV420P;
     } else {
@@ -697,12 +1100,24 @@ int cls_infile::encoder_init_video_h264()
         enc_ctx->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
     }
 
+    enc_ctx->opaque = this;
+    enc_ctx->get_encode_buffer = &infile_get_encode_buffer;
+    /* Slices keep each encode short so the strand gives its worker back */
+    if (chitm->strand != nullptr) {
+        enc_ctx->thread_type = FF_THREAD_SLICE;
+    }
+
     av_dict_set( &opts, "profile", "baseline", 0 );
-    av_dict_set( &opts, "crf", "17", 0 );
+    av_dict_set( &opts, "crf", std::to_string(chitm->ratectl->crf()).c_str(), 0 );
     av_dict_set( &opts, "tune", "zerolatency", 0 );
-    av_dict_set( &opts, "preset", "superfast", 0 );
-    av_dict_set( &opts, "keyint", "4", 0 );
+    av_dict_set( &opts, "preset", chitm->ratectl->preset().c_str(), 0 );
+    av_dict_set( &opts, "keyint", std::to_string(chitm->ch_gop).c_str(), 0 );
     av_dict_set( &opts, "scenecut", "0", 0 );
+    /* Frames sent as I by encoder_send() for joining clients become IDRs */
+    av_dict_set( &opts, "forced-idr", "1", 0 );
+    if (chitm->ch_intrarefresh == true) {
+        av_dict_set( &opts, "intra-refresh", "1", 0 );
+    }
 
     retcd = avcodec_open2(enc_ctx, encoder, &opts);
     if (retcd < 0) {
@@ -728,14 +1143,51 @@ int cls_infile::encoder_init_video_h264()
     return 0;
 }
 
+/* Drain and replace the video encoder so a new preset or size takes
+ * effect.  The new encoder starts on an IDR so the GOP boundary is kept
+*/
+void cls_infile::encoder_reopen_video()
+{
+    int retcd;
+
+    avcodec_send_frame(ofile.video.codec_ctx, NULL);
+    retcd = 0;
+    while (retcd == 0) {
+        av_packet_unref(pkt_out);
+        retcd = avcodec_receive_packet(ofile.video.codec_ctx, pkt_out);
+        if (retcd == 0) {
+            pkt_out->stream_index = ofile.video.index;
+            if (pkt_out->pts > 0) {
+                packet_add(pkt_out);
+            }
+        }
+    }
+    av_packet_unref(pkt_out);
+
+    pthread_mutex_lock(&mtx);
+        avcodec_free_context(&ofile.video.codec_ctx);
+        ofile.video.codec_ctx = nullptr;
+        if (chitm->ch_encode == "h264") {
+            retcd = encoder_open_video_h264();
+        } else {
+            retcd = encoder_open_video_mpeg();
+        }
+        if (retcd == 0) {
+            chitm->desc_publish();
+        }
+    pthread_mutex_unlock(&mtx);
+
+    if (retcd != 0) {
+        LOG_MSG(ERR, NO_ERRNO
+            , "Ch%s: Unable to reopen video encoder"
+            , ch_nbr.c_str());
+        chitm->ch_finish = true;
+    }
+}
+
 int cls_infile::encoder_init_video_mpeg()
 {
-    const AVCodec *encoder;
     AVStream *stream;
-    AVCodecContext *enc_ctx, *dec_ctx;
-    AVDictionary *opts = nullptr;
-    char errstr[128];
-    int retcd;
 
     ofile.video.codec_ctx = nullptr;
 
@@ -749,6 +1201,21 @@ int cls_infile::encoder_init_video_mpeg()
     }
     ofile.video.index = stream->index;
 
+    return encoder_open_video_mpeg();
+}
+
+/* Open the mpeg2 encoder for the existing output stream */
+int cls_infile::encoder_open_video_mpeg()
+{
+    const AVCodec *encoder;
+    AVStream *stream;
+    AVCodecContext *enc_ctx, *dec_ctx;
+    AVDictionary *opts = nullptr;
+    char errstr[128];
+    int retcd;
+
+    stream = ofile.video.strm;
+
     encoder = avcodec_find_encoder(AV_CODEC_ID_MPEG2VIDEO);
     if (encoder == nullptr) {
         LOG_MSG(NTC, NO_ERRNO
@@ -780,10 +1247,13 @@ int cls_infile::encoder_init_video_mpeg()
 
     enc_ctx->codec_id = AV_CODEC_ID_MPEG2VIDEO;
     enc_ctx->codec_type = AVMEDIA_TYPE_VIDEO;
-    enc_ctx->width = dec_ctx->width;
-    enc_ctx->height = dec_ctx->height;
+    enc_ctx->width = enc_width;
+    enc_ctx->height = enc_height;
     enc_ctx->max_b_frames = 4;
     enc_ctx->gop_size = 4;
+    if (chitm->ch_gop_set == true) {
+        enc_ctx->gop_size = chitm->ch_gop;
+    }
     enc_ctx->framerate = dec_ctx->framerate;
     enc_ctx->framerate.num = 30;
     enc_ctx->framerate.den = 1;
@@ -803,6 +1273,11 @@ int cls_infile::encoder_init_video_mpeg()
     if (ofile.fmt_ctx->oformat->flags & AVFMT_GLOBALHEADER) {
         enc_ctx->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
     }
+    enc_ctx->opaque = this;
+    enc_ctx->get_encode_buffer = &infile_get_encode_buffer;
+    if (chitm->strand != nullptr) {
+        enc_ctx->thread_type = FF_THREAD_SLICE;
+    }
 
     retcd = avcodec_open2(enc_ctx, encoder, &opts);
     if (retcd < 0) {
@@ -894,6 +1369,8 @@ int cls_infile::encoder_init_audio()
         , dec_ctx->ch_layout.nb_channels);
     av_channel_layout_copy(&enc_ctx->ch_layout
         , &dec_ctx->ch_layout);
+    enc_ctx->opaque = this;
+    enc_ctx->get_encode_buffer = &infile_get_encode_buffer;
 
     retcd = avcodec_open2(enc_ctx, encoder, &opts);
     if (retcd < 0) {
@@ -917,11 +1394,175 @@ int cls_infile::encoder_init_audio()
                 , ch_nbr.c_str());
             return -1;
         }
+
+        /* Allocate the buffer for the frames read from the fifo once per file*/
+        av_frame_unref(frame_fifo);
+        frame_fifo->nb_samples  = enc_ctx->frame_size;
+        frame_fifo->format      = enc_ctx->sample_fmt;
+        frame_fifo->sample_rate = enc_ctx->sample_rate;
+        av_channel_layout_copy(&frame_fifo->ch_layout, &enc_ctx->ch_layout);
+        retcd = av_frame_get_buffer(frame_fifo, 0);
+        if (retcd < 0) {
+            av_strerror(retcd, errstr, sizeof(errstr));
+            LOG_MSG(NTC, NO_ERRNO
+                , "Ch%s: Could not allocate fifo frame buffer %s"
+                , ch_nbr.c_str(), errstr);
+            return -1;
+        }
     }
 
     return 0;
 }
 
+void cls_infile::filter_free()
+{
+    if (flt_graph != nullptr) {
+        avfilter_graph_free(&flt_graph);
+        flt_graph = nullptr;
+    }
+    flt_src = nullptr;
+    flt_sink = nullptr;
+    flt_desc = "";
+}
+
+/* Push out the frames the graph still holds at the end of a file.  The
+ * fps filter keeps one back until it sees the next
+*/
+void cls_infile::filter_flush()
+{
+    if (flt_graph == nullptr) {
+        return;
+    }
+    if (av_buffersrc_add_frame(flt_src, NULL) < 0) {
+        return;
+    }
+    filter_receive();
+}
+
+/* Build a graph that runs desc on the decoded video frames */
+int cls_infile::filter_init(std::string desc)
+{
+    int retcd;
+    char errstr[128];
+
+    retcd = myfilter_init(&flt_graph, &flt_src, &flt_sink
+        , ifile.video.codec_ctx, ifile.video.strm->time_base, desc);
+    if (retcd < 0) {
+        av_strerror(retcd, errstr, sizeof(errstr));
+        LOG_MSG(ERR, NO_ERRNO
+            , "Ch%s: Could not create video filter %s: %s"
+            , ch_nbr.c_str(), desc.c_str(), errstr);
+        filter_free();
+        return -1;
+    }
+
+    flt_desc = desc;
+
+    return 0;
+}
+
+/* Work out the filters for the channel's maxres and maxfps along with
+ * the size and rate that come out of them
+*/
+std::string infile_filter_desc(cls_channel *chitm, AVCodecContext *dec_ctx
+    , bool downscale, int &wd, int &ht, AVRational &framerate)
+{
+    std::string desc, flags;
+
+    wd = dec_ctx->width;
+    ht = dec_ctx->height;
+
+    /* Fit within maxres keeping the aspect ratio */
+    if ((chitm->ch_maxwidth > 0) && (chitm->ch_maxheight > 0) &&
+        ((wd > chitm->ch_maxwidth) || (ht > chitm->ch_maxheight))) {
+        if (((int64_t)wd * chitm->ch_maxheight) > ((int64_t)ht * chitm->ch_maxwidth)) {
+            ht = (int)(((int64_t)ht * chitm->ch_maxwidth) / wd);
+            wd = chitm->ch_maxwidth;
+        } else {
+            wd = (int)(((int64_t)wd * chitm->ch_maxheight) / ht);
+            ht = chitm->ch_maxheight;
+        }
+        wd = (wd / 2) * 2;
+        ht = (ht / 2) * 2;
+    }
+
+    flags = "bilinear";
+    if (downscale == true) {
+        wd = (wd / 4) * 2;
+        ht = (ht / 4) * 2;
+        flags = "fast_bilinear";
+    }
+
+    /* Drop frames before scaling so the scaler only sees what is kept */
+    desc = "";
+    framerate = dec_ctx->framerate;
+    if ((chitm->ch_maxfps > 0) && (dec_ctx->framerate.num > 0) &&
+        (dec_ctx->framerate.den > 0) &&
+        (av_cmp_q(dec_ctx->framerate, AVRational{chitm->ch_maxfps, 1}) > 0)) {
+        desc = "fps=" + std::to_string(chitm->ch_maxfps);
+        framerate = AVRational{chitm->ch_maxfps, 1};
+    }
+    if ((wd != dec_ctx->width) || (ht != dec_ctx->height)) {
+        if (desc != "") {
+            desc += ",";
+        }
+        desc += "scale=" + std::to_string(wd) + ":" + std::to_string(ht) +
+            ":flags=" + flags;
+    }
+
+    return desc;
+}
+
+/* Apply the filters for the current settings.  The encoder is reopened
+ * when the size changes
+*/
+void cls_infile::video_filter_update()
+{
+    int wd, ht;
+    AVCodecContext *dec_ctx;
+    std::string desc;
+
+    dec_ctx = ifile.video.codec_ctx;
+    desc = infile_filter_desc(chitm, dec_ctx
+        , (chitm->ratectl->shed == RATECTL_SHED_DOWNSCALE)
+        , wd, ht, enc_framerate);
+
+    if (desc != flt_desc) {
+        filter_free();
+        if (desc != "") {
+            if (filter_init(desc) != 0) {
+                wd = dec_ctx->width;
+                ht = dec_ctx->height;
+                enc_framerate = dec_ctx->framerate;
+            }
+        }
+    }
+
+    if ((wd != enc_width) || (ht != enc_height)) {
+        enc_width = wd;
+        enc_height = ht;
+        if (ofile.video.codec_ctx != nullptr) {
+            encoder_reopen_video();
+        }
+    }
+}
+
+/* Apply the overload stage chosen by the rate controller */
+void cls_infile::shed_apply()
+{
+    if (ifile.video.codec_ctx == nullptr) {
+        return;
+    }
+
+    if (chitm->ratectl->shed >= RATECTL_SHED_NONREF) {
+        ifile.video.codec_ctx->skip_frame = AVDISCARD_NONREF;
+    } else {
+        ifile.video.codec_ctx->skip_frame = AVDISCARD_DEFAULT;
+    }
+
+    video_filter_update();
+}
+
 int cls_infile::encoder_init()
 {
     if (ifile.fmt_ctx == NULL) {
@@ -938,7 +1579,12 @@ int cls_infile::encoder_init()
         chitm->pktarray->resize();
     }
 
+    chitm->ratectl->init(chitm->ch_encode == "h264");
+
     if (ifile.video.index != -1) {
+        enc_width = ifile.video.codec_ctx->width;
+        enc_height = ifile.video.codec_ctx->height;
+        shed_apply();
         if (chitm->ch_encode == "h264") {
             if (encoder_init_video_h264() != 0) {
                 return -1;
@@ -954,15 +1600,23 @@ int cls_infile::encoder_init()
             return -1;
         }
     }
+    chitm->desc_publish();
     return 0;
 
 }
 
 void cls_infile::stop()
 {
+    int indx;
+
     LOG_MSG(NTC, NO_ERRNO, "Ch%s: Closing"
         , ch_nbr.c_str());
 
+    /* Let the queued encodes finish before the encoders go */
+    if (chitm->strand != nullptr) {
+        chitm->strand->wait();
+    }
+
     if (ifile.audio.codec_ctx !=  nullptr) {
         avcodec_free_context(&ifile.audio.codec_ctx);
         ifile.audio.codec_ctx =  nullptr;
@@ -975,6 +1629,7 @@ void cls_infile::stop()
         avformat_close_input(&ifile.fmt_ctx);
         ifile.fmt_ctx = nullptr;
     }
+    chitm->inread->close();
 
     if (ofile.audio.codec_ctx !=  nullptr) {
         avcodec_free_context(&ofile.audio.codec_ctx);
@@ -993,6 +1648,24 @@ void cls_infile::stop()
         av_audio_fifo_free(fifo);
         fifo= nullptr;
     }
+
+    filter_free();
+
+    chitm->cache->record_abort();
+    chitm->cache->play_close(false);
+    cache_play = false;
+    pkt_pending = false;
+
+    /* The profiles are started again on the next file's first frame */
+    for (indx=0; indx < (int)chitm->renditions.size(); indx++) {
+        chitm->renditions[indx]->encoder_free();
+    }
+
+    av_frame_unref(frame);
+    av_frame_unref(frame_fifo);
+    av_frame_unref(frame_flt);
+    frame_ready = false;
+    av_packet_unref(pkt_out);
 }
 
 void cls_infile::start(std::string fnm)
@@ -1008,6 +1681,13 @@ void cls_infile::start(std::string fnm)
     if (encoder_init() != 0) {
         return;
     }
+    cache_pts = AV_NOPTS_VALUE;
+    cache_apts = AV_NOPTS_VALUE;
+    ofile.audio.last_pts = AV_NOPTS_VALUE;
+    cache_play = chitm->cache->play_open(fnm);
+    if (cache_play == false) {
+        chitm->cache->record_open(fnm);
+    }
     is_started = true;
 }
 
@@ -1016,15 +1696,47 @@ cls_infile::cls_infile(cls_channel *p_chitm)
     chitm = p_chitm;
     defaults();
     ch_nbr = p_chitm->ch_nbr;
-    frame = nullptr;
-    pkt_in = nullptr;
     fifo = nullptr;
 
+    /* Allocated once per channel and reused for every packet and frame */
+    frame = myframe_alloc();
+    frame_fifo = myframe_alloc();
+    frame_flt = myframe_alloc();
+    frame_ready = false;
+    flt_graph = nullptr;
+    flt_src = nullptr;
+    flt_sink = nullptr;
+    flt_desc = "";
+    enc_width = 0;
+    enc_height = 0;
+    enc_framerate = AVRational{0, 1};
+    shed_cnt = 0;
+    cache_play = false;
+    cache_pts = AV_NOPTS_VALUE;
+    cache_apts = AV_NOPTS_VALUE;
+    capture = nullptr;
+    pkt_pending = false;
+    pkt_wake = 0;
+    pkt_in = mypacket_alloc(nullptr);
+    pkt_out = mypacket_alloc(nullptr);
+    pool_video = av_buffer_pool_init(INFILE_POOL_VIDEO_SZ, NULL);
+    pool_audio = av_buffer_pool_init(INFILE_POOL_AUDIO_SZ, NULL);
+
     pthread_mutex_init(&mtx, NULL);
 
 }
 
 cls_infile::~cls_infile()
 {
-   pthread_mutex_destroy(&mtx);
+    myframe_free(frame);
+    myframe_free(frame_fifo);
+    myframe_free(frame_flt);
+    filter_free();
+    mypacket_free(pkt_in);
+    mypacket_free(pkt_out);
+    /* Buffers still referenced are released when their last user is done */
+    av_buffer_pool_uninit(&pool_video);
+    av_buffer_pool_uninit(&pool_audio);
+
+    pthread_mutex_destroy(&mtx);
 }
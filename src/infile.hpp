@@ -18,6 +18,9 @@
 
 #ifndef _INCLUDE_INFILE_HPP_
 #define _INCLUDE_INFILE_HPP_
+    #define INFILE_POOL_VIDEO_SZ (1024 * 1024)  /* Size of pooled video packet buffers */
+    #define INFILE_POOL_AUDIO_SZ (16 * 1024)    /* Size of pooled audio packet buffers */
+    #define INFILE_STRAND_MAX    8              /* Frames queued for the encode pool before reading waits */
 
     class cls_infile {
         public:
@@ -26,7 +29,10 @@
 
             void start(std::string fnm);
             void read();
+            int64_t step();
             void stop();
+            int  read_capture(std::vector<AVPacket*> &audio, std::vector<int64_t> &keys);
+            int  encoder_get_buffer(AVCodecContext *ctx, AVPacket *pkt, int flags);
 
             ctx_file_info   ifile;
             ctx_file_info   ofile;
@@ -38,7 +44,27 @@
             std::string     ch_nbr;
 
             AVPacket        *pkt_in;
+            AVPacket        *pkt_out;
             AVFrame         *frame;
+            AVFrame         *frame_fifo;
+            bool            frame_ready;
+            AVFrame         *frame_flt;
+            AVFilterGraph   *flt_graph;
+            AVFilterContext *flt_src;
+            AVFilterContext *flt_sink;
+            std::string     flt_desc;
+            int             enc_width;
+            int             enc_height;
+            AVRational      enc_framerate;
+            int64_t         shed_cnt;
+            bool            cache_play;     /* Packets come from the cache instead of the encoder */
+            int64_t         cache_pts;      /* Last video pts played from the cache */
+            int64_t         cache_apts;     /* Last audio pts played from the cache */
+            std::vector<AVPacket*>  *capture;   /* Keep the encoded audio instead of adding it */
+            bool            pkt_pending;    /* pkt_in is read and waiting to be due */
+            int64_t         pkt_wake;
+            AVBufferPool    *pool_video;
+            AVBufferPool    *pool_audio;
             AVAudioFifo     *fifo;
             int64_t         audio_last_pts;
             int64_t         audio_last_dts;
@@ -52,16 +78,38 @@
             void decoder_send();
             void decoder_receive();
 
-            int  encoder_buffer_audio();
-            void encoder_send();
-            void encoder_receive();
+            int  encoder_buffer_audio(AVFrame *frm_in);
+            int  encoder_send_frame(AVFrame *frm);
+            int  encoder_send_video(AVFrame *frm_in);
+            void encoder_send(AVFrame *frm_in, int strm_idx);
+            void encoder_receive(int strm_idx);
+            void encode_job(AVFrame *frm, int strm_idx, int64_t busy_dec);
+            void margin_job(int64_t margin);
+            void packet_add(AVPacket *pkt);
             int  encoder_init_video_h264();
+            int  encoder_open_video_h264();
+            void encoder_reopen_video();
             int  encoder_init_video_mpeg();
+            int  encoder_open_video_mpeg();
             int  encoder_init_audio();
             int  encoder_init();
 
+            void filter_free();
+            int  filter_init(std::string desc);
+            int  filter_receive();
+            void filter_flush();
+            void video_filter_update();
+            void shed_apply();
+
+            int64_t packet_due();
             void infile_wait();
+            int  packet_read();
+            void packet_handle();
+            void read_end(int retcd);
 
     };
 
+    std::string infile_filter_desc(cls_channel *chitm, AVCodecContext *dec_ctx
+        , bool downscale, int &wd, int &ht, AVRational &framerate);
+
 #endif
@@ -0,0 +1,443 @@
+/*
+ *    This file is part of Restream.
+ *
+ *    Restream is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    Restream is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with Restream.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "restream.hpp"
+#include "conf.hpp"
+#include "util.hpp"
+#include "logger.hpp"
+#include "channel.hpp"
+#include "infile.hpp"
+#include "pktarray.hpp"
+#include "ratectl.hpp"
+#include "rendition.hpp"
+#include "cache.hpp"
+#include "workpool.hpp"
+#include "pretrans.hpp"
+#include "pacer.hpp"
+#include "reactor.hpp"
+#include "inread.hpp"
+#include "uring.hpp"
+#include "timeshift.hpp"
+#include "recorder.hpp"
+#include "tsmux.hpp"
+#include "localout.hpp"
+#include "webu.hpp"
+#include "webu_ans.hpp"
+#include "webu_mpegts.hpp"
+#include "webu_mpts.hpp"
+
+static int inread_read(void *opaque, uint8_t *buf, int buf_size)
+{
+    return ((cls_inread *)opaque)->read(buf, buf_size);
+}
+
+static int64_t inread_seek(void *opaque, int64_t offset, int whence)
+{
+    return ((cls_inread *)opaque)->seek(offset, whence);
+}
+
+/* Keep the window ahead of the demuxer filled */
+void cls_inread::io_run()
+{
+    int64_t want, off, ep, tm_start;
+    ssize_t cnt;
+
+    mythreadname_set("io", atoi(ch_nbr.c_str()), NULL);
+
+    while (true) {
+        std::unique_lock<std::mutex> lck(mtx);
+        while ((finish == false) &&
+            ((eof == true) || (err != 0) || ((fill - pos) >= ring_size))) {
+            cond.wait(lck);
+        }
+        if (finish == true) {
+            break;
+        }
+        off = fill;
+        ep = epoch;
+        want = ring_size - (fill - pos);
+        if (want > (ring_size - (off % ring_size))) {
+            want = ring_size - (off % ring_size);
+        }
+        if (want > INREAD_CHUNK) {
+            want = INREAD_CHUNK;
+        }
+        lck.unlock();
+
+        /* Only this thread writes past fill so the read is done unlocked */
+        posix_fadvise(fd, off + want, ring_size, POSIX_FADV_WILLNEED);
+        tm_start = av_gettime_relative();
+        cnt = pread(fd, ring + (off % ring_size), (size_t)want, off);
+        if ((cnt < 0) && (errno == EINTR)) {
+            continue;
+        }
+
+        lck.lock();
+        read_usec += av_gettime_relative() - tm_start;
+        if (ep == epoch) {
+            if (cnt > 0) {
+                fill += cnt;
+                read_bytes += cnt;
+            } else if (cnt == 0) {
+                eof = true;
+            } else {
+                err = errno;
+                LOG_MSG(NTC, SHOW_ERRNO
+                    , "Ch%s: Error reading input", ch_nbr.c_str());
+            }
+        }
+        lck.unlock();
+        cond.notify_all();
+    }
+}
+
+/* Queue the next read of the window on the ring.  The caller holds mtx */
+void cls_inread::io_next()
+{
+    int64_t want, off, ep, tm_start;
+
+    if ((finish == true) || (io_busy == true) || (eof == true) ||
+        (err != 0) || ((fill - pos) >= ring_size)) {
+        return;
+    }
+    off = fill;
+    ep = epoch;
+    want = ring_size - (fill - pos);
+    if (want > (ring_size - (off % ring_size))) {
+        want = ring_size - (off % ring_size);
+    }
+    if (want > INREAD_CHUNK) {
+        want = INREAD_CHUNK;
+    }
+
+    io_busy = true;
+    tm_start = av_gettime_relative();
+    uring->read(fd, ring + (off % ring_size), (unsigned int)want, off
+        , [this, ep, tm_start](int res) { io_done(ep, tm_start, res); });
+}
+
+/* Called from the ring thread when a read has completed */
+void cls_inread::io_done(int64_t ep, int64_t tm_start, int res)
+{
+    std::unique_lock<std::mutex> lck(mtx);
+
+    io_busy = false;
+    read_usec += av_gettime_relative() - tm_start;
+    if (ep == epoch) {
+        if (res > 0) {
+            fill += res;
+            read_bytes += res;
+        } else if (res == 0) {
+            eof = true;
+        } else if ((res != -EINTR) && (res != -EAGAIN)) {
+            err = -res;
+            LOG_MSG(NTC, NO_ERRNO
+                , "Ch%s: Error reading input: %s"
+                , ch_nbr.c_str(), strerror(err));
+        }
+    }
+    io_next();
+    lck.unlock();
+    cond.notify_all();
+}
+
+void cls_inread::stall_add(int64_t tm_start)
+{
+    int64_t tm_wait;
+
+    tm_wait = av_gettime_relative() - tm_start;
+    if (tm_wait >= INREAD_STALL) {
+        stall_cnt++;
+        stall_usec += tm_wait;
+    }
+}
+
+/* Copy from the mapping and advise the kernel of the next window */
+int cls_inread::read_map(uint8_t *buf, int buf_size)
+{
+    int64_t cnt, tm_start, adv_st, pgsz;
+
+    if (pos >= file_size) {
+        return AVERROR_EOF;
+    }
+    cnt = file_size - pos;
+    if (cnt > buf_size) {
+        cnt = buf_size;
+    }
+
+    if ((pos + cnt + ring_size / 2) > map_advised) {
+        pgsz = sysconf(_SC_PAGESIZE);
+        adv_st = ((pos + cnt) / pgsz) * pgsz;
+        map_advised = adv_st + ring_size;
+        if (map_advised > file_size) {
+            map_advised = file_size;
+        }
+        madvise(map + adv_st, (size_t)(map_advised - adv_st), MADV_WILLNEED);
+    }
+
+    tm_start = av_gettime_relative();
+    memcpy(buf, map + pos, (size_t)cnt);
+
+    std::lock_guard<std::mutex> lck(mtx);
+    pos += cnt;
+    read_bytes += cnt;
+    read_usec += av_gettime_relative() - tm_start;
+    stall_add(tm_start);
+
+    return (int)cnt;
+}
+
+int cls_inread::read(uint8_t *buf, int buf_size)
+{
+    int64_t cnt, tm_start;
+
+    if (map != nullptr) {
+        return read_map(buf, buf_size);
+    }
+
+    std::unique_lock<std::mutex> lck(mtx);
+    tm_start = av_gettime_relative();
+    while ((finish == false) && (fill == pos) &&
+        (eof == false) && (err == 0)) {
+        cond.wait(lck);
+    }
+    stall_add(tm_start);
+
+    if (fill == pos) {
+        if (err != 0) {
+            return AVERROR(err);
+        }
+        return AVERROR_EOF;
+    }
+
+    cnt = fill - pos;
+    if (cnt > buf_size) {
+        cnt = buf_size;
+    }
+    if (cnt > (ring_size - (pos % ring_size))) {
+        cnt = ring_size - (pos % ring_size);
+    }
+    memcpy(buf, ring + (pos % ring_size), (size_t)cnt);
+    pos += cnt;
+    if (uring != nullptr) {
+        io_next();
+    }
+    lck.unlock();
+    cond.notify_all();
+
+    return (int)cnt;
+}
+
+/* Seeks inside the window only move the read position.  Anything else
+ * drops the window and the thread starts again from the new position
+*/
+int64_t cls_inread::seek(int64_t offset, int whence)
+{
+    int64_t target;
+
+    if (whence & AVSEEK_SIZE) {
+        return file_size;
+    }
+
+    std::unique_lock<std::mutex> lck(mtx);
+    switch (whence & ~AVSEEK_FORCE) {
+    case SEEK_SET:
+        target = offset;
+        break;
+    case SEEK_CUR:
+        target = pos + offset;
+        break;
+    case SEEK_END:
+        target = file_size + offset;
+        break;
+    default:
+        return -1;
+    }
+    if (target < 0) {
+        return -1;
+    }
+
+    if ((map != nullptr) || ((target >= pos) && (target <= fill))) {
+        pos = target;
+        return target;
+    }
+
+    pos = target;
+    fill = target;
+    epoch++;
+    eof = false;
+    err = 0;
+    if (uring != nullptr) {
+        io_next();
+    }
+    lck.unlock();
+    cond.notify_all();
+
+    return target;
+}
+
+/* Open fnm and set up avio for the demuxer.  Returns -1 when the
+ * caller should let FFmpeg read the file itself
+*/
+int cls_inread::open(std::string fnm)
+{
+    struct stat st;
+    uint8_t *buf;
+
+    close();
+
+    if ((chitm->ch_readahead <= 0) && (chitm->ch_readmmap == false)) {
+        return -1;
+    }
+
+    fd = ::open(fnm.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+    if ((fstat(fd, &st) != 0) || (S_ISREG(st.st_mode) == false)) {
+        close();
+        return -1;
+    }
+    file_size = st.st_size;
+    ring_size = chitm->ch_readahead;
+    if (ring_size <= 0) {
+        ring_size = INREAD_WINDOW_DFLT;
+    }
+    if (ring_size < INREAD_CHUNK) {
+        ring_size = INREAD_CHUNK;
+    }
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    pos = 0;
+    fill = 0;
+    eof = false;
+    err = 0;
+    finish = false;
+    map_advised = 0;
+
+    if ((chitm->ch_readmmap == true) && (file_size > 0)) {
+        map = (uint8_t *)mmap(NULL, (size_t)file_size
+            , PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED) {
+            LOG_MSG(NTC, SHOW_ERRNO
+                , "Ch%s: Could not map '%s', reading instead"
+                , ch_nbr.c_str(), fnm.c_str());
+            map = nullptr;
+        } else {
+            madvise(map, (size_t)file_size, MADV_SEQUENTIAL);
+        }
+    }
+
+    if (map == nullptr) {
+        ring = (uint8_t *)mymalloc((size_t)ring_size);
+        if (app->uring != nullptr) {
+            uring = app->uring;
+            mtx.lock();
+                io_next();
+            mtx.unlock();
+        } else {
+            io_thread = std::thread(&cls_inread::io_run, this);
+        }
+    }
+
+    buf = (uint8_t *)av_malloc(INREAD_AVIO_BUF);
+    avio = avio_alloc_context(buf, INREAD_AVIO_BUF, 0, this
+        , &inread_read, NULL, &inread_seek);
+    if (avio == nullptr) {
+        av_free(buf);
+        close();
+        return -1;
+    }
+
+    return 0;
+}
+
+/* The demuxer must be closed before this is called */
+void cls_inread::close()
+{
+    if (io_thread.joinable() == true) {
+        mtx.lock();
+            finish = true;
+        mtx.unlock();
+        cond.notify_all();
+        io_thread.join();
+    }
+    if (uring != nullptr) {
+        std::unique_lock<std::mutex> lck(mtx);
+        finish = true;
+        while (io_busy == true) {
+            cond.wait(lck);
+        }
+        lck.unlock();
+        uring = nullptr;
+    }
+    if (avio != nullptr) {
+        av_freep(&avio->buffer);
+        avio_context_free(&avio);
+        avio = nullptr;
+    }
+    if (map != nullptr) {
+        munmap(map, (size_t)file_size);
+        map = nullptr;
+    }
+    myfree(&ring);
+    if (fd != -1) {
+        ::close(fd);
+        fd = -1;
+    }
+    file_size = 0;
+}
+
+void cls_inread::stats_get(ctx_channel_stats &st)
+{
+    std::lock_guard<std::mutex> lck(mtx);
+    st.read_bytes = read_bytes;
+    st.read_usec = read_usec;
+    st.read_stalls = stall_cnt;
+    st.read_stall_usec = stall_usec;
+}
+
+cls_inread::cls_inread(cls_channel *p_chitm)
+{
+    chitm = p_chitm;
+    ch_nbr = chitm->ch_nbr;
+    avio = nullptr;
+    fd = -1;
+    file_size = 0;
+    map = nullptr;
+    map_advised = 0;
+    ring = nullptr;
+    ring_size = 0;
+    pos = 0;
+    fill = 0;
+    epoch = 0;
+    eof = false;
+    err = 0;
+    finish = false;
+    uring = nullptr;
+    io_busy = false;
+    read_bytes = 0;
+    read_usec = 0;
+    stall_cnt = 0;
+    stall_usec = 0;
+}
+
+cls_inread::~cls_inread()
+{
+    close();
+}
@@ -0,0 +1,80 @@
+/*
+ *    This file is part of Restream.
+ *
+ *    Restream is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    Restream is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with Restream.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef _INCLUDE_INREAD_HPP_
+#define _INCLUDE_INREAD_HPP_
+    #define INREAD_AVIO_BUF     (256 * 1024)        /* Buffer handed to the demuxer */
+    #define INREAD_CHUNK        (1024 * 1024)       /* Largest single read of the I/O thread */
+    #define INREAD_WINDOW_DFLT  (4 * 1024 * 1024)   /* Read ahead when only mmap is asked for */
+    #define INREAD_STALL        1000                /* Microseconds a read waits before it counts as a stall */
+
+    /* Feeds the demuxer of a channel from a read ahead window.  A thread
+     * keeps the window filled while the channel waits on its schedule so
+     * a slow disk is absorbed before the packets are due.  Local files
+     * may instead be mapped with the window used as the advice size.
+     * With io_uring on the reads go through the shared ring instead of
+     * the thread
+    */
+    class cls_inread {
+        public:
+            cls_inread(cls_channel *p_chitm);
+            ~cls_inread();
+
+            AVIOContext     *avio;
+
+            int     open(std::string fnm);
+            void    close();
+            int     read(uint8_t *buf, int buf_size);
+            int64_t seek(int64_t offset, int whence);
+            void    stats_get(ctx_channel_stats &st);
+
+        private:
+            cls_channel     *chitm;
+            std::string     ch_nbr;
+            int             fd;
+            int64_t         file_size;
+            uint8_t         *map;           /* The whole file in mmap mode */
+            int64_t         map_advised;    /* End of the range last given to madvise */
+            uint8_t         *ring;
+            int64_t         ring_size;
+            int64_t         pos;            /* File position of the next byte for the demuxer */
+            int64_t         fill;           /* File position the ring holds data up to */
+            int64_t         epoch;          /* Changed by a seek outside of the window */
+            bool            eof;
+            int             err;
+            bool            finish;
+            cls_uring       *uring;         /* Shared ring used instead of io_thread */
+            bool            io_busy;        /* A read is queued on the ring */
+
+            std::thread             io_thread;
+            std::mutex              mtx;
+            std::condition_variable cond;
+
+            int64_t         read_bytes;
+            int64_t         read_usec;
+            int64_t         stall_cnt;
+            int64_t         stall_usec;
+
+            void    io_run();
+            void    io_next();
+            void    io_done(int64_t ep, int64_t tm_start, int res);
+            int     read_map(uint8_t *buf, int buf_size);
+            void    stall_add(int64_t tm_start);
+    };
+
+#endif
@@ -0,0 +1,653 @@
+/*
+ *    This file is part of Restream.
+ *
+ *    Restream is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    Restream is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with Restream.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "restream.hpp"
+#include "conf.hpp"
+#include "util.hpp"
+#include "logger.hpp"
+#include "channel.hpp"
+#include "infile.hpp"
+#include "pktarray.hpp"
+#include "ratectl.hpp"
+#include "rendition.hpp"
+#include "cache.hpp"
+#include "workpool.hpp"
+#include "pretrans.hpp"
+#include "pacer.hpp"
+#include "reactor.hpp"
+#include "inread.hpp"
+#include "uring.hpp"
+#include "timeshift.hpp"
+#include "recorder.hpp"
+#include "tsmux.hpp"
+#include "localout.hpp"
+#include "webu.hpp"
+#include "webu_ans.hpp"
+#include "webu_mpegts.hpp"
+#include "webu_mpts.hpp"
+
+
+static int localout_avio_write(void *opaque, uint8_t *buf, int buf_size)
+{
+    return ((cls_localout *)opaque)->avio_write(buf, buf_size);
+}
+
+/* Write as much as the reader takes without blocking.  Bytes written or -1 */
+static int64_t localout_write(int fd, uint8_t *buf, int64_t len)
+{
+    int64_t done;
+    ssize_t cnt;
+
+    done = 0;
+    while (done < len) {
+        cnt = write(fd, buf + done, (size_t)(len - done));
+        if (cnt < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) {
+                break;
+            }
+            return -1;
+        }
+        done += cnt;
+    }
+
+    return done;
+}
+
+int cls_localout::sock_init()
+{
+    struct stat sfile;
+    struct sockaddr_un addr;
+
+    if (sock_path.length() >= sizeof(addr.sun_path)) {
+        LOG_MSG(ERR, NO_ERRNO
+            , "Ch%s: Local socket path too long %s"
+            , ch_nbr.c_str(), sock_path.c_str());
+        return -1;
+    }
+
+    /* Only a socket left from an earlier run is replaced */
+    if (stat(sock_path.c_str(), &sfile) == 0) {
+        if (S_ISSOCK(sfile.st_mode) == false) {
+            LOG_MSG(ERR, NO_ERRNO
+                , "Ch%s: %s exists and is not a socket"
+                , ch_nbr.c_str(), sock_path.c_str());
+            return -1;
+        }
+        unlink(sock_path.c_str());
+    }
+
+    sock_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (sock_fd == -1) {
+        LOG_MSG(ERR, SHOW_ERRNO
+            , "Ch%s: Could not create the local socket", ch_nbr.c_str());
+        return -1;
+    }
+
+    memset(&addr, '\0', sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", sock_path.c_str());
+    if ((bind(sock_fd, (struct sockaddr*)&addr, sizeof(addr)) == -1) ||
+        (listen(sock_fd, LOCALOUT_CLIENTS) == -1)) {
+        LOG_MSG(ERR, SHOW_ERRNO
+            , "Ch%s: Could not listen on %s"
+            , ch_nbr.c_str(), sock_path.c_str());
+        close(sock_fd);
+        sock_fd = -1;
+        return -1;
+    }
+
+    LOG_MSG(NTC, NO_ERRNO
+        , "Ch%s: Serving the stream on %s", ch_nbr.c_str(), sock_path.c_str());
+
+    return 0;
+}
+
+void cls_localout::fifo_init()
+{
+    struct stat sfile;
+
+    if (stat(fifo_path.c_str(), &sfile) == 0) {
+        if (S_ISFIFO(sfile.st_mode) == false) {
+            LOG_MSG(ERR, NO_ERRNO
+                , "Ch%s: %s exists and is not a named pipe"
+                , ch_nbr.c_str(), fifo_path.c_str());
+            fifo_path = "";
+            return;
+        }
+    } else if (mkfifo(fifo_path.c_str(), 0660) == -1) {
+        LOG_MSG(ERR, SHOW_ERRNO
+            , "Ch%s: Could not create the named pipe %s"
+            , ch_nbr.c_str(), fifo_path.c_str());
+        fifo_path = "";
+        return;
+    }
+
+    LOG_MSG(NTC, NO_ERRNO
+        , "Ch%s: Serving the stream on %s", ch_nbr.c_str(), fifo_path.c_str());
+}
+
+void cls_localout::client_add(int fd, bool is_fifo)
+{
+    ctx_localout_client cl;
+
+    cl.fd = fd;
+    cl.is_fifo = is_fifo;
+    cl.waitkey = true;
+    cl.offset = 0;
+    clients.push_back(cl);
+    clients_cnt = (int)clients.size();
+    chitm->ch_idr = true;
+
+    LOG_MSG(NTC, NO_ERRNO
+        , "Ch%s: Local reader connected on %s", ch_nbr.c_str()
+        , (is_fifo == true) ? fifo_path.c_str() : sock_path.c_str());
+}
+
+void cls_localout::client_close(int indx)
+{
+    close(clients[indx].fd);
+    if (clients[indx].is_fifo == true) {
+        fifo_open = false;
+        fifo_retry = av_gettime_relative() + 1000000;
+    }
+    clients.erase(clients.begin() + indx);
+    clients_cnt = (int)clients.size();
+
+    LOG_MSG(NTC, NO_ERRNO
+        , "Ch%s: Local reader disconnected", ch_nbr.c_str());
+}
+
+/* Take the waiting socket connections and open the pipe once it has a
+ * reader.  Opening a pipe for writing without a reader fails with ENXIO
+*/
+void cls_localout::clients_add()
+{
+    int fd, sz;
+    int64_t timenow;
+
+    while (sock_fd != -1) {
+        fd = accept4(sock_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd == -1) {
+            break;
+        }
+        if (clients.size() >= LOCALOUT_CLIENTS) {
+            LOG_MSG(NTC, NO_ERRNO
+                , "Ch%s: Too many local readers", ch_nbr.c_str());
+            close(fd);
+            continue;
+        }
+        sz = LOCALOUT_SNDBUF;
+        setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &sz, sizeof(sz));
+        client_add(fd, false);
+    }
+
+    if ((fifo_path == "") || (fifo_open == true)) {
+        return;
+    }
+    timenow = av_gettime_relative();
+    if (timenow < fifo_retry) {
+        return;
+    }
+    fd = open(fifo_path.c_str(), O_WRONLY | O_NONBLOCK | O_CLOEXEC);
+    if (fd == -1) {
+        if (errno != ENXIO) {
+            LOG_MSG(ERR, SHOW_ERRNO
+                , "Ch%s: Could not open %s", ch_nbr.c_str(), fifo_path.c_str());
+        }
+        fifo_retry = timenow + 1000000;
+        return;
+    }
+    /* The default of 64k would make every write a short one */
+    fcntl(fd, F_SETPIPE_SZ, LOCALOUT_SNDBUF);
+    fifo_open = true;
+    client_add(fd, true);
+}
+
+/* Send the reader's unsent bytes and then buf.  What it does not take is
+ * kept and a reader that falls too far behind starts over at a keyframe.
+ * The bytes up to the end of the TS packet being sent are kept so the
+ * reader stays on packet boundaries.  -1 when the reader went away
+*/
+int cls_localout::client_write(ctx_localout_client &cl, uint8_t *buf, int64_t len)
+{
+    int64_t done, sent, unsent, keep;
+
+    sent = 0;
+    if (cl.pend.empty() == false) {
+        done = localout_write(cl.fd, cl.pend.data(), (int64_t)cl.pend.size());
+        if (done < 0) {
+            return -1;
+        }
+        cl.pend.erase(cl.pend.begin(), cl.pend.begin() + done);
+        sent += done;
+    }
+
+    done = 0;
+    if ((cl.pend.empty() == true) && (len > 0)) {
+        done = localout_write(cl.fd, buf, len);
+        if (done < 0) {
+            return -1;
+        }
+        sent += done;
+    }
+
+    if (done < len) {
+        if (((int64_t)cl.pend.size() + len - done) > LOCALOUT_BACKLOG) {
+            unsent = cl.offset + done - (int64_t)cl.pend.size();
+            keep = (TSMUX_PKT - (unsent % TSMUX_PKT)) % TSMUX_PKT;
+            if (keep <= (int64_t)cl.pend.size()) {
+                cl.pend.resize((size_t)keep);
+            } else {
+                cl.pend.insert(cl.pend.end(), buf + done
+                    , buf + done + (keep - (int64_t)cl.pend.size()));
+            }
+            cl.offset = unsent + (int64_t)cl.pend.size();
+            cl.waitkey = true;
+            mtx.lock();
+                resyncs++;
+            mtx.unlock();
+            LOG_MSG(NTC, NO_ERRNO
+                , "Ch%s: Local reader fell behind, resyncing", ch_nbr.c_str());
+        } else {
+            cl.pend.insert(cl.pend.end(), buf + done, buf + len);
+            cl.offset += len;
+        }
+    } else {
+        cl.offset += len;
+    }
+
+    mtx.lock();
+        bytes += sent;
+    mtx.unlock();
+
+    return 0;
+}
+
+/* Hand the collected output to every reader.  New readers start at the
+ * first keyframe, which the muxer always precedes with the PAT and PMT
+*/
+void cls_localout::clients_send()
+{
+    int indx;
+    int64_t start;
+
+    for (indx = (int)clients.size() - 1; indx >= 0; indx--) {
+        ctx_localout_client &cl = clients[indx];
+        start = 0;
+        if (cl.waitkey == true) {
+            if (key_pos < 0) {
+                /* Finish the packet cut short at a resync */
+                if (client_write(cl, wbuf, 0) != 0) {
+                    client_close(indx);
+                }
+                continue;
+            }
+            cl.waitkey = false;
+            start = key_pos;
+        }
+        if (client_write(cl, wbuf + start, wbuf_used - start) != 0) {
+            client_close(indx);
+        }
+    }
+
+    wbuf_used = 0;
+    key_pos = -1;
+}
+
+int cls_localout::avio_write(uint8_t *buf, int buf_size)
+{
+    int64_t cnt, done;
+
+    done = 0;
+    while (done < buf_size) {
+        cnt = LOCALOUT_BUF - wbuf_used;
+        if (cnt > (buf_size - done)) {
+            cnt = buf_size - done;
+        }
+        memcpy(wbuf + wbuf_used, buf + done, (size_t)cnt);
+        wbuf_used += cnt;
+        done += cnt;
+        if (wbuf_used == LOCALOUT_BUF) {
+            clients_send();
+        }
+    }
+
+    return buf_size;
+}
+
+int cls_localout::streams_add()
+{
+    AVStream *strm;
+
+    strm_video = -1;
+    strm_audio = -1;
+
+    if ((desc->video_index != -1) && (desc->video_par != nullptr)) {
+        strm = avformat_new_stream(fmt_ctx, NULL);
+        if ((strm == nullptr) ||
+            (avcodec_parameters_copy(strm->codecpar, desc->video_par) < 0)) {
+            return -1;
+        }
+        strm->codecpar->codec_tag = 0;
+        strm->time_base = desc->video_strm_tb;
+        strm_video = strm->index;
+    }
+    if ((desc->audio_index != -1) && (desc->audio_par != nullptr)) {
+        strm = avformat_new_stream(fmt_ctx, NULL);
+        if ((strm == nullptr) ||
+            (avcodec_parameters_copy(strm->codecpar, desc->audio_par) < 0)) {
+            return -1;
+        }
+        strm->codecpar->codec_tag = 0;
+        strm->time_base = desc->audio_tb;
+        strm_audio = strm->index;
+    }
+
+    if ((strm_video == -1) && (strm_audio == -1)) {
+        return -1;
+    }
+
+    return 0;
+}
+
+int cls_localout::mux_open()
+{
+    int retcd;
+    char errstr[128];
+    uint8_t *aviobuf;
+    AVIOContext *avio;
+
+    desc = chitm->desc_get();
+    if (desc == nullptr) {
+        return -1;
+    }
+
+    avformat_alloc_output_context2(&fmt_ctx, NULL, "mpegts", NULL);
+    if (fmt_ctx == nullptr) {
+        return -1;
+    }
+    if (streams_add() != 0) {
+        LOG_MSG(ERR, NO_ERRNO
+            , "Ch%s: Could not set up the streams of the local output"
+            , ch_nbr.c_str());
+        mux_close();
+        return -1;
+    }
+
+    aviobuf = (uint8_t *)av_malloc(LOCALOUT_AVIO_BUF);
+    avio = avio_alloc_context(aviobuf, LOCALOUT_AVIO_BUF, 1, this
+        , NULL, &localout_avio_write, NULL);
+    if (avio == nullptr) {
+        av_free(aviobuf);
+        mux_close();
+        return -1;
+    }
+    fmt_ctx->pb = avio;
+    fmt_ctx->flags |= AVFMT_FLAG_CUSTOM_IO;
+    fmt_ctx->max_delay = 0;
+
+    retcd = avformat_write_header(fmt_ctx, NULL);
+    if (retcd < 0) {
+        av_strerror(retcd, errstr, sizeof(errstr));
+        LOG_MSG(ERR, NO_ERRNO
+            , "Ch%s: Could not write the header of the local output: %s"
+            , ch_nbr.c_str(), errstr);
+        mux_close();
+        return -1;
+    }
+
+    if (strm_video != -1) {
+        myrescale_init(rs_video, AVRational{1, PKTARRAY_TIMEBASE}
+            , fmt_ctx->streams[strm_video]->time_base);
+    }
+    if (strm_audio != -1) {
+        myrescale_init(rs_audio, AVRational{1, PKTARRAY_TIMEBASE}
+            , fmt_ctx->streams[strm_audio]->time_base);
+    }
+    last_dts[0] = AV_NOPTS_VALUE;
+    last_dts[1] = AV_NOPTS_VALUE;
+
+    /* Start at the live edge and have the encoder send an IDR */
+    pkt_idnbr = 0;
+    pkt_index = chitm->pktarray->index_curr();
+    if (pkt_index >= 0) {
+        pthread_mutex_lock(&chitm->pktarray->mtx);
+            pkt_idnbr = chitm->pktarray->array[pkt_index].idnbr;
+        pthread_mutex_unlock(&chitm->pktarray->mtx);
+    }
+    chitm->ch_idr = true;
+
+    return 0;
+}
+
+void cls_localout::mux_close()
+{
+    if (fmt_ctx != nullptr) {
+        if (fmt_ctx->pb != nullptr) {
+            av_freep(&fmt_ctx->pb->buffer);
+            avio_context_free(&fmt_ctx->pb);
+        }
+        avformat_free_context(fmt_ctx);
+        fmt_ctx = nullptr;
+    }
+    mypacket_free(pkt);
+    pkt = nullptr;
+    desc = nullptr;
+    wbuf_used = 0;
+    key_pos = -1;
+}
+
+/* Copy the next packet of the ring into pkt.  False when there is none yet */
+bool cls_localout::packet_next()
+{
+    int indx;
+    bool pktready;
+    cls_pktarray *pktarray;
+
+    pktarray = chitm->pktarray;
+    pktready = false;
+
+    pthread_mutex_lock(&pktarray->mtx);
+        if (pktarray->count > 0) {
+            indx = pktarray->index_valid(pktarray->index_next(pkt_index));
+            if ((pktarray->array[indx].packet != nullptr) &&
+                (pktarray->array[indx].idnbr > pkt_idnbr)) {
+                pkt = mypacket_alloc(pkt);
+                if (mycopy_packet(pkt, pktarray->array[indx].packet) == 0) {
+                    pktready = true;
+                }
+                pkt_index = indx;
+                pkt_idnbr = pktarray->array[indx].idnbr;
+            }
+        }
+    pthread_mutex_unlock(&pktarray->mtx);
+
+    return pktready;
+}
+
+/* The ring is in decode order so packets are written as they come */
+void cls_localout::packet_write()
+{
+    int retcd, strm, slot;
+    char errstr[128];
+    ctx_rescale *rs;
+
+    if (chitm->desc_gen != desc->generation) {
+        desc = chitm->desc_get();
+    }
+
+    if (pkt->stream_index == desc->video_index) {
+        strm = strm_video;
+        rs = &rs_video;
+        slot = 0;
+    } else if (pkt->stream_index == desc->audio_index) {
+        strm = strm_audio;
+        rs = &rs_audio;
+        slot = 1;
+    } else {
+        return;
+    }
+    if (strm == -1) {
+        return;
+    }
+
+    pkt->pts = myrescale(*rs, pkt->pts);
+    pkt->dts = myrescale(*rs, pkt->dts);
+    if (pkt->duration > 0) {
+        pkt->duration = myrescale(*rs, pkt->duration);
+    }
+    if ((pkt->dts != AV_NOPTS_VALUE) && (last_dts[slot] != AV_NOPTS_VALUE) &&
+        (pkt->dts <= last_dts[slot])) {
+        return;
+    }
+    last_dts[slot] = pkt->dts;
+    pkt->stream_index = strm;
+    pkt->pos = -1;
+
+    /* Mark where the keyframe starts for the readers waiting on one */
+    if ((strm == strm_video) && ((pkt->flags & AV_PKT_FLAG_KEY) != 0)) {
+        avio_flush(fmt_ctx->pb);
+        if (key_pos == -1) {
+            key_pos = wbuf_used;
+        }
+    }
+
+    retcd = av_write_frame(fmt_ctx, pkt);
+    if (retcd < 0) {
+        av_strerror(retcd, errstr, sizeof(errstr));
+        LOG_MSG(ERR, NO_ERRNO
+            , "Ch%s: Error writing to the local output: %s"
+            , ch_nbr.c_str(), errstr);
+    }
+}
+
+void cls_localout::run()
+{
+    int cnt;
+
+    mythreadname_set("lo", atoi(ch_nbr.c_str()), NULL);
+
+    while (true) {
+        std::unique_lock<std::mutex> lck(mtx);
+        if (finish == true) {
+            break;
+        }
+        lck.unlock();
+
+        clients_add();
+
+        if (clients.empty() == true) {
+            if (fmt_ctx != nullptr) {
+                mux_close();
+            }
+            lck.lock();
+            cond.wait_for(lck, std::chrono::milliseconds(100));
+            continue;
+        }
+        if ((fmt_ctx == nullptr) && (mux_open() != 0)) {
+            lck.lock();
+            cond.wait_for(lck, std::chrono::seconds(1));
+            continue;
+        }
+
+        /* Whatever the ring holds goes out together, bounded so new
+         * readers are still taken while catching up
+        */
+        cnt = 0;
+        while ((cnt < 256) && (packet_next() == true)) {
+            packet_write();
+            cnt++;
+        }
+        avio_flush(fmt_ctx->pb);
+        clients_send();
+
+        if (cnt == 0) {
+            lck.lock();
+            cond.wait_for(lck, std::chrono::microseconds(LOCALOUT_IDLE));
+        }
+    }
+
+    mux_close();
+    while (clients.empty() == false) {
+        client_close((int)clients.size() - 1);
+    }
+    if (sock_fd != -1) {
+        close(sock_fd);
+        sock_fd = -1;
+        unlink(sock_path.c_str());
+    }
+}
+
+void cls_localout::stats_get(ctx_channel_stats &st)
+{
+    std::lock_guard<std::mutex> lck(mtx);
+    st.local_bytes = bytes;
+    st.local_resyncs = resyncs;
+}
+
+cls_localout::cls_localout(cls_channel *p_chitm)
+{
+    chitm = p_chitm;
+    ch_nbr = chitm->ch_nbr;
+    clients_cnt = 0;
+    sock_path = chitm->ch_localsock;
+    fifo_path = chitm->ch_fifo;
+    sock_fd = -1;
+    fifo_retry = 0;
+    fifo_open = false;
+    finish = false;
+    wbuf = (uint8_t *)mymalloc(LOCALOUT_BUF);
+    wbuf_used = 0;
+    key_pos = -1;
+    fmt_ctx = nullptr;
+    desc = nullptr;
+    strm_video = -1;
+    strm_audio = -1;
+    last_dts[0] = AV_NOPTS_VALUE;
+    last_dts[1] = AV_NOPTS_VALUE;
+    pkt_index = -1;
+    pkt_idnbr = 0;
+    pkt = nullptr;
+    bytes = 0;
+    resyncs = 0;
+
+    if (sock_path != "") {
+        sock_init();
+    }
+    if (fifo_path != "") {
+        fifo_init();
+    }
+    if ((sock_fd != -1) || (fifo_path != "")) {
+        lo_thread = std::thread(&cls_localout::run, this);
+    }
+}
+
+cls_localout::~cls_localout()
+{
+    mtx.lock();
+        finish = true;
+    mtx.unlock();
+    cond.notify_all();
+    if (lo_thread.joinable() == true) {
+        lo_thread.join();
+    }
+    free(wbuf);
+}
@@ -0,0 +1,99 @@
+/*
+ *    This file is part of Restream.
+ *
+ *    Restream is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    Restream is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with Restream.  If not, see <https://www.gnu.org/licenses/>.
+ *
+*/
+
+#ifndef _INCLUDE_LOCALOUT_HPP_
+#define _INCLUDE_LOCALOUT_HPP_
+    #define LOCALOUT_BUF        (1024 * 1024)       /* Muxed bytes collected before the clients are written */
+    #define LOCALOUT_AVIO_BUF   (64 * 1024)
+    #define LOCALOUT_SNDBUF     (1024 * 1024)       /* Socket and pipe buffer asked for each client */
+    #define LOCALOUT_BACKLOG    (8 * 1024 * 1024)   /* Unsent bytes a client may hold before it is resynced */
+    #define LOCALOUT_CLIENTS    32
+    #define LOCALOUT_IDLE       10000               /* Microseconds to wait for the next packet */
+
+    /* A reader of the local output */
+    struct ctx_localout_client {
+        int                     fd;
+        bool                    is_fifo;
+        bool                    waitkey;        /* Nothing sent until the next keyframe */
+        std::vector<uint8_t>    pend;           /* Bytes the reader has not taken yet */
+        int64_t                 offset;         /* Bytes sent or pending for the reader */
+    };
+
+    /* Serves the channel as a plain transport stream to readers on the
+     * same host over a Unix stream socket and/or a named pipe.  One muxer
+     * follows the ring and its output goes to every reader in large
+     * writes, without the HTTP layer of the web clients
+    */
+    class cls_localout {
+        public:
+            cls_localout(cls_channel *p_chitm);
+            ~cls_localout();
+
+            std::atomic<int>    clients_cnt;
+
+            int     avio_write(uint8_t *buf, int buf_size);
+            void    stats_get(ctx_channel_stats &st);
+
+        private:
+            cls_channel     *chitm;
+            std::string     ch_nbr;
+            std::string     sock_path;
+            std::string     fifo_path;
+            int             sock_fd;
+            int64_t         fifo_retry;     /* Time of the next attempt to open the pipe */
+            bool            fifo_open;
+            bool            finish;
+            std::vector<ctx_localout_client>    clients;
+
+            uint8_t         *wbuf;
+            int64_t         wbuf_used;
+            int64_t         key_pos;        /* Offset of the first keyframe in wbuf or -1 */
+            AVFormatContext *fmt_ctx;
+            ptr_stream_desc desc;
+            int             strm_video;
+            int             strm_audio;
+            ctx_rescale     rs_video;
+            ctx_rescale     rs_audio;
+            int64_t         last_dts[2];
+            int             pkt_index;
+            int64_t         pkt_idnbr;
+            AVPacket        *pkt;
+
+            int64_t         bytes;
+            int64_t         resyncs;
+
+            std::thread             lo_thread;
+            std::mutex              mtx;
+            std::condition_variable cond;
+
+            void    run();
+            int     sock_init();
+            void    fifo_init();
+            void    clients_add();
+            void    client_add(int fd, bool is_fifo);
+            void    client_close(int indx);
+            int     client_write(ctx_localout_client &cl, uint8_t *buf, int64_t len);
+            void    clients_send();
+            int     streams_add();
+            int     mux_open();
+            void    mux_close();
+            bool    packet_next();
+            void    packet_write();
+    };
+
+#endif /* _INCLUDE_LOCALOUT_HPP_ */
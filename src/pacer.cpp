@@ -0,0 +1,187 @@
+/*
+ *    This file is part of Restream.
+ *
+ *    Restream is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    Restream is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with Restream.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "restream.hpp"
+#include "conf.hpp"
+#include "util.hpp"
+#include "logger.hpp"
+#include "channel.hpp"
+#include "infile.hpp"
+#include "pktarray.hpp"
+#include "ratectl.hpp"
+#include "rendition.hpp"
+#include "cache.hpp"
+#include "workpool.hpp"
+#include "pretrans.hpp"
+#include "pacer.hpp"
+#include "reactor.hpp"
+#include "inread.hpp"
+#include "uring.hpp"
+#include "timeshift.hpp"
+#include "recorder.hpp"
+#include "tsmux.hpp"
+#include "localout.hpp"
+#include "webu.hpp"
+#include "webu_ans.hpp"
+#include "webu_mpegts.hpp"
+#include "webu_mpts.hpp"
+
+int64_t cls_pacer::now_ns()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((int64_t)ts.tv_sec * 1000000000L) + ts.tv_nsec;
+}
+
+/* Start a new schedule with position 0 due now */
+void cls_pacer::start()
+{
+    origin = now_ns();
+}
+
+/* Move the schedule so that pos_us is due now */
+void cls_pacer::rebase(int64_t pos_us)
+{
+    origin = now_ns() - (pos_us * 1000);
+}
+
+void cls_pacer::sample_add(int64_t late_ns)
+{
+    if (late_ns < 0) {
+        late_ns = -late_ns;
+    }
+    pthread_mutex_lock(&mtx);
+        if ((int)samples.size() < PACER_SAMPLES) {
+            samples.push_back(late_ns / 1000);
+        } else {
+            samples[sample_indx] = late_ns / 1000;
+        }
+        sample_indx = (sample_indx + 1) % PACER_SAMPLES;
+    pthread_mutex_unlock(&mtx);
+}
+
+/* Work out when the packet at pos_us should be woken for.  Returns 0
+ * when it is due now.  margin_us is how far ahead of the schedule the
+ * caller is.  When far behind after a stall the schedule is moved so
+ * that no more than PACER_MAX_LAG is sent in a burst to catch up
+*/
+int64_t cls_pacer::due(int64_t pos_us, int64_t &margin_us)
+{
+    int64_t now, margin, wake_ns;
+
+    now = now_ns();
+    deadline = origin + (pos_us * 1000);
+    margin = deadline - now;
+    margin_us = margin / 1000;
+
+    if (margin < -(PACER_MAX_LAG * 1000L)) {
+        origin += (-margin) - (PACER_MAX_LAG * 1000L);
+        deadline = 0;
+        pthread_mutex_lock(&chitm->mtx_stats);
+            chitm->stats.pace_stalls++;
+        pthread_mutex_unlock(&chitm->mtx_stats);
+        return 0;
+    }
+
+    if (margin > (PACER_MAX_SLEEP * 1000L)) {
+        LOG_MSG(NTC, NO_ERRNO
+            , "Ch%s: Timestamps jumped ahead %lds, restarting the schedule"
+            , ch_nbr.c_str(), (long)(margin / 1000000000L));
+        rebase(pos_us);
+        deadline = 0;
+        margin_us = 0;
+        return 0;
+    }
+
+    /* Wake early by the average lateness so wake ups centre on the schedule */
+    wake_ns = deadline - wake_adj;
+    if (wake_ns <= now) {
+        deadline = 0;
+        return 0;
+    }
+    return wake_ns;
+}
+
+void cls_pacer::sleep(int64_t wake_ns)
+{
+    struct timespec ts;
+
+    ts.tv_sec = wake_ns / 1000000000L;
+    ts.tv_nsec = wake_ns % 1000000000L;
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR);
+
+    woke();
+}
+
+/* Note how late the wake up for the last due() was */
+void cls_pacer::woke()
+{
+    int64_t late;
+
+    if (deadline == 0) {
+        return;
+    }
+    late = now_ns() - deadline;
+    deadline = 0;
+
+    wake_adj += late / 8;
+    if (wake_adj < 0) {
+        wake_adj = 0;
+    } else if (wake_adj > PACER_WAKE_MAX) {
+        wake_adj = PACER_WAKE_MAX;
+    }
+    sample_add(late);
+}
+
+/* Percentiles of how far the recent wake ups were from the schedule */
+void cls_pacer::stats_get(ctx_channel_stats &st)
+{
+    std::vector<int64_t> sorted;
+
+    pthread_mutex_lock(&mtx);
+        sorted = samples;
+    pthread_mutex_unlock(&mtx);
+
+    st.pace_jit_p50 = 0;
+    st.pace_jit_p99 = 0;
+    st.pace_jit_max = 0;
+    if (sorted.size() == 0) {
+        return;
+    }
+    std::sort(sorted.begin(), sorted.end());
+    st.pace_jit_p50 = sorted[(sorted.size() * 50) / 100];
+    st.pace_jit_p99 = sorted[(sorted.size() * 99) / 100];
+    st.pace_jit_max = sorted[sorted.size() - 1];
+}
+
+cls_pacer::cls_pacer(cls_channel *p_chitm)
+{
+    chitm = p_chitm;
+    ch_nbr = p_chitm->ch_nbr;
+    origin = now_ns();
+    wake_adj = 0;
+    deadline = 0;
+    sample_indx = 0;
+    pthread_mutex_init(&mtx, NULL);
+}
+
+cls_pacer::~cls_pacer()
+{
+    pthread_mutex_destroy(&mtx);
+}
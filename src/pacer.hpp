@@ -0,0 +1,57 @@
+/*
+ *    This file is part of Restream.
+ *
+ *    Restream is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    Restream is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with Restream.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef _INCLUDE_PACER_HPP_
+#define _INCLUDE_PACER_HPP_
+    #define PACER_MAX_LAG       250000      /* Microseconds behind before the schedule is moved */
+    #define PACER_MAX_SLEEP     100000000   /* Microseconds ahead that counts as a discontinuity */
+    #define PACER_WAKE_MAX      2000000     /* Largest early wake up in nanoseconds */
+    #define PACER_SAMPLES       1024        /* Wake ups kept for the jitter percentiles */
+
+    /* Releases the packets of a channel at absolute times on the
+     * monotonic clock.  Each packet is due at the schedule origin plus
+     * its dts from the start of the file so sleep errors do not add up
+    */
+    class cls_pacer {
+        public:
+            cls_pacer(cls_channel *p_chitm);
+            ~cls_pacer();
+
+            void    start();
+            void    rebase(int64_t pos_us);
+            int64_t due(int64_t pos_us, int64_t &margin_us);
+            void    sleep(int64_t wake_ns);
+            void    woke();
+            int64_t now_ns();
+            void    stats_get(ctx_channel_stats &st);
+
+        private:
+            cls_channel     *chitm;
+            std::string     ch_nbr;
+            int64_t         origin;     /* Monotonic time in ns when pos 0 is due */
+            int64_t         wake_adj;   /* Average wake up lateness in ns that is slept less */
+            int64_t         deadline;   /* When the packet given to due() is on schedule */
+
+            pthread_mutex_t         mtx;
+            std::vector<int64_t>    samples;
+            int                     sample_indx;
+
+            void    sample_add(int64_t late_ns);
+    };
+
+#endif
@@ -23,36 +23,338 @@
 #include "channel.hpp"
 #include "infile.hpp"
 #include "pktarray.hpp"
+#include "ratectl.hpp"
+#include "rendition.hpp"
+#include "cache.hpp"
+#include "workpool.hpp"
+#include "pretrans.hpp"
+#include "pacer.hpp"
+#include "reactor.hpp"
+#include "inread.hpp"
+#include "uring.hpp"
+#include "timeshift.hpp"
+#include "recorder.hpp"
+#include "tsmux.hpp"
+#include "localout.hpp"
 #include "webu.hpp"
 #include "webu_ans.hpp"
 #include "webu_mpegts.hpp"
+#include "webu_mpts.hpp"
 
 
-void cls_pktarray::resize()
+/* Buffer free callback for payloads that live in the arena */
+static void pktarray_arena_free(void *opaque, uint8_t *data)
+{
+    (void)data;
+    ((ctx_arena_region *)opaque)->busy = false;
+}
+
+/* Map the arena that holds the payloads of every packet in the ring */
+void cls_pktarray::arena_init()
 {
-    ctx_packet_item pktitm;
     int indx;
 
-    if (count <= 0) {
-        LOG_MSG(ERR, NO_ERRNO,"Attempt to resize to zero");
-        abort();
+    arena = nullptr;
+    if (chitm->ch_ringhuge == true) {
+        arena_size = ((arena_size + PKTARRAY_HUGEPAGE - 1) / PKTARRAY_HUGEPAGE) * PKTARRAY_HUGEPAGE;
+        arena = (uint8_t *)mmap(NULL, arena_size, PROT_READ | PROT_WRITE
+            , MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (arena == MAP_FAILED) {
+            LOG_MSG(NTC, SHOW_ERRNO
+                , "Ch%s: Hugepages not available for ring, using normal pages"
+                , ch_nbr.c_str());
+            arena = nullptr;
+        }
+    }
+    if (arena == nullptr) {
+        arena = (uint8_t *)mmap(NULL, arena_size, PROT_READ | PROT_WRITE
+            , MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (arena == MAP_FAILED) {
+            LOG_MSG(ERR, SHOW_ERRNO
+                , "Ch%s: Unable to map %lu bytes for ring, using heap"
+                , ch_nbr.c_str(), (unsigned long)arena_size);
+            arena = nullptr;
+            arena_size = 0;
+            return;
+        }
+        #ifdef MADV_HUGEPAGE
+            if (chitm->ch_ringhuge == true) {
+                madvise(arena, arena_size, MADV_HUGEPAGE);
+            }
+        #endif
+    }
+
+    /* Spare regions let the ring keep going while clients hold old payloads */
+    reg_count = count * 2;
+    regions = new ctx_arena_region[reg_count];
+    for (indx=0; indx < reg_count; indx++) {
+        regions[indx].offset = 0;
+        regions[indx].size = 0;
+        regions[indx].slot = -1;
+        regions[indx].busy = false;
     }
+    reg_head = 0;
+    reg_tail = 0;
+    reg_used = 0;
+    arena_head = 0;
 
-    pktitm.idnbr = -1;
-    pktitm.iskey = false;
-    pktitm.iswritten = false;
-    pktitm.packet = nullptr;
-    pktitm.file_cnt = 0;
-    pktitm.start_pts = 0;
-    pktitm.timebase={0,0};
+    LOG_MSG(NTC, NO_ERRNO
+        , "Ch%s: Ring of %d slots using %lu bytes"
+        , ch_nbr.c_str(), count, (unsigned long)arena_size);
+}
+
+void cls_pktarray::arena_deinit()
+{
+    if (arena != nullptr) {
+        munmap(arena, arena_size);
+        arena = nullptr;
+    }
+    if (regions != nullptr) {
+        delete [] regions;
+        regions = nullptr;
+    }
+    arena_size = 0;
+    reg_count = 0;
+    reg_used = 0;
+}
+
+/* Release the oldest regions whose payloads are no longer referenced */
+void cls_pktarray::arena_reclaim()
+{
+    while ((reg_used > 0) && (regions[reg_tail].busy == false)) {
+        regions[reg_tail].slot = -1;
+        reg_tail = (reg_tail + 1) % reg_count;
+        reg_used--;
+    }
+    if (reg_used == 0) {
+        arena_head = 0;
+    }
+}
+
+/* Find room for need bytes after the newest region */
+bool cls_pktarray::arena_fit(size_t need, size_t &offset)
+{
+    size_t tail_off;
+
+    if (reg_used == reg_count) {
+        return false;
+    }
+    if (reg_used == 0) {
+        offset = 0;
+        return (need <= arena_size);
+    }
+
+    tail_off = regions[reg_tail].offset;
+    if (arena_head > tail_off) {
+        if ((arena_size - arena_head) >= need) {
+            offset = arena_head;
+            return true;
+        }
+        if (tail_off >= need) {
+            offset = 0;
+            return true;
+        }
+    } else if ((tail_off - arena_head) >= need) {
+        offset = arena_head;
+        return true;
+    }
+
+    return false;
+}
+
+/* Drop the slot that owns the oldest region.  False when nothing can be released */
+bool cls_pktarray::arena_evict()
+{
+    int slot;
+
+    if (reg_used == 0) {
+        return false;
+    }
+    slot = regions[reg_tail].slot;
+    if ((slot < 0) || (array[slot].region != reg_tail)) {
+        /* A client still holds this payload */
+        return false;
+    }
+    array[slot].idnbr = -1;
+    array[slot].iskey = false;
+    array[slot].region = -1;
+    av_packet_unref(array[slot].packet);
+
+    return true;
+}
+
+/* Carve a buffer for slot indx out of the arena.  Returns nullptr when it must use the heap */
+AVBufferRef *cls_pktarray::arena_get(int indx, int size)
+{
+    size_t need, offset;
+    AVBufferRef *buf;
+    ctx_arena_region *reg;
+
+    if (arena == nullptr) {
+        return nullptr;
+    }
+
+    need = (size_t)size + AV_INPUT_BUFFER_PADDING_SIZE;
+    need = ((need + PKTARRAY_ALIGN - 1) / PKTARRAY_ALIGN) * PKTARRAY_ALIGN;
+    if (need > (arena_size / 4)) {
+        arena_fallback++;
+        return nullptr;
+    }
+
+    offset = 0;
+    arena_reclaim();
+    while (arena_fit(need, offset) == false) {
+        if (arena_evict() == false) {
+            arena_fallback++;
+            return nullptr;
+        }
+        arena_reclaim();
+    }
+
+    reg = &regions[reg_head];
+    reg->offset = offset;
+    reg->size = need;
+    reg->slot = indx;
+    reg->busy = true;
+
+    buf = av_buffer_create(arena + offset
+        , (size_t)size + AV_INPUT_BUFFER_PADDING_SIZE
+        , pktarray_arena_free, reg, 0);
+    if (buf == nullptr) {
+        reg->busy = false;
+        reg->slot = -1;
+        return nullptr;
+    }
+
+    array[indx].region = reg_head;
+    reg_head = (reg_head + 1) % reg_count;
+    reg_used++;
+    arena_head = offset + need;
+
+    return buf;
+}
+
+/* Size the ring from the ringbytes/ringsecs options and map its arena */
+void cls_pktarray::resize()
+{
+    ctx_packet_item pktitm;
+    int indx;
+    int64_t bitrate, secs_bytes, slots;
 
     pthread_mutex_lock(&mtx);
+
+        arena_size = PKTARRAY_BYTES_DFLT;
+        if (chitm->ch_ringbytes > 0) {
+            arena_size = (size_t)chitm->ch_ringbytes;
+        }
+        if (chitm->ch_ringsecs > 0) {
+            bitrate = 0;
+            if (chitm->infile->ifile.fmt_ctx != nullptr) {
+                bitrate = chitm->infile->ifile.fmt_ctx->bit_rate;
+            }
+            if (bitrate <= 0) {
+                bitrate = PKTARRAY_BITRATE_DFLT;
+            }
+            /* Leave headroom since the output bitrate is not known yet */
+            secs_bytes = ((bitrate / 8) * chitm->ch_ringsecs * 3) / 2;
+            if ((chitm->ch_ringbytes <= 0) || (secs_bytes < chitm->ch_ringbytes)) {
+                arena_size = (size_t)secs_bytes;
+            }
+        }
+
+        slots = (int64_t)arena_size / PKTARRAY_SLOT_BYTES;
+        if (slots < PKTARRAY_SLOTS_MIN) {
+            slots = PKTARRAY_SLOTS_MIN;
+        } else if (slots > PKTARRAY_SLOTS_MAX) {
+            slots = PKTARRAY_SLOTS_MAX;
+        }
+        count = (int)slots;
+
+        pktitm.idnbr = -1;
+        pktitm.iskey = false;
+        pktitm.iswritten = false;
+        pktitm.packet = nullptr;
+        pktitm.region = -1;
+
         for (indx=1; indx <= count; indx++) {
+            /* The slot packets live as long as the array */
+            pktitm.packet = mypacket_alloc(nullptr);
             array.push_back(pktitm);
         }
+
+        arena_init();
+
+    pthread_mutex_unlock(&mtx);
+}
+
+/* Mark all the slots as empty and return their payloads to the arena*/
+void cls_pktarray::reset()
+{
+    int indx;
+
+    pthread_mutex_lock(&mtx);
+        for (indx=0; indx < (int)array.size(); indx++) {
+            array[indx].idnbr = -1;
+            array[indx].iskey = false;
+            array[indx].iswritten = false;
+            if (array[indx].region != -1) {
+                array[indx].region = -1;
+                av_packet_unref(array[indx].packet);
+            }
+        }
+        if (arena != nullptr) {
+            arena_reclaim();
+        }
+        keyindex.clear();
     pthread_mutex_unlock(&mtx);
 }
 
+/* Copy the packet into the slot.  The payload goes into the arena when
+ * possible and otherwise into a heap buffer the slot keeps for reuse
+*/
+int cls_pktarray::slot_copy(int indx, AVPacket *src)
+{
+    size_t need;
+    AVPacket *dst;
+    AVBufferRef *buf;
+
+    dst = array[indx].packet;
+    if (array[indx].region != -1) {
+        array[indx].region = -1;
+        av_packet_unref(dst);
+    }
+
+    need = (size_t)src->size + AV_INPUT_BUFFER_PADDING_SIZE;
+    buf = arena_get(indx, src->size);
+    if (buf != nullptr) {
+        av_buffer_unref(&dst->buf);
+        dst->buf = buf;
+    } else if ((dst->buf == nullptr) ||
+        (dst->buf->size < need) ||
+        (av_buffer_is_writable(dst->buf) == 0)) {
+        av_buffer_unref(&dst->buf);
+        dst->buf = av_buffer_alloc(need);
+        if (dst->buf == nullptr) {
+            dst->data = nullptr;
+            dst->size = 0;
+            return AVERROR(ENOMEM);
+        }
+    }
+    memcpy(dst->buf->data, src->data, src->size);
+    memset(dst->buf->data + src->size, 0, AV_INPUT_BUFFER_PADDING_SIZE);
+
+    dst->data = dst->buf->data;
+    dst->size = src->size;
+    dst->pts = src->pts;
+    dst->dts = src->dts;
+    dst->duration = src->duration;
+    dst->flags = src->flags;
+    dst->stream_index = src->stream_index;
+    dst->pos = src->pos;
+
+    return 0;
+}
+
 int cls_pktarray::index_curr()
 {
     int retval;
@@ -80,6 +382,187 @@ int cls_pktarray::index_prev(int index)
     }
 }
 
+/* Caller holds mtx.  Drop keyframes whose slots have been reused or evicted */
+void cls_pktarray::key_prune()
+{
+    while (keyindex.empty() == false) {
+        if (array[keyindex.front().index].idnbr == keyindex.front().idnbr) {
+            break;
+        }
+        keyindex.pop_front();
+    }
+}
+
+/* Find where a new client should start reading.  nth selects the
+ * nth newest video keyframe or when burst is set, the newest keyframe
+ * at least burst seconds behind the live edge.  The start is moved back
+ * over any audio that plays at or after the keyframe but was queued
+ * ahead of it.  Returns the index before the start (readers advance
+ * first) or -1
+*/
+int cls_pktarray::index_join(int nth, int burst, int64_t &idnbr)
+{
+    int pos, indx, indx_start, chk;
+    ctx_packet_item *key, *itm;
+
+    pthread_mutex_lock(&mtx);
+        key_prune();
+        if (keyindex.empty() == true) {
+            pthread_mutex_unlock(&mtx);
+            return -1;
+        }
+
+        if (nth < 1) {
+            nth = 1;
+        }
+        pos = (int)keyindex.size() - nth;
+        if (pos < 0) {
+            pos = 0;
+        }
+        if (burst > 0) {
+            pos = (int)keyindex.size() - 1;
+            while ((pos > 0) &&
+                ((video_tm - keyindex[pos].tm) < ((int64_t)burst * 1000000))) {
+                pos--;
+            }
+        }
+        indx_start = keyindex[pos].index;
+        key = &array[indx_start];
+
+        indx = index_prev(indx_start);
+        for (chk=0; chk < PKTARRAY_AUDIO_BACK; chk++) {
+            itm = &array[indx];
+            if ((itm->idnbr == -1) ||
+                (itm->idnbr >= array[indx_start].idnbr) ||
+                (itm->packet->stream_index == key->packet->stream_index) ||
+                (itm->packet->pts == AV_NOPTS_VALUE)) {
+                break;
+            }
+            if (itm->packet->pts < key->packet->pts) {
+                break;
+            }
+            indx_start = indx;
+            indx = index_prev(indx);
+        }
+
+        idnbr = array[indx_start].idnbr - 1;
+    pthread_mutex_unlock(&mtx);
+
+    return index_prev(indx_start);
+}
+
+/* Newest slot and its id so a reader only sees packets added after now */
+int cls_pktarray::index_live(int64_t &idnbr)
+{
+    int retval;
+
+    pthread_mutex_lock(&mtx);
+        retval = arrayindex;
+        idnbr = pktnbr;
+    pthread_mutex_unlock(&mtx);
+
+    return retval;
+}
+
+void cls_pktarray::stats_get(ctx_channel_stats &stats)
+{
+    pthread_mutex_lock(&mtx);
+        if (count > 0) {
+            key_prune();
+        }
+        stats.ring_slots = count;
+        stats.ring_bytes = (int64_t)arena_size;
+        stats.ring_keys = (int)keyindex.size();
+        stats.ring_fallback = arena_fallback;
+    pthread_mutex_unlock(&mtx);
+}
+
+/* Caller holds mtx.  Moves a reader that sits on an evicted slot forward
+ * to the oldest packet still in the ring
+*/
+int cls_pktarray::index_valid(int index)
+{
+    int indx, chk;
+
+    if ((arrayindex == -1) ||
+        (array[index].idnbr != -1) ||
+        (index == index_next(arrayindex))) {
+        return index;
+    }
+
+    indx = index_next(arrayindex);
+    for (chk=0; chk < count; chk++) {
+        if (array[indx].idnbr != -1) {
+            return indx;
+        }
+        indx = index_next(indx);
+    }
+
+    return index;
+}
+
+/* Move the copy in the ring onto the channel timeline.  Each file
+ * starts where the previous one ended and the dts only moves forward
+ * so the clients can send the packets without any adjustment
+*/
+void cls_pktarray::timeline(AVPacket *pkt)
+{
+    int sidx;
+    int64_t start_pts, pkt_end;
+    AVRational tb_src, tb_dst;
+
+    if (pkt->stream_index == chitm->infile->ifile.video.index) {
+        sidx = 0;
+        tb_src = chitm->infile->ifile.video.strm->time_base;
+        start_pts = chitm->infile->ifile.video.start_pts;
+    } else {
+        sidx = 1;
+        tb_src = chitm->infile->ifile.audio.strm->time_base;
+        start_pts = chitm->infile->ifile.audio.start_pts;
+    }
+    tb_dst = AVRational{1, PKTARRAY_TIMEBASE};
+
+    if (tl_file_cnt != chitm->file_cnt) {
+        tl_file_cnt = chitm->file_cnt;
+        tl_base = tl_end;
+    }
+    myrescale_check(tl_rs[sidx], tb_src, tb_dst);
+
+    if (pkt->dts == AV_NOPTS_VALUE) {
+        pkt->dts = pkt->pts;
+    }
+    if (pkt->dts == AV_NOPTS_VALUE) {
+        pkt->dts = tl_dts[sidx] + 1;
+    } else {
+        pkt->dts = myrescale(tl_rs[sidx], pkt->dts - start_pts) + tl_base;
+        if (pkt->dts <= tl_dts[sidx]) {
+            pkt->dts = tl_dts[sidx] + 1;
+        }
+    }
+    if (pkt->pts == AV_NOPTS_VALUE) {
+        pkt->pts = pkt->dts;
+    } else {
+        pkt->pts = myrescale(tl_rs[sidx], pkt->pts - start_pts) + tl_base;
+        if (pkt->pts < pkt->dts) {
+            pkt->pts = pkt->dts;
+        }
+    }
+    if (pkt->duration > 0) {
+        pkt->duration = myrescale(tl_rs[sidx], pkt->duration);
+    }
+    pkt->time_base = tb_dst;
+    tl_dts[sidx] = pkt->dts;
+
+    if (pkt->duration > 0) {
+        pkt_end = pkt->pts + pkt->duration;
+    } else {
+        pkt_end = pkt->pts + 1;
+    }
+    if (pkt_end > tl_end) {
+        tl_end = pkt_end;
+    }
+}
+
 void cls_pktarray::add(AVPacket *pkt)
 {
     int indx_next, retcd;
@@ -91,23 +574,18 @@ void cls_pktarray::add(AVPacket *pkt)
     pthread_mutex_lock(&mtx);
 
         pktnbr++;
-        array[indx_next].idnbr = pktnbr;
 
-        if (array[indx_next].packet != nullptr) {
-            mypacket_free(array[indx_next].packet);
-            array[indx_next].packet = nullptr;
-        }
-        array[indx_next].packet = mypacket_alloc(array[indx_next].packet);
-
-        retcd = mycopy_packet(array[indx_next].packet, pkt);
+        retcd = slot_copy(indx_next, pkt);
         if (retcd < 0) {
             av_strerror(retcd, errstr, sizeof(errstr));
             LOG_MSG(NTC, NO_ERRNO
                 , "Ch%s: Error copying packet: %s"
                 , ch_nbr.c_str(), errstr);
-            mypacket_free(array[indx_next].packet);
-            array[indx_next].packet = NULL;
+            array[indx_next].idnbr = -1;
+            pthread_mutex_unlock(&mtx);
+            return;
         }
+        array[indx_next].idnbr = pktnbr;
 
         if (array[indx_next].packet->flags & AV_PKT_FLAG_KEY) {
             array[indx_next].iskey = true;
@@ -121,19 +599,27 @@ void cls_pktarray::add(AVPacket *pkt)
             }
         }
         array[indx_next].iswritten = false;
-        array[indx_next].file_cnt = chitm->file_cnt;
-        if (pkt->stream_index == chitm->infile->ifile.video.index) {
-            array[indx_next].timebase = chitm->infile->ifile.video.strm->time_base;
-            array[indx_next].start_pts= chitm->infile->ifile.video.start_pts;
-        } else {
-            array[indx_next].timebase = chitm->infile->ifile.audio.strm->time_base;
-            array[indx_next].start_pts= chitm->infile->ifile.audio.start_pts;
+
+        timeline(array[indx_next].packet);
+
+        if ((pkt->stream_index == chitm->infile->ifile.video.index) &&
+            (pkt->pts != AV_NOPTS_VALUE)) {
+            video_tm = myrescale(tm_rs, array[indx_next].packet->pts);
+            key_prune();
+            if (array[indx_next].iskey == true) {
+                keyindex.push_back({indx_next, pktnbr, video_tm});
+            }
         }
 
         arrayindex = indx_next;
 
     pthread_mutex_unlock(&mtx);
 
+    /* Only the producer writes this slot so it is still valid here */
+    if (timeshift != nullptr) {
+        timeshift->add(array[indx_next].packet);
+    }
+
 /*
     LOG_MSG(ERR, NO_ERRNO," %d %d/%d %d/%d %d/%d %d/%d "
         ,ifile.video.codec_ctx->framerate
@@ -154,11 +640,30 @@ cls_pktarray::cls_pktarray(cls_channel *p_chitm)
 {
     pthread_mutex_init(&mtx, NULL);
     chitm = p_chitm;
+    ch_nbr = chitm->ch_nbr;
     pktnbr = 0;
-    count = 600;        /* 600 is arbitrary */
+    count = 0;          /* Sized by resize() once the first file is open */
     arrayindex = -1;
     start = 0;
-    resize();
+    arena_fallback = 0;
+    timeshift = nullptr;
+    video_tm = 0;
+    tl_base = PKTARRAY_TL_START;
+    tl_end = PKTARRAY_TL_START;
+    tl_file_cnt = 0;
+    tl_dts[0] = 0;
+    tl_dts[1] = 0;
+    myrescale_init(tl_rs[0], AVRational{0, 1}, AVRational{1, PKTARRAY_TIMEBASE});
+    myrescale_init(tl_rs[1], AVRational{0, 1}, AVRational{1, PKTARRAY_TIMEBASE});
+    myrescale_init(tm_rs, AVRational{1, PKTARRAY_TIMEBASE}, AVRational{1, AV_TIME_BASE});
+    arena = nullptr;
+    arena_size = 0;
+    arena_head = 0;
+    regions = nullptr;
+    reg_count = 0;
+    reg_head = 0;
+    reg_tail = 0;
+    reg_used = 0;
 }
 
 cls_pktarray::~cls_pktarray()
@@ -177,5 +682,6 @@ cls_pktarray::~cls_pktarray()
     array.clear();
     count = 0;
 
-}
+    arena_deinit();
 
+}
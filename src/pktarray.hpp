@@ -18,6 +18,18 @@
 
 #ifndef _INCLUDE_PKTARRAY_HPP_
 #define _INCLUDE_PKTARRAY_HPP_
+    #define PKTARRAY_BYTES_DFLT   (32 * 1024 * 1024)  /* Arena size when no ring size is specified */
+    #define PKTARRAY_BITRATE_DFLT 8000000             /* Bitrate assumed for ringsecs when the file has none */
+    #define PKTARRAY_SLOT_BYTES   4096                /* Average payload assumed when deriving the slot count */
+    #define PKTARRAY_SLOTS_MIN    600
+    #define PKTARRAY_SLOTS_MAX    16384
+    #define PKTARRAY_PREFILL      600                 /* Packets read ahead when the first client connects */
+    #define PKTARRAY_ALIGN        64
+    #define PKTARRAY_HUGEPAGE     (2 * 1024 * 1024)
+    #define PKTARRAY_AUDIO_BACK   64                  /* Audio packets to look back for when joining */
+    #define PKTARRAY_TIMEBASE     90000               /* Ticks per second of the channel timeline */
+    #define PKTARRAY_TL_START     90000               /* Timeline position of the first packet */
+
     class cls_pktarray{
         public:
             cls_pktarray(cls_channel *p_chitm);
@@ -26,16 +38,50 @@
             int     count;
             int     start;
             int64_t pktnbr;
+            int64_t arena_fallback;     /* Packets that could not be placed in the arena */
             pthread_mutex_t    mtx;
+            cls_timeshift   *timeshift;     /* Also given each packet when set */
             void    resize();
+            void    reset();
             void    add(AVPacket *pkt);
             int     index_curr();
             int     index_next(int index);
             int     index_prev(int index);
+            int     index_valid(int index);
+            int     index_join(int nth, int burst, int64_t &idnbr);
+            int     index_live(int64_t &idnbr);
+            void    stats_get(ctx_channel_stats &stats);
         private:
             std::string     ch_nbr;
             cls_channel     *chitm;
             int             arrayindex;
+            std::deque<ctx_keyframe_item>   keyindex;
+            int64_t         video_tm;       /* Time of the newest video packet */
+            int64_t         tl_base;        /* Timeline position where the current file starts */
+            int64_t         tl_end;         /* End of the latest packet on the timeline */
+            int64_t         tl_file_cnt;
+            int64_t         tl_dts[2];      /* Last video and audio dts on the timeline */
+            ctx_rescale     tl_rs[2];       /* Video and audio of the file to the timeline */
+            ctx_rescale     tm_rs;          /* Timeline to microseconds */
+
+            uint8_t             *arena;
+            size_t              arena_size;
+            size_t              arena_head;
+            ctx_arena_region    *regions;
+            int                 reg_count;
+            int                 reg_head;
+            int                 reg_tail;
+            int                 reg_used;
+
+            void    arena_init();
+            void    arena_deinit();
+            void    arena_reclaim();
+            bool    arena_fit(size_t need, size_t &offset);
+            bool    arena_evict();
+            AVBufferRef *arena_get(int indx, int size);
+            int     slot_copy(int indx, AVPacket *src);
+            void    key_prune();
+            void    timeline(AVPacket *pkt);
     };
 
 #endif
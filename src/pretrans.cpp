@@ -0,0 +1,509 @@
+/*
+ *    This file is part of Restream.
+ *
+ *    Restream is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    Restream is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with Restream.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "restream.hpp"
+#include "conf.hpp"
+#include "util.hpp"
+#include "logger.hpp"
+#include "channel.hpp"
+#include "infile.hpp"
+#include "pktarray.hpp"
+#include "ratectl.hpp"
+#include "rendition.hpp"
+#include "cache.hpp"
+#include "workpool.hpp"
+#include "pretrans.hpp"
+#include "pacer.hpp"
+#include "reactor.hpp"
+#include "inread.hpp"
+#include "uring.hpp"
+#include "timeshift.hpp"
+#include "recorder.hpp"
+#include "tsmux.hpp"
+#include "localout.hpp"
+#include "webu.hpp"
+#include "webu_ans.hpp"
+#include "webu_mpegts.hpp"
+#include "webu_mpts.hpp"
+
+/* Split the video at the source keyframes into chunks of at least
+ * PRETRANS_CHUNK_SECS.  The first chunk also takes anything before
+ * the first keyframe
+*/
+void cls_pretrans::chunks_build(std::vector<int64_t> &keys)
+{
+    int64_t min_len, chnk_start;
+    ctx_pretrans_chunk *chnk;
+    size_t indx;
+
+    if (vindex == -1) {
+        return;
+    }
+
+    min_len = av_rescale_q(PRETRANS_CHUNK_SECS, AVRational{1, 1}, vtime_base);
+
+    chnk = new ctx_pretrans_chunk;
+    chnk->start = AV_NOPTS_VALUE;
+    chnk->done = false;
+    chnk->ok = false;
+    chnk_start = (keys.size() > 0) ? keys[0] : 0;
+
+    for (indx=0; indx < keys.size(); indx++) {
+        if ((keys[indx] - chnk_start) < min_len) {
+            continue;
+        }
+        chnk->end = keys[indx];
+        chunks.push_back(chnk);
+
+        chnk = new ctx_pretrans_chunk;
+        chnk->start = keys[indx];
+        chnk->done = false;
+        chnk->ok = false;
+        chnk_start = keys[indx];
+    }
+    chnk->end = AV_NOPTS_VALUE;
+    chunks.push_back(chnk);
+}
+
+void cls_pretrans::chunks_free()
+{
+    size_t indx, pidx;
+
+    for (indx=0; indx < chunks.size(); indx++) {
+        for (pidx=0; pidx < chunks[indx]->pkts.size(); pidx++) {
+            mypacket_free(chunks[indx]->pkts[pidx]);
+        }
+        delete chunks[indx];
+    }
+    chunks.clear();
+
+    for (indx=0; indx < audio.size(); indx++) {
+        mypacket_free(audio[indx]);
+    }
+    audio.clear();
+}
+
+/* Each chunk decodes on its own single thread since the chunks
+ * themselves run in parallel
+*/
+AVCodecContext *cls_pretrans::decoder_open(AVFormatContext *fmt_ctx)
+{
+    AVStream *stream;
+    const AVCodec *dec;
+    AVCodecContext *dec_ctx;
+
+    stream = fmt_ctx->streams[vindex];
+    dec = avcodec_find_decoder(stream->codecpar->codec_id);
+    if (dec == nullptr) {
+        return nullptr;
+    }
+
+    dec_ctx = avcodec_alloc_context3(dec);
+    if (dec_ctx == nullptr) {
+        return nullptr;
+    }
+
+    if (avcodec_parameters_to_context(dec_ctx, stream->codecpar) < 0) {
+        avcodec_free_context(&dec_ctx);
+        return nullptr;
+    }
+    dec_ctx->framerate = av_guess_frame_rate(fmt_ctx, stream, NULL);
+    dec_ctx->pkt_timebase = stream->time_base;
+    dec_ctx->thread_count = 1;
+
+    if (avcodec_open2(dec_ctx, dec, NULL) < 0) {
+        avcodec_free_context(&dec_ctx);
+        return nullptr;
+    }
+
+    return dec_ctx;
+}
+
+/* Same settings as the live h264 encoder so the cached output can not
+ * be told apart from what the channel would have produced
+*/
+AVCodecContext *cls_pretrans::encoder_open(int wd, int ht
+    , AVRational framerate, AVPixelFormat pix_fmt)
+{
+    const AVCodec *encoder;
+    AVCodecContext *enc_ctx;
+    AVDictionary *opts = NULL;
+    char errstr[128];
+    int retcd;
+
+    encoder = avcodec_find_encoder(AV_CODEC_ID_H264);
+    if (encoder == nullptr) {
+        return nullptr;
+    }
+
+    enc_ctx = avcodec_alloc_context3(encoder);
+    if (enc_ctx == nullptr) {
+        return nullptr;
+    }
+
+    enc_ctx->codec_type = AVMEDIA_TYPE_VIDEO;
+    enc_ctx->width = wd;
+    enc_ctx->height = ht;
+    enc_ctx->time_base.num = 1;
+    enc_ctx->time_base.den = 90000;
+    enc_ctx->max_b_frames = 4;
+    enc_ctx->framerate = framerate;
+    enc_ctx->bit_rate = 400000;
+    enc_ctx->gop_size = chitm->ch_gop;
+    enc_ctx->thread_count = 1;
+    if (pix_fmt == -1) {
+        enc_ctx->pix_fmt = AV_PIX_FMT_YUV420P;
+    } else {
+        enc_ctx->pix_fmt = pix_fmt;
+    }
+
+    av_dict_set( &opts, "profile", "baseline", 0 );
+    av_dict_set( &opts, "crf", std::to_string(chitm->ratectl->crf()).c_str(), 0 );
+    av_dict_set( &opts, "tune", "zerolatency", 0 );
+    av_dict_set( &opts, "preset", chitm->ratectl->preset().c_str(), 0 );
+    av_dict_set( &opts, "keyint", std::to_string(chitm->ch_gop).c_str(), 0 );
+    av_dict_set( &opts, "scenecut", "0", 0 );
+    av_dict_set( &opts, "forced-idr", "1", 0 );
+    if (chitm->ch_intrarefresh == true) {
+        av_dict_set( &opts, "intra-refresh", "1", 0 );
+    }
+
+    retcd = avcodec_open2(enc_ctx, encoder, &opts);
+    av_dict_free(&opts);
+    if (retcd < 0) {
+        av_strerror(retcd, errstr, sizeof(errstr));
+        LOG_MSG(NTC, NO_ERRNO
+            , "Ch%s: Could not open video encoder: %s %dx%d"
+            , ch_nbr.c_str(), errstr, wd, ht);
+        avcodec_free_context(&enc_ctx);
+        return nullptr;
+    }
+
+    return enc_ctx;
+}
+
+void cls_pretrans::encoder_receive(AVCodecContext *enc_ctx
+    , ctx_pretrans_chunk *chnk)
+{
+    AVPacket *pkt;
+
+    pkt = mypacket_alloc(nullptr);
+    while (avcodec_receive_packet(enc_ctx, pkt) == 0) {
+        pkt->stream_index = chitm->infile->ofile.video.index;
+        if (pkt->pts > 0) {
+            chnk->pkts.push_back(pkt);
+            pkt = mypacket_alloc(nullptr);
+        } else {
+            av_packet_unref(pkt);
+        }
+    }
+    mypacket_free(pkt);
+}
+
+/* Send a frame through the filter graph, when there is one, and on to
+ * the encoder.  A null frame drains everything
+*/
+int cls_pretrans::frame_encode(AVFrame *frm, AVCodecContext *enc_ctx
+    , AVFilterContext *flt_src, AVFilterContext *flt_sink
+    , ctx_pretrans_chunk *chnk)
+{
+    int retcd;
+    AVFrame *frm_flt;
+
+    if (flt_src == nullptr) {
+        if (frm != nullptr) {
+            frm->pict_type = AV_PICTURE_TYPE_NONE;
+        }
+        retcd = avcodec_send_frame(enc_ctx, frm);
+        encoder_receive(enc_ctx, chnk);
+        return retcd;
+    }
+
+    if (frm == nullptr) {
+        retcd = av_buffersrc_add_frame_flags(flt_src, NULL, 0);
+    } else {
+        retcd = av_buffersrc_add_frame_flags(flt_src, frm, AV_BUFFERSRC_FLAG_KEEP_REF);
+    }
+    if (retcd < 0) {
+        return retcd;
+    }
+
+    frm_flt = myframe_alloc();
+    while (true) {
+        retcd = av_buffersink_get_frame(flt_sink, frm_flt);
+        if (retcd < 0) {
+            break;
+        }
+        if (frm_flt->pts != AV_NOPTS_VALUE) {
+            frm_flt->pts = av_rescale_q(frm_flt->pts
+                , av_buffersink_get_time_base(flt_sink), vtime_base);
+        }
+        frm_flt->pict_type = AV_PICTURE_TYPE_NONE;
+        retcd = avcodec_send_frame(enc_ctx, frm_flt);
+        av_frame_unref(frm_flt);
+        encoder_receive(enc_ctx, chnk);
+        if (retcd < 0) {
+            break;
+        }
+    }
+    myframe_free(frm_flt);
+
+    if (frm == nullptr) {
+        avcodec_send_frame(enc_ctx, NULL);
+        encoder_receive(enc_ctx, chnk);
+    }
+
+    if ((retcd == AVERROR(EAGAIN)) || (retcd == AVERROR_EOF)) {
+        return 0;
+    }
+    return retcd;
+}
+
+/* Runs on the pool.  Decode from the keyframe at the chunk start and
+ * encode every frame up to the keyframe of the next chunk.  The frame
+ * pts are kept so the chunks join without any rebasing
+*/
+void cls_pretrans::chunk_encode(ctx_pretrans_chunk *chnk)
+{
+    AVFormatContext *fmt_ctx;
+    AVCodecContext *dec_ctx, *enc_ctx;
+    AVFilterGraph *flt_graph;
+    AVFilterContext *flt_src, *flt_sink;
+    AVPacket *pkt;
+    AVFrame *frm;
+    AVRational framerate;
+    std::string desc;
+    int wd, ht, retcd;
+    int64_t last_pts;
+    bool fin;
+
+    fmt_ctx = nullptr;
+    dec_ctx = nullptr;
+    enc_ctx = nullptr;
+    flt_graph = nullptr;
+    flt_src = nullptr;
+    flt_sink = nullptr;
+    pkt = mypacket_alloc(nullptr);
+    frm = myframe_alloc();
+    chnk->ok = false;
+
+    retcd = avformat_open_input(&fmt_ctx, fnm.c_str(), NULL, NULL);
+    if (retcd == 0) {
+        retcd = avformat_find_stream_info(fmt_ctx, NULL);
+    }
+    if (retcd >= 0) {
+        dec_ctx = decoder_open(fmt_ctx);
+    }
+    if (dec_ctx != nullptr) {
+        desc = infile_filter_desc(chitm, dec_ctx, false, wd, ht, framerate);
+        retcd = 0;
+        if (desc != "") {
+            retcd = myfilter_init(&flt_graph, &flt_src, &flt_sink
+                , dec_ctx, vtime_base, desc);
+        }
+        if (retcd == 0) {
+            enc_ctx = encoder_open(wd, ht, framerate, dec_ctx->pix_fmt);
+        }
+    }
+    if ((enc_ctx != nullptr) && (chnk->start != AV_NOPTS_VALUE)) {
+        if (av_seek_frame(fmt_ctx, vindex, chnk->start, AVSEEK_FLAG_BACKWARD) < 0) {
+            avcodec_free_context(&enc_ctx);
+        }
+    }
+
+    if (enc_ctx == nullptr) {
+        LOG_MSG(NTC, NO_ERRNO
+            , "Ch%s: Could not set up the chunk at %ld of %s"
+            , ch_nbr.c_str(), (long)chnk->start, fnm.c_str());
+    } else {
+        last_pts = AV_NOPTS_VALUE;
+        fin = false;
+        while ((fin == false) && (app->finish == false)) {
+            av_packet_unref(pkt);
+            if (av_read_frame(fmt_ctx, pkt) < 0) {
+                avcodec_send_packet(dec_ctx, NULL);
+                fin = true;
+            } else if (pkt->stream_index != vindex) {
+                continue;
+            } else if (avcodec_send_packet(dec_ctx, pkt) < 0) {
+                continue;
+            }
+            while (avcodec_receive_frame(dec_ctx, frm) == 0) {
+                if ((frm->pts == AV_NOPTS_VALUE) ||
+                    ((chnk->start != AV_NOPTS_VALUE) && (frm->pts < chnk->start)) ||
+                    ((last_pts != AV_NOPTS_VALUE) && (frm->pts <= last_pts))) {
+                    av_frame_unref(frm);
+                    continue;
+                }
+                if ((chnk->end != AV_NOPTS_VALUE) && (frm->pts >= chnk->end)) {
+                    av_frame_unref(frm);
+                    fin = true;
+                    break;
+                }
+                last_pts = frm->pts;
+                frame_encode(frm, enc_ctx, flt_src, flt_sink, chnk);
+                av_frame_unref(frm);
+            }
+        }
+        if (app->finish == false) {
+            frame_encode(nullptr, enc_ctx, flt_src, flt_sink, chnk);
+            chnk->ok = true;
+        }
+    }
+
+    if (flt_graph != nullptr) {
+        avfilter_graph_free(&flt_graph);
+    }
+    if (enc_ctx != nullptr) {
+        avcodec_free_context(&enc_ctx);
+    }
+    if (dec_ctx != nullptr) {
+        avcodec_free_context(&dec_ctx);
+    }
+    if (fmt_ctx != nullptr) {
+        avformat_close_input(&fmt_ctx);
+    }
+    myframe_free(frm);
+    mypacket_free(pkt);
+
+    chnk->done = true;
+}
+
+/* Hand the chunks to the pool a window at a time and write them to the
+ * cache in order with the audio merged in by dts
+*/
+int cls_pretrans::stitch()
+{
+    int indx, next, window;
+    size_t aidx, pidx;
+    int64_t ts;
+    AVPacket *pkt;
+    ctx_pretrans_chunk *chnk;
+
+    window = pool->threads * 2;
+    next = 0;
+    aidx = 0;
+    for (indx=0; indx < (int)chunks.size(); indx++) {
+        while ((next < (int)chunks.size()) && (next < (indx + window))) {
+            chnk = chunks[next];
+            pool->submit([this, chnk]() { chunk_encode(chnk); });
+            next++;
+        }
+
+        chnk = chunks[indx];
+        while (chnk->done == false) {
+            SLEEP(0, 10000000L);
+        }
+        if (chnk->ok == false) {
+            pool->wait();
+            return -1;
+        }
+
+        for (pidx=0; pidx < chnk->pkts.size(); pidx++) {
+            pkt = chnk->pkts[pidx];
+            ts = (pkt->dts != AV_NOPTS_VALUE) ? pkt->dts : pkt->pts;
+            while ((aidx < audio.size()) &&
+                (av_compare_ts(audio[aidx]->dts, atime_base
+                    , ts, vtime_base) <= 0)) {
+                chitm->cache->record_add(audio[aidx]);
+                aidx++;
+            }
+            chitm->cache->record_add(pkt);
+            mypacket_free(pkt);
+        }
+        chnk->pkts.clear();
+
+        LOG_MSG(INF, NO_ERRNO
+            , "Ch%s: Chunk %d of %d done"
+            , ch_nbr.c_str(), indx + 1, (int)chunks.size());
+    }
+
+    while (aidx < audio.size()) {
+        chitm->cache->record_add(audio[aidx]);
+        aidx++;
+    }
+
+    return 0;
+}
+
+/* Encode one file into the cache.  The audio is encoded in one pass by
+ * the channel's own infile and the video in parallel chunks
+*/
+int cls_pretrans::file(std::string p_fnm)
+{
+    std::vector<int64_t> keys;
+    int retcd;
+
+    fnm = p_fnm;
+
+    chitm->infile->start(fnm);
+    retcd = chitm->infile->read_capture(audio, keys);
+    if (retcd == 1) {
+        LOG_MSG(NTC, NO_ERRNO
+            , "Ch%s: Already in the cache: %s"
+            , ch_nbr.c_str(), fnm.c_str());
+        chunks_free();
+        chitm->infile->stop();
+        return 0;
+    } else if (retcd != 0) {
+        chunks_free();
+        chitm->infile->stop();
+        return -1;
+    }
+
+    vindex = chitm->infile->ifile.video.index;
+    if (vindex != -1) {
+        vtime_base = chitm->infile->ifile.video.strm->time_base;
+    }
+    if (chitm->infile->ifile.audio.index != -1) {
+        atime_base = chitm->infile->ifile.audio.strm->time_base;
+    }
+
+    chunks_build(keys);
+    LOG_MSG(NTC, NO_ERRNO
+        , "Ch%s: Encoding %d chunks of %s"
+        , ch_nbr.c_str(), (int)chunks.size(), fnm.c_str());
+
+    retcd = stitch();
+    if (retcd == 0) {
+        chitm->cache->record_close();
+    } else {
+        chitm->cache->record_abort();
+    }
+
+    chunks_free();
+    chitm->infile->stop();
+
+    return retcd;
+}
+
+cls_pretrans::cls_pretrans(cls_channel *p_chitm, cls_workpool *p_pool)
+{
+    chitm = p_chitm;
+    pool = p_pool;
+    ch_nbr = p_chitm->ch_nbr;
+    fnm = "";
+    vindex = -1;
+    vtime_base = AVRational{1, 1};
+    atime_base = AVRational{1, 1};
+}
+
+cls_pretrans::~cls_pretrans()
+{
+    chunks_free();
+}
@@ -0,0 +1,69 @@
+/*
+ *    This file is part of Restream.
+ *
+ *    Restream is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    Restream is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with Restream.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef _INCLUDE_PRETRANS_HPP_
+#define _INCLUDE_PRETRANS_HPP_
+    #define PRETRANS_CHUNK_SECS     10      /* Shortest run of GOPs encoded as one task */
+
+    /* The video between two keyframes of the source.  end is
+     * AV_NOPTS_VALUE for the last chunk of the file
+    */
+    struct ctx_pretrans_chunk {
+        int64_t                 start;
+        int64_t                 end;
+        std::vector<AVPacket*>  pkts;
+        std::atomic<bool>       done;
+        bool                    ok;
+    };
+
+    /* Encode each file of a channel ahead of time into the cache.  The
+     * video is split at keyframes and the chunks are encoded in parallel
+    */
+    class cls_pretrans {
+        public:
+            cls_pretrans(cls_channel *p_chitm, cls_workpool *p_pool);
+            ~cls_pretrans();
+
+            int     file(std::string fnm);
+
+        private:
+            cls_channel     *chitm;
+            cls_workpool    *pool;
+            std::string     ch_nbr;
+            std::string     fnm;
+            int             vindex;
+            AVRational      vtime_base;
+            AVRational      atime_base;
+            std::vector<ctx_pretrans_chunk*>    chunks;
+            std::vector<AVPacket*>              audio;
+
+            void    chunks_build(std::vector<int64_t> &keys);
+            void    chunks_free();
+            AVCodecContext *decoder_open(AVFormatContext *fmt_ctx);
+            AVCodecContext *encoder_open(int wd, int ht
+                , AVRational framerate, AVPixelFormat pix_fmt);
+            void    encoder_receive(AVCodecContext *enc_ctx
+                , ctx_pretrans_chunk *chnk);
+            int     frame_encode(AVFrame *frm, AVCodecContext *enc_ctx
+                , AVFilterContext *flt_src, AVFilterContext *flt_sink
+                , ctx_pretrans_chunk *chnk);
+            void    chunk_encode(ctx_pretrans_chunk *chnk);
+            int     stitch();
+    };
+
+#endif
@@ -0,0 +1,347 @@
+/*
+ *    This file is part of Restream.
+ *
+ *    Restream is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    Restream is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with Restream.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "restream.hpp"
+#include "conf.hpp"
+#include "util.hpp"
+#include "logger.hpp"
+#include "channel.hpp"
+#include "infile.hpp"
+#include "pktarray.hpp"
+#include "ratectl.hpp"
+#include "rendition.hpp"
+#include "cache.hpp"
+#include "workpool.hpp"
+#include "pretrans.hpp"
+#include "pacer.hpp"
+#include "reactor.hpp"
+#include "inread.hpp"
+#include "uring.hpp"
+#include "timeshift.hpp"
+#include "recorder.hpp"
+#include "tsmux.hpp"
+#include "localout.hpp"
+#include "webu.hpp"
+#include "webu_ans.hpp"
+#include "webu_mpegts.hpp"
+#include "webu_mpts.hpp"
+
+/* x264 presets from fastest to slowest */
+static const char *ratectl_presets[] = {
+    "ultrafast", "superfast", "veryfast", "faster", "fast", "medium", "slow"
+};
+#define RATECTL_PRESET_CNT (int)(sizeof(ratectl_presets) / sizeof(ratectl_presets[0]))
+#define RATECTL_PRESET_DFLT 1   /* superfast */
+
+int cls_ratectl::preset_index(std::string nm)
+{
+    int indx;
+
+    for (indx=0; indx < RATECTL_PRESET_CNT; indx++) {
+        if (nm == ratectl_presets[indx]) {
+            return indx;
+        }
+    }
+    return -1;
+}
+
+/* Order the allowed preset/crf pairs from best quality to least work.
+ * Presets get faster at the lowest crf first and the crf is only raised
+ * once the fastest allowed preset is reached
+*/
+void cls_ratectl::ladder_build()
+{
+    int p_fast, p_slow, indx, crf_val;
+    ctx_ratectl_level lvl;
+
+    p_fast = preset_index(chitm->ch_preset_fast);
+    if (p_fast == -1) {
+        LOG_MSG(NTC, NO_ERRNO
+            , "Ch%s: Invalid preset_fast %s"
+            , ch_nbr.c_str(), chitm->ch_preset_fast.c_str());
+        p_fast = 0;
+    }
+    p_slow = preset_index(chitm->ch_preset_slow);
+    if (p_slow == -1) {
+        LOG_MSG(NTC, NO_ERRNO
+            , "Ch%s: Invalid preset_slow %s"
+            , ch_nbr.c_str(), chitm->ch_preset_slow.c_str());
+        p_slow = RATECTL_PRESET_DFLT;
+    }
+    if (p_slow < p_fast) {
+        p_slow = p_fast;
+    }
+
+    ladder.clear();
+    for (indx=p_slow; indx >= p_fast; indx--) {
+        lvl.preset = indx;
+        lvl.crf = chitm->ch_crf_min;
+        ladder.push_back(lvl);
+    }
+    crf_val = chitm->ch_crf_min + RATECTL_CRF_STEP;
+    while (crf_val <= chitm->ch_crf_max) {
+        lvl.preset = p_fast;
+        lvl.crf = crf_val;
+        ladder.push_back(lvl);
+        crf_val += RATECTL_CRF_STEP;
+    }
+
+    /* Begin at the previous fixed setting when the bounds allow it */
+    level = 0;
+    for (indx=0; indx < (int)ladder.size(); indx++) {
+        if (ladder[indx].preset <= RATECTL_PRESET_DFLT) {
+            level = indx;
+            break;
+        }
+    }
+    level_base = level;
+}
+
+/* Called when a file is opened.  Only the h264 encoder is controlled */
+void cls_ratectl::init(bool p_active)
+{
+    active = (p_active && chitm->ch_ratectl);
+    calm_cnt = 0;
+    frame_cnt = 0;
+    win_busy = 0;
+    win_first = -1;
+    win_last = -1;
+    win_margin = INT64_MAX;
+}
+
+void cls_ratectl::busy_add(int64_t busy_us)
+{
+    win_busy += busy_us;
+}
+
+/* Record the pacing margin of a video packet.  Returns true when the
+ * shed stage changed and must be applied by the caller
+*/
+bool cls_ratectl::margin_add(int64_t margin_us)
+{
+    int64_t now;
+
+    if (margin_us < win_margin) {
+        win_margin = margin_us;
+    }
+
+    now = av_gettime_relative();
+    if ((now - margin_pub) >= 1000000) {
+        margin_pub = now;
+        pthread_mutex_lock(&chitm->mtx_stats);
+            chitm->stats.pace_margin = margin_us;
+        pthread_mutex_unlock(&chitm->mtx_stats);
+    }
+
+    if (chitm->ch_shed == false) {
+        return false;
+    }
+    return shed_check(margin_us);
+}
+
+/* Shed one more stage after being behind for a while and restore one
+ * stage after keeping up for a longer while
+*/
+bool cls_ratectl::shed_check(int64_t margin_us)
+{
+    int64_t now;
+    int stage;
+
+    now = av_gettime_relative();
+    stage = (int)shed;
+
+    if (margin_us < RATECTL_SHED_LATE) {
+        ok_since = -1;
+        if (late_since == -1) {
+            late_since = now;
+        }
+        if (((now - late_since) >= RATECTL_SHED_HOLD) &&
+            (shed != RATECTL_SHED_DOWNSCALE)) {
+            stage++;
+            late_since = now;
+        }
+    } else if (margin_us > 0) {
+        late_since = -1;
+        if (ok_since == -1) {
+            ok_since = now;
+        }
+        if (((now - ok_since) >= RATECTL_SHED_RESTORE) &&
+            (shed != RATECTL_SHED_NONE)) {
+            stage--;
+            ok_since = now;
+        }
+    } else {
+        late_since = -1;
+        ok_since = -1;
+    }
+
+    if (stage == (int)shed) {
+        return false;
+    }
+
+    LOG_MSG(NTC, NO_ERRNO
+        , "Ch%s: %s work, shed stage %d margin %ld ms"
+        , ch_nbr.c_str(), (stage > (int)shed) ? "Shedding" : "Restoring"
+        , stage, (long)(margin_us / 1000));
+
+    pthread_mutex_lock(&chitm->mtx_stats);
+        if (stage > (int)shed) {
+            chitm->stats.shed_up++;
+        } else {
+            chitm->stats.shed_down++;
+        }
+        chitm->stats.shed_stage = stage;
+        chitm->stats.pace_margin = margin_us;
+    pthread_mutex_unlock(&chitm->mtx_stats);
+
+    shed = (enum RATECTL_SHED)stage;
+
+    return true;
+}
+
+/* Count a video frame sent to the encoder.  frame_us is its time from the
+ * start of the file.  At the end of each GOP a decision is made
+*/
+enum RATECTL_ACT cls_ratectl::frame_add(int64_t frame_us)
+{
+    enum RATECTL_ACT act;
+
+    if (win_first == -1) {
+        win_first = frame_us;
+    }
+    win_last = frame_us;
+    frame_cnt++;
+
+    if ((frame_cnt % chitm->ch_gop) != 0) {
+        return RATECTL_ACT_NONE;
+    }
+
+    act = decide();
+
+    win_busy = 0;
+    win_first = -1;
+    win_last = -1;
+    win_margin = INT64_MAX;
+
+    return act;
+}
+
+enum RATECTL_ACT cls_ratectl::decide()
+{
+    int64_t load, media;
+    int level_new;
+    enum RATECTL_ACT act;
+
+    media = win_last - win_first;
+    if (media <= 0) {
+        return RATECTL_ACT_NONE;
+    }
+    load = (win_busy * 1000) / media;
+
+    level_new = level;
+    if (active == true) {
+        if ((load > RATECTL_LOAD_HIGH) || (win_margin < RATECTL_LATE)) {
+            calm_cnt = 0;
+            if (level < ((int)ladder.size() - 1)) {
+                level_new = level + 1;
+            }
+        } else if (load < RATECTL_LOAD_LOW) {
+            calm_cnt++;
+            if ((calm_cnt >= RATECTL_CALM) && (level > 0)) {
+                level_new = level - 1;
+                calm_cnt = 0;
+            }
+        } else {
+            calm_cnt = 0;
+        }
+    }
+
+    act = RATECTL_ACT_NONE;
+    if (level_new != level) {
+        if (ladder[level_new].preset != ladder[level].preset) {
+            act = RATECTL_ACT_PRESET;
+        } else {
+            act = RATECTL_ACT_CRF;
+        }
+        LOG_MSG(INF, NO_ERRNO
+            , "Ch%s: Load %d.%d%% moving to preset %s crf %d"
+            , ch_nbr.c_str(), (int)(load / 10), (int)(load % 10)
+            , ratectl_presets[ladder[level_new].preset]
+            , ladder[level_new].crf);
+    }
+
+    pthread_mutex_lock(&chitm->mtx_stats);
+        chitm->stats.ctl_load = load;
+        if (win_margin != INT64_MAX) {
+            chitm->stats.ctl_margin = win_margin;
+        }
+        if (level_new > level) {
+            chitm->stats.ctl_faster++;
+        } else if (level_new < level) {
+            chitm->stats.ctl_slower++;
+        }
+        chitm->stats.ctl_level = level_new;
+        chitm->stats.ctl_preset = ladder[level_new].preset;
+        chitm->stats.ctl_crf = ladder[level_new].crf;
+    pthread_mutex_unlock(&chitm->mtx_stats);
+
+    level = level_new;
+
+    return act;
+}
+
+std::string cls_ratectl::preset()
+{
+    return ratectl_presets[ladder[level].preset];
+}
+
+int cls_ratectl::crf()
+{
+    return ladder[level].crf;
+}
+
+/* Whether the encoder runs at the starting level without shedding */
+bool cls_ratectl::baseline()
+{
+    return ((shed == RATECTL_SHED_NONE) && (level == level_base));
+}
+
+cls_ratectl::cls_ratectl(cls_channel *p_chitm)
+{
+    chitm = p_chitm;
+    ch_nbr = chitm->ch_nbr;
+    level = 0;
+    level_base = 0;
+    shed = RATECTL_SHED_NONE;
+    late_since = -1;
+    ok_since = -1;
+    margin_pub = 0;
+    ladder_build();
+    init(false);
+
+    pthread_mutex_lock(&chitm->mtx_stats);
+        chitm->stats.ctl_level = level;
+        chitm->stats.ctl_preset = ladder[level].preset;
+        chitm->stats.ctl_crf = ladder[level].crf;
+    pthread_mutex_unlock(&chitm->mtx_stats);
+}
+
+cls_ratectl::~cls_ratectl()
+{
+    ladder.clear();
+}
@@ -0,0 +1,91 @@
+/*
+ *    This file is part of Restream.
+ *
+ *    Restream is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    Restream is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with Restream.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef _INCLUDE_RATECTL_HPP_
+#define _INCLUDE_RATECTL_HPP_
+    #define RATECTL_LOAD_HIGH   850     /* Permille of realtime spent working before going faster */
+    #define RATECTL_LOAD_LOW    550     /* Permille of realtime spent working before going slower */
+    #define RATECTL_LATE        -100000 /* Margin in microseconds that counts as falling behind */
+    #define RATECTL_CALM        2       /* Quiet windows required before raising quality */
+    #define RATECTL_CRF_STEP    2
+    #define RATECTL_SHED_LATE   -250000     /* Margin in microseconds that counts as overloaded */
+    #define RATECTL_SHED_HOLD   2000000     /* Time overloaded before shedding the next stage */
+    #define RATECTL_SHED_RESTORE 10000000   /* Time keeping up before restoring a stage */
+
+    enum RATECTL_ACT {
+        RATECTL_ACT_NONE,
+        RATECTL_ACT_CRF,        /* The crf can be changed on the running encoder */
+        RATECTL_ACT_PRESET      /* The encoder must be reopened */
+    };
+
+    /* Work shed when a channel cannot keep realtime, in the order applied */
+    enum RATECTL_SHED {
+        RATECTL_SHED_NONE,
+        RATECTL_SHED_NONREF,    /* Decoder skips non-reference frames */
+        RATECTL_SHED_HALFRATE,  /* Every other frame is dropped before encoding */
+        RATECTL_SHED_DOWNSCALE  /* Encode at half width and height */
+    };
+
+    struct ctx_ratectl_level {
+        int     preset;         /* Index into the preset list */
+        int     crf;
+    };
+
+    class cls_ratectl {
+        public:
+            cls_ratectl(cls_channel *p_chitm);
+            ~cls_ratectl();
+
+            void    init(bool p_active);
+            void    busy_add(int64_t busy_us);
+            bool    margin_add(int64_t margin_us);
+            enum RATECTL_ACT frame_add(int64_t frame_us);
+
+            std::string preset();
+            int         crf();
+            bool        baseline();
+
+            enum RATECTL_SHED   shed;   /* Current overload stage */
+
+        private:
+            cls_channel     *chitm;
+            std::string     ch_nbr;
+            bool            active;
+
+            std::vector<ctx_ratectl_level>  ladder;
+            int             level;
+            int             level_base;     /* Level a file starts from */
+            int             calm_cnt;
+
+            int64_t         frame_cnt;
+            int64_t         win_busy;
+            int64_t         win_first;
+            int64_t         win_last;
+            int64_t         win_margin;
+
+            int64_t         late_since;
+            int64_t         ok_since;
+            int64_t         margin_pub;
+
+            bool    shed_check(int64_t margin_us);
+            int     preset_index(std::string nm);
+            void    ladder_build();
+            enum RATECTL_ACT decide();
+    };
+
+#endif
@@ -0,0 +1,178 @@
+/*
+ *    This file is part of Restream.
+ *
+ *    Restream is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    Restream is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with Restream.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "restream.hpp"
+#include "conf.hpp"
+#include "util.hpp"
+#include "logger.hpp"
+#include "channel.hpp"
+#include "infile.hpp"
+#include "pktarray.hpp"
+#include "ratectl.hpp"
+#include "rendition.hpp"
+#include "cache.hpp"
+#include "workpool.hpp"
+#include "pretrans.hpp"
+#include "pacer.hpp"
+#include "reactor.hpp"
+#include "inread.hpp"
+#include "uring.hpp"
+#include "timeshift.hpp"
+#include "recorder.hpp"
+#include "tsmux.hpp"
+#include "localout.hpp"
+#include "webu.hpp"
+#include "webu_ans.hpp"
+#include "webu_mpegts.hpp"
+#include "webu_mpts.hpp"
+
+int64_t cls_reactor::now_ns()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((int64_t)ts.tv_sec * 1000000000L) + ts.tv_nsec;
+}
+
+/* Put the channel in the slot for wake_ns.  Times already passed go in
+ * the next slot to be run.  Times more than one turn of the wheel away
+ * stay in their slot until they are due
+*/
+void cls_reactor::schedule(cls_channel *chitm, int64_t wake_ns)
+{
+    int64_t tick;
+    ctx_reactor_timer tmr;
+
+    tmr.chitm = chitm;
+    tmr.wake_ns = wake_ns;
+
+    mtx.lock();
+        tick = wake_ns / REACTOR_TICK;
+        if (tick <= tick_last) {
+            tick = tick_last + 1;
+        }
+        wheel[tick % REACTOR_SLOTS].push_back(tmr);
+    mtx.unlock();
+}
+
+void cls_reactor::channel_add(cls_channel *chitm)
+{
+    LOG_MSG(NTC, NO_ERRNO, "Starting ch%s on reactor %d"
+        , chitm->ch_nbr.c_str(), indx);
+    schedule(chitm, 0);
+}
+
+/* Runs on the pool.  A channel is only ever in the wheel or on one
+ * worker so its steps never run at the same time
+*/
+void cls_reactor::channel_run(cls_channel *chitm)
+{
+    int cnt;
+    int64_t wake_ns;
+
+    for (cnt=0; cnt < REACTOR_BATCH; cnt++) {
+        if (finish == true) {
+            return;
+        }
+        wake_ns = chitm->step();
+        if ((wake_ns < 0) || (finish == true)) {
+            return;
+        } else if (wake_ns > 0) {
+            schedule(chitm, wake_ns);
+            return;
+        }
+    }
+    if (finish == false) {
+        schedule(chitm, 0);
+    }
+}
+
+void cls_reactor::run()
+{
+    struct timespec ts;
+    int64_t now, tick, tick_now, wake;
+    size_t chk;
+    std::vector<ctx_reactor_timer> *slot;
+    std::vector<cls_channel*> ready;
+    cls_channel *chitm;
+
+    mythreadname_set("re", indx, NULL);
+
+    while (finish == false) {
+        wake = (tick_last + 1) * REACTOR_TICK;
+        ts.tv_sec = wake / 1000000000L;
+        ts.tv_nsec = wake % 1000000000L;
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR);
+
+        now = now_ns();
+        tick_now = now / REACTOR_TICK;
+
+        ready.clear();
+        mtx.lock();
+            /* After a long stall every slot only needs one look */
+            if ((tick_now - tick_last) > REACTOR_SLOTS) {
+                tick_last = tick_now - REACTOR_SLOTS;
+            }
+            for (tick = tick_last + 1; tick <= tick_now; tick++) {
+                slot = &wheel[tick % REACTOR_SLOTS];
+                chk = 0;
+                while (chk < slot->size()) {
+                    if ((*slot)[chk].wake_ns <= now) {
+                        ready.push_back((*slot)[chk].chitm);
+                        (*slot)[chk] = slot->back();
+                        slot->pop_back();
+                    } else {
+                        chk++;
+                    }
+                }
+            }
+            tick_last = tick_now;
+        mtx.unlock();
+
+        for (chk=0; chk < ready.size(); chk++) {
+            chitm = ready[chk];
+            pool->submit([this, chitm]() { channel_run(chitm); });
+        }
+    }
+}
+
+cls_reactor::cls_reactor(int p_indx, cls_workpool *p_pool)
+{
+    indx = p_indx;
+    pool = p_pool;
+    finish = false;
+    wheel.resize(REACTOR_SLOTS);
+    tick_last = now_ns() / REACTOR_TICK;
+    thd = std::thread(&cls_reactor::run, this);
+}
+
+/* Stop handing out channels.  Steps already on the pool no longer put
+ * their channel back so the reactor can go once the pool is idle
+*/
+void cls_reactor::stop()
+{
+    finish = true;
+    if (thd.joinable() == true) {
+        thd.join();
+    }
+}
+
+cls_reactor::~cls_reactor()
+{
+    stop();
+}
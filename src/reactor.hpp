@@ -0,0 +1,58 @@
+/*
+ *    This file is part of Restream.
+ *
+ *    Restream is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    Restream is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with Restream.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef _INCLUDE_REACTOR_HPP_
+#define _INCLUDE_REACTOR_HPP_
+    #define REACTOR_TICK    1000000     /* Nanoseconds covered by each wheel slot */
+    #define REACTOR_SLOTS   1024
+    #define REACTOR_BATCH   64          /* Steps a channel runs before giving up its worker */
+
+    struct ctx_reactor_timer {
+        cls_channel     *chitm;
+        int64_t         wake_ns;
+    };
+
+    /* Drives channels as state machines instead of a thread each.  The
+     * reactor thread keeps a timer wheel of when each channel is next
+     * due and hands due channels to the shared pool to run their steps
+    */
+    class cls_reactor {
+        public:
+            cls_reactor(int p_indx, cls_workpool *p_pool);
+            ~cls_reactor();
+
+            void    channel_add(cls_channel *chitm);
+            void    schedule(cls_channel *chitm, int64_t wake_ns);
+            void    stop();
+
+        private:
+            int             indx;
+            cls_workpool    *pool;
+            std::thread     thd;
+            std::atomic<bool>   finish;
+
+            std::mutex      mtx;
+            std::vector<std::vector<ctx_reactor_timer>> wheel;
+            int64_t         tick_last;  /* Last slot that was run */
+
+            int64_t now_ns();
+            void    run();
+            void    channel_run(cls_channel *chitm);
+    };
+
+#endif
@@ -0,0 +1,616 @@
+/*
+ *    This file is part of Restream.
+ *
+ *    Restream is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    Restream is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with Restream.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "restream.hpp"
+#include "conf.hpp"
+#include "util.hpp"
+#include "logger.hpp"
+#include "channel.hpp"
+#include "infile.hpp"
+#include "pktarray.hpp"
+#include "ratectl.hpp"
+#include "rendition.hpp"
+#include "cache.hpp"
+#include "workpool.hpp"
+#include "pretrans.hpp"
+#include "pacer.hpp"
+#include "reactor.hpp"
+#include "inread.hpp"
+#include "uring.hpp"
+#include "timeshift.hpp"
+#include "recorder.hpp"
+#include "tsmux.hpp"
+#include "localout.hpp"
+#include "webu.hpp"
+#include "webu_ans.hpp"
+#include "webu_mpegts.hpp"
+#include "webu_mpts.hpp"
+
+static int recorder_avio_write(void *opaque, uint8_t *buf, int buf_size)
+{
+    return ((cls_recorder *)opaque)->avio_write(buf, buf_size);
+}
+
+/* Parse HH:MM-HH:MM[,HH:MM-HH:MM...].  A window may span midnight */
+void cls_recorder::schedule_parse(std::string parm)
+{
+    int h1, m1, h2, m2;
+    size_t pos_st, pos_en;
+    std::string item;
+
+    windows.clear();
+    pos_st = 0;
+    while (pos_st < parm.length()) {
+        pos_en = parm.find(",", pos_st);
+        if (pos_en == std::string::npos) {
+            pos_en = parm.length();
+        }
+        item = parm.substr(pos_st, pos_en - pos_st);
+        pos_st = pos_en + 1;
+
+        if ((sscanf(item.c_str(), "%d:%d-%d:%d", &h1, &m1, &h2, &m2) != 4) ||
+            (h1 < 0) || (h1 > 23) || (m1 < 0) || (m1 > 59) ||
+            (h2 < 0) || (h2 > 24) || (m2 < 0) || (m2 > 59)) {
+            LOG_MSG(NTC, NO_ERRNO
+                , "Ch%s: Invalid record window %s"
+                , ch_nbr.c_str(), item.c_str());
+            continue;
+        }
+        windows.push_back({(h1 * 60) + m1, (h2 * 60) + m2});
+    }
+}
+
+/* Whether now is inside one of the scheduled windows */
+bool cls_recorder::schedule_on()
+{
+    int indx, mins;
+    time_t timenow;
+    struct tm time_info;
+
+    if (windows.empty() == true) {
+        return false;
+    }
+
+    timenow = time(NULL);
+    localtime_r(&timenow, &time_info);
+    mins = (time_info.tm_hour * 60) + time_info.tm_min;
+
+    for (indx=0; indx < (int)windows.size(); indx++) {
+        if (windows[indx].start <= windows[indx].end) {
+            if ((mins >= windows[indx].start) && (mins < windows[indx].end)) {
+                return true;
+            }
+        } else if ((mins >= windows[indx].start) || (mins < windows[indx].end)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/* Write out the buffer.  Unless all is set only whole alignment blocks
+ * are written so the file offset stays valid for O_DIRECT
+*/
+int cls_recorder::file_flush(bool all)
+{
+    int64_t len, done;
+    ssize_t cnt;
+
+    if (all == true) {
+        len = wbuf_used;
+        if (rec_direct == true) {
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_DIRECT);
+        }
+    } else {
+        len = (wbuf_used / RECORDER_ALIGN) * RECORDER_ALIGN;
+    }
+
+    done = 0;
+    while (done < len) {
+        cnt = write(fd, wbuf + done, (size_t)(len - done));
+        if (cnt < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            LOG_MSG(ERR, SHOW_ERRNO
+                , "Ch%s: Error writing recording %s"
+                , ch_nbr.c_str(), fnm.c_str());
+            return -1;
+        }
+        done += cnt;
+    }
+
+    if (len < wbuf_used) {
+        memmove(wbuf, wbuf + len, (size_t)(wbuf_used - len));
+    }
+    wbuf_used -= len;
+
+    mtx.lock();
+        bytes += len;
+    mtx.unlock();
+
+    return 0;
+}
+
+/* Collect the output of the muxer into large writes */
+int cls_recorder::avio_write(uint8_t *buf, int buf_size)
+{
+    int64_t cnt, done;
+
+    done = 0;
+    while (done < buf_size) {
+        cnt = RECORDER_BUF - wbuf_used;
+        if (cnt > (buf_size - done)) {
+            cnt = buf_size - done;
+        }
+        memcpy(wbuf + wbuf_used, buf + done, (size_t)cnt);
+        wbuf_used += cnt;
+        done += cnt;
+        if ((wbuf_used == RECORDER_BUF) && (file_flush(false) != 0)) {
+            return AVERROR(EIO);
+        }
+    }
+
+    return buf_size;
+}
+
+/* Streams of the recording are copies of the channel's encoder output */
+int cls_recorder::streams_add()
+{
+    AVStream *strm;
+
+    strm_video = -1;
+    strm_audio = -1;
+
+    if ((desc->video_index != -1) && (desc->video_par != nullptr)) {
+        strm = avformat_new_stream(fmt_ctx, NULL);
+        if ((strm == nullptr) ||
+            (avcodec_parameters_copy(strm->codecpar, desc->video_par) < 0)) {
+            return -1;
+        }
+        strm->codecpar->codec_tag = 0;
+        strm->time_base = desc->video_strm_tb;
+        strm->avg_frame_rate = desc->framerate;
+        strm_video = strm->index;
+    }
+    if ((desc->audio_index != -1) && (desc->audio_par != nullptr)) {
+        strm = avformat_new_stream(fmt_ctx, NULL);
+        if ((strm == nullptr) ||
+            (avcodec_parameters_copy(strm->codecpar, desc->audio_par) < 0)) {
+            return -1;
+        }
+        strm->codecpar->codec_tag = 0;
+        strm->time_base = desc->audio_tb;
+        strm_audio = strm->index;
+    }
+
+    if ((strm_video == -1) && (strm_audio == -1)) {
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Returns 1 while the channel has no stream description yet so the
+ * caller tries again, -1 when the file or muxer could not be set up
+*/
+int cls_recorder::file_open()
+{
+    int retcd, flags;
+    char errstr[128], timebuf[32];
+    time_t timenow;
+    struct tm time_info;
+    uint8_t *aviobuf;
+    AVIOContext *avio;
+
+    desc = chitm->desc_get();
+    if (desc == nullptr) {
+        if (wait_logged == false) {
+            LOG_MSG(NTC, NO_ERRNO
+                , "Ch%s: Recording waits for the encoder", ch_nbr.c_str());
+            wait_logged = true;
+        }
+        return 1;
+    }
+    wait_logged = false;
+
+    timenow = time(NULL);
+    localtime_r(&timenow, &time_info);
+    strftime(timebuf, sizeof(timebuf), "%Y%m%d_%H%M%S", &time_info);
+    mtx.lock();
+        fnm = app->conf->record_dir + "/ch" + ch_nbr + "_" + timebuf + "." + rec_fmt;
+    mtx.unlock();
+
+    flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+    if (rec_direct == true) {
+        flags |= O_DIRECT;
+    }
+    fd = open(fnm.c_str(), flags, 0644);
+    if ((fd < 0) && (rec_direct == true) && (errno == EINVAL)) {
+        LOG_MSG(NTC, NO_ERRNO
+            , "Ch%s: O_DIRECT not supported for %s, using buffered writes"
+            , ch_nbr.c_str(), fnm.c_str());
+        rec_direct = false;
+        fd = open(fnm.c_str(), flags & ~O_DIRECT, 0644);
+    }
+    if (fd < 0) {
+        LOG_MSG(ERR, SHOW_ERRNO
+            , "Ch%s: Could not create recording %s"
+            , ch_nbr.c_str(), fnm.c_str());
+        return -1;
+    }
+
+    if (posix_memalign((void **)&wbuf, RECORDER_ALIGN, RECORDER_BUF) != 0) {
+        wbuf = nullptr;
+        file_close();
+        return -1;
+    }
+    wbuf_used = 0;
+
+    avformat_alloc_output_context2(&fmt_ctx, NULL
+        , (rec_fmt == "mkv") ? "matroska" : "mpegts", NULL);
+    if (fmt_ctx == nullptr) {
+        file_close();
+        return -1;
+    }
+    if (streams_add() != 0) {
+        LOG_MSG(ERR, NO_ERRNO
+            , "Ch%s: Could not set up the streams of the recording"
+            , ch_nbr.c_str());
+        file_close();
+        return -1;
+    }
+
+    /* The output is not seekable so mkv files are written without cues */
+    aviobuf = (uint8_t *)av_malloc(RECORDER_AVIO_BUF);
+    avio = avio_alloc_context(aviobuf, RECORDER_AVIO_BUF, 1, this
+        , NULL, &recorder_avio_write, NULL);
+    if (avio == nullptr) {
+        av_free(aviobuf);
+        file_close();
+        return -1;
+    }
+    fmt_ctx->pb = avio;
+    fmt_ctx->flags |= AVFMT_FLAG_CUSTOM_IO;
+
+    retcd = avformat_write_header(fmt_ctx, NULL);
+    if (retcd < 0) {
+        av_strerror(retcd, errstr, sizeof(errstr));
+        LOG_MSG(ERR, NO_ERRNO
+            , "Ch%s: Could not write the header of %s: %s"
+            , ch_nbr.c_str(), fnm.c_str(), errstr);
+        file_close();
+        return -1;
+    }
+
+    if (strm_video != -1) {
+        myrescale_init(rs_video, AVRational{1, PKTARRAY_TIMEBASE}
+            , fmt_ctx->streams[strm_video]->time_base);
+    }
+    if (strm_audio != -1) {
+        myrescale_init(rs_audio, AVRational{1, PKTARRAY_TIMEBASE}
+            , fmt_ctx->streams[strm_audio]->time_base);
+    }
+    last_dts[0] = AV_NOPTS_VALUE;
+    last_dts[1] = AV_NOPTS_VALUE;
+    key_seen = (strm_video == -1);
+
+    /* Start at the live edge and have the encoder send an IDR */
+    pkt_idnbr = 0;
+    pkt_index = chitm->pktarray->index_curr();
+    if (pkt_index >= 0) {
+        pthread_mutex_lock(&chitm->pktarray->mtx);
+            pkt_idnbr = chitm->pktarray->array[pkt_index].idnbr;
+        pthread_mutex_unlock(&chitm->pktarray->mtx);
+    }
+    chitm->ch_idr = true;
+
+    mtx.lock();
+        files++;
+    mtx.unlock();
+    recording = true;
+
+    LOG_MSG(NTC, NO_ERRNO
+        , "Ch%s: Recording to %s", ch_nbr.c_str(), fnm.c_str());
+
+    return 0;
+}
+
+void cls_recorder::file_close()
+{
+    if (fmt_ctx != nullptr) {
+        if (recording == true) {
+            av_write_trailer(fmt_ctx);
+        }
+        if (fmt_ctx->pb != nullptr) {
+            avio_flush(fmt_ctx->pb);
+            av_freep(&fmt_ctx->pb->buffer);
+            avio_context_free(&fmt_ctx->pb);
+        }
+        avformat_free_context(fmt_ctx);
+        fmt_ctx = nullptr;
+    }
+    if (fd != -1) {
+        if (wbuf != nullptr) {
+            file_flush(true);
+        }
+        close(fd);
+        fd = -1;
+        if (recording == true) {
+            LOG_MSG(NTC, NO_ERRNO
+                , "Ch%s: Finished recording %s", ch_nbr.c_str(), fnm.c_str());
+        }
+    }
+    free(wbuf);
+    wbuf = nullptr;
+    wbuf_used = 0;
+    mypacket_free(pkt);
+    pkt = nullptr;
+    desc = nullptr;
+    recording = false;
+}
+
+/* Copy the next packet of the ring into pkt.  False when there is none yet */
+bool cls_recorder::packet_next()
+{
+    int indx;
+    bool pktready;
+    cls_pktarray *pktarray;
+
+    pktarray = chitm->pktarray;
+    pktready = false;
+
+    pthread_mutex_lock(&pktarray->mtx);
+        if (pktarray->count > 0) {
+            indx = pktarray->index_valid(pktarray->index_next(pkt_index));
+            if ((pktarray->array[indx].packet != nullptr) &&
+                (pktarray->array[indx].idnbr > pkt_idnbr)) {
+                if ((pkt_idnbr > 0) &&
+                    (pktarray->array[indx].idnbr != (pkt_idnbr + 1))) {
+                    mtx.lock();
+                        drops += pktarray->array[indx].idnbr - pkt_idnbr - 1;
+                    mtx.unlock();
+                }
+                pkt = mypacket_alloc(pkt);
+                if (mycopy_packet(pkt, pktarray->array[indx].packet) == 0) {
+                    pktready = true;
+                }
+                pkt_index = indx;
+                pkt_idnbr = pktarray->array[indx].idnbr;
+            }
+        }
+    pthread_mutex_unlock(&pktarray->mtx);
+
+    return pktready;
+}
+
+void cls_recorder::packet_write()
+{
+    int retcd, strm, slot;
+    char errstr[128];
+    ctx_rescale *rs;
+
+    if (chitm->desc_gen != desc->generation) {
+        desc = chitm->desc_get();
+    }
+
+    if (pkt->stream_index == desc->video_index) {
+        strm = strm_video;
+        rs = &rs_video;
+        slot = 0;
+    } else if (pkt->stream_index == desc->audio_index) {
+        strm = strm_audio;
+        rs = &rs_audio;
+        slot = 1;
+    } else {
+        return;
+    }
+    if (strm == -1) {
+        return;
+    }
+
+    /* Begin the file on a keyframe */
+    if (key_seen == false) {
+        if ((strm != strm_video) || ((pkt->flags & AV_PKT_FLAG_KEY) == 0)) {
+            return;
+        }
+        key_seen = true;
+    }
+
+    pkt->pts = myrescale(*rs, pkt->pts);
+    pkt->dts = myrescale(*rs, pkt->dts);
+    if (pkt->duration > 0) {
+        pkt->duration = myrescale(*rs, pkt->duration);
+    }
+    if ((pkt->dts != AV_NOPTS_VALUE) && (last_dts[slot] != AV_NOPTS_VALUE) &&
+        (pkt->dts <= last_dts[slot])) {
+        return;
+    }
+    last_dts[slot] = pkt->dts;
+    pkt->stream_index = strm;
+    pkt->pos = -1;
+
+    retcd = av_interleaved_write_frame(fmt_ctx, pkt);
+    if (retcd < 0) {
+        av_strerror(retcd, errstr, sizeof(errstr));
+        LOG_MSG(ERR, NO_ERRNO
+            , "Ch%s: Error writing to recording: %s"
+            , ch_nbr.c_str(), errstr);
+    }
+}
+
+void cls_recorder::run()
+{
+    int retcd;
+    bool want, sched;
+
+    mythreadname_set("rc", atoi(ch_nbr.c_str()), NULL);
+
+    while (true) {
+        std::unique_lock<std::mutex> lck(mtx);
+        if (finish == true) {
+            break;
+        }
+        sched = schedule_on();
+        if (sched == false) {
+            held = false;
+        }
+        want = ((manual == true) || ((sched == true) && (held == false)));
+        lck.unlock();
+
+        if ((want == true) && (fmt_ctx == nullptr) && (fd == -1)) {
+            retcd = file_open();
+            if (retcd < 0) {
+                lck.lock();
+                    manual = false;
+                    held = sched;
+                lck.unlock();
+            }
+        } else if ((want == false) && (fd != -1)) {
+            file_close();
+        }
+
+        if (recording == true) {
+            if (packet_next() == true) {
+                packet_write();
+                continue;
+            }
+            lck.lock();
+            cond.wait_for(lck, std::chrono::microseconds(RECORDER_IDLE));
+        } else {
+            lck.lock();
+            cond.wait_for(lck, std::chrono::seconds(1));
+        }
+    }
+
+    file_close();
+}
+
+/* Start the thread once it is needed.  The caller holds mtx */
+void cls_recorder::thread_start()
+{
+    if (rec_thread.joinable() == false) {
+        rec_thread = std::thread(&cls_recorder::run, this);
+    }
+}
+
+int cls_recorder::start(std::string fmt)
+{
+    if ((fmt != "") && (fmt != "ts") && (fmt != "mkv")) {
+        LOG_MSG(NTC, NO_ERRNO
+            , "Ch%s: Unknown recording format %s"
+            , ch_nbr.c_str(), fmt.c_str());
+        return -1;
+    }
+
+    mtx.lock();
+        if (fmt != "") {
+            rec_fmt = fmt;
+        }
+        manual = true;
+        held = false;
+        thread_start();
+    mtx.unlock();
+    cond.notify_all();
+
+    return 0;
+}
+
+void cls_recorder::stop()
+{
+    mtx.lock();
+        manual = false;
+        held = schedule_on();
+    mtx.unlock();
+    cond.notify_all();
+}
+
+std::string cls_recorder::status()
+{
+    std::string retval;
+
+    mtx.lock();
+        retval = "{\"recording\":";
+        retval += (recording == true) ? "true" : "false";
+        retval += ",\"requested\":";
+        retval += ((manual == true) ||
+            ((schedule_on() == true) && (held == false))) ? "true" : "false";
+        retval += ",\"format\":\"" + rec_fmt + "\"";
+        retval += ",\"file\":\"" + ((recording == true) ? fnm : "") + "\"";
+        retval += ",\"bytes\":" + std::to_string(bytes);
+        retval += ",\"files\":" + std::to_string(files);
+        retval += "}";
+    mtx.unlock();
+
+    return retval;
+}
+
+void cls_recorder::stats_get(ctx_channel_stats &st)
+{
+    std::lock_guard<std::mutex> lck(mtx);
+    st.rec_bytes = bytes;
+    st.rec_files = files;
+    st.rec_drops = drops;
+}
+
+cls_recorder::cls_recorder(cls_channel *p_chitm)
+{
+    chitm = p_chitm;
+    ch_nbr = chitm->ch_nbr;
+    recording = false;
+    rec_fmt = chitm->ch_record_fmt;
+    rec_direct = chitm->ch_record_direct;
+    manual = false;
+    held = false;
+    finish = false;
+    wait_logged = false;
+    fd = -1;
+    wbuf = nullptr;
+    wbuf_used = 0;
+    fmt_ctx = nullptr;
+    desc = nullptr;
+    strm_video = -1;
+    strm_audio = -1;
+    last_dts[0] = AV_NOPTS_VALUE;
+    last_dts[1] = AV_NOPTS_VALUE;
+    key_seen = false;
+    pkt_index = -1;
+    pkt_idnbr = 0;
+    pkt = nullptr;
+    bytes = 0;
+    files = 0;
+    drops = 0;
+
+    schedule_parse(chitm->ch_record);
+    if (windows.empty() == false) {
+        mtx.lock();
+            thread_start();
+        mtx.unlock();
+    }
+}
+
+cls_recorder::~cls_recorder()
+{
+    mtx.lock();
+        finish = true;
+    mtx.unlock();
+    cond.notify_all();
+    if (rec_thread.joinable() == true) {
+        rec_thread.join();
+    }
+}
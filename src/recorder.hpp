@@ -0,0 +1,97 @@
+/*
+ *    This file is part of Restream.
+ *
+ *    Restream is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    Restream is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with Restream.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef _INCLUDE_RECORDER_HPP_
+#define _INCLUDE_RECORDER_HPP_
+    #define RECORDER_BUF        (4 * 1024 * 1024)   /* Muxed bytes collected before a write */
+    #define RECORDER_ALIGN      4096                /* Buffer and write alignment for O_DIRECT */
+    #define RECORDER_AVIO_BUF   (64 * 1024)
+    #define RECORDER_IDLE       10000               /* Microseconds to wait for the next packet */
+
+    /* Daily window of a recording schedule in minutes after midnight */
+    struct ctx_recorder_window {
+        int     start;
+        int     end;
+    };
+
+    /* Writes the packets of the channel's ring to a TS or MKV file.  The
+     * packets are the ones already encoded for the clients so a recording
+     * only costs the muxing and the disk writes.  Recordings are started
+     * and stopped from the web API or by the record= schedule
+    */
+    class cls_recorder {
+        public:
+            cls_recorder(cls_channel *p_chitm);
+            ~cls_recorder();
+
+            std::atomic<bool>   recording;
+
+            int     start(std::string fmt);
+            void    stop();
+            int     avio_write(uint8_t *buf, int buf_size);
+            std::string status();
+            void    stats_get(ctx_channel_stats &st);
+
+        private:
+            cls_channel     *chitm;
+            std::string     ch_nbr;
+            std::vector<ctx_recorder_window>    windows;
+            std::string     rec_fmt;        /* ts or mkv */
+            bool            rec_direct;     /* Write with O_DIRECT */
+            bool            manual;         /* Started from the API */
+            bool            held;           /* Stopped from the API inside a scheduled window */
+            bool            finish;
+            bool            wait_logged;    /* Waiting for the encoder was logged */
+
+            std::string     fnm;
+            int             fd;
+            uint8_t         *wbuf;          /* Aligned write buffer */
+            int64_t         wbuf_used;
+            AVFormatContext *fmt_ctx;
+            ptr_stream_desc desc;
+            int             strm_video;     /* Output stream of the ring's video and audio */
+            int             strm_audio;
+            ctx_rescale     rs_video;
+            ctx_rescale     rs_audio;
+            int64_t         last_dts[2];
+            bool            key_seen;
+            int             pkt_index;
+            int64_t         pkt_idnbr;
+            AVPacket        *pkt;
+
+            int64_t         bytes;
+            int64_t         files;
+            int64_t         drops;
+
+            std::thread             rec_thread;
+            std::mutex              mtx;
+            std::condition_variable cond;
+
+            void    run();
+            void    thread_start();
+            bool    schedule_on();
+            void    schedule_parse(std::string parm);
+            int     file_open();
+            void    file_close();
+            int     file_flush(bool all);
+            int     streams_add();
+            bool    packet_next();
+            void    packet_write();
+    };
+
+#endif
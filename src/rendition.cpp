@@ -0,0 +1,417 @@
+/*
+ *    This file is part of Restream.
+ *
+ *    Restream is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    Restream is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with Restream.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "restream.hpp"
+#include "conf.hpp"
+#include "util.hpp"
+#include "logger.hpp"
+#include "channel.hpp"
+#include "infile.hpp"
+#include "pktarray.hpp"
+#include "ratectl.hpp"
+#include "rendition.hpp"
+#include "cache.hpp"
+#include "workpool.hpp"
+#include "pretrans.hpp"
+#include "pacer.hpp"
+#include "reactor.hpp"
+#include "inread.hpp"
+#include "uring.hpp"
+#include "timeshift.hpp"
+#include "recorder.hpp"
+#include "tsmux.hpp"
+#include "localout.hpp"
+#include "webu.hpp"
+#include "webu_ans.hpp"
+#include "webu_mpegts.hpp"
+#include "webu_mpts.hpp"
+
+/* The profile is given as WIDTHxHEIGHT:KBPS */
+int cls_rendition::spec_parse(std::string spec)
+{
+    size_t pos_x, pos_c;
+
+    pos_x = spec.find("x");
+    pos_c = spec.find(":");
+    if ((pos_x == std::string::npos) || (pos_c == std::string::npos) ||
+        (pos_c < pos_x)) {
+        return -1;
+    }
+    width = atoi(spec.substr(0, pos_x).c_str());
+    height = atoi(spec.substr(pos_x + 1, pos_c - pos_x - 1).c_str());
+    kbps = atoi(spec.substr(pos_c + 1).c_str());
+    if ((width <= 0) || (height <= 0) || (kbps <= 0)) {
+        return -1;
+    }
+    width = (width / 2) * 2;
+    height = (height / 2) * 2;
+
+    return 0;
+}
+
+/* A new client wants this rendition.  The ring starts empty when the
+ * encoder is not running so no stale packets from an earlier session
+ * are sent
+*/
+void cls_rendition::client_add()
+{
+    time_used = av_gettime_relative();
+    if ((cnct_cnt++ == 0) && (enc_ctx == nullptr)) {
+        pktarray->reset();
+    }
+}
+
+void cls_rendition::client_remove()
+{
+    if (cnct_cnt > 0) {
+        cnct_cnt--;
+    }
+    time_used = av_gettime_relative();
+}
+
+/* Wait for the channel thread to start the encoder for a new client */
+bool cls_rendition::wait_ready()
+{
+    int64_t tm_start;
+    bool ready;
+
+    tm_start = av_gettime_relative();
+    while (true) {
+        pthread_mutex_lock(&chitm->infile->mtx);
+            ready = ((enc_ctx != nullptr) && (desc_gen > 0) &&
+                (pktarray->count > 0));
+        pthread_mutex_unlock(&chitm->infile->mtx);
+        if (ready == true) {
+            return true;
+        }
+        if ((chitm->ch_finish == true) ||
+            ((av_gettime_relative() - tm_start) > RENDITION_WAIT)) {
+            LOG_MSG(NTC, NO_ERRNO
+                , "Ch%s: Profile %s did not start"
+                , ch_nbr.c_str(), name.c_str());
+            return false;
+        }
+        SLEEP(0, 10000000L);
+    }
+}
+
+/* Scale to the profile size keeping the aspect ratio and pad the rest */
+int cls_rendition::filter_init()
+{
+    int retcd;
+    char errstr[128];
+    std::string desc;
+
+    desc = "scale=" + std::to_string(width) + ":" + std::to_string(height) +
+        ":flags=bilinear:force_original_aspect_ratio=decrease" +
+        ",pad=" + std::to_string(width) + ":" + std::to_string(height) +
+        ":(ow-iw)/2:(oh-ih)/2,format=yuv420p";
+
+    retcd = myfilter_init(&flt_graph, &flt_src, &flt_sink
+        , chitm->infile->ifile.video.codec_ctx
+        , chitm->infile->ifile.video.strm->time_base, desc);
+    if (retcd < 0) {
+        av_strerror(retcd, errstr, sizeof(errstr));
+        LOG_MSG(ERR, NO_ERRNO
+            , "Ch%s: Could not create filter for profile %s: %s"
+            , ch_nbr.c_str(), name.c_str(), errstr);
+        return -1;
+    }
+
+    return 0;
+}
+
+/* The bitrate is capped so the profile suits slow links.  The preset
+ * follows the channel's rate controller
+*/
+int cls_rendition::encoder_open()
+{
+    const AVCodec *encoder;
+    AVCodecContext *ctx, *dec_ctx;
+    AVDictionary *opts = NULL;
+    char errstr[128];
+    int retcd;
+
+    encoder = avcodec_find_encoder(AV_CODEC_ID_H264);
+    if (encoder == nullptr) {
+        LOG_MSG(NTC, NO_ERRNO
+            , "Ch%s: Could not find video encoder"
+            , ch_nbr.c_str());
+        return -1;
+    }
+
+    ctx = avcodec_alloc_context3(encoder);
+    if (ctx == nullptr) {
+        LOG_MSG(NTC, NO_ERRNO
+            , "Ch%s: Could not allocate video encoder"
+            , ch_nbr.c_str());
+        return -1;
+    }
+
+    dec_ctx = chitm->infile->ifile.video.codec_ctx;
+
+    ctx->codec_type = AVMEDIA_TYPE_VIDEO;
+    ctx->codec_id = AV_CODEC_ID_H264;
+    ctx->width = width;
+    ctx->height = height;
+    ctx->time_base.num = 1;
+    ctx->time_base.den = 90000;
+    ctx->max_b_frames = 0;
+    ctx->framerate = dec_ctx->framerate;
+    ctx->bit_rate = (int64_t)kbps * 1000;
+    ctx->rc_max_rate = ctx->bit_rate;
+    ctx->rc_buffer_size = (int)(ctx->bit_rate * 2);
+    ctx->gop_size = chitm->ch_gop;
+    ctx->pix_fmt = AV_PIX_FMT_YUV420P;
+
+    av_dict_set( &opts, "profile", "baseline", 0 );
+    av_dict_set( &opts, "tune", "zerolatency", 0 );
+    av_dict_set( &opts, "preset", chitm->ratectl->preset().c_str(), 0 );
+    av_dict_set( &opts, "keyint", std::to_string(chitm->ch_gop).c_str(), 0 );
+    av_dict_set( &opts, "scenecut", "0", 0 );
+    av_dict_set( &opts, "forced-idr", "1", 0 );
+
+    retcd = avcodec_open2(ctx, encoder, &opts);
+    av_dict_free(&opts);
+    if (retcd < 0) {
+        av_strerror(retcd, errstr, sizeof(errstr));
+        LOG_MSG(NTC, NO_ERRNO
+            , "Ch%s: Could not open encoder for profile %s: %s %dx%d"
+            , ch_nbr.c_str(), name.c_str(), errstr
+            , ctx->width, ctx->height);
+        avcodec_free_context(&ctx);
+        return -1;
+    }
+
+    pthread_mutex_lock(&chitm->infile->mtx);
+        enc_ctx = ctx;
+        desc_publish();
+    pthread_mutex_unlock(&chitm->infile->mtx);
+
+    return 0;
+}
+
+/* The profile's own video with the channel's audio.  The caller
+ * holds the infile mtx
+*/
+void cls_rendition::desc_publish()
+{
+    std::shared_ptr<ctx_stream_desc> dsc;
+    cls_infile *inf;
+
+    inf = chitm->infile;
+    if (inf->ofile.video.strm == nullptr) {
+        return;
+    }
+    dsc = std::make_shared<ctx_stream_desc>();
+    dsc->generation = desc_gen + 1;
+
+    if (stream_desc_video(dsc.get(), enc_ctx
+        , inf->ofile.video.index, inf->ofile.video.strm->time_base) != 0) {
+        return;
+    }
+    if ((inf->ofile.audio.index != -1) &&
+        (inf->ofile.audio.codec_ctx != nullptr)) {
+        if (stream_desc_audio(dsc.get(), inf->ofile.audio.codec_ctx
+            , inf->ofile.audio.index) != 0) {
+            return;
+        }
+    }
+
+    std::atomic_store(&strm_desc, ptr_stream_desc(dsc));
+    desc_gen = dsc->generation;
+}
+
+ptr_stream_desc cls_rendition::desc_get()
+{
+    return std::atomic_load(&strm_desc);
+}
+
+int cls_rendition::start()
+{
+    if (pktarray->count == 0) {
+        pktarray->resize();
+    }
+
+    if (filter_init() != 0) {
+        encoder_free();
+        failed = true;
+        return -1;
+    }
+    if (encoder_open() != 0) {
+        encoder_free();
+        failed = true;
+        return -1;
+    }
+    idr = true;
+
+    LOG_MSG(NTC, NO_ERRNO
+        , "Ch%s: Started profile %s %dx%d %dkbps"
+        , ch_nbr.c_str(), name.c_str(), width, height, kbps);
+
+    return 0;
+}
+
+/* Release the scaler and encoder.  The caller holds the infile mtx */
+void cls_rendition::encoder_free()
+{
+    if (flt_graph != nullptr) {
+        avfilter_graph_free(&flt_graph);
+        flt_graph = nullptr;
+    }
+    flt_src = nullptr;
+    flt_sink = nullptr;
+    if (enc_ctx != nullptr) {
+        avcodec_free_context(&enc_ctx);
+        enc_ctx = nullptr;
+    }
+    av_frame_unref(frame_flt);
+    av_packet_unref(pkt_out);
+    failed = false;
+}
+
+void cls_rendition::encoder_receive()
+{
+    int retcd;
+
+    retcd = 0;
+    while (retcd == 0) {
+        av_packet_unref(pkt_out);
+        retcd = avcodec_receive_packet(enc_ctx, pkt_out);
+        if (retcd == 0) {
+            pkt_out->stream_index = chitm->infile->ofile.video.index;
+            if (pkt_out->pts > 0) {
+                pktarray->add(pkt_out);
+            }
+        }
+    }
+    av_packet_unref(pkt_out);
+}
+
+/* Called by the channel thread with each decoded video frame.  The
+ * encoder is started on demand and stopped once idle
+*/
+void cls_rendition::frame_send(AVFrame *frm)
+{
+    int retcd;
+    char errstr[128];
+
+    if (valid == false) {
+        return;
+    }
+
+    if (cnct_cnt == 0) {
+        if ((enc_ctx != nullptr) &&
+            ((av_gettime_relative() - time_used) > RENDITION_IDLE)) {
+            LOG_MSG(NTC, NO_ERRNO
+                , "Ch%s: Stopping idle profile %s"
+                , ch_nbr.c_str(), name.c_str());
+            pthread_mutex_lock(&chitm->infile->mtx);
+                encoder_free();
+            pthread_mutex_unlock(&chitm->infile->mtx);
+        }
+        if (enc_ctx == nullptr) {
+            return;
+        }
+    }
+
+    if (enc_ctx == nullptr) {
+        if ((failed == true) || (start() != 0)) {
+            return;
+        }
+    }
+
+    retcd = av_buffersrc_add_frame_flags(flt_src, frm, AV_BUFFERSRC_FLAG_KEEP_REF);
+    while (retcd >= 0) {
+        av_frame_unref(frame_flt);
+        retcd = av_buffersink_get_frame(flt_sink, frame_flt);
+        if (retcd < 0) {
+            break;
+        }
+        if (frame_flt->pts != AV_NOPTS_VALUE) {
+            frame_flt->pts = av_rescale_q(frame_flt->pts
+                , av_buffersink_get_time_base(flt_sink)
+                , chitm->infile->ifile.video.strm->time_base);
+        }
+        if (idr.exchange(false) == true) {
+            frame_flt->pict_type = AV_PICTURE_TYPE_I;
+        } else {
+            frame_flt->pict_type = AV_PICTURE_TYPE_NONE;
+        }
+        retcd = avcodec_send_frame(enc_ctx, frame_flt);
+        av_frame_unref(frame_flt);
+        if (retcd < 0) {
+            break;
+        }
+        encoder_receive();
+    }
+    if ((retcd < 0) && (retcd != AVERROR(EAGAIN)) && (retcd != AVERROR_EOF)) {
+        av_strerror(retcd, errstr, sizeof(errstr));
+        LOG_MSG(NTC, NO_ERRNO
+            , "Ch%s: Error encoding profile %s: %s"
+            , ch_nbr.c_str(), name.c_str(), errstr);
+    }
+}
+
+/* The audio from the channel encoder is shared by every rendition */
+void cls_rendition::audio_add(AVPacket *pkt)
+{
+    if ((valid == false) || (enc_ctx == nullptr)) {
+        return;
+    }
+    pktarray->add(pkt);
+}
+
+cls_rendition::cls_rendition(cls_channel *p_chitm, std::string p_name, std::string p_spec)
+{
+    chitm = p_chitm;
+    ch_nbr = chitm->ch_nbr;
+    name = p_name;
+    width = 0;
+    height = 0;
+    kbps = 0;
+    valid = true;
+    failed = false;
+    enc_ctx = nullptr;
+    flt_graph = nullptr;
+    flt_src = nullptr;
+    flt_sink = nullptr;
+    cnct_cnt = 0;
+    idr = false;
+    time_used = 0;
+    desc_gen = 0;
+
+    if (spec_parse(p_spec) != 0) {
+        LOG_MSG(NTC, NO_ERRNO
+            , "Ch%s: Invalid profile %s %s"
+            , ch_nbr.c_str(), name.c_str(), p_spec.c_str());
+        valid = false;
+    }
+
+    frame_flt = myframe_alloc();
+    pkt_out = mypacket_alloc(nullptr);
+    pktarray = new cls_pktarray(chitm);
+}
+
+cls_rendition::~cls_rendition()
+{
+    encoder_free();
+    myframe_free(frame_flt);
+    mypacket_free(pkt_out);
+    delete pktarray;
+}
@@ -0,0 +1,69 @@
+/*
+ *    This file is part of Restream.
+ *
+ *    Restream is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    Restream is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with Restream.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef _INCLUDE_RENDITION_HPP_
+#define _INCLUDE_RENDITION_HPP_
+    #define RENDITION_IDLE  30000000    /* Time without clients before the encoder is stopped */
+    #define RENDITION_WAIT  5000000     /* Time a new client waits for the encoder to start */
+
+    /* A secondary scaler and encoder fed from the channel's decoded frames */
+    class cls_rendition {
+        public:
+            cls_rendition(cls_channel *p_chitm, std::string p_name, std::string p_spec);
+            ~cls_rendition();
+
+            std::string     name;
+            int             width;
+            int             height;
+            int             kbps;
+            bool            valid;
+            cls_pktarray    *pktarray;
+            AVCodecContext  *enc_ctx;       /* Guarded by the infile mtx */
+            std::atomic<int>        cnct_cnt;
+            std::atomic<bool>       idr;
+            std::atomic<int64_t>    time_used;
+            std::atomic<int64_t>    desc_gen;
+
+            void    client_add();
+            void    client_remove();
+            bool    wait_ready();
+            void    frame_send(AVFrame *frm);
+            void    audio_add(AVPacket *pkt);
+            void    encoder_free();
+            ptr_stream_desc desc_get();
+
+        private:
+            ptr_stream_desc strm_desc;
+            cls_channel     *chitm;
+            std::string     ch_nbr;
+            AVFilterGraph   *flt_graph;
+            AVFilterContext *flt_src;
+            AVFilterContext *flt_sink;
+            AVFrame         *frame_flt;
+            AVPacket        *pkt_out;
+            bool            failed;
+
+            int     spec_parse(std::string spec);
+            int     filter_init();
+            int     encoder_open();
+            void    desc_publish();
+            int     start();
+            void    encoder_receive();
+    };
+
+#endif
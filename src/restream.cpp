@@ -23,9 +23,23 @@
 #include "channel.hpp"
 #include "infile.hpp"
 #include "pktarray.hpp"
+#include "ratectl.hpp"
+#include "rendition.hpp"
+#include "cache.hpp"
+#include "workpool.hpp"
+#include "pretrans.hpp"
+#include "pacer.hpp"
+#include "reactor.hpp"
+#include "inread.hpp"
+#include "uring.hpp"
+#include "timeshift.hpp"
+#include "recorder.hpp"
+#include "tsmux.hpp"
+#include "localout.hpp"
 #include "webu.hpp"
 #include "webu_ans.hpp"
 #include "webu_mpegts.hpp"
+#include "webu_mpts.hpp"
 
 cls_app *app;
 
@@ -94,9 +108,40 @@ void cls_app::channels_start()
         app->ch_count++;
     }
 
-    for (indx=0; indx < app->ch_count; indx++) {
-        ch_thread = std::thread(&cls_channel::process, app->channels[indx]);
-        ch_thread.detach();
+    if (app->conf->io_uring == true) {
+        app->uring = new cls_uring();
+        if (app->uring->ok == false) {
+            delete app->uring;
+            app->uring = nullptr;
+        }
+    }
+
+    if (app->conf->engine == "reactor") {
+        app->pool = new cls_workpool(app->conf->pool_workers, "wk");
+        for (indx=0; indx < app->conf->reactor_threads; indx++) {
+            app->reactors.push_back(new cls_reactor(indx, app->pool));
+        }
+        LOG_MSG(NTC, NO_ERRNO
+            , "Reactor engine with %d reactors and %d workers"
+            , app->conf->reactor_threads, app->pool->threads);
+        for (indx=0; indx < app->ch_count; indx++) {
+            app->reactors[indx % app->conf->reactor_threads]->channel_add(
+                app->channels[indx]);
+        }
+    } else {
+        /* Each channel reads and decodes on its own thread and encodes on the pool */
+        if (app->conf->encode_pool == true) {
+            app->pool = new cls_workpool(app->conf->pool_workers, "wk");
+            LOG_MSG(NTC, NO_ERRNO
+                , "Encode pool with %d workers", app->pool->threads);
+            for (indx=0; indx < app->ch_count; indx++) {
+                app->channels[indx]->strand = new cls_strand(app->pool);
+            }
+        }
+        for (indx=0; indx < app->ch_count; indx++) {
+            ch_thread = std::thread(&cls_channel::process, app->channels[indx]);
+            ch_thread.detach();
+        }
     }
     if (app->ch_count == 0) {
         LOG_MSG(NTC, NO_ERRNO,"Configuration file lacks channel parameters");
@@ -162,12 +207,60 @@ void cls_app::channels_wait()
 
 }
 
+/* Run each channel playing pretrans_dir in turn on the main thread
+ * with one pool shared by all of their files
+*/
+void cls_app::pretranscode()
+{
+    int indx;
+    bool found;
+    std::list<std::string>::iterator    it;
+
+    if (conf->cache_dir == "") {
+        LOG_MSG(ERR, NO_ERRNO, "Pretranscode requires cache_dir");
+        return;
+    }
+
+    ch_count = 0;
+    for (it  = conf->channels.begin();
+         it != conf->channels.end(); it++) {
+        channels.push_back(new cls_channel(ch_count, it->c_str()));
+        ch_count++;
+    }
+
+    pool = new cls_workpool(0, "pre");
+    LOG_MSG(NTC, NO_ERRNO, "Pretranscoding with %d threads", pool->threads);
+
+    found = false;
+    for (indx=0; indx < ch_count; indx++) {
+        if (finish == true) {
+            break;
+        }
+        if (channels[indx]->pretranscode(pool) == true) {
+            found = true;
+        }
+    }
+    delete pool;
+    pool = nullptr;
+
+    if (found == false) {
+        LOG_MSG(ERR, NO_ERRNO
+            , "No channel plays %s", pretrans_dir.c_str());
+    }
+}
+
 int main(int argc, char **argv)
 {
     mythreadname_set(nullptr,1,"main");
 
     app = new cls_app(argc, argv);
 
+    if (app->pretrans_dir != "") {
+        app->pretranscode();
+        delete app;
+        return 0;
+    }
+
     app->channels_start();
 
     app->channels_wait();
@@ -185,12 +278,19 @@ cls_app::cls_app(int p_argc, char **p_argv)
     argv = p_argv;
 
     finish = false;
+    pretrans_dir = "";
+    ch_count = 0;
+    webu = nullptr;
+    pool = nullptr;
+    uring = nullptr;
 
     signal_setup();
 
     log = new cls_log(this);
     conf = new cls_config(this);
-    webu = new cls_webu(this);
+    if (pretrans_dir == "") {
+        webu = new cls_webu(this);
+    }
 
 }
 
@@ -198,11 +298,33 @@ cls_app::~cls_app()
 {
     int indx;
 
+    /* Stop scheduling and let running steps finish before the channels
+     * go.  The reactors are freed last since a step in flight still
+     * looks at its reactor when it returns
+    */
+    for (indx=0; indx < (int)reactors.size(); indx++) {
+        reactors[indx]->stop();
+    }
+    if (pool != nullptr) {
+        delete pool;
+        pool = nullptr;
+    }
+    for (indx=0; indx < (int)reactors.size(); indx++) {
+        delete reactors[indx];
+    }
+    reactors.clear();
+
     for (indx=0; indx < app->ch_count; indx++) {
         delete app->channels[indx];
     }
+    if (uring != nullptr) {
+        delete uring;
+        uring = nullptr;
+    }
 
-    delete webu;
+    if (webu != nullptr) {
+        delete webu;
+    }
     delete conf;
     delete log;
 
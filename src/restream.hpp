@@ -31,6 +31,7 @@
         #include <libavutil/timestamp.h>
         #include <libavutil/time.h>
         #include <libavutil/mem.h>
+        #include <libavutil/crc.h>
         #include "libavutil/audio_fifo.h"
         #include <libswscale/swscale.h>
     }
@@ -53,11 +54,19 @@
     #include <string>
     #include <list>
     #include <vector>
+    #include <deque>
     #include <iostream>
     #include <fstream>
     #include <thread>
     #include <algorithm>
     #include <mutex>
+    #include <atomic>
+    #include <functional>
+    #include <memory>
+    #include <condition_variable>
+    #include <getopt.h>
+    #include <sys/mman.h>
+    #include <sys/eventfd.h>
     #include <netinet/in.h>
     #include <arpa/inet.h>
 
@@ -67,9 +76,24 @@
     class cls_channel;
     class cls_infile;
     class cls_pktarray;
+    class cls_ratectl;
+    class cls_rendition;
+    class cls_cache;
+    class cls_workpool;
+    class cls_strand;
+    class cls_pretrans;
+    class cls_pacer;
+    class cls_reactor;
+    class cls_inread;
+    class cls_uring;
+    class cls_timeshift;
+    class cls_recorder;
+    class cls_localout;
+    class cls_tsmux;
     class cls_webu;
     class cls_webua;
     class cls_webuts;
+    class cls_webumpts;
 
     extern cls_app *app;
 
@@ -149,9 +173,111 @@
         int64_t     idnbr;
         bool        iskey;
         bool        iswritten;
-        AVRational  timebase;
-        int64_t     start_pts;
-        int64_t     file_cnt;
+        int         region;         /* Arena region holding the payload or -1 when on the heap */
+    };
+    struct ctx_keyframe_item {
+        int         index;          /* Slot in the ring holding the keyframe */
+        int64_t     idnbr;          /* Packet id to detect when the slot is reused */
+        int64_t     tm;             /* Microseconds on the channel timeline */
+    };
+    struct ctx_channel_stats {
+        int64_t     clients;        /* Clients connected since startup */
+        int64_t     ttff_cnt;       /* Clients that have received a first frame */
+        int64_t     ttff_sum;       /* Total time to first frame in microseconds */
+        int64_t     ttff_max;
+        int64_t     ttff_last;
+        int         ring_slots;
+        int64_t     ring_bytes;
+        int         ring_keys;      /* Keyframes currently indexed in the ring */
+        int64_t     ring_fallback;
+        int64_t     burst_cnt;      /* Clients that joined with a burst */
+        int64_t     burst_bytes;    /* Bytes sent faster than realtime */
+        int64_t     burst_usec;     /* Total time spent bursting */
+        int64_t     ctl_load;       /* Permille of realtime spent decoding and encoding */
+        int64_t     ctl_margin;     /* Smallest pacing margin of the last window in microseconds */
+        int         ctl_level;
+        int         ctl_preset;     /* Index of the preset from ultrafast */
+        int         ctl_crf;
+        int64_t     ctl_faster;     /* Steps taken to reduce encode work */
+        int64_t     ctl_slower;     /* Steps taken to raise quality */
+        int64_t     pace_margin;    /* Latest pacing margin in microseconds */
+        int         shed_stage;
+        int64_t     shed_up;        /* Times more work was shed */
+        int64_t     shed_down;      /* Times work was restored */
+        int64_t     shed_dropped;   /* Frames dropped at half rate */
+        int64_t     cache_hits;     /* Files played from the cache */
+        int64_t     cache_misses;
+        int64_t     cache_stored;   /* Files written to the cache */
+        int64_t     cache_evicted;
+        int64_t     cache_corrupt;  /* Cache files that failed validation */
+        int64_t     pace_stalls;    /* Times the schedule was moved after falling behind */
+        int64_t     pace_jit_p50;   /* Wake up deviation from the schedule in microseconds */
+        int64_t     pace_jit_p99;
+        int64_t     pace_jit_max;
+        int64_t     read_bytes;     /* Bytes read from the input files */
+        int64_t     read_usec;      /* Time spent in those reads */
+        int64_t     read_stalls;    /* Times the demuxer waited on the read ahead */
+        int64_t     read_stall_usec;
+        int64_t     rec_bytes;      /* Bytes written to recordings */
+        int64_t     rec_files;
+        int64_t     rec_drops;      /* Packets a recording missed after falling behind the ring */
+        int64_t     local_bytes;    /* Bytes written to local readers */
+        int64_t     local_resyncs;  /* Times a local reader fell behind and restarted at a keyframe */
+    };
+    struct ctx_arena_region {
+        size_t              offset;     /* Start of the region within the arena */
+        size_t              size;       /* Bytes reserved including padding and alignment */
+        int                 slot;       /* Ring slot that owns the region */
+        std::atomic<bool>   busy;       /* Cleared by the buffer free callback */
+    };
+    /* Layout of the cache files.  Each packet record is followed by its data */
+    struct ctx_cache_head {
+        char        magic[4];
+        uint32_t    version;
+        uint64_t    key;
+    };
+    struct ctx_cache_rec {
+        int64_t     pts;
+        int64_t     dts;
+        int64_t     duration;
+        int32_t     size;
+        int32_t     stream_index;
+        int32_t     flags;
+        uint32_t    crc;            /* CRC32 of the packet data */
+    };
+    struct ctx_cache_tail {
+        uint64_t    pkt_cnt;
+        uint64_t    key_cnt;        /* Entries in the keyframe index */
+        int64_t     index_pos;      /* File offset of the keyframe index */
+        uint32_t    crc;            /* CRC32 over all of the record crcs */
+        char        magic[4];
+    };
+    /* Header of a packet record in the timeshift file */
+    struct ctx_timeshift_rec {
+        uint32_t    magic;
+        uint32_t    size;           /* Bytes of packet data after the header */
+        int64_t     pts;
+        int64_t     dts;
+        int64_t     duration;
+        int32_t     stream_index;
+        int32_t     flags;
+    };
+    struct ctx_cache_file {
+        std::string path;
+        int64_t     size;
+        time_t      mtime;
+    };
+    /* Rescale between two fixed time bases as a multiply and a shift or
+     * divide.  generic is set when the ratio does not fit in 64 bits
+    */
+    struct ctx_rescale {
+        AVRational      src;
+        AVRational      dst;
+        int64_t         mul;
+        int64_t         div;
+        int             shift;          /* log2 of div when a power of two or -1 */
+        int64_t         lim;            /* Largest value that can not overflow */
+        bool            generic;
     };
     struct ctx_av_info {
         int             index;
@@ -160,6 +286,7 @@
         int64_t         base_pdts;
         int64_t         start_pts;
         int64_t         last_pts;
+        ctx_rescale     rs_us;          /* Stream time base to microseconds */
     };
     struct ctx_file_info {
         AVFormatContext *fmt_ctx;
@@ -178,16 +305,21 @@
             char        **argv;
             bool        finish;
             std::string conf_file;
+            std::string pretrans_dir;   /* Set by --pretranscode */
 
             cls_config  *conf;
             cls_log     *log;
             cls_webu    *webu;
             std::vector<cls_channel*>   channels;
+            std::vector<cls_reactor*>   reactors;
+            cls_workpool                *pool;      /* Workers for the reactor engine or pretranscode */
+            cls_uring                   *uring;     /* Shared input reads when io_uring is on */
 
             int         ch_count;
 
             void channels_start();
             void channels_wait();
+            void pretranscode();
 
         private:
             void signal_setup();
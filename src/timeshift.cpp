@@ -0,0 +1,252 @@
+/*
+ *    This file is part of Restream.
+ *
+ *    Restream is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    Restream is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with Restream.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "restream.hpp"
+#include "conf.hpp"
+#include "util.hpp"
+#include "logger.hpp"
+#include "channel.hpp"
+#include "infile.hpp"
+#include "pktarray.hpp"
+#include "ratectl.hpp"
+#include "rendition.hpp"
+#include "cache.hpp"
+#include "workpool.hpp"
+#include "pretrans.hpp"
+#include "pacer.hpp"
+#include "reactor.hpp"
+#include "inread.hpp"
+#include "uring.hpp"
+#include "timeshift.hpp"
+#include "recorder.hpp"
+#include "tsmux.hpp"
+#include "localout.hpp"
+#include "webu.hpp"
+#include "webu_ans.hpp"
+#include "webu_mpegts.hpp"
+#include "webu_mpts.hpp"
+
+static int64_t timeshift_align(int64_t sz)
+{
+    return (sz + 7) & ~((int64_t)7);
+}
+
+/* Drop keyframes that were overwritten or are older than the window */
+void cls_timeshift::key_prune()
+{
+    while ((keys.empty() == false) &&
+        ((keys.front().pos < (written - size)) ||
+         ((newest_pts - keys.front().pts) > window))) {
+        keys.pop_front();
+    }
+}
+
+/* Append a packet from the channel's ring.  Called by the producer */
+void cls_timeshift::add(AVPacket *pkt)
+{
+    int64_t need, phys;
+    ctx_timeshift_rec rec;
+
+    need = timeshift_align((int64_t)sizeof(rec) + pkt->size);
+    if (need > (size / 4)) {
+        return;
+    }
+
+    rec.magic = TIMESHIFT_MAGIC;
+    rec.size = (uint32_t)pkt->size;
+    rec.pts = pkt->pts;
+    rec.dts = pkt->dts;
+    rec.duration = pkt->duration;
+    rec.stream_index = pkt->stream_index;
+    rec.flags = pkt->flags;
+
+    pthread_mutex_lock(&mtx);
+        phys = written % size;
+        if ((size - phys) < need) {
+            if ((size - phys) >= (int64_t)sizeof(rec)) {
+                ((ctx_timeshift_rec *)(map + phys))->magic = TIMESHIFT_WRAP;
+            }
+            written += size - phys;
+            phys = 0;
+        }
+        memcpy(map + phys, &rec, sizeof(rec));
+        if (pkt->size > 0) {
+            memcpy(map + phys + sizeof(rec), pkt->data, (size_t)pkt->size);
+        }
+
+        if ((pkt->flags & AV_PKT_FLAG_KEY) &&
+            (pkt->stream_index == chitm->infile->ifile.video.index) &&
+            (pkt->pts != AV_NOPTS_VALUE)) {
+            keys.push_back({written, pkt->pts});
+        }
+        written += need;
+        if (pkt->pts != AV_NOPTS_VALUE) {
+            newest_pts = pkt->pts;
+        }
+        key_prune();
+    pthread_mutex_unlock(&mtx);
+}
+
+/* Position of the keyframe offset seconds before the newest packet or
+ * of the oldest keyframe when the store does not reach back that far
+*/
+int64_t cls_timeshift::seek(int64_t offset)
+{
+    int64_t target, pos;
+    int indx;
+
+    pthread_mutex_lock(&mtx);
+        key_prune();
+        if (keys.empty() == true) {
+            pthread_mutex_unlock(&mtx);
+            return -1;
+        }
+        target = newest_pts + (offset * PKTARRAY_TIMEBASE);
+        pos = keys.front().pos;
+        for (indx = (int)keys.size() - 1; indx >= 0; indx--) {
+            if (keys[indx].pts <= target) {
+                pos = keys[indx].pos;
+                break;
+            }
+        }
+    pthread_mutex_unlock(&mtx);
+
+    return pos;
+}
+
+/* Copy the packet at pos into pkt and move pos past it.  Returns 1 when
+ * pos is at the newest packet and -1 when it was overwritten
+*/
+int cls_timeshift::read(int64_t &pos, AVPacket *pkt)
+{
+    int64_t phys;
+    ctx_timeshift_rec *rec;
+
+    pthread_mutex_lock(&mtx);
+        while (true) {
+            if (pos < (written - size)) {
+                pthread_mutex_unlock(&mtx);
+                return -1;
+            }
+            if (pos >= written) {
+                pthread_mutex_unlock(&mtx);
+                return 1;
+            }
+            phys = pos % size;
+            rec = (ctx_timeshift_rec *)(map + phys);
+            if (((size - phys) < (int64_t)sizeof(ctx_timeshift_rec)) ||
+                (rec->magic == TIMESHIFT_WRAP)) {
+                pos += size - phys;
+                continue;
+            }
+            break;
+        }
+        if ((rec->magic != TIMESHIFT_MAGIC) ||
+            (av_new_packet(pkt, (int)rec->size) < 0)) {
+            pthread_mutex_unlock(&mtx);
+            return -1;
+        }
+        memcpy(pkt->data, map + phys + sizeof(ctx_timeshift_rec), rec->size);
+        pkt->pts = rec->pts;
+        pkt->dts = rec->dts;
+        pkt->duration = rec->duration;
+        pkt->stream_index = rec->stream_index;
+        pkt->flags = rec->flags;
+        pos += timeshift_align((int64_t)sizeof(ctx_timeshift_rec) + rec->size);
+    pthread_mutex_unlock(&mtx);
+
+    return 0;
+}
+
+/* Seconds from the oldest keyframe to the newest packet */
+int64_t cls_timeshift::covered()
+{
+    int64_t secs;
+
+    pthread_mutex_lock(&mtx);
+        if (keys.empty() == true) {
+            secs = 0;
+        } else {
+            secs = (newest_pts - keys.front().pts) / PKTARRAY_TIMEBASE;
+        }
+    pthread_mutex_unlock(&mtx);
+
+    return secs;
+}
+
+cls_timeshift::cls_timeshift(cls_channel *p_chitm)
+{
+    chitm = p_chitm;
+    ch_nbr = chitm->ch_nbr;
+    ok = false;
+    fd = -1;
+    map = nullptr;
+    written = 0;
+    newest_pts = 0;
+    window = chitm->ch_timeshift * PKTARRAY_TIMEBASE;
+    pthread_mutex_init(&mtx, NULL);
+
+    size = chitm->ch_timeshift_bytes;
+    if (size <= 0) {
+        size = chitm->ch_timeshift * (PKTARRAY_BITRATE_DFLT / 8);
+    }
+    size = timeshift_align(size);
+
+    fnm = app->conf->timeshift_dir + "/restream_ch" + ch_nbr + TIMESHIFT_EXT;
+    fd = open(fnm.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        LOG_MSG(NTC, SHOW_ERRNO
+            , "Ch%s: Could not create timeshift file %s"
+            , ch_nbr.c_str(), fnm.c_str());
+        return;
+    }
+    if (ftruncate(fd, (off_t)size) != 0) {
+        LOG_MSG(NTC, SHOW_ERRNO
+            , "Ch%s: Could not size timeshift file %s"
+            , ch_nbr.c_str(), fnm.c_str());
+        return;
+    }
+    map = (uint8_t *)mmap(NULL, (size_t)size
+        , PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        map = nullptr;
+        LOG_MSG(NTC, SHOW_ERRNO
+            , "Ch%s: Could not map timeshift file %s"
+            , ch_nbr.c_str(), fnm.c_str());
+        return;
+    }
+
+    ok = true;
+    LOG_MSG(NTC, NO_ERRNO
+        , "Ch%s: Timeshift of %ld seconds in %s"
+        , ch_nbr.c_str(), (long)chitm->ch_timeshift, fnm.c_str());
+}
+
+cls_timeshift::~cls_timeshift()
+{
+    if (map != nullptr) {
+        munmap(map, (size_t)size);
+        map = nullptr;
+    }
+    if (fd != -1) {
+        close(fd);
+        fd = -1;
+        unlink(fnm.c_str());
+    }
+    pthread_mutex_destroy(&mtx);
+}
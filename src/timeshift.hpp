@@ -0,0 +1,65 @@
+/*
+ *    This file is part of Restream.
+ *
+ *    Restream is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    Restream is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with Restream.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef _INCLUDE_TIMESHIFT_HPP_
+#define _INCLUDE_TIMESHIFT_HPP_
+    #define TIMESHIFT_MAGIC     0x48535452          /* Start of each packet record */
+    #define TIMESHIFT_WRAP      0x50415257          /* The rest of the file is unused */
+    #define TIMESHIFT_EXT       ".tsb"
+    #define TIMESHIFT_LEAD      500000              /* Microseconds a reader may send ahead of realtime */
+
+    /* Keyframe in the store.  pos is the logical offset of its record */
+    struct ctx_timeshift_key {
+        int64_t     pos;
+        int64_t     pts;
+    };
+
+    /* The encoded packets of a channel for the last few hours kept in a
+     * memory mapped file used as a ring.  Positions are logical byte
+     * offsets that only grow so a reader can tell when the writer has
+     * gone past it.  Packets are stored on the channel timeline
+    */
+    class cls_timeshift {
+        public:
+            cls_timeshift(cls_channel *p_chitm);
+            ~cls_timeshift();
+
+            bool    ok;
+
+            void    add(AVPacket *pkt);
+            int64_t seek(int64_t offset);
+            int     read(int64_t &pos, AVPacket *pkt);
+            int64_t covered();
+
+        private:
+            cls_channel     *chitm;
+            std::string     ch_nbr;
+            std::string     fnm;
+            int             fd;
+            uint8_t         *map;
+            int64_t         size;
+            int64_t         written;        /* Logical offset of the next record */
+            int64_t         window;         /* Timeline ticks kept in the index */
+            int64_t         newest_pts;
+            std::deque<ctx_timeshift_key>   keys;
+            pthread_mutex_t mtx;
+
+            void    key_prune();
+    };
+
+#endif
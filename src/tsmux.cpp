@@ -0,0 +1,429 @@
+/*
+ *    This file is part of Restream.
+ *
+ *    Restream is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    Restream is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with Restream.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "restream.hpp"
+#include "conf.hpp"
+#include "util.hpp"
+#include "logger.hpp"
+#include "channel.hpp"
+#include "infile.hpp"
+#include "pktarray.hpp"
+#include "ratectl.hpp"
+#include "rendition.hpp"
+#include "cache.hpp"
+#include "workpool.hpp"
+#include "pretrans.hpp"
+#include "pacer.hpp"
+#include "reactor.hpp"
+#include "inread.hpp"
+#include "uring.hpp"
+#include "timeshift.hpp"
+#include "recorder.hpp"
+#include "tsmux.hpp"
+#include "localout.hpp"
+#include "webu.hpp"
+#include "webu_ans.hpp"
+#include "webu_mpegts.hpp"
+#include "webu_mpts.hpp"
+
+/* Access unit delimiter the libavformat muxer puts in front of H.264 */
+static const uint8_t tsmux_aud[6] = {0x00, 0x00, 0x00, 0x01, 0x09, 0xf0};
+
+/* CRC32 of the MPEG-2 sections */
+static uint32_t tsmux_crc(const uint8_t *data, int len)
+{
+    uint32_t crc;
+    int indx, bit;
+
+    crc = 0xffffffff;
+    for (indx=0; indx < len; indx++) {
+        crc ^= (uint32_t)data[indx] << 24;
+        for (bit=0; bit < 8; bit++) {
+            if (crc & 0x80000000) {
+                crc = (crc << 1) ^ 0x04c11db7;
+            } else {
+                crc = crc << 1;
+            }
+        }
+    }
+    return crc;
+}
+
+/* Write a 33 bit timestamp with its marker bits */
+static void tsmux_ts_put(uint8_t *q, int prefix, int64_t ts)
+{
+    ts &= 0x1ffffffffLL;
+    q[0] = (uint8_t)((prefix << 4) | (((ts >> 30) & 0x07) << 1) | 1);
+    q[1] = (uint8_t)((ts >> 22) & 0xff);
+    q[2] = (uint8_t)((((ts >> 15) & 0x7f) << 1) | 1);
+    q[3] = (uint8_t)((ts >> 7) & 0xff);
+    q[4] = (uint8_t)(((ts & 0x7f) << 1) | 1);
+}
+
+/* Room for cnt bytes at the end of the buffer.  It only grows when a
+ * response is larger than any before it
+*/
+uint8_t *cls_tsmux::reserve(unsigned char *&buf, size_t &size
+    , size_t &used, size_t cnt)
+{
+    uint8_t *retval;
+
+    if ((used + cnt) > size) {
+        size = used + cnt + TSMUX_GROW;
+        buf = (unsigned char *)realloc(buf, size);
+    }
+    retval = buf + used;
+    used += cnt;
+
+    return retval;
+}
+
+/* Put a section that fits in one packet.  Only the counter changes later */
+void cls_tsmux::section_put(uint8_t *tspkt, int pid, uint8_t *sect, int len)
+{
+    uint32_t crc;
+
+    crc = tsmux_crc(sect, len);
+    sect[len]     = (uint8_t)(crc >> 24);
+    sect[len + 1] = (uint8_t)(crc >> 16);
+    sect[len + 2] = (uint8_t)(crc >> 8);
+    sect[len + 3] = (uint8_t)crc;
+
+    memset(tspkt, 0xff, TSMUX_PKT);
+    tspkt[0] = 0x47;
+    tspkt[1] = (uint8_t)(0x40 | (pid >> 8));
+    tspkt[2] = (uint8_t)(pid & 0xff);
+    tspkt[3] = 0x10;
+    tspkt[4] = 0x00;        /* pointer_field */
+    memcpy(tspkt + 5, sect, (size_t)(len + 4));
+}
+
+void cls_tsmux::tables_build()
+{
+    uint8_t sect[TSMUX_PKT];
+    int len, slen;
+
+    len = 0;
+    sect[len++] = 0x00;                         /* table_id */
+    slen = 5 + 4 + 4;
+    sect[len++] = (uint8_t)(0xb0 | (slen >> 8));
+    sect[len++] = (uint8_t)(slen & 0xff);
+    sect[len++] = 0x00;                         /* transport_stream_id */
+    sect[len++] = 0x01;
+    sect[len++] = 0xc1;                         /* version 0, current */
+    sect[len++] = 0x00;
+    sect[len++] = 0x00;
+    sect[len++] = (uint8_t)(TSMUX_PROGRAM >> 8);
+    sect[len++] = (uint8_t)(TSMUX_PROGRAM & 0xff);
+    sect[len++] = (uint8_t)(0xe0 | (TSMUX_PID_PMT >> 8));
+    sect[len++] = (uint8_t)(TSMUX_PID_PMT & 0xff);
+    section_put(pat, 0x0000, sect, len);
+
+    len = 0;
+    sect[len++] = 0x02;                         /* table_id */
+    slen = 9 + 4;
+    if (video.index != -1) {
+        slen += 5;
+    }
+    if (audio.index != -1) {
+        slen += 5;
+    }
+    sect[len++] = (uint8_t)(0xb0 | (slen >> 8));
+    sect[len++] = (uint8_t)(slen & 0xff);
+    sect[len++] = (uint8_t)(TSMUX_PROGRAM >> 8);
+    sect[len++] = (uint8_t)(TSMUX_PROGRAM & 0xff);
+    sect[len++] = 0xc1;
+    sect[len++] = 0x00;
+    sect[len++] = 0x00;
+    sect[len++] = (uint8_t)(0xe0 | (pcr_pid >> 8));
+    sect[len++] = (uint8_t)(pcr_pid & 0xff);
+    sect[len++] = 0xf0;                         /* program_info_length */
+    sect[len++] = 0x00;
+    if (video.index != -1) {
+        sect[len++] = video.stream_type;
+        sect[len++] = (uint8_t)(0xe0 | (video.pid >> 8));
+        sect[len++] = (uint8_t)(video.pid & 0xff);
+        sect[len++] = 0xf0;
+        sect[len++] = 0x00;
+    }
+    if (audio.index != -1) {
+        sect[len++] = audio.stream_type;
+        sect[len++] = (uint8_t)(0xe0 | (audio.pid >> 8));
+        sect[len++] = (uint8_t)(audio.pid & 0xff);
+        sect[len++] = 0xf0;
+        sect[len++] = 0x00;
+    }
+    section_put(pmt, TSMUX_PID_PMT, sect, len);
+}
+
+void cls_tsmux::tables_put(unsigned char *&buf, size_t &size, size_t &used)
+{
+    uint8_t *q;
+
+    q = reserve(buf, size, used, TSMUX_PKT * 2);
+    memcpy(q, pat, TSMUX_PKT);
+    q[3] = (uint8_t)(0x10 | pat_cc);
+    pat_cc = (pat_cc + 1) & 0x0f;
+    memcpy(q + TSMUX_PKT, pmt, TSMUX_PKT);
+    q[TSMUX_PKT + 3] = (uint8_t)(0x10 | pmt_cc);
+    pmt_cc = (pmt_cc + 1) & 0x0f;
+}
+
+/* Cut the PES of pkt into transport packets.  The PES header, the AUD
+ * and the payload are copied in turn without being joined first
+*/
+void cls_tsmux::pes_put(ctx_tsmux_es &es, AVPacket *pkt, bool pcr
+    , unsigned char *&buf, size_t &size, size_t &used)
+{
+    uint8_t hdr[19], afl, *q, *p;
+    const uint8_t *seg[3];
+    int seg_len[3], seg_indx, seg_pos;
+    int hdr_len, left, room, af_len, cnt, pes_len;
+    int64_t pts, dts;
+    bool first, key;
+
+    pts = pkt->pts;
+    dts = pkt->dts;
+    if (pts == AV_NOPTS_VALUE) {
+        pts = dts;
+    }
+    if (dts == AV_NOPTS_VALUE) {
+        dts = pts;
+    }
+    key = ((pkt->flags & AV_PKT_FLAG_KEY) != 0);
+
+    seg[1] = tsmux_aud;
+    seg_len[1] = 0;
+    if ((es.is_h264 == true) &&
+        !((pkt->size >= 5) && (pkt->data[0] == 0) && (pkt->data[1] == 0) &&
+          (((pkt->data[2] == 1) && ((pkt->data[3] & 0x1f) == 9)) ||
+           ((pkt->data[2] == 0) && (pkt->data[3] == 1) &&
+            ((pkt->data[4] & 0x1f) == 9))))) {
+        seg_len[1] = sizeof(tsmux_aud);
+    }
+
+    hdr_len = 0;
+    hdr[hdr_len++] = 0x00;
+    hdr[hdr_len++] = 0x00;
+    hdr[hdr_len++] = 0x01;
+    hdr[hdr_len++] = es.stream_id;
+    hdr_len += 2;                               /* PES_packet_length */
+    hdr[hdr_len++] = 0x80;
+    if (pts == AV_NOPTS_VALUE) {
+        hdr[hdr_len++] = 0x00;
+        hdr[hdr_len++] = 0;
+    } else if ((dts != AV_NOPTS_VALUE) && (dts != pts)) {
+        hdr[hdr_len++] = 0xc0;
+        hdr[hdr_len++] = 10;
+        tsmux_ts_put(hdr + hdr_len, 0x03, pts);
+        tsmux_ts_put(hdr + hdr_len + 5, 0x01, dts);
+        hdr_len += 10;
+    } else {
+        hdr[hdr_len++] = 0x80;
+        hdr[hdr_len++] = 5;
+        tsmux_ts_put(hdr + hdr_len, 0x02, pts);
+        hdr_len += 5;
+    }
+    pes_len = (hdr_len - 6) + seg_len[1] + pkt->size;
+    if ((es.stream_id >= 0xe0) || (pes_len > 0xffff)) {
+        pes_len = 0;
+    }
+    hdr[4] = (uint8_t)(pes_len >> 8);
+    hdr[5] = (uint8_t)(pes_len & 0xff);
+
+    seg[0] = hdr;
+    seg_len[0] = hdr_len;
+    seg[2] = pkt->data;
+    seg_len[2] = pkt->size;
+    seg_indx = 0;
+    seg_pos = 0;
+
+    left = seg_len[0] + seg_len[1] + seg_len[2];
+    first = true;
+    while (left > 0) {
+        p = reserve(buf, size, used, TSMUX_PKT);
+
+        afl = 0;
+        if (first == true) {
+            if (key == true) {
+                afl |= 0x40;                    /* random_access_indicator */
+            }
+            if (pcr == true) {
+                afl |= 0x10;
+            }
+        }
+        af_len = 0;
+        if (afl != 0) {
+            af_len = (pcr == true) ? 8 : 2;
+        }
+        room = (TSMUX_PKT - 4) - af_len;
+        if (left < room) {
+            af_len += room - left;
+            room = left;
+        }
+
+        p[0] = 0x47;
+        p[1] = (uint8_t)(((first == true) ? 0x40 : 0x00) | (es.pid >> 8));
+        p[2] = (uint8_t)(es.pid & 0xff);
+        p[3] = (uint8_t)(((af_len > 0) ? 0x30 : 0x10) | es.cc);
+        es.cc = (es.cc + 1) & 0x0f;
+
+        q = p + 4;
+        if (af_len > 0) {
+            q[0] = (uint8_t)(af_len - 1);
+            if (af_len > 1) {
+                q[1] = afl;
+                cnt = 2;
+                if (afl & 0x10) {
+                    /* PCR at the dts as libavformat does without max_delay */
+                    q[2] = (uint8_t)((dts >> 25) & 0xff);
+                    q[3] = (uint8_t)((dts >> 17) & 0xff);
+                    q[4] = (uint8_t)((dts >> 9) & 0xff);
+                    q[5] = (uint8_t)((dts >> 1) & 0xff);
+                    q[6] = (uint8_t)(((dts & 1) << 7) | 0x7e);
+                    q[7] = 0x00;
+                    cnt = 8;
+                }
+                memset(q + cnt, 0xff, (size_t)(af_len - cnt));
+            }
+            q += af_len;
+        }
+
+        left -= room;
+        while (room > 0) {
+            cnt = seg_len[seg_indx] - seg_pos;
+            if (cnt > room) {
+                cnt = room;
+            }
+            memcpy(q, seg[seg_indx] + seg_pos, (size_t)cnt);
+            q += cnt;
+            room -= cnt;
+            seg_pos += cnt;
+            if (seg_pos == seg_len[seg_indx]) {
+                seg_indx++;
+                seg_pos = 0;
+            }
+        }
+        first = false;
+    }
+}
+
+/* Add the transport packets of pkt to buf.  The timestamps must be in 90 kHz */
+int cls_tsmux::write(AVPacket *pkt, unsigned char *&buf
+    , size_t &size, size_t &used)
+{
+    ctx_tsmux_es *es;
+    bool key, pcr;
+    int64_t dts;
+
+    if ((video.index != -1) && (pkt->stream_index == video.index)) {
+        es = &video;
+    } else if ((audio.index != -1) && (pkt->stream_index == audio.index)) {
+        es = &audio;
+    } else {
+        return 0;
+    }
+
+    dts = pkt->dts;
+    if (dts == AV_NOPTS_VALUE) {
+        dts = pkt->pts;
+    }
+    key = ((pkt->flags & AV_PKT_FLAG_KEY) != 0);
+
+    if ((table_dts == AV_NOPTS_VALUE) ||
+        ((es == &video) && (key == true)) ||
+        ((dts != AV_NOPTS_VALUE) && ((dts - table_dts) >= TSMUX_TABLE_IVL))) {
+        tables_put(buf, size, used);
+        table_dts = dts;
+    }
+
+    pcr = false;
+    if ((es->pid == pcr_pid) && (dts != AV_NOPTS_VALUE) &&
+        ((pcr_dts == AV_NOPTS_VALUE) || (key == true) ||
+         ((dts - pcr_dts) >= TSMUX_PCR_IVL))) {
+        pcr = true;
+        pcr_dts = dts;
+    }
+
+    pes_put(*es, pkt, pcr, buf, size, used);
+
+    return 0;
+}
+
+int cls_tsmux::init(int video_index, enum AVCodecID video_codec
+    , int audio_index, enum AVCodecID audio_codec)
+{
+    video.index = video_index;
+    video.pid = TSMUX_PID_VIDEO;
+    video.cc = 0;
+    video.stream_id = 0xe0;
+    video.is_h264 = (video_codec == AV_CODEC_ID_H264);
+    if (video_codec == AV_CODEC_ID_H264) {
+        video.stream_type = 0x1b;
+    } else if (video_codec == AV_CODEC_ID_MPEG2VIDEO) {
+        video.stream_type = 0x02;
+    } else if (video_index != -1) {
+        return -1;
+    }
+
+    audio.index = audio_index;
+    audio.pid = (video_index == -1) ? TSMUX_PID_VIDEO : TSMUX_PID_AUDIO;
+    audio.cc = 0;
+    audio.is_h264 = false;
+    if (audio_codec == AV_CODEC_ID_AC3) {
+        audio.stream_type = 0x81;
+        audio.stream_id = 0xbd;
+    } else if (audio_codec == AV_CODEC_ID_MP2) {
+        audio.stream_type = 0x03;
+        audio.stream_id = 0xc0;
+    } else if (audio_index != -1) {
+        return -1;
+    }
+
+    pcr_pid = (video_index != -1) ? video.pid : audio.pid;
+    tables_build();
+
+    return 0;
+}
+
+cls_tsmux::cls_tsmux()
+{
+    video.index = -1;
+    audio.index = -1;
+    video.pid = TSMUX_PID_VIDEO;
+    audio.pid = TSMUX_PID_AUDIO;
+    video.cc = 0;
+    audio.cc = 0;
+    video.stream_type = 0;
+    audio.stream_type = 0;
+    video.stream_id = 0xe0;
+    audio.stream_id = 0xbd;
+    video.is_h264 = false;
+    audio.is_h264 = false;
+    pcr_pid = TSMUX_PID_VIDEO;
+    pat_cc = 0;
+    pmt_cc = 0;
+    table_dts = AV_NOPTS_VALUE;
+    pcr_dts = AV_NOPTS_VALUE;
+    memset(pat, 0xff, sizeof(pat));
+    memset(pmt, 0xff, sizeof(pmt));
+}
+
+cls_tsmux::~cls_tsmux()
+{
+}
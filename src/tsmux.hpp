@@ -0,0 +1,75 @@
+/*
+ *    This file is part of Restream.
+ *
+ *    Restream is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    Restream is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with Restream.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef _INCLUDE_TSMUX_HPP_
+#define _INCLUDE_TSMUX_HPP_
+    #define TSMUX_PKT           188
+    #define TSMUX_PID_PMT       0x1000      /* Same pids and program as the libavformat muxer */
+    #define TSMUX_PID_VIDEO     0x100
+    #define TSMUX_PID_AUDIO     0x101
+    #define TSMUX_PROGRAM       1
+    #define TSMUX_TABLE_IVL     9000        /* 90 kHz ticks between PAT/PMT repeats */
+    #define TSMUX_PCR_IVL       1800        /* 90 kHz ticks between PCRs */
+    #define TSMUX_GROW          (TSMUX_PKT * 512)
+
+    /* Elementary stream of the transport stream */
+    struct ctx_tsmux_es {
+        int         index;          /* Stream index of the packets */
+        int         pid;
+        int         cc;             /* Continuity counter */
+        uint8_t     stream_type;
+        uint8_t     stream_id;
+        bool        is_h264;
+    };
+
+    /* Writes the packets of one H.264 or MPEG-2 video and one AC3 audio
+     * stream as a single program transport stream.  The PAT and PMT are
+     * built once and each PES is cut straight into 188 byte packets in
+     * the caller's response buffer so nothing is allocated per packet
+    */
+    class cls_tsmux {
+        public:
+            cls_tsmux();
+            ~cls_tsmux();
+
+            int     init(int video_index, enum AVCodecID video_codec
+                        , int audio_index, enum AVCodecID audio_codec);
+            int     write(AVPacket *pkt, unsigned char *&buf
+                        , size_t &size, size_t &used);
+
+        private:
+            ctx_tsmux_es    video;
+            ctx_tsmux_es    audio;
+            int             pcr_pid;
+            uint8_t         pat[TSMUX_PKT];
+            uint8_t         pmt[TSMUX_PKT];
+            int             pat_cc;
+            int             pmt_cc;
+            int64_t         table_dts;      /* dts when the tables were last sent */
+            int64_t         pcr_dts;
+
+            uint8_t *reserve(unsigned char *&buf, size_t &size
+                        , size_t &used, size_t cnt);
+            void    section_put(uint8_t *tspkt, int pid, uint8_t *sect, int len);
+            void    tables_build();
+            void    tables_put(unsigned char *&buf, size_t &size, size_t &used);
+            void    pes_put(ctx_tsmux_es &es, AVPacket *pkt, bool pcr
+                        , unsigned char *&buf, size_t &size, size_t &used);
+    };
+
+#endif
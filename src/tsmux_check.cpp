@@ -0,0 +1,808 @@
+/*
+ *    This file is part of Restream.
+ *
+ *    Restream is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    Restream is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with Restream.  If not, see <https://www.gnu.org/licenses/>.
+ *
+*/
+
+/* Checks the native TS packetizer against the libavformat muxer.  The
+ * same packets are written by both and each output is parsed: sync
+ * bytes, continuity counters, adaptation fields, PCRs, section CRCs and
+ * PES headers.  The elementary streams and the video timestamps carried
+ * by the two outputs must then be the same.
+ *
+ * Without an argument MPEG-2 video and MP2 audio are encoded for the
+ * test.  A file given as the argument is checked with its own packets
+ * instead, for example an H.264 and AC3 recording of a channel.
+ * Exits 0 when both outputs pass, 1 on a failure and 77 when the test
+ * can not run here.
+*/
+
+#include "restream.hpp"
+#include "tsmux.hpp"
+
+#define TSCHECK_FRAMES      100         /* Video frames encoded for the test */
+#define TSCHECK_OFFSET      90000       /* Start of the test timestamps in 90 kHz */
+#define TSCHECK_ERR_MAX     20          /* Errors printed per output */
+
+struct ctx_tscheck_pes {
+    int64_t     pts;
+    int64_t     dts;
+    int         size;
+};
+
+struct ctx_tscheck_es {
+    int         pid;
+    int         stream_type;
+    std::vector<uint8_t>            cur;    /* PES being collected */
+    std::vector<uint8_t>            data;   /* Elementary stream bytes */
+    std::vector<ctx_tscheck_pes>    pes;
+};
+
+struct ctx_tscheck {
+    const char  *name;
+    int         pmt_pid;
+    int         pcr_pid;
+    int         cc[0x2000];
+    int64_t     pcr_last;
+    int         pcr_cnt;
+    int         pkt_cnt;
+    int         err_cnt;
+    std::vector<ctx_tscheck_es>     es;
+};
+
+static int tscheck_avio_write(void *opaque, uint8_t *buf, int buf_size)
+{
+    std::vector<uint8_t> *out = (std::vector<uint8_t> *)opaque;
+
+    out->insert(out->end(), buf, buf + buf_size);
+    return buf_size;
+}
+
+static void tscheck_err(ctx_tscheck &ts, const char *fmt, ...)
+{
+    va_list ap;
+
+    ts.err_cnt++;
+    if (ts.err_cnt > TSCHECK_ERR_MAX) {
+        return;
+    }
+    printf("%s: packet %d: ", ts.name, ts.pkt_cnt);
+    va_start(ap, fmt);
+    vprintf(fmt, ap);
+    va_end(ap);
+    printf("\n");
+}
+
+/* CRC32 of the MPEG-2 sections.  Over a section with its CRC it is zero */
+static uint32_t tscheck_crc(const uint8_t *data, int len)
+{
+    uint32_t crc;
+    int indx, bit;
+
+    crc = 0xffffffff;
+    for (indx=0; indx < len; indx++) {
+        crc ^= (uint32_t)data[indx] << 24;
+        for (bit=0; bit < 8; bit++) {
+            if (crc & 0x80000000) {
+                crc = (crc << 1) ^ 0x04c11db7;
+            } else {
+                crc = crc << 1;
+            }
+        }
+    }
+    return crc;
+}
+
+/* Read a 33 bit PES timestamp.  -1 when a marker bit is missing */
+static int64_t tscheck_ts_get(const uint8_t *q)
+{
+    if (((q[0] & 1) == 0) || ((q[2] & 1) == 0) || ((q[4] & 1) == 0)) {
+        return -1;
+    }
+    return ((int64_t)((q[0] >> 1) & 0x07) << 30) |
+        ((int64_t)q[1] << 22) | ((int64_t)(q[2] >> 1) << 15) |
+        ((int64_t)q[3] << 7) | (int64_t)(q[4] >> 1);
+}
+
+static ctx_tscheck_es *tscheck_es(ctx_tscheck &ts, int pid)
+{
+    int indx;
+
+    for (indx=0; indx < (int)ts.es.size(); indx++) {
+        if (ts.es[indx].pid == pid) {
+            return &ts.es[indx];
+        }
+    }
+    return nullptr;
+}
+
+static bool tscheck_is_video(int stream_type)
+{
+    return ((stream_type == 0x1b) || (stream_type == 0x02));
+}
+
+/* Check the header of the collected PES and keep its payload */
+static void tscheck_pes_end(ctx_tscheck &ts, ctx_tscheck_es &es)
+{
+    ctx_tscheck_pes pes;
+    const uint8_t *q;
+    int pes_len, hdr_len, flags, len;
+
+    if (es.cur.empty() == true) {
+        return;
+    }
+    q = es.cur.data();
+    len = (int)es.cur.size();
+
+    if ((len < 9) || (q[0] != 0) || (q[1] != 0) || (q[2] != 1)) {
+        tscheck_err(ts, "pid 0x%x PES without a start code", es.pid);
+        es.cur.clear();
+        return;
+    }
+    pes_len = (q[4] << 8) | q[5];
+    if ((pes_len != 0) && (pes_len != (len - 6))) {
+        tscheck_err(ts, "pid 0x%x PES length %d but %d bytes"
+            , es.pid, pes_len, len - 6);
+    }
+    if ((q[6] & 0xc0) != 0x80) {
+        tscheck_err(ts, "pid 0x%x bad PES header marker", es.pid);
+    }
+    flags = q[7] & 0xc0;
+    hdr_len = q[8];
+    if ((9 + hdr_len) > len) {
+        tscheck_err(ts, "pid 0x%x PES header runs past the PES", es.pid);
+        es.cur.clear();
+        return;
+    }
+
+    pes.pts = AV_NOPTS_VALUE;
+    pes.dts = AV_NOPTS_VALUE;
+    if (flags == 0x80) {
+        if ((hdr_len < 5) || ((q[9] >> 4) != 0x02)) {
+            tscheck_err(ts, "pid 0x%x bad PTS field", es.pid);
+        } else {
+            pes.pts = tscheck_ts_get(q + 9);
+            pes.dts = pes.pts;
+        }
+    } else if (flags == 0xc0) {
+        if ((hdr_len < 10) || ((q[9] >> 4) != 0x03) || ((q[14] >> 4) != 0x01)) {
+            tscheck_err(ts, "pid 0x%x bad PTS/DTS fields", es.pid);
+        } else {
+            pes.pts = tscheck_ts_get(q + 9);
+            pes.dts = tscheck_ts_get(q + 14);
+        }
+    } else if (flags == 0x40) {
+        tscheck_err(ts, "pid 0x%x DTS without PTS", es.pid);
+    }
+    if ((pes.pts == -1) || (pes.dts == -1)) {
+        tscheck_err(ts, "pid 0x%x timestamp marker bit missing", es.pid);
+    }
+
+    pes.size = len - 9 - hdr_len;
+    es.data.insert(es.data.end(), es.cur.begin() + 9 + hdr_len, es.cur.end());
+    es.pes.push_back(pes);
+    es.cur.clear();
+}
+
+/* The tables of both muxers fit in one packet each */
+static void tscheck_section(ctx_tscheck &ts, int pid, const uint8_t *p, int len)
+{
+    const uint8_t *s;
+    int ptr, sl, pos, end, info_len, es_pid;
+    ctx_tscheck_es es;
+
+    if (len < 1) {
+        tscheck_err(ts, "pid 0x%x empty section packet", pid);
+        return;
+    }
+    ptr = p[0];
+    if ((1 + ptr + 3) > len) {
+        tscheck_err(ts, "pid 0x%x pointer field past the packet", pid);
+        return;
+    }
+    s = p + 1 + ptr;
+    len -= 1 + ptr;
+    sl = ((s[1] & 0x0f) << 8) | s[2];
+    if ((3 + sl) > len) {
+        tscheck_err(ts, "pid 0x%x section of %d bytes spans packets", pid, sl);
+        return;
+    }
+    if (sl < 9) {
+        tscheck_err(ts, "pid 0x%x section too short", pid);
+        return;
+    }
+    if (tscheck_crc(s, 3 + sl) != 0) {
+        tscheck_err(ts, "pid 0x%x table 0x%x CRC mismatch", pid, s[0]);
+        return;
+    }
+
+    end = 3 + sl - 4;
+    if ((pid == 0) && (s[0] == 0x00)) {
+        for (pos=8; (pos + 4) <= end; pos += 4) {
+            if (((s[pos] << 8) | s[pos + 1]) != 0) {
+                ts.pmt_pid = ((s[pos + 2] & 0x1f) << 8) | s[pos + 3];
+            }
+        }
+    } else if ((pid == ts.pmt_pid) && (s[0] == 0x02)) {
+        ts.pcr_pid = ((s[8] & 0x1f) << 8) | s[9];
+        info_len = ((s[10] & 0x0f) << 8) | s[11];
+        for (pos = 12 + info_len; (pos + 5) <= end; ) {
+            es_pid = ((s[pos + 1] & 0x1f) << 8) | s[pos + 2];
+            if (tscheck_es(ts, es_pid) == nullptr) {
+                es.pid = es_pid;
+                es.stream_type = s[pos];
+                ts.es.push_back(es);
+            } else if (tscheck_es(ts, es_pid)->stream_type != s[pos]) {
+                tscheck_err(ts, "pid 0x%x changed stream type", es_pid);
+            }
+            pos += 5 + (((s[pos + 3] & 0x0f) << 8) | s[pos + 4]);
+        }
+    }
+}
+
+static void tscheck_parse(ctx_tscheck &ts, std::vector<uint8_t> &buf)
+{
+    const uint8_t *p;
+    int indx, pid, afc, cc, off, af_len, flags, used;
+    bool pusi;
+    int64_t pcr;
+    ctx_tscheck_es *es;
+
+    ts.pmt_pid = -1;
+    ts.pcr_pid = -1;
+    for (indx=0; indx < 0x2000; indx++) {
+        ts.cc[indx] = -1;
+    }
+    ts.pcr_last = -1;
+    ts.pcr_cnt = 0;
+    ts.pkt_cnt = 0;
+    ts.err_cnt = 0;
+    ts.es.clear();
+
+    if ((buf.size() % TSMUX_PKT) != 0) {
+        tscheck_err(ts, "output of %d bytes is not whole packets", (int)buf.size());
+    }
+
+    for (ts.pkt_cnt=0; ts.pkt_cnt < (int)(buf.size() / TSMUX_PKT); ts.pkt_cnt++) {
+        p = buf.data() + (ts.pkt_cnt * TSMUX_PKT);
+        if (p[0] != 0x47) {
+            tscheck_err(ts, "sync byte 0x%02x", p[0]);
+            continue;
+        }
+        pid = ((p[1] & 0x1f) << 8) | p[2];
+        pusi = ((p[1] & 0x40) != 0);
+        afc = (p[3] >> 4) & 0x03;
+        cc = p[3] & 0x0f;
+        if ((p[1] & 0x80) != 0) {
+            tscheck_err(ts, "pid 0x%x transport error bit", pid);
+        }
+        if (pid == 0x1fff) {
+            continue;
+        }
+        if (afc == 0) {
+            tscheck_err(ts, "pid 0x%x reserved adaptation field control", pid);
+            continue;
+        }
+
+        if ((afc & 0x01) != 0) {
+            if ((ts.cc[pid] != -1) && (cc != ((ts.cc[pid] + 1) & 0x0f))) {
+                tscheck_err(ts, "pid 0x%x continuity %d after %d"
+                    , pid, cc, ts.cc[pid]);
+            }
+            ts.cc[pid] = cc;
+        }
+
+        off = 4;
+        if ((afc & 0x02) != 0) {
+            af_len = p[4];
+            if (((afc == 0x02) && (af_len != 183)) ||
+                ((afc == 0x03) && (af_len > 182))) {
+                tscheck_err(ts, "pid 0x%x adaptation field length %d", pid, af_len);
+                continue;
+            }
+            if (af_len > 0) {
+                flags = p[5];
+                used = 1;
+                if ((flags & 0x10) != 0) {
+                    if (af_len < 7) {
+                        tscheck_err(ts, "pid 0x%x PCR in a short adaptation field", pid);
+                        continue;
+                    }
+                    pcr = ((int64_t)p[6] << 25) | ((int64_t)p[7] << 17) |
+                        ((int64_t)p[8] << 9) | ((int64_t)p[9] << 1) | (p[10] >> 7);
+                    pcr = (pcr * 300) + (((p[10] & 0x01) << 8) | p[11]);
+                    if (pid != ts.pcr_pid) {
+                        tscheck_err(ts, "PCR on pid 0x%x, the PCR pid is 0x%x"
+                            , pid, ts.pcr_pid);
+                    }
+                    if (pcr < ts.pcr_last) {
+                        tscheck_err(ts, "PCR went back");
+                    }
+                    ts.pcr_last = pcr;
+                    ts.pcr_cnt++;
+                    used += 6;
+                }
+                if ((flags & 0x0f) == 0) {
+                    for (; used < af_len; used++) {
+                        if (p[5 + used] != 0xff) {
+                            tscheck_err(ts, "pid 0x%x stuffing byte 0x%02x"
+                                , pid, p[5 + used]);
+                            break;
+                        }
+                    }
+                }
+            }
+            off += 1 + af_len;
+        }
+        if ((afc & 0x01) == 0) {
+            continue;
+        }
+
+        if ((pid == 0) || (pid == 0x11) || (pid == ts.pmt_pid)) {
+            if (pusi == true) {
+                tscheck_section(ts, pid, p + off, TSMUX_PKT - off);
+            }
+            continue;
+        }
+
+        es = tscheck_es(ts, pid);
+        if (es == nullptr) {
+            tscheck_err(ts, "pid 0x%x not in the PMT", pid);
+            continue;
+        }
+        if (pusi == true) {
+            tscheck_pes_end(ts, *es);
+        } else if (es->cur.empty() == true) {
+            tscheck_err(ts, "pid 0x%x payload before the first PES start", pid);
+            continue;
+        }
+        es->cur.insert(es->cur.end(), p + off, p + TSMUX_PKT);
+    }
+
+    for (indx=0; indx < (int)ts.es.size(); indx++) {
+        tscheck_pes_end(ts, ts.es[indx]);
+    }
+    if (ts.pmt_pid == -1) {
+        tscheck_err(ts, "no PAT");
+    }
+    if (ts.es.empty() == true) {
+        tscheck_err(ts, "no PMT");
+    }
+    if (ts.pcr_cnt == 0) {
+        tscheck_err(ts, "no PCR");
+    }
+}
+
+/* Both outputs must carry the same streams and bytes.  The native output
+ * has a PES for every packet.  libavformat may put several audio frames
+ * in one PES so its audio timestamps need only be among the native ones
+*/
+static int tscheck_compare(ctx_tscheck &nat, ctx_tscheck &lavf
+    , std::vector<AVPacket*> &pkts, int video_index)
+{
+    int indx, pos, errs, want;
+    int64_t offset, pts;
+    bool found;
+    size_t chk;
+
+    errs = 0;
+    if (nat.es.size() != lavf.es.size()) {
+        printf("compare: %d native streams and %d libavformat streams\n"
+            , (int)nat.es.size(), (int)lavf.es.size());
+        return 1;
+    }
+
+    offset = 0;
+    for (indx=0; indx < (int)nat.es.size(); indx++) {
+        if ((nat.es[indx].pes.empty() == false) &&
+            (lavf.es[indx].pes.empty() == false) &&
+            (nat.es[indx].pes[0].dts != AV_NOPTS_VALUE)) {
+            offset = lavf.es[indx].pes[0].dts - nat.es[indx].pes[0].dts;
+            break;
+        }
+    }
+
+    for (indx=0; indx < (int)nat.es.size(); indx++) {
+        ctx_tscheck_es &a = nat.es[indx];
+        ctx_tscheck_es &b = lavf.es[indx];
+
+        if (a.stream_type != b.stream_type) {
+            printf("compare: stream %d type 0x%x and 0x%x\n"
+                , indx, a.stream_type, b.stream_type);
+            errs++;
+            continue;
+        }
+
+        want = 0;
+        for (pos=0; pos < (int)pkts.size(); pos++) {
+            if ((pkts[pos]->stream_index == video_index) ==
+                tscheck_is_video(a.stream_type)) {
+                want++;
+            }
+        }
+        if ((int)a.pes.size() != want) {
+            printf("compare: stream %d has %d native PES for %d packets\n"
+                , indx, (int)a.pes.size(), want);
+            errs++;
+        }
+
+        if (a.data.size() != b.data.size()) {
+            printf("compare: stream %d has %d native and %d libavformat bytes\n"
+                , indx, (int)a.data.size(), (int)b.data.size());
+            errs++;
+        }
+        for (chk=0; chk < a.data.size() && chk < b.data.size(); chk++) {
+            if (a.data[chk] != b.data[chk]) {
+                printf("compare: stream %d differs at byte %d\n", indx, (int)chk);
+                errs++;
+                break;
+            }
+        }
+
+        if (tscheck_is_video(a.stream_type) == true) {
+            if (a.pes.size() != b.pes.size()) {
+                printf("compare: stream %d has %d native and %d libavformat PES\n"
+                    , indx, (int)a.pes.size(), (int)b.pes.size());
+                errs++;
+            }
+            for (pos=0; pos < (int)a.pes.size() && pos < (int)b.pes.size(); pos++) {
+                if (((a.pes[pos].pts + offset) != b.pes[pos].pts) ||
+                    ((a.pes[pos].dts + offset) != b.pes[pos].dts) ||
+                    (a.pes[pos].size != b.pes[pos].size)) {
+                    printf("compare: stream %d PES %d pts %ld/%ld dts %ld/%ld size %d/%d\n"
+                        , indx, pos
+                        , (long)a.pes[pos].pts, (long)(b.pes[pos].pts - offset)
+                        , (long)a.pes[pos].dts, (long)(b.pes[pos].dts - offset)
+                        , a.pes[pos].size, b.pes[pos].size);
+                    errs++;
+                    break;
+                }
+            }
+        } else {
+            for (pos=0; pos < (int)b.pes.size(); pos++) {
+                pts = b.pes[pos].pts - offset;
+                found = false;
+                for (chk=0; chk < a.pes.size(); chk++) {
+                    if (a.pes[chk].pts == pts) {
+                        found = true;
+                        break;
+                    }
+                }
+                if (found == false) {
+                    printf("compare: stream %d libavformat PES %d pts %ld not in the native output\n"
+                        , indx, pos, (long)pts);
+                    errs++;
+                    break;
+                }
+            }
+        }
+    }
+
+    return (errs == 0) ? 0 : 1;
+}
+
+/* Encode a test pattern and a tone so the check needs no input file */
+static int tscheck_encode(std::vector<AVPacket*> &pkts
+    , AVCodecParameters *video_par, AVCodecParameters *audio_par)
+{
+    const AVCodec *codec;
+    AVCodecContext *enc[2];
+    AVFrame *frm;
+    AVPacket *pkt;
+    int indx, strm, x, y, cnt, smp;
+    int16_t *samples;
+    std::vector<AVPacket*> out[2];
+    size_t pos[2];
+
+    enc[0] = nullptr;
+    enc[1] = nullptr;
+
+    codec = avcodec_find_encoder(AV_CODEC_ID_MPEG2VIDEO);
+    if (codec == nullptr) {
+        return 77;
+    }
+    enc[0] = avcodec_alloc_context3(codec);
+    enc[0]->width = 352;
+    enc[0]->height = 288;
+    enc[0]->pix_fmt = AV_PIX_FMT_YUV420P;
+    enc[0]->time_base = AVRational{1, 25};
+    enc[0]->framerate = AVRational{25, 1};
+    enc[0]->gop_size = 12;
+    enc[0]->max_b_frames = 2;
+    enc[0]->bit_rate = 1000000;
+
+    codec = avcodec_find_encoder(AV_CODEC_ID_MP2);
+    if (codec == nullptr) {
+        avcodec_free_context(&enc[0]);
+        return 77;
+    }
+    enc[1] = avcodec_alloc_context3(codec);
+    enc[1]->sample_rate = 48000;
+    enc[1]->sample_fmt = AV_SAMPLE_FMT_S16;
+    av_channel_layout_default(&enc[1]->ch_layout, 2);
+    enc[1]->time_base = AVRational{1, 48000};
+    enc[1]->bit_rate = 192000;
+
+    if ((avcodec_open2(enc[0], enc[0]->codec, NULL) < 0) ||
+        (avcodec_open2(enc[1], enc[1]->codec, NULL) < 0)) {
+        avcodec_free_context(&enc[0]);
+        avcodec_free_context(&enc[1]);
+        return 77;
+    }
+    avcodec_parameters_from_context(video_par, enc[0]);
+    avcodec_parameters_from_context(audio_par, enc[1]);
+
+    frm = av_frame_alloc();
+    pkt = av_packet_alloc();
+    for (strm=0; strm < 2; strm++) {
+        if (strm == 0) {
+            cnt = TSCHECK_FRAMES;
+        } else {
+            cnt = (TSCHECK_FRAMES * 48000) / (25 * enc[1]->frame_size);
+        }
+        for (indx=0; indx <= cnt; indx++) {
+            if (indx < cnt) {
+                av_frame_unref(frm);
+                if (strm == 0) {
+                    frm->format = enc[0]->pix_fmt;
+                    frm->width = enc[0]->width;
+                    frm->height = enc[0]->height;
+                } else {
+                    frm->format = enc[1]->sample_fmt;
+                    frm->nb_samples = enc[1]->frame_size;
+                    av_channel_layout_copy(&frm->ch_layout, &enc[1]->ch_layout);
+                }
+                av_frame_get_buffer(frm, 0);
+                if (strm == 0) {
+                    for (y=0; y < frm->height; y++) {
+                        for (x=0; x < frm->width; x++) {
+                            frm->data[0][(y * frm->linesize[0]) + x] =
+                                (uint8_t)(x + y + (indx * 3));
+                        }
+                    }
+                    for (y=0; y < (frm->height / 2); y++) {
+                        memset(frm->data[1] + (y * frm->linesize[1]), 128, (size_t)(frm->width / 2));
+                        memset(frm->data[2] + (y * frm->linesize[2]), 128, (size_t)(frm->width / 2));
+                    }
+                    frm->pts = indx;
+                } else {
+                    samples = (int16_t *)frm->data[0];
+                    for (smp=0; smp < frm->nb_samples; smp++) {
+                        samples[smp * 2] = (int16_t)(((smp * 37) % 2000) - 1000);
+                        samples[(smp * 2) + 1] = samples[smp * 2];
+                    }
+                    frm->pts = (int64_t)indx * enc[1]->frame_size;
+                }
+                avcodec_send_frame(enc[strm], frm);
+            } else {
+                avcodec_send_frame(enc[strm], NULL);
+            }
+            while (avcodec_receive_packet(enc[strm], pkt) == 0) {
+                av_packet_rescale_ts(pkt, enc[strm]->time_base, AVRational{1, 90000});
+                pkt->pts += TSCHECK_OFFSET;
+                pkt->dts += TSCHECK_OFFSET;
+                pkt->stream_index = strm;
+                out[strm].push_back(av_packet_clone(pkt));
+                av_packet_unref(pkt);
+            }
+        }
+    }
+    av_packet_free(&pkt);
+    av_frame_free(&frm);
+    avcodec_free_context(&enc[0]);
+    avcodec_free_context(&enc[1]);
+
+    /* Interleave on dts as the channel's ring does */
+    pos[0] = 0;
+    pos[1] = 0;
+    while ((pos[0] < out[0].size()) || (pos[1] < out[1].size())) {
+        if ((pos[1] >= out[1].size()) ||
+            ((pos[0] < out[0].size()) && (out[0][pos[0]]->dts <= out[1][pos[1]]->dts))) {
+            pkts.push_back(out[0][pos[0]++]);
+        } else {
+            pkts.push_back(out[1][pos[1]++]);
+        }
+    }
+
+    return 0;
+}
+
+/* Take the first video and audio stream of a file */
+static int tscheck_read(const char *fnm, std::vector<AVPacket*> &pkts
+    , AVCodecParameters *video_par, AVCodecParameters *audio_par)
+{
+    AVFormatContext *fmt_ctx;
+    AVPacket *pkt;
+    int strm[2];
+
+    fmt_ctx = nullptr;
+    if (avformat_open_input(&fmt_ctx, fnm, NULL, NULL) < 0) {
+        printf("Could not open %s\n", fnm);
+        return 1;
+    }
+    avformat_find_stream_info(fmt_ctx, NULL);
+    strm[0] = av_find_best_stream(fmt_ctx, AVMEDIA_TYPE_VIDEO, -1, -1, NULL, 0);
+    strm[1] = av_find_best_stream(fmt_ctx, AVMEDIA_TYPE_AUDIO, -1, -1, NULL, 0);
+    if (strm[0] >= 0) {
+        avcodec_parameters_copy(video_par, fmt_ctx->streams[strm[0]]->codecpar);
+    }
+    if (strm[1] >= 0) {
+        avcodec_parameters_copy(audio_par, fmt_ctx->streams[strm[1]]->codecpar);
+    }
+
+    pkt = av_packet_alloc();
+    while (av_read_frame(fmt_ctx, pkt) >= 0) {
+        if ((pkt->stream_index == strm[0]) || (pkt->stream_index == strm[1])) {
+            av_packet_rescale_ts(pkt, fmt_ctx->streams[pkt->stream_index]->time_base
+                , AVRational{1, 90000});
+            pkt->stream_index = (pkt->stream_index == strm[0]) ? 0 : 1;
+            pkts.push_back(av_packet_clone(pkt));
+        }
+        av_packet_unref(pkt);
+    }
+    av_packet_free(&pkt);
+    avformat_close_input(&fmt_ctx);
+
+    if (strm[0] < 0) {
+        video_par->codec_id = AV_CODEC_ID_NONE;
+    }
+    if (strm[1] < 0) {
+        audio_par->codec_id = AV_CODEC_ID_NONE;
+    }
+
+    return 0;
+}
+
+/* Write the packets with the libavformat muxer as the lavf path of the
+ * client streams does
+*/
+static int tscheck_lavf(std::vector<AVPacket*> &pkts, std::vector<uint8_t> &out
+    , AVCodecParameters *video_par, AVCodecParameters *audio_par)
+{
+    AVFormatContext *fmt_ctx;
+    AVStream *strm;
+    AVPacket *pkt;
+    unsigned char *aviobuf;
+    int map[2], indx;
+
+    fmt_ctx = nullptr;
+    avformat_alloc_output_context2(&fmt_ctx, NULL, "mpegts", NULL);
+    if (fmt_ctx == nullptr) {
+        return -1;
+    }
+    map[0] = -1;
+    map[1] = -1;
+    if (video_par->codec_id != AV_CODEC_ID_NONE) {
+        strm = avformat_new_stream(fmt_ctx, NULL);
+        avcodec_parameters_copy(strm->codecpar, video_par);
+        strm->codecpar->codec_tag = 0;
+        strm->time_base = AVRational{1, 90000};
+        map[0] = strm->index;
+    }
+    if (audio_par->codec_id != AV_CODEC_ID_NONE) {
+        strm = avformat_new_stream(fmt_ctx, NULL);
+        avcodec_parameters_copy(strm->codecpar, audio_par);
+        strm->codecpar->codec_tag = 0;
+        strm->time_base = AVRational{1, 90000};
+        map[1] = strm->index;
+    }
+
+    aviobuf = (unsigned char *)av_malloc(4096);
+    fmt_ctx->pb = avio_alloc_context(aviobuf, 4096, 1, &out
+        , NULL, &tscheck_avio_write, NULL);
+    fmt_ctx->flags |= AVFMT_FLAG_CUSTOM_IO;
+    if (avformat_write_header(fmt_ctx, NULL) < 0) {
+        av_freep(&fmt_ctx->pb->buffer);
+        avio_context_free(&fmt_ctx->pb);
+        avformat_free_context(fmt_ctx);
+        return -1;
+    }
+
+    for (indx=0; indx < (int)pkts.size(); indx++) {
+        if (map[pkts[indx]->stream_index] == -1) {
+            continue;
+        }
+        pkt = av_packet_clone(pkts[indx]);
+        pkt->stream_index = map[pkt->stream_index];
+        av_interleaved_write_frame(fmt_ctx, pkt);
+        av_packet_free(&pkt);
+    }
+    av_write_trailer(fmt_ctx);
+    avio_flush(fmt_ctx->pb);
+
+    av_freep(&fmt_ctx->pb->buffer);
+    avio_context_free(&fmt_ctx->pb);
+    avformat_free_context(fmt_ctx);
+
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    std::vector<AVPacket*> pkts;
+    std::vector<uint8_t> lavf_out, nat_out;
+    AVCodecParameters *video_par, *audio_par;
+    cls_tsmux *tsmux;
+    ctx_tscheck nat, lavf;
+    unsigned char *buf;
+    size_t size, used;
+    int retcd, indx, video_index, audio_index;
+
+    av_log_set_level(AV_LOG_ERROR);
+    video_par = avcodec_parameters_alloc();
+    audio_par = avcodec_parameters_alloc();
+
+    if (argc > 1) {
+        retcd = tscheck_read(argv[1], pkts, video_par, audio_par);
+    } else {
+        retcd = tscheck_encode(pkts, video_par, audio_par);
+    }
+    if (retcd != 0) {
+        if (retcd == 77) {
+            printf("Encoders for the test are not available\n");
+        }
+        return retcd;
+    }
+
+    video_index = (video_par->codec_id != AV_CODEC_ID_NONE) ? 0 : -1;
+    audio_index = (audio_par->codec_id != AV_CODEC_ID_NONE) ? 1 : -1;
+    tsmux = new cls_tsmux();
+    if (tsmux->init(video_index, video_par->codec_id
+            , audio_index, audio_par->codec_id) != 0) {
+        printf("Streams not supported by the native packetizer\n");
+        delete tsmux;
+        return 77;
+    }
+    buf = nullptr;
+    size = 0;
+    used = 0;
+    for (indx=0; indx < (int)pkts.size(); indx++) {
+        tsmux->write(pkts[indx], buf, size, used);
+    }
+    nat_out.assign(buf, buf + used);
+    free(buf);
+    delete tsmux;
+
+    if (tscheck_lavf(pkts, lavf_out, video_par, audio_par) != 0) {
+        printf("The libavformat muxer could not be opened\n");
+        return 1;
+    }
+
+    nat.name = "native";
+    tscheck_parse(nat, nat_out);
+    lavf.name = "lavf";
+    tscheck_parse(lavf, lavf_out);
+
+    printf("native: %d packets, %d errors.  lavf: %d packets, %d errors\n"
+        , (int)(nat_out.size() / TSMUX_PKT), nat.err_cnt
+        , (int)(lavf_out.size() / TSMUX_PKT), lavf.err_cnt);
+
+    retcd = 0;
+    if ((nat.err_cnt > 0) || (lavf.err_cnt > 0)) {
+        retcd = 1;
+    } else {
+        retcd = tscheck_compare(nat, lavf, pkts, 0);
+    }
+
+    for (indx=0; indx < (int)pkts.size(); indx++) {
+        av_packet_free(&pkts[indx]);
+    }
+    avcodec_parameters_free(&video_par);
+    avcodec_parameters_free(&audio_par);
+
+    printf("%s\n", (retcd == 0) ? "PASS" : "FAIL");
+
+    return retcd;
+}
@@ -0,0 +1,214 @@
+/*
+ *    This file is part of Restream.
+ *
+ *    Restream is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    Restream is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with Restream.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "restream.hpp"
+#include "conf.hpp"
+#include "util.hpp"
+#include "logger.hpp"
+#include "channel.hpp"
+#include "infile.hpp"
+#include "pktarray.hpp"
+#include "ratectl.hpp"
+#include "rendition.hpp"
+#include "cache.hpp"
+#include "workpool.hpp"
+#include "pretrans.hpp"
+#include "pacer.hpp"
+#include "reactor.hpp"
+#include "inread.hpp"
+#include "uring.hpp"
+#include "timeshift.hpp"
+#include "recorder.hpp"
+#include "tsmux.hpp"
+#include "localout.hpp"
+#include "webu.hpp"
+#include "webu_ans.hpp"
+#include "webu_mpegts.hpp"
+#include "webu_mpts.hpp"
+
+void cls_uring::wake()
+{
+    uint64_t val;
+
+    val = 1;
+    if (write(evfd, &val, sizeof(val)) < 0) {
+        LOG_MSG(NTC, SHOW_ERRNO, "Could not wake the io_uring thread");
+    }
+}
+
+/* Queue a read for the next submit.  Only valid when ok is set */
+void cls_uring::read(int fd, uint8_t *buf, unsigned int len
+    , int64_t off, std::function<void(int)> done)
+{
+    ctx_uring_req *req;
+
+    req = new ctx_uring_req;
+    req->fd = fd;
+    req->buf = buf;
+    req->len = len;
+    req->off = off;
+    req->done = done;
+
+    mtx.lock();
+        pending.push_back(req);
+    mtx.unlock();
+
+    wake();
+}
+
+#ifdef HAVE_LIBURING
+
+/* Submit what the channels queued since the last pass in one call and
+ * route the completions.  A read on the eventfd is kept in the ring so
+ * new requests wake the thread
+*/
+void cls_uring::run()
+{
+    int retcd, indx;
+    unsigned head, cnt;
+    bool armed;
+    struct io_uring_sqe *sqe;
+    struct io_uring_cqe *cqe;
+    ctx_uring_req *req;
+
+    mythreadname_set("ur", 0, NULL);
+    armed = false;
+
+    while (true) {
+        if ((finish == true) && (inflight == 0)) {
+            break;
+        }
+        if (armed == false) {
+            sqe = io_uring_get_sqe(&ring);
+            if (sqe != nullptr) {
+                io_uring_prep_read(sqe, evfd, &evval, sizeof(evval), 0);
+                io_uring_sqe_set_data(sqe, nullptr);
+                armed = true;
+            }
+        }
+
+        mtx.lock();
+            indx = 0;
+            while ((indx < (int)pending.size()) && (inflight < URING_DEPTH)) {
+                sqe = io_uring_get_sqe(&ring);
+                if (sqe == nullptr) {
+                    break;
+                }
+                req = pending[indx];
+                io_uring_prep_read(sqe, req->fd, req->buf, req->len, (__u64)req->off);
+                io_uring_sqe_set_data(sqe, req);
+                inflight++;
+                indx++;
+            }
+            pending.erase(pending.begin(), pending.begin() + indx);
+        mtx.unlock();
+
+        retcd = io_uring_submit_and_wait(&ring, 1);
+        if ((retcd < 0) && (retcd != -EINTR)) {
+            LOG_MSG(NTC, NO_ERRNO
+                , "io_uring submit failed: %s", strerror(-retcd));
+        }
+
+        cnt = 0;
+        io_uring_for_each_cqe(&ring, head, cqe) {
+            req = (ctx_uring_req *)io_uring_cqe_get_data(cqe);
+            if (req == nullptr) {
+                armed = false;
+            } else {
+                inflight--;
+                req->done(cqe->res);
+                delete req;
+            }
+            cnt++;
+        }
+        io_uring_cq_advance(&ring, cnt);
+    }
+}
+
+cls_uring::cls_uring()
+{
+    int retcd;
+
+    ok = false;
+    finish = false;
+    inflight = 0;
+    evval = 0;
+
+    evfd = eventfd(0, EFD_CLOEXEC);
+    if (evfd < 0) {
+        LOG_MSG(NTC, SHOW_ERRNO
+            , "Could not create the io_uring eventfd, using blocking reads");
+        return;
+    }
+
+    retcd = io_uring_queue_init(URING_DEPTH, &ring, 0);
+    if (retcd < 0) {
+        LOG_MSG(NTC, NO_ERRNO
+            , "io_uring is not available, using blocking reads: %s"
+            , strerror(-retcd));
+        close(evfd);
+        evfd = -1;
+        return;
+    }
+
+    ok = true;
+    ring_thread = std::thread(&cls_uring::run, this);
+    LOG_MSG(NTC, NO_ERRNO, "Reading input files through io_uring");
+}
+
+cls_uring::~cls_uring()
+{
+    int indx;
+
+    if (ok == true) {
+        finish = true;
+        wake();
+        ring_thread.join();
+        io_uring_queue_exit(&ring);
+    }
+    if (evfd != -1) {
+        close(evfd);
+    }
+    for (indx=0; indx < (int)pending.size(); indx++) {
+        delete pending[indx];
+    }
+    pending.clear();
+}
+
+#else
+
+void cls_uring::run()
+{
+}
+
+cls_uring::cls_uring()
+{
+    ok = false;
+    finish = false;
+    inflight = 0;
+    evval = 0;
+    evfd = -1;
+    LOG_MSG(NTC, NO_ERRNO
+        , "Built without io_uring support, using blocking reads");
+}
+
+cls_uring::~cls_uring()
+{
+}
+
+#endif
@@ -0,0 +1,68 @@
+/*
+ *    This file is part of Restream.
+ *
+ *    Restream is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    Restream is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with Restream.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef _INCLUDE_URING_HPP_
+#define _INCLUDE_URING_HPP_
+    #ifdef HAVE_LIBURING
+        #include <liburing.h>
+    #endif
+
+    #define URING_DEPTH     256     /* Submission queue entries of the ring */
+
+    /* A read handed to the ring.  done is called from the ring thread
+     * with the byte count or a negative errno
+    */
+    struct ctx_uring_req {
+        int                         fd;
+        uint8_t                     *buf;
+        unsigned int                len;
+        int64_t                     off;
+        std::function<void(int)>    done;
+    };
+
+    /* One io_uring for the process.  Reads from every channel are queued
+     * and submitted together by a single thread which also hands each
+     * completion back to its channel
+    */
+    class cls_uring {
+        public:
+            cls_uring();
+            ~cls_uring();
+
+            bool    ok;         /* False when the ring could not be set up */
+
+            void    read(int fd, uint8_t *buf, unsigned int len
+                        , int64_t off, std::function<void(int)> done);
+
+        private:
+            std::mutex                      mtx;
+            std::vector<ctx_uring_req*>     pending;
+            std::thread                     ring_thread;
+            std::atomic<bool>               finish;
+            int                             evfd;       /* Wakes the ring thread for new reads */
+            uint64_t                        evval;
+            int                             inflight;
+            #ifdef HAVE_LIBURING
+                struct io_uring             ring;
+            #endif
+
+            void    run();
+            void    wake();
+    };
+
+#endif
@@ -24,9 +24,23 @@
 #include "channel.hpp"
 #include "infile.hpp"
 #include "pktarray.hpp"
+#include "ratectl.hpp"
+#include "rendition.hpp"
+#include "cache.hpp"
+#include "workpool.hpp"
+#include "pretrans.hpp"
+#include "pacer.hpp"
+#include "reactor.hpp"
+#include "inread.hpp"
+#include "uring.hpp"
+#include "timeshift.hpp"
+#include "recorder.hpp"
+#include "tsmux.hpp"
+#include "localout.hpp"
 #include "webu.hpp"
 #include "webu_ans.hpp"
 #include "webu_mpegts.hpp"
+#include "webu_mpts.hpp"
 
 
 /** Non case sensitive equality check for strings*/
@@ -407,6 +421,173 @@ AVPacket *mypacket_alloc(AVPacket *pkt)
 
 }
 
+/* Copy pkt into a buffer of its own so that pooled buffers are not
+ * held while the copy is kept
+*/
+AVPacket *mypacket_dup(AVPacket *pkt)
+{
+    AVPacket *pkt_dup;
+
+    pkt_dup = mypacket_alloc(nullptr);
+    if (av_new_packet(pkt_dup, pkt->size) < 0) {
+        mypacket_free(pkt_dup);
+        return nullptr;
+    }
+    memcpy(pkt_dup->data, pkt->data, (size_t)pkt->size);
+    av_packet_copy_props(pkt_dup, pkt);
+    pkt_dup->stream_index = pkt->stream_index;
+
+    return pkt_dup;
+}
+
+/* Reduce dst/src to one ratio ahead of time.  The common time bases
+ * come down to a small multiplier with a power of two or small divisor
+*/
+void myrescale_init(ctx_rescale &rs, AVRational src, AVRational dst)
+{
+    int64_t num, den, gcd;
+
+    rs.src = src;
+    rs.dst = dst;
+    rs.mul = 1;
+    rs.div = 1;
+    rs.shift = -1;
+    rs.lim = 0;
+    rs.generic = true;
+
+    if ((src.num <= 0) || (src.den <= 0) ||
+        (dst.num <= 0) || (dst.den <= 0)) {
+        return;
+    }
+
+    num = (int64_t)src.num * dst.den;
+    den = (int64_t)src.den * dst.num;
+    gcd = av_gcd(num, den);
+    num /= gcd;
+    den /= gcd;
+
+    rs.mul = num;
+    rs.div = den;
+    if ((den & (den - 1)) == 0) {
+        rs.shift = 0;
+        while ((((int64_t)1) << rs.shift) < den) {
+            rs.shift++;
+        }
+    }
+    rs.lim = (INT64_MAX - den) / num;
+    rs.generic = false;
+}
+
+/* Set up rs again only when the time bases have changed */
+void myrescale_check(ctx_rescale &rs, AVRational src, AVRational dst)
+{
+    if ((rs.src.num != src.num) || (rs.src.den != src.den) ||
+        (rs.dst.num != dst.num) || (rs.dst.den != dst.den)) {
+        myrescale_init(rs, src, dst);
+    }
+}
+
+/* Same result as av_rescale_q, rounding to nearest with halves away
+ * from zero.  Values that could overflow take the generic path
+*/
+int64_t myrescale(const ctx_rescale &rs, int64_t val)
+{
+    int64_t absval, retval;
+
+    if (val == AV_NOPTS_VALUE) {
+        return val;
+    }
+    if (rs.generic == true) {
+        return av_rescale_q(val, rs.src, rs.dst);
+    }
+
+    if (val < 0) {
+        absval = -val;
+    } else {
+        absval = val;
+    }
+    if (absval > rs.lim) {
+        return av_rescale_q(val, rs.src, rs.dst);
+    }
+
+    if (rs.shift >= 0) {
+        retval = (absval * rs.mul + (rs.div >> 1)) >> rs.shift;
+    } else {
+        retval = (absval * rs.mul + (rs.div >> 1)) / rs.div;
+    }
+
+    if (val < 0) {
+        return -retval;
+    }
+    return retval;
+}
+
+/* Build a graph running desc on frames from dec_ctx with time_base.
+ * The graph is freed again when it can not be configured
+*/
+int myfilter_init(AVFilterGraph **graph, AVFilterContext **src
+    , AVFilterContext **sink, AVCodecContext *dec_ctx
+    , AVRational time_base, std::string desc)
+{
+    int retcd;
+    char args[256];
+    AVFilterInOut *outputs, *inputs;
+    AVRational sar;
+
+    sar = dec_ctx->sample_aspect_ratio;
+    if (sar.num == 0) {
+        sar = AVRational{1, 1};
+    }
+
+    *graph = avfilter_graph_alloc();
+    if (*graph == nullptr) {
+        return AVERROR(ENOMEM);
+    }
+
+    snprintf(args, sizeof(args)
+        , "video_size=%dx%d:pix_fmt=%d:time_base=%d/%d:pixel_aspect=%d/%d"
+        , dec_ctx->width, dec_ctx->height, dec_ctx->pix_fmt
+        , time_base.num, time_base.den
+        , sar.num, sar.den);
+
+    retcd = avfilter_graph_create_filter(src
+        , avfilter_get_by_name("buffer"), "in", args, NULL, *graph);
+    if (retcd >= 0) {
+        retcd = avfilter_graph_create_filter(sink
+            , avfilter_get_by_name("buffersink"), "out", NULL, NULL, *graph);
+    }
+
+    if (retcd >= 0) {
+        outputs = avfilter_inout_alloc();
+        inputs = avfilter_inout_alloc();
+        outputs->name = av_strdup("in");
+        outputs->filter_ctx = *src;
+        outputs->pad_idx = 0;
+        outputs->next = NULL;
+        inputs->name = av_strdup("out");
+        inputs->filter_ctx = *sink;
+        inputs->pad_idx = 0;
+        inputs->next = NULL;
+
+        retcd = avfilter_graph_parse_ptr(*graph, desc.c_str()
+            , &inputs, &outputs, NULL);
+        if (retcd >= 0) {
+            retcd = avfilter_graph_config(*graph, NULL);
+        }
+        avfilter_inout_free(&inputs);
+        avfilter_inout_free(&outputs);
+    }
+
+    if (retcd < 0) {
+        avfilter_graph_free(graph);
+        *graph = nullptr;
+        *src = nullptr;
+        *sink = nullptr;
+    }
+
+    return retcd;
+}
+
 /*********************************************/
 
 static void util_parms_file(ctx_params &params, std::string params_file)
@@ -798,3 +979,36 @@ void util_parms_update(ctx_params &params, std::string &confline)
     return;
 }
 
+
+/* Convert a size such as 64M or 512K into bytes.  Returns -1 when invalid */
+int64_t util_parms_bytes(std::string parm)
+{
+    int64_t retval;
+    char *endptr;
+
+    mytrim(parm);
+    if (parm == "") {
+        return -1;
+    }
+
+    retval = (int64_t)strtoll(parm.c_str(), &endptr, 10);
+    if ((endptr == parm.c_str()) || (retval < 0)) {
+        return -1;
+    }
+
+    if ((*endptr == 'k') || (*endptr == 'K')) {
+        retval *= 1024;
+        endptr++;
+    } else if ((*endptr == 'm') || (*endptr == 'M')) {
+        retval *= 1024 * 1024;
+        endptr++;
+    } else if ((*endptr == 'g') || (*endptr == 'G')) {
+        retval *= 1024 * 1024 * 1024;
+        endptr++;
+    }
+    if (*endptr != '\0') {
+        return -1;
+    }
+
+    return retval;
+}
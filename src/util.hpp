@@ -112,11 +112,19 @@
     int myimage_fill_arrays(AVFrame *frame,uint8_t *buffer_ptr,enum MyPixelFormat pix_fmt,int width,int height);
     int mycopy_packet(AVPacket *dest_pkt, AVPacket *src_pkt);
     AVPacket *mypacket_alloc(AVPacket *pkt);
+    AVPacket *mypacket_dup(AVPacket *pkt);
+    void myrescale_init(ctx_rescale &rs, AVRational src, AVRational dst);
+    void myrescale_check(ctx_rescale &rs, AVRational src, AVRational dst);
+    int64_t myrescale(const ctx_rescale &rs, int64_t val);
+    int myfilter_init(AVFilterGraph **graph, AVFilterContext **src
+        , AVFilterContext **sink, AVCodecContext *dec_ctx
+        , AVRational time_base, std::string desc);
 
     void util_parms_parse(ctx_params &params, std::string parm_desc, std::string confline);
     void util_parms_add_default(ctx_params &params, std::string parm_nm, std::string parm_vl);
     void util_parms_add_default(ctx_params &params, std::string parm_nm, int parm_vl);
     void util_parms_add(ctx_params &params, std::string parm_nm, std::string parm_val);
     void util_parms_update(ctx_params &params, std::string &confline);
+    int64_t util_parms_bytes(std::string parm);
 
 #endif /* _INCLUDE_UTIL_HPP_ */
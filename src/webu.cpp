@@ -23,9 +23,23 @@
 #include "channel.hpp"
 #include "infile.hpp"
 #include "pktarray.hpp"
+#include "ratectl.hpp"
+#include "rendition.hpp"
+#include "cache.hpp"
+#include "workpool.hpp"
+#include "pretrans.hpp"
+#include "pacer.hpp"
+#include "reactor.hpp"
+#include "inread.hpp"
+#include "uring.hpp"
+#include "timeshift.hpp"
+#include "recorder.hpp"
+#include "tsmux.hpp"
+#include "localout.hpp"
 #include "webu.hpp"
 #include "webu_ans.hpp"
 #include "webu_mpegts.hpp"
+#include "webu_mpts.hpp"
 
 
 /* Initialize the MHD answer */
@@ -49,6 +63,7 @@ static void mhd_deinit(void *cls, struct MHD_Connection *connection
     (void)connection;
     (void)cls;
     (void)toe;
+    int indx;
     cls_webua *webua =(cls_webua *) *con_cls;
 
     if (webua != nullptr) {
@@ -56,8 +71,18 @@ static void mhd_deinit(void *cls, struct MHD_Connection *connection
             if (webua->chitm->cnct_cnt > 0) {
                 webua->chitm->cnct_cnt--;
             }
+            if (webua->rnd != nullptr) {
+                webua->rnd->client_remove();
+            }
             LOG_MSG(INF, NO_ERRNO ,"Ch%s: Closing connection"
                 , webua->chitm->ch_nbr.c_str());
+        } else if (webua->cnct_type == WEBUA_CNCT_MPTS) {
+            for (indx=0; indx < (int)webua->mpts_chs.size(); indx++) {
+                if (webua->mpts_chs[indx]->cnct_cnt > 0) {
+                    webua->mpts_chs[indx]->cnct_cnt--;
+                }
+            }
+            LOG_MSG(INF, NO_ERRNO ,"Closing multi program connection");
         }
         delete webua;
     }
@@ -23,9 +23,23 @@
 #include "channel.hpp"
 #include "infile.hpp"
 #include "pktarray.hpp"
+#include "ratectl.hpp"
+#include "rendition.hpp"
+#include "cache.hpp"
+#include "workpool.hpp"
+#include "pretrans.hpp"
+#include "pacer.hpp"
+#include "reactor.hpp"
+#include "inread.hpp"
+#include "uring.hpp"
+#include "timeshift.hpp"
+#include "recorder.hpp"
+#include "tsmux.hpp"
+#include "localout.hpp"
 #include "webu.hpp"
 #include "webu_ans.hpp"
 #include "webu_mpegts.hpp"
+#include "webu_mpts.hpp"
 
 void cls_webua::html_badreq()
 {
@@ -590,6 +604,288 @@ mhdrslt cls_webua::mhd_send()
     return retcd;
 }
 
+void cls_webua::metrics_head(std::string name, std::string mtype, std::string help)
+{
+    resp_page += "# HELP " + name + " " + help + "\n";
+    resp_page += "# TYPE " + name + " " + mtype + "\n";
+}
+
+void cls_webua::metrics_value(std::string name, std::string chnbr, int64_t val)
+{
+    resp_page += name + "{channel=\"" + chnbr + "\"} " + std::to_string(val) + "\n";
+}
+
+void cls_webua::metrics_value(std::string name, std::string chnbr, double val)
+{
+    char buf[64];
+
+    snprintf(buf, sizeof(buf), "%.6f", val);
+    resp_page += name + "{channel=\"" + chnbr + "\"} " + buf + "\n";
+}
+
+/* Start or stop the recording of the channel with /chN/record/start
+ * or /chN/record/stop and answer with its state
+*/
+void cls_webua::record()
+{
+    const char *val;
+    std::string fmt;
+
+    if (uri_cmd2 == "start") {
+        val = MHD_lookup_connection_value(connection, MHD_GET_ARGUMENT_KIND, "fmt");
+        if (val != NULL) {
+            fmt = val;
+        }
+        if (chitm->recorder->start(fmt) != 0) {
+            html_badreq();
+            return;
+        }
+    } else if (uri_cmd2 == "stop") {
+        chitm->recorder->stop();
+    } else if (uri_cmd2 != "") {
+        html_badreq();
+        return;
+    }
+
+    resp_page = chitm->recorder->status();
+    resp_type = WEBUA_RESP_JSON;
+}
+
+/* Create the metrics page in the Prometheus text format */
+void cls_webua::metrics()
+{
+    int indx;
+    std::vector<ctx_channel_stats> stats;
+    std::vector<std::string> chnbr;
+    ctx_channel_stats st;
+    cls_channel *ch;
+
+    for (indx=0; indx < c_app->ch_count; indx++) {
+        ch = c_app->channels[indx];
+        pthread_mutex_lock(&ch->mtx_stats);
+            st = ch->stats;
+        pthread_mutex_unlock(&ch->mtx_stats);
+        ch->pktarray->stats_get(st);
+        ch->pacer->stats_get(st);
+        ch->inread->stats_get(st);
+        ch->recorder->stats_get(st);
+        if (ch->localout != nullptr) {
+            ch->localout->stats_get(st);
+        }
+        stats.push_back(st);
+        chnbr.push_back(ch->ch_nbr);
+    }
+
+    resp_page = "";
+
+    metrics_head("restream_clients", "gauge", "Clients currently connected");
+    for (indx=0; indx < (int)stats.size(); indx++) {
+        metrics_value("restream_clients", chnbr[indx]
+            , (int64_t)c_app->channels[indx]->cnct_cnt);
+    }
+    metrics_head("restream_clients_total", "counter", "Clients connected since startup");
+    for (indx=0; indx < (int)stats.size(); indx++) {
+        metrics_value("restream_clients_total", chnbr[indx], stats[indx].clients);
+    }
+
+    metrics_head("restream_ttff_seconds", "summary", "Time from connect to first video frame");
+    for (indx=0; indx < (int)stats.size(); indx++) {
+        metrics_value("restream_ttff_seconds_sum", chnbr[indx]
+            , (double)stats[indx].ttff_sum / 1000000.0);
+        metrics_value("restream_ttff_seconds_count", chnbr[indx], stats[indx].ttff_cnt);
+    }
+    metrics_head("restream_ttff_max_seconds", "gauge", "Longest time to first video frame");
+    for (indx=0; indx < (int)stats.size(); indx++) {
+        metrics_value("restream_ttff_max_seconds", chnbr[indx]
+            , (double)stats[indx].ttff_max / 1000000.0);
+    }
+    metrics_head("restream_ttff_last_seconds", "gauge", "Time to first video frame of the newest client");
+    for (indx=0; indx < (int)stats.size(); indx++) {
+        metrics_value("restream_ttff_last_seconds", chnbr[indx]
+            , (double)stats[indx].ttff_last / 1000000.0);
+    }
+
+    metrics_head("restream_burst_total", "counter", "Clients that joined with a burst");
+    for (indx=0; indx < (int)stats.size(); indx++) {
+        metrics_value("restream_burst_total", chnbr[indx], stats[indx].burst_cnt);
+    }
+    metrics_head("restream_burst_bytes_total", "counter", "Bytes sent in join bursts");
+    for (indx=0; indx < (int)stats.size(); indx++) {
+        metrics_value("restream_burst_bytes_total", chnbr[indx], stats[indx].burst_bytes);
+    }
+    metrics_head("restream_burst_seconds_total", "counter", "Time spent sending join bursts");
+    for (indx=0; indx < (int)stats.size(); indx++) {
+        metrics_value("restream_burst_seconds_total", chnbr[indx]
+            , (double)stats[indx].burst_usec / 1000000.0);
+    }
+
+    metrics_head("restream_encode_load_ratio", "gauge", "Share of realtime spent decoding and encoding");
+    for (indx=0; indx < (int)stats.size(); indx++) {
+        metrics_value("restream_encode_load_ratio", chnbr[indx]
+            , (double)stats[indx].ctl_load / 1000.0);
+    }
+    metrics_head("restream_pacing_margin_now_seconds", "gauge", "Latest pacing margin, negative when behind");
+    for (indx=0; indx < (int)stats.size(); indx++) {
+        metrics_value("restream_pacing_margin_now_seconds", chnbr[indx]
+            , (double)stats[indx].pace_margin / 1000000.0);
+    }
+    metrics_head("restream_shed_stage", "gauge", "Overload stage, 0 none 1 skip nonref 2 half rate 3 downscale");
+    for (indx=0; indx < (int)stats.size(); indx++) {
+        metrics_value("restream_shed_stage", chnbr[indx], (int64_t)stats[indx].shed_stage);
+    }
+    metrics_head("restream_shed_total", "counter", "Times more work was shed");
+    for (indx=0; indx < (int)stats.size(); indx++) {
+        metrics_value("restream_shed_total", chnbr[indx], stats[indx].shed_up);
+    }
+    metrics_head("restream_shed_restore_total", "counter", "Times shed work was restored");
+    for (indx=0; indx < (int)stats.size(); indx++) {
+        metrics_value("restream_shed_restore_total", chnbr[indx], stats[indx].shed_down);
+    }
+    metrics_head("restream_shed_dropped_frames_total", "counter", "Frames dropped at half rate");
+    for (indx=0; indx < (int)stats.size(); indx++) {
+        metrics_value("restream_shed_dropped_frames_total", chnbr[indx], stats[indx].shed_dropped);
+    }
+    metrics_head("restream_pacing_margin_seconds", "gauge", "Smallest pacing margin of the last GOP");
+    for (indx=0; indx < (int)stats.size(); indx++) {
+        metrics_value("restream_pacing_margin_seconds", chnbr[indx]
+            , (double)stats[indx].ctl_margin / 1000000.0);
+    }
+    metrics_head("restream_ratectl_level", "gauge", "Rate controller level, 0 is best quality");
+    for (indx=0; indx < (int)stats.size(); indx++) {
+        metrics_value("restream_ratectl_level", chnbr[indx], (int64_t)stats[indx].ctl_level);
+    }
+    metrics_head("restream_ratectl_preset", "gauge", "x264 preset in use, 0 is ultrafast");
+    for (indx=0; indx < (int)stats.size(); indx++) {
+        metrics_value("restream_ratectl_preset", chnbr[indx], (int64_t)stats[indx].ctl_preset);
+    }
+    metrics_head("restream_ratectl_crf", "gauge", "x264 crf in use");
+    for (indx=0; indx < (int)stats.size(); indx++) {
+        metrics_value("restream_ratectl_crf", chnbr[indx], (int64_t)stats[indx].ctl_crf);
+    }
+    metrics_head("restream_ratectl_faster_total", "counter", "Steps taken to reduce encode work");
+    for (indx=0; indx < (int)stats.size(); indx++) {
+        metrics_value("restream_ratectl_faster_total", chnbr[indx], stats[indx].ctl_faster);
+    }
+    metrics_head("restream_ratectl_slower_total", "counter", "Steps taken to raise quality");
+    for (indx=0; indx < (int)stats.size(); indx++) {
+        metrics_value("restream_ratectl_slower_total", chnbr[indx], stats[indx].ctl_slower);
+    }
+
+    metrics_head("restream_cache_hits_total", "counter", "Files played from the cache");
+    for (indx=0; indx < (int)stats.size(); indx++) {
+        metrics_value("restream_cache_hits_total", chnbr[indx], stats[indx].cache_hits);
+    }
+    metrics_head("restream_cache_misses_total", "counter", "Files not found in the cache");
+    for (indx=0; indx < (int)stats.size(); indx++) {
+        metrics_value("restream_cache_misses_total", chnbr[indx], stats[indx].cache_misses);
+    }
+    metrics_head("restream_cache_stored_total", "counter", "Files written to the cache");
+    for (indx=0; indx < (int)stats.size(); indx++) {
+        metrics_value("restream_cache_stored_total", chnbr[indx], stats[indx].cache_stored);
+    }
+    metrics_head("restream_cache_evicted_total", "counter", "Cache files removed to keep within cache_size");
+    for (indx=0; indx < (int)stats.size(); indx++) {
+        metrics_value("restream_cache_evicted_total", chnbr[indx], stats[indx].cache_evicted);
+    }
+    metrics_head("restream_cache_corrupt_total", "counter", "Cache files that failed validation");
+    for (indx=0; indx < (int)stats.size(); indx++) {
+        metrics_value("restream_cache_corrupt_total", chnbr[indx], stats[indx].cache_corrupt);
+    }
+
+    metrics_head("restream_pacing_stalls_total", "counter", "Times the schedule was moved after falling behind");
+    for (indx=0; indx < (int)stats.size(); indx++) {
+        metrics_value("restream_pacing_stalls_total", chnbr[indx], stats[indx].pace_stalls);
+    }
+    metrics_head("restream_pacing_jitter_p50_seconds", "gauge", "Median wake up deviation from the schedule");
+    for (indx=0; indx < (int)stats.size(); indx++) {
+        metrics_value("restream_pacing_jitter_p50_seconds", chnbr[indx]
+            , (double)stats[indx].pace_jit_p50 / 1000000.0);
+    }
+    metrics_head("restream_pacing_jitter_p99_seconds", "gauge", "99th percentile wake up deviation from the schedule");
+    for (indx=0; indx < (int)stats.size(); indx++) {
+        metrics_value("restream_pacing_jitter_p99_seconds", chnbr[indx]
+            , (double)stats[indx].pace_jit_p99 / 1000000.0);
+    }
+    metrics_head("restream_pacing_jitter_max_seconds", "gauge", "Largest recent wake up deviation from the schedule");
+    for (indx=0; indx < (int)stats.size(); indx++) {
+        metrics_value("restream_pacing_jitter_max_seconds", chnbr[indx]
+            , (double)stats[indx].pace_jit_max / 1000000.0);
+    }
+
+    metrics_head("restream_input_read_bytes_total", "counter", "Bytes read from the input files");
+    for (indx=0; indx < (int)stats.size(); indx++) {
+        metrics_value("restream_input_read_bytes_total", chnbr[indx], stats[indx].read_bytes);
+    }
+    metrics_head("restream_input_read_seconds_total", "counter", "Time spent reading the input files");
+    for (indx=0; indx < (int)stats.size(); indx++) {
+        metrics_value("restream_input_read_seconds_total", chnbr[indx]
+            , (double)stats[indx].read_usec / 1000000.0);
+    }
+    metrics_head("restream_input_stalls_total", "counter", "Times the demuxer waited on the read ahead");
+    for (indx=0; indx < (int)stats.size(); indx++) {
+        metrics_value("restream_input_stalls_total", chnbr[indx], stats[indx].read_stalls);
+    }
+    metrics_head("restream_input_stall_seconds_total", "counter", "Time the demuxer waited on the read ahead");
+    for (indx=0; indx < (int)stats.size(); indx++) {
+        metrics_value("restream_input_stall_seconds_total", chnbr[indx]
+            , (double)stats[indx].read_stall_usec / 1000000.0);
+    }
+    metrics_head("restream_recording", "gauge", "Whether the channel is being recorded");
+    for (indx=0; indx < (int)stats.size(); indx++) {
+        metrics_value("restream_recording", chnbr[indx]
+            , (int64_t)(c_app->channels[indx]->recorder->recording ? 1 : 0));
+    }
+    metrics_head("restream_record_bytes_total", "counter", "Bytes written to recordings");
+    for (indx=0; indx < (int)stats.size(); indx++) {
+        metrics_value("restream_record_bytes_total", chnbr[indx], stats[indx].rec_bytes);
+    }
+    metrics_head("restream_record_files_total", "counter", "Recordings started");
+    for (indx=0; indx < (int)stats.size(); indx++) {
+        metrics_value("restream_record_files_total", chnbr[indx], stats[indx].rec_files);
+    }
+    metrics_head("restream_record_dropped_packets_total", "counter", "Packets recordings missed after falling behind the ring");
+    for (indx=0; indx < (int)stats.size(); indx++) {
+        metrics_value("restream_record_dropped_packets_total", chnbr[indx], stats[indx].rec_drops);
+    }
+    metrics_head("restream_local_readers", "gauge", "Readers on the local socket and pipe");
+    for (indx=0; indx < (int)stats.size(); indx++) {
+        ch = c_app->channels[indx];
+        metrics_value("restream_local_readers", chnbr[indx]
+            , (ch->localout == nullptr) ? (int64_t)0 : (int64_t)ch->localout->clients_cnt);
+    }
+    metrics_head("restream_local_bytes_total", "counter", "Bytes written to local readers");
+    for (indx=0; indx < (int)stats.size(); indx++) {
+        metrics_value("restream_local_bytes_total", chnbr[indx], stats[indx].local_bytes);
+    }
+    metrics_head("restream_local_resyncs_total", "counter", "Times a local reader fell behind and restarted at a keyframe");
+    for (indx=0; indx < (int)stats.size(); indx++) {
+        metrics_value("restream_local_resyncs_total", chnbr[indx], stats[indx].local_resyncs);
+    }
+    metrics_head("restream_timeshift_seconds", "gauge", "Seconds of the past held in the timeshift store");
+    for (indx=0; indx < (int)stats.size(); indx++) {
+        ch = c_app->channels[indx];
+        metrics_value("restream_timeshift_seconds", chnbr[indx]
+            , (ch->timeshift == nullptr) ? (int64_t)0 : ch->timeshift->covered());
+    }
+
+    metrics_head("restream_ring_slots", "gauge", "Packet slots in the ring");
+    for (indx=0; indx < (int)stats.size(); indx++) {
+        metrics_value("restream_ring_slots", chnbr[indx], (int64_t)stats[indx].ring_slots);
+    }
+    metrics_head("restream_ring_bytes", "gauge", "Bytes in the ring payload arena");
+    for (indx=0; indx < (int)stats.size(); indx++) {
+        metrics_value("restream_ring_bytes", chnbr[indx], stats[indx].ring_bytes);
+    }
+    metrics_head("restream_ring_keyframes", "gauge", "Video keyframes indexed in the ring");
+    for (indx=0; indx < (int)stats.size(); indx++) {
+        metrics_value("restream_ring_keyframes", chnbr[indx], (int64_t)stats[indx].ring_keys);
+    }
+    metrics_head("restream_ring_fallback_total", "counter", "Packets stored outside the arena");
+    for (indx=0; indx < (int)stats.size(); indx++) {
+        metrics_value("restream_ring_fallback_total", chnbr[indx], stats[indx].ring_fallback);
+    }
+}
+
 /* Answer the get request from the user */
 mhdrslt cls_webua::answer_get()
 {
@@ -605,6 +901,25 @@ mhdrslt cls_webua::answer_get()
             retcd = mhd_send();
         }
 
+    } else if (uri_chid == "mpts") {
+        retcd = mpts_main();
+        if (retcd == MHD_NO) {
+            html_badreq();
+            retcd = mhd_send();
+        }
+    } else if ((uri_cmd1 == "record") && (chitm != nullptr)) {
+        record();
+        retcd = mhd_send();
+        if (retcd == MHD_NO) {
+            LOG_MSG(NTC, NO_ERRNO ,"send record status failed.");
+        }
+    } else if (uri_chid == "metrics") {
+        metrics();
+        resp_type = WEBUA_RESP_TEXT;
+        retcd = mhd_send();
+        if (retcd == MHD_NO) {
+            LOG_MSG(NTC, NO_ERRNO ,"send metrics failed.");
+        }
     } else {
         resp_page = "<html><head><title>Sample Page</title>"
             "</head><body>Sample Page</body></html>";
@@ -680,27 +995,57 @@ mhdrslt cls_webua::answer(struct MHD_Connection *p_connection)
 
 }
 
-void cls_webua::stream_cnct_cnt()
+void cls_webua::stream_cnct_cnt(cls_channel *ch)
 {
-    int indx, chk;
+    int chk;
 
-    if (chitm->cnct_cnt == 0) {
-        for (indx=0; indx < (int)chitm->pktarray->array.size(); indx++) {
-            if (chitm->pktarray->array[indx].packet != nullptr) {
-                mypacket_free(chitm->pktarray->array[indx].packet);
-                chitm->pktarray->array[indx].packet = nullptr;
-            }
-        }
-        chitm->cnct_cnt++;
-        chitm->pktarray->start = chitm->pktarray->count;
+    pthread_mutex_lock(&ch->mtx_stats);
+        ch->stats.clients++;
+    pthread_mutex_unlock(&ch->mtx_stats);
+
+    /* A ring kept filled for a recording or the timeshift store is already live */
+    if (ch->active() == false) {
+        ch->pktarray->reset();
+        ch->cnct_cnt++;
+        ch->pktarray->start = PKTARRAY_PREFILL;
         chk = 0;
-        while ((chitm->pktarray->start > 0) && (chk <100000)) {
+        while ((ch->pktarray->start > 0) && (chk <100000)) {
             SLEEP(0,10000L);
             chk++;
         }
     } else {
-        chitm->cnct_cnt++;
+        ch->cnct_cnt++;
+    }
+}
+
+/* Find the rendition asked for with ?profile=name.  None means the
+ * channel's own stream
+*/
+int cls_webua::stream_profile()
+{
+    const char *val;
+    int indx;
+
+    rnd = nullptr;
+    val = MHD_lookup_connection_value(connection, MHD_GET_ARGUMENT_KIND, "profile");
+    if ((val == NULL) || (*val == '\0')) {
+        return 0;
+    }
+
+    for (indx=0; indx < (int)chitm->renditions.size(); indx++) {
+        if ((chitm->renditions[indx]->name == val) &&
+            (chitm->renditions[indx]->valid == true)) {
+            rnd = chitm->renditions[indx];
+            rnd->client_add();
+            return 0;
+        }
     }
+
+    LOG_MSG(ERR, NO_ERRNO
+        , "Ch%s: Unknown profile requested: %s"
+        , chitm->ch_nbr.c_str(), val);
+
+    return -1;
 }
 
 int cls_webua::stream_type()
@@ -757,7 +1102,10 @@ mhdrslt cls_webua::stream_main()
     }
 
     if (uri_cmd1 == "mpegts") {
-        stream_cnct_cnt();
+        if (stream_profile() == -1) {
+            return MHD_NO;
+        }
+        stream_cnct_cnt(chitm);
         if (c_webuts == nullptr) {
            c_webuts = new cls_webuts(c_app, this);
         }
@@ -768,12 +1116,84 @@ mhdrslt cls_webua::stream_main()
 
 }
 
+/* Channels of /mpts?ch=1,2,3 in the order given */
+int cls_webua::mpts_parse()
+{
+    const char *val;
+    std::string parm, nbr;
+    size_t pos_st, pos_en;
+    int indx;
+    bool found;
+
+    mpts_chs.clear();
+    val = MHD_lookup_connection_value(connection, MHD_GET_ARGUMENT_KIND, "ch");
+    if ((val == NULL) || (*val == '\0')) {
+        return -1;
+    }
+    parm = val;
+
+    pos_st = 0;
+    while (pos_st < parm.length()) {
+        pos_en = parm.find(",", pos_st);
+        if (pos_en == std::string::npos) {
+            pos_en = parm.length();
+        }
+        nbr = parm.substr(pos_st, pos_en - pos_st);
+        pos_st = pos_en + 1;
+
+        found = false;
+        for (indx=0; indx < c_app->ch_count; indx++) {
+            if (c_app->channels[indx]->ch_nbr == nbr) {
+                found = true;
+                if (std::find(mpts_chs.begin(), mpts_chs.end()
+                    , c_app->channels[indx]) == mpts_chs.end()) {
+                    mpts_chs.push_back(c_app->channels[indx]);
+                }
+            }
+        }
+        if (found == false) {
+            LOG_MSG(ERR, NO_ERRNO
+                , "Unknown channel for the multi program stream: %s"
+                , nbr.c_str());
+            mpts_chs.clear();
+            return -1;
+        }
+    }
+
+    if (mpts_chs.empty() == true) {
+        return -1;
+    }
+
+    return 0;
+}
+
+/* One transport stream with a program for each channel asked for */
+mhdrslt cls_webua::mpts_main()
+{
+    int indx;
+
+    if ((c_webu->wb_finish == true) || (mpts_parse() == -1)) {
+        return MHD_NO;
+    }
+
+    cnct_type = WEBUA_CNCT_MPTS;
+    for (indx=0; indx < (int)mpts_chs.size(); indx++) {
+        stream_cnct_cnt(mpts_chs[indx]);
+    }
+    if (c_webumpts == nullptr) {
+        c_webumpts = new cls_webumpts(c_app, this);
+    }
+
+    return c_webumpts->main();
+}
+
 cls_webua::cls_webua(cls_app *p_app, const char *uri)
 {
     c_app = p_app;
     c_webu = p_app->webu;
     c_conf = p_app->conf;
     c_webuts = nullptr;
+    c_webumpts = nullptr;
 
     url           = "";
     uri_chid      = "";
@@ -794,6 +1214,7 @@ cls_webua::cls_webua(cls_app *p_app, const char *uri)
     cnct_method   = WEBUA_METHOD_GET;
     channel_indx  = -1;
     chitm  = nullptr;
+    rnd    = nullptr;
 
     mhd_first = true;
 
@@ -810,6 +1231,9 @@ cls_webua::~cls_webua()
     if (c_webuts != nullptr) {
         delete c_webuts;
     }
+    if (c_webumpts != nullptr) {
+        delete c_webumpts;
+    }
 }
 
 
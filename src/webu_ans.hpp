@@ -30,6 +30,7 @@
     enum WEBUA_CNCT {
         WEBUA_CNCT_CONTROL,
         WEBUA_CNCT_TS_FULL,
+        WEBUA_CNCT_MPTS,
         WEBUA_CNCT_UNKNOWN
     };
 
@@ -44,8 +45,10 @@
             cls_webua(cls_app *p_app, const char *uri);
             ~cls_webua();
             cls_channel             *chitm;
+            cls_rendition           *rnd;           /* Profile requested with ?profile= */
             enum WEBUA_CNCT         cnct_type;      /* Type of connection we are processing */
             struct MHD_Connection   *connection;    /* The MHD connection value from the client */
+            std::vector<cls_channel*>   mpts_chs;   /* Channels of a /mpts request */
 
             mhdrslt answer(struct MHD_Connection *connection);
 
@@ -54,6 +57,7 @@
             cls_webu        *c_webu;
             cls_config      *c_conf;
             cls_webuts      *c_webuts;
+            cls_webumpts    *c_webumpts;
 
             std::string hostfull;       /* Full http name for host with port number */
             char        *auth_opaque;   /* Opaque string for digest authentication*/
@@ -94,10 +98,19 @@
             mhdrslt failauth_check();
 
 
-            void    stream_cnct_cnt();
+            void    metrics_head(std::string name, std::string mtype, std::string help);
+            void    metrics_value(std::string name, std::string chnbr, int64_t val);
+            void    metrics_value(std::string name, std::string chnbr, double val);
+            void    metrics();
+            void    record();
+
+            void    stream_cnct_cnt(cls_channel *ch);
+            int     stream_profile();
             int     stream_type();
             int     stream_checks();
             mhdrslt stream_main();
+            int     mpts_parse();
+            mhdrslt mpts_main();
 
     };
 
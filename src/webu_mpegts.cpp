@@ -23,9 +23,23 @@
 #include "channel.hpp"
 #include "infile.hpp"
 #include "pktarray.hpp"
+#include "ratectl.hpp"
+#include "rendition.hpp"
+#include "cache.hpp"
+#include "workpool.hpp"
+#include "pretrans.hpp"
+#include "pacer.hpp"
+#include "reactor.hpp"
+#include "inread.hpp"
+#include "uring.hpp"
+#include "timeshift.hpp"
+#include "recorder.hpp"
+#include "tsmux.hpp"
+#include "localout.hpp"
 #include "webu.hpp"
 #include "webu_ans.hpp"
 #include "webu_mpegts.hpp"
+#include "webu_mpts.hpp"
 
 static int webu_mpegts_avio_buf(void *opaque, uint8_t *buf, int buf_size)
 {
@@ -68,7 +82,12 @@ ssize_t cls_webuts::mpegts_response(uint64_t pos, char *buf, size_t max)
     }
 
     if ((stream_pos == 0) && (resp_used == 0)) {
-        getimg();
+        if (burst_on == true) {
+            getburst();
+        }
+        if (resp_used == 0) {
+            getimg();
+        }
     }
 
     if (resp_used == 0) {
@@ -94,6 +113,10 @@ ssize_t cls_webuts::mpegts_response(uint64_t pos, char *buf, size_t max)
 
 void cls_webuts::free_context()
 {
+    if (tsmux != nullptr) {
+        delete tsmux;
+        tsmux = nullptr;
+    }
     if (wfile.audio.codec_ctx != nullptr) {
         myavcodec_close(wfile.audio.codec_ctx);
         wfile.audio.codec_ctx = nullptr;
@@ -191,195 +214,72 @@ void cls_webuts::packet_wait()
     }
 }
 
+/* The ring holds the packets on the channel timeline so only the
+ * time base of the output stream is applied here
+*/
 void cls_webuts::packet_pts()
 {
-    int64_t ts_interval, base_pdts, last_pts;
-    int64_t strm_st_pts, src_pts, temp_pts;
-    AVRational tmpdst;
+    ctx_rescale *rs;
 
-    src_pts = pkt->pts;
     if (wfile.time_start == -1) {
         wfile.time_start = av_gettime_relative();
-        file_cnt = pkt_file_cnt;
     }
-/*
-        LOG_MSG(DBG, NO_ERRNO
-            ,"init %d %d pts %d %d %d/%d st-a %d %d/%d st-v %d %d/%d"
-            , pkt->stream_index
-            , file_cnt
-            , src_pts
-            , chitm->pktarray[indx].start_pts
-            , chitm->pktarray[indx].timebase.num
-            , chitm->pktarray[indx].timebase.den
-            , wfile.audio.start_pts
-            , wfile.audio.strm->time_base.num
-            , wfile.audio.strm->time_base.den
-            , wfile.video.start_pts
-            , wfile.video.strm->time_base.num
-            , wfile.video.strm->time_base.den
-            );
-*/
-
 
     if (pkt->stream_index == wfile.audio.index) {
-        if (wfile.audio.start_pts == -1 ) {
-            wfile.audio.start_pts = av_rescale_q(
-                src_pts - pkt_start_pts
-                , pkt_timebase
-                , wfile.audio.strm->time_base);
-            if (wfile.audio.start_pts <= 0) {
-                wfile.audio.start_pts = 1;
-            }
-            if (wfile.video.start_pts != -1 ) {
-                temp_pts = av_rescale_q(
-                    wfile.video.start_pts
-                    , wfile.video.strm->time_base
-                    , wfile.audio.strm->time_base);
-                if (temp_pts < wfile.audio.start_pts) {
-                    wfile.audio.start_pts = temp_pts;
-                } else {
-                    wfile.video.start_pts = av_rescale_q(
-                        wfile.audio.start_pts
-                        , wfile.audio.strm->time_base
-                        , wfile.video.strm->time_base);
-                }
-            }
-            wfile.audio.last_pts = 0;
-            wfile.audio.base_pdts = 0;
-        }
-        tmpdst = wfile.audio.strm->time_base;
-        last_pts = wfile.audio.last_pts;
-        base_pdts = wfile.audio.base_pdts;
-        strm_st_pts = wfile.audio.start_pts;
+        rs = &rs_audio;
+        myrescale_check(rs_audio, AVRational{1, PKTARRAY_TIMEBASE}
+            , wfile.audio.strm->time_base);
     } else {
-        if (wfile.video.start_pts == -1 ) {
-            wfile.video.start_pts = av_rescale_q(
-                src_pts - pkt_start_pts
-                , pkt_timebase
-                , wfile.video.strm->time_base);
-            if (wfile.video.start_pts <= 0) {
-                wfile.video.start_pts = 1;
-            }
-            if (wfile.audio.start_pts != -1 ) {
-                temp_pts = av_rescale_q(
-                    wfile.audio.start_pts
-                    , wfile.audio.strm->time_base
-                    , wfile.video.strm->time_base);
-                if (temp_pts < wfile.video.start_pts) {
-                    wfile.video.start_pts = temp_pts;
-                } else {
-                    wfile.audio.start_pts = av_rescale_q(
-                        wfile.video.start_pts
-                        , wfile.video.strm->time_base
-                        , wfile.audio.strm->time_base);
-                }
-            }
-            wfile.video.last_pts = 0;
-            wfile.video.base_pdts = 0;
-        }
-        tmpdst = wfile.video.strm->time_base;
-        last_pts = wfile.video.last_pts;
-        base_pdts = wfile.video.base_pdts;
-        strm_st_pts = wfile.video.start_pts;
+        rs = &rs_video;
+        myrescale_check(rs_video, AVRational{1, PKTARRAY_TIMEBASE}
+            , wfile.video.strm->time_base);
     }
+    pkt->pts = myrescale(*rs, pkt->pts);
+    pkt->dts = myrescale(*rs, pkt->dts);
+    if (pkt->duration > 0) {
+        pkt->duration = myrescale(*rs, pkt->duration);
+    }
+    pkt->time_base = rs->dst;
+}
 
-
-    if (pkt->pts != AV_NOPTS_VALUE) {
-        if (file_cnt == pkt_file_cnt) {
-            pkt->pts = av_rescale_q(pkt->pts - pkt_start_pts
-                ,pkt_timebase, tmpdst) - strm_st_pts + base_pdts;
-        } else {
-            file_cnt = pkt_file_cnt;
-            base_pdts = last_pts + strm_st_pts;
-            pkt->pts = av_rescale_q(pkt->pts - pkt_start_pts
-                ,pkt_timebase, tmpdst) - strm_st_pts + base_pdts;
-            if (pkt->pts == last_pts) {
-                pkt->pts++;
-            }
-            if (pkt->stream_index == wfile.audio.index) {
-                wfile.audio.base_pdts = base_pdts;
-                wfile.video.base_pdts = av_rescale_q(base_pdts
-                    , wfile.audio.strm->time_base
-                    , wfile.video.strm->time_base);
-            } else {
-                wfile.video.base_pdts = base_pdts;
-                wfile.audio.base_pdts = av_rescale_q(base_pdts
-                    , wfile.video.strm->time_base
-                    , wfile.audio.strm->time_base);
-            }
-        }
-        if (pkt->pts <= 0) {
-            if (pkt->pts < 0) {
-                LOG_MSG(DBG, NO_ERRNO
-                    ,"Skipping %d",pkt->pts);
-
-                //abort();
-                return;
-            }
-            pkt->pts = 1;
-        }
+/* The stream description of the channel or of the profile */
+ptr_stream_desc cls_webuts::desc_load()
+{
+    if (rnd != nullptr) {
+        return rnd->desc_get();
     }
+    return chitm->desc_get();
+}
 
-    if (pkt->dts != AV_NOPTS_VALUE) {
-        if (file_cnt == pkt_file_cnt) {
-            pkt->dts = av_rescale_q(pkt->dts - pkt_start_pts
-                ,pkt_timebase, tmpdst) - strm_st_pts + base_pdts;
-        } else {
-            file_cnt = pkt_file_cnt;
-            base_pdts = last_pts + strm_st_pts;
-            pkt->dts = av_rescale_q(pkt->dts - pkt_start_pts
-                , pkt_timebase, tmpdst) - strm_st_pts + base_pdts;
-            if (pkt->dts == last_pts) {
-                pkt->dts++;
-            }
-            if (pkt->stream_index == wfile.audio.index) {
-                wfile.audio.base_pdts = base_pdts;
-                wfile.video.base_pdts = av_rescale_q(base_pdts
-                    , wfile.audio.strm->time_base
-                    , wfile.video.strm->time_base);
-            } else {
-                wfile.video.base_pdts = base_pdts;
-                wfile.audio.base_pdts = av_rescale_q(base_pdts
-                    , wfile.video.strm->time_base
-                    , wfile.audio.strm->time_base);
-            }
-        }
-        if (pkt->dts <= 0) {
-            pkt->dts = 1;
-        }
+int64_t cls_webuts::desc_gen()
+{
+    if (rnd != nullptr) {
+        return rnd->desc_gen;
     }
+    return chitm->desc_gen;
+}
 
-    ts_interval = pkt->duration;
-    pkt->duration = av_rescale_q(ts_interval,pkt_timebase, tmpdst);
-    bool chk;
-    if (pkt->flags & AV_PKT_FLAG_KEY) {
-        chk = true;
-    } else {
-        chk = false;
+/* A new file or encoder was published.  The muxer keeps the streams
+ * it was opened with so only the stream indexes are taken over
+*/
+void cls_webuts::desc_update()
+{
+    ptr_stream_desc dsc;
+
+    dsc = desc_load();
+    if (dsc == nullptr) {
+        return;
     }
-    if (chk) {
-        chk = false;
+    if ((dsc->video_index != desc->video_index) ||
+        (dsc->audio_index != desc->audio_index) ||
+        ((dsc->video_par != nullptr) && (desc->video_par != nullptr) &&
+         ((dsc->video_par->width != desc->video_par->width) ||
+          (dsc->video_par->height != desc->video_par->height)))) {
+        LOG_MSG(DBG, NO_ERRNO
+            , "Ch%s: Stream layout changed with generation %ld"
+            , chitm->ch_nbr.c_str(), (long)dsc->generation);
     }
-/*
-    LOG_MSG(DBG, NO_ERRNO
-        ,"data %d %d src %d  %d/%d newpts %d %d tb-a %d/%d %d %d tb-v %d/%d %d %d"
-        , pkt->stream_index
-        , file_cnt
-        , src_pts
-        , pkt_timebase.num
-        , pkt_timebase.den
-        , pkt->pts
-        , chk
-        , wfile.audio.strm->time_base.num
-        , wfile.audio.strm->time_base.den
-        , wfile.audio.base_pdts
-        , wfile.audio.start_pts
-        , wfile.video.strm->time_base.num
-        , wfile.video.strm->time_base.den
-        , wfile.video.base_pdts
-        , wfile.video.start_pts
-        );
-*/
+    desc = dsc;
 }
 
 /* Write the packet in the array at indx to the output format context */
@@ -392,12 +292,16 @@ void cls_webuts::packet_write()
         return;
     }
 
-    if ((wfile.audio.index != chitm->infile->ofile.audio.index) ||
-        (wfile.video.index != chitm->infile->ofile.video.index)) {
-        if (pkt->stream_index == chitm->infile->ofile.audio.index) {
+    if (desc_gen() != desc->generation) {
+        desc_update();
+    }
+
+    if ((wfile.audio.index != desc->audio_index) ||
+        (wfile.video.index != desc->video_index)) {
+        if (pkt->stream_index == desc->audio_index) {
             LOG_MSG(DBG, NO_ERRNO,"Swapping audio");
             pkt->stream_index = wfile.audio.index;
-        } else if (pkt->stream_index == chitm->infile->ofile.video.index) {
+        } else if (pkt->stream_index == desc->video_index) {
             LOG_MSG(DBG, NO_ERRNO,"Swapping video");
             pkt->stream_index = wfile.video.index;
         }
@@ -426,30 +330,69 @@ void cls_webuts::packet_write()
         , chitm->ch_nbr.c_str()
         , pkt_index, pkt_idnbr);
 */
+    /* Hold back video until the first keyframe */
     if ((start_cnt == 1) &&
-        (pkt_key == false) &&
-        (pkt->stream_index = chitm->infile->ofile.video.index)) {
-        return;
+        (pkt->stream_index == wfile.video.index)) {
+        if (pkt_key == false) {
+            return;
+        }
+        start_cnt = 0;
     }
-    start_cnt = 0;
 
-    retcd = av_interleaved_write_frame(wfile.fmt_ctx, pkt);
+    if (tsmux != nullptr) {
+        retcd = tsmux->write(pkt, resp_image, resp_size, resp_used);
+    } else if (chitm->ch_lowlatency == true) {
+        /* The ring is already in decode order so write it as it comes
+         * and push the packet out to the response buffer right away
+        */
+        retcd = av_write_frame(wfile.fmt_ctx, pkt);
+        if (retcd >= 0) {
+            avio_flush(wfile.fmt_ctx->pb);
+        }
+    } else {
+        retcd = av_interleaved_write_frame(wfile.fmt_ctx, pkt);
+    }
     if (retcd < 0) {
         av_strerror(retcd, errstr, sizeof(errstr));
         LOG_MSG(ERR, NO_ERRNO
             ,"Error writing frame index %d id %d err %s"
             , pkt_index, pkt_idnbr, errstr);
+    } else if ((ttff_done == false) &&
+        (pkt->stream_index == wfile.video.index)) {
+        ttff_update();
     }
 
 }
 
+/* Record the time from connecting until the first video frame was muxed */
+void cls_webuts::ttff_update()
+{
+    int64_t ttff;
+
+    ttff_done = true;
+    ttff = av_gettime_relative() - time_open;
+
+    pthread_mutex_lock(&chitm->mtx_stats);
+        chitm->stats.ttff_cnt++;
+        chitm->stats.ttff_sum += ttff;
+        chitm->stats.ttff_last = ttff;
+        if (ttff > chitm->stats.ttff_max) {
+            chitm->stats.ttff_max = ttff;
+        }
+    pthread_mutex_unlock(&chitm->mtx_stats);
+
+    LOG_MSG(DBG, NO_ERRNO
+        , "Ch%s: First frame after %ld ms"
+        , chitm->ch_nbr.c_str(), (long)(ttff / 1000));
+}
+
 void cls_webuts::pkt_copy(int indx)
 {
     int retcd;
     char errstr[128];
     ctx_packet_item *pkt_src;
 
-    pkt_src = &chitm->pktarray->array[indx];
+    pkt_src = &pktarray->array[indx];
     retcd = mycopy_packet(pkt, pkt_src->packet);
     if (retcd < 0) {
         av_strerror(retcd, errstr, sizeof(errstr));
@@ -460,18 +403,16 @@ void cls_webuts::pkt_copy(int indx)
     }
     pkt_index     = indx;
     pkt_idnbr     = pkt_src->idnbr;
-    pkt_start_pts = pkt_src->start_pts;
-    pkt_timebase  = pkt_src->timebase;
-    pkt_file_cnt  = pkt_src->file_cnt;
     pkt_key       = pkt_src->iskey;
 }
 
 bool cls_webuts::pkt_get(int indx)
 {
     bool pktready;
-    pthread_mutex_lock(&chitm->pktarray->mtx);
-        if ((chitm->pktarray->array[indx].packet != nullptr) &&
-            (chitm->pktarray->array[indx].idnbr > pkt_idnbr) ) {
+    pthread_mutex_lock(&pktarray->mtx);
+        indx = pktarray->index_valid(indx);
+        if ((pktarray->array[indx].packet != nullptr) &&
+            (pktarray->array[indx].idnbr > pkt_idnbr) ) {
             pkt_copy(indx);
             if (pkt == nullptr) {
                 pktready = false;
@@ -481,7 +422,7 @@ bool cls_webuts::pkt_get(int indx)
         } else {
             pktready = false;
         }
-    pthread_mutex_unlock(&chitm->pktarray->mtx);
+    pthread_mutex_unlock(&pktarray->mtx);
     return pktready;
 }
 
@@ -490,15 +431,20 @@ void cls_webuts::getimg()
     int indx_next, chk;
     bool pktready;
 
-    pthread_mutex_lock(&chitm->pktarray->mtx);
-        if (chitm->pktarray->count == 0) {
-            pthread_mutex_unlock(&chitm->pktarray->mtx);
+    if (ts_pos != -1) {
+        getimg_ts();
+        return;
+    }
+
+    pthread_mutex_lock(&pktarray->mtx);
+        if (pktarray->count == 0) {
+            pthread_mutex_unlock(&pktarray->mtx);
             return;
         }
-    pthread_mutex_unlock(&chitm->pktarray->mtx);
+    pthread_mutex_unlock(&pktarray->mtx);
 
     indx_next = pkt_index;
-    indx_next = chitm->pktarray->index_next(indx_next);
+    indx_next = pktarray->index_next(indx_next);
 
     pkt = mypacket_alloc(pkt);
 
@@ -525,11 +471,109 @@ void cls_webuts::getimg()
     pkt = nullptr;
 }
 
+/* Send the next packet from the timeshift store.  The packets are paced
+ * on their dts so the client stays the asked for distance behind live
+*/
+void cls_webuts::getimg_ts()
+{
+    int retcd, chk;
+    int64_t due, tm_wait;
+
+    pkt = mypacket_alloc(pkt);
+
+    retcd = chitm->timeshift->read(ts_pos, pkt);
+    chk = 0;
+    while ((retcd == 1) && (chk < 1000) &&
+        (c_webu->wb_finish == false)) {
+        SLEEP(0, msec_cnt * 1000);
+        retcd = chitm->timeshift->read(ts_pos, pkt);
+        chk++;
+    }
+
+    if (retcd == -1) {
+        /* The writer went past us so start again at the oldest keyframe */
+        ts_pos = chitm->timeshift->seek(-chitm->ch_timeshift);
+        ts_origin_wall = -1;
+        start_cnt = 1;
+        LOG_MSG(INF, NO_ERRNO
+            , "Ch%s: Timeshift client was overtaken, restarting at %ld"
+            , chitm->ch_nbr.c_str(), (long)ts_pos);
+    }
+    if (retcd != 0) {
+        mypacket_free(pkt);
+        pkt = nullptr;
+        return;
+    }
+
+    if (pkt->dts != AV_NOPTS_VALUE) {
+        if (ts_origin_wall == -1) {
+            ts_origin_wall = av_gettime_relative();
+            ts_origin_pts = pkt->dts;
+        }
+        due = ts_origin_wall + av_rescale(pkt->dts - ts_origin_pts
+            , AV_TIME_BASE, PKTARRAY_TIMEBASE);
+        tm_wait = due - av_gettime_relative() - TIMESHIFT_LEAD;
+        while ((tm_wait > 0) && (c_webu->wb_finish == false)) {
+            if (tm_wait > 100000) {
+                tm_wait = 100000;
+            }
+            SLEEP(0, tm_wait * 1000);
+            tm_wait = due - av_gettime_relative() - TIMESHIFT_LEAD;
+        }
+    }
+
+    pkt_key = ((pkt->flags & AV_PKT_FLAG_KEY) != 0);
+    packet_write();
+
+    mypacket_free(pkt);
+    pkt = nullptr;
+}
+
+/* Mux every packet already waiting in the ring without blocking */
+void cls_webuts::getburst()
+{
+    int indx_next;
+
+    while ((resp_used < WEBUTS_BURST_CHUNK) &&
+        (c_webu->wb_finish == false)) {
+        indx_next = pktarray->index_next(pkt_index);
+        pkt = mypacket_alloc(pkt);
+        if (pkt_get(indx_next) == false) {
+            mypacket_free(pkt);
+            pkt = nullptr;
+            burst_end();
+            return;
+        }
+        packet_write();
+        mypacket_free(pkt);
+        pkt = nullptr;
+    }
+    burst_bytes += (int64_t)resp_used;
+}
+
+/* The client has caught up with the live edge */
+void cls_webuts::burst_end()
+{
+    burst_on = false;
+    burst_bytes += (int64_t)resp_used;
+
+    pthread_mutex_lock(&chitm->mtx_stats);
+        chitm->stats.burst_cnt++;
+        chitm->stats.burst_bytes += burst_bytes;
+        chitm->stats.burst_usec += av_gettime_relative() - time_open;
+    pthread_mutex_unlock(&chitm->mtx_stats);
+
+    LOG_MSG(DBG, NO_ERRNO
+        , "Ch%s: Burst of %ld bytes complete"
+        , chitm->ch_nbr.c_str(), (long)burst_bytes);
+}
+
 int cls_webuts::streams_video_h264()
 {
     int retcd;
     char errstr[128];
-    AVCodecContext  *wfl_ctx, *enc_ctx;
+    AVCodecContext  *wfl_ctx;
+    AVCodecParameters *par;
     AVDictionary    *opts;
     const AVCodec   *encoder;
     AVStream        *stream;
@@ -558,20 +602,20 @@ int cls_webuts::streams_video_h264()
         return -1;
     }
 
-    enc_ctx = chitm->infile->ofile.video.codec_ctx;
+    par = desc->video_par;
     wfl_ctx = wfile.video.codec_ctx;
 
-    wfl_ctx->gop_size      = enc_ctx->gop_size;
-    wfl_ctx->codec_id      = enc_ctx->codec_id;
-    wfl_ctx->codec_type    = enc_ctx->codec_type;
-    wfl_ctx->bit_rate      = enc_ctx->bit_rate;
-    wfl_ctx->width         = enc_ctx->width;
-    wfl_ctx->height        = enc_ctx->height;
-    wfl_ctx->time_base     = enc_ctx->time_base;
-    wfl_ctx->pix_fmt       = enc_ctx->pix_fmt;
-    wfl_ctx->max_b_frames  = enc_ctx->max_b_frames;
-    wfl_ctx->framerate     = enc_ctx->framerate;
-    wfl_ctx->keyint_min    = enc_ctx->keyint_min;
+    wfl_ctx->gop_size      = desc->gop_size;
+    wfl_ctx->codec_id      = par->codec_id;
+    wfl_ctx->codec_type    = par->codec_type;
+    wfl_ctx->bit_rate      = par->bit_rate;
+    wfl_ctx->width         = par->width;
+    wfl_ctx->height        = par->height;
+    wfl_ctx->time_base     = desc->video_tb;
+    wfl_ctx->pix_fmt       = (enum AVPixelFormat)par->format;
+    wfl_ctx->max_b_frames  = desc->max_b_frames;
+    wfl_ctx->framerate     = desc->framerate;
+    wfl_ctx->keyint_min    = desc->keyint_min;
 
     av_dict_set( &opts, "profile", "baseline", 0 );
     av_dict_set( &opts, "crf", "17", 0 );
@@ -581,7 +625,7 @@ int cls_webuts::streams_video_h264()
     av_dict_set( &opts, "scenecut", "200", 0 );
 
     if (wfile.fmt_ctx->oformat->flags & AVFMT_GLOBALHEADER) {
-        enc_ctx->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+        wfl_ctx->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
     }
 
     retcd = avcodec_open2(wfl_ctx, encoder, &opts);
@@ -602,7 +646,7 @@ int cls_webuts::streams_video_h264()
         free_context();
         return -1;
     }
-    stream->time_base = chitm->infile->ofile.video.strm->time_base;
+    stream->time_base = desc->video_strm_tb;
 
     return 0;
 }
@@ -611,7 +655,8 @@ int cls_webuts::streams_video_mpeg()
 {
     int retcd;
     char errstr[128];
-    AVCodecContext  *wfl_ctx, *enc_ctx;
+    AVCodecContext  *wfl_ctx;
+    AVCodecParameters *par;
     AVDictionary    *opts;
     const AVCodec   *encoder;
     AVStream        *stream;
@@ -640,20 +685,20 @@ int cls_webuts::streams_video_mpeg()
         return -1;
     }
 
-    enc_ctx = chitm->infile->ofile.video.codec_ctx;
+    par = desc->video_par;
     wfl_ctx = wfile.video.codec_ctx;
 
-    wfl_ctx->codec_id      = enc_ctx->codec_id;
-    wfl_ctx->codec_type    = enc_ctx->codec_type;
-    wfl_ctx->width         = enc_ctx->width;
-    wfl_ctx->height        = enc_ctx->height;
-    wfl_ctx->time_base     = enc_ctx->time_base;
-    wfl_ctx->max_b_frames  = enc_ctx->max_b_frames;
-    wfl_ctx->framerate     = enc_ctx->framerate;
-    wfl_ctx->bit_rate      = enc_ctx->bit_rate;
-    wfl_ctx->gop_size      = enc_ctx->gop_size;
-    wfl_ctx->pix_fmt       = enc_ctx->pix_fmt;
-    wfl_ctx->sw_pix_fmt    = enc_ctx->sw_pix_fmt;
+    wfl_ctx->codec_id      = par->codec_id;
+    wfl_ctx->codec_type    = par->codec_type;
+    wfl_ctx->width         = par->width;
+    wfl_ctx->height        = par->height;
+    wfl_ctx->time_base     = desc->video_tb;
+    wfl_ctx->max_b_frames  = desc->max_b_frames;
+    wfl_ctx->framerate     = desc->framerate;
+    wfl_ctx->bit_rate      = par->bit_rate;
+    wfl_ctx->gop_size      = desc->gop_size;
+    wfl_ctx->pix_fmt       = (enum AVPixelFormat)par->format;
+    wfl_ctx->sw_pix_fmt    = desc->sw_pix_fmt;
     if (wfile.fmt_ctx->oformat->flags & AVFMT_GLOBALHEADER) {
         wfl_ctx->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
     }
@@ -682,9 +727,9 @@ int cls_webuts::streams_video_mpeg()
         free_context();
         return -1;
     }
-    stream->time_base = chitm->infile->ofile.video.strm->time_base;
-    stream->r_frame_rate = enc_ctx->framerate;
-    stream->avg_frame_rate= enc_ctx->framerate;
+    stream->time_base = desc->video_strm_tb;
+    stream->r_frame_rate = desc->framerate;
+    stream->avg_frame_rate= desc->framerate;
 
 /*
     LOG_MSG(NTC, NO_ERRNO
@@ -703,7 +748,8 @@ int cls_webuts::streams_video_mpeg()
 int cls_webuts::streams_audio()
 {
     int retcd;
-    AVCodecContext  *wfl_ctx, *enc_ctx;
+    AVCodecContext  *wfl_ctx;
+    AVCodecParameters *par;
     char errstr[128];
     AVDictionary *opts = NULL;
     const AVCodec *encoder;
@@ -730,30 +776,30 @@ int cls_webuts::streams_audio()
         return -1;
     }
 
-    enc_ctx =chitm->infile->ofile.audio.codec_ctx;
+    par = desc->audio_par;
     wfl_ctx =wfile.audio.codec_ctx;
 
     wfile.fmt_ctx->audio_codec_id = AV_CODEC_ID_AC3;
     wfile.fmt_ctx->audio_codec = avcodec_find_encoder(AV_CODEC_ID_AC3);
     stream->codecpar->codec_id=AV_CODEC_ID_AC3;
-    stream->codecpar->bit_rate = enc_ctx->bit_rate;;
-    stream->codecpar->frame_size = enc_ctx->frame_size;;
+    stream->codecpar->bit_rate = par->bit_rate;
+    stream->codecpar->frame_size = par->frame_size;
     av_channel_layout_default(&stream->codecpar->ch_layout
-        , enc_ctx->ch_layout.nb_channels);
+        , par->ch_layout.nb_channels);
 
-    stream->codecpar->format = enc_ctx->sample_fmt;
-    stream->codecpar->sample_rate = enc_ctx->sample_rate;
-    stream->time_base.den  = enc_ctx->sample_rate;
+    stream->codecpar->format = par->format;
+    stream->codecpar->sample_rate = par->sample_rate;
+    stream->time_base.den  = par->sample_rate;
     stream->time_base.num = 1;
 
-    wfl_ctx->bit_rate = enc_ctx->bit_rate;
-    wfl_ctx->sample_fmt = enc_ctx->sample_fmt;
-    wfl_ctx->sample_rate = enc_ctx->sample_rate;
-    wfl_ctx->time_base = enc_ctx->time_base;
+    wfl_ctx->bit_rate = par->bit_rate;
+    wfl_ctx->sample_fmt = (enum AVSampleFormat)par->format;
+    wfl_ctx->sample_rate = par->sample_rate;
+    wfl_ctx->time_base = desc->audio_tb;
     av_channel_layout_default(&wfl_ctx->ch_layout
-        , enc_ctx->ch_layout.nb_channels);
-    wfl_ctx->frame_size = enc_ctx->frame_size;
-    wfl_ctx->pkt_timebase = enc_ctx->pkt_timebase;
+        , par->ch_layout.nb_channels);
+    wfl_ctx->frame_size = par->frame_size;
+    wfl_ctx->pkt_timebase = desc->audio_pkt_tb;
 
     retcd = avcodec_open2(wfl_ctx, encoder, &opts);
     if (retcd < 0) {
@@ -768,49 +814,47 @@ int cls_webuts::streams_audio()
     return 0;
 }
 
-int cls_webuts::open()
+/* Set up the native packetizer.  The streams are only kept for their
+ * parameters and get the 90 kHz time base the packetizer writes
+*/
+int cls_webuts::open_tsmux()
 {
-    int retcd, indx_curr;
-    char errstr[128];
-    unsigned char   *buf_image;
-    AVDictionary    *opts;
+    enum AVCodecID video_codec, audio_codec;
 
-    if (c_webu->wb_finish == true) {
-        return -1;
+    video_codec = AV_CODEC_ID_NONE;
+    audio_codec = AV_CODEC_ID_NONE;
+    if (wfile.video.strm != nullptr) {
+        wfile.video.strm->time_base = AVRational{1, 90000};
+        video_codec = wfile.video.strm->codecpar->codec_id;
+    }
+    if (wfile.audio.strm != nullptr) {
+        wfile.audio.strm->time_base = AVRational{1, 90000};
+        audio_codec = wfile.audio.strm->codecpar->codec_id;
     }
 
-    opts = NULL;
-    wfile.fmt_ctx = avformat_alloc_context();
-    wfile.fmt_ctx->oformat = av_guess_format("mpegts", NULL, NULL);
+    tsmux = new cls_tsmux();
+    if (tsmux->init(wfile.video.index, video_codec
+            , wfile.audio.index, audio_codec) != 0) {
+        LOG_MSG(NTC, NO_ERRNO
+            , "Ch%s: Streams not supported by the native packetizer"
+            , chitm->ch_nbr.c_str());
+        delete tsmux;
+        tsmux = nullptr;
+        return -1;
+    }
 
-    pthread_mutex_lock(&chitm->infile->mtx);
-        if (chitm->infile->ofile.video.index != -1) {
-            if (chitm->ch_encode == "h264") {
-                retcd = streams_video_h264();
-            } else {
-                retcd = streams_video_mpeg();
-            }
-            if (retcd < 0) {
-                pthread_mutex_unlock(&chitm->infile->mtx);
-                free_context();
-                return -1;
-            }
-        }
-        if (chitm->infile->ofile.audio.index != -1) {
-            retcd = streams_audio();
-            if (retcd < 0) {
-                pthread_mutex_unlock(&chitm->infile->mtx);
-                free_context();
-                return -1;
-            }
-        }
-    pthread_mutex_unlock(&chitm->infile->mtx);
+    return 0;
+}
 
-    resp_image  =(unsigned char*) mymalloc(WEBUA_LEN_RESP * 10);
-    memset(resp_image,'\0',WEBUA_LEN_RESP);
-    resp_size = WEBUA_LEN_RESP;
-    resp_used = 0;
+/* Have the libavformat muxer write the stream */
+int cls_webuts::open_lavf()
+{
+    int retcd;
+    char errstr[128];
+    unsigned char   *buf_image;
+    AVDictionary    *opts;
 
+    opts = NULL;
     aviobuf_sz = WEBUA_LEN_RESP;
     buf_image = (unsigned char*)av_malloc(aviobuf_sz);
     wfile.fmt_ctx->pb = avio_alloc_context(
@@ -818,6 +862,12 @@ int cls_webuts::open()
         , NULL, &webu_mpegts_avio_buf, NULL);
     wfile.fmt_ctx->flags = AVFMT_FLAG_CUSTOM_IO;
     av_dict_set(&opts, "movflags", "empty_moov", 0);
+    if (chitm->ch_lowlatency == true) {
+        /* No mux delay or preload ahead of the PCR and a PES per packet */
+        wfile.fmt_ctx->max_delay = 0;
+        wfile.fmt_ctx->flags |= AVFMT_FLAG_FLUSH_PACKETS;
+        av_dict_set(&opts, "pes_payload_size", "0", 0);
+    }
 
     retcd = avformat_write_header(wfile.fmt_ctx, &opts);
     if (retcd < 0) {
@@ -830,19 +880,121 @@ int cls_webuts::open()
     }
     av_dict_free(&opts);
 
+    return 0;
+}
+
+int cls_webuts::open()
+{
+    int retcd, indx_curr, indx_join;
+    int64_t idnbr_join, offset;
+    const char *val;
+
+    if (c_webu->wb_finish == true) {
+        return -1;
+    }
+
+    time_open = av_gettime_relative();
+    ttff_done = false;
+    burst_bytes = 0;
+    offset = 0;
+
+    if ((rnd != nullptr) && (rnd->wait_ready() == false)) {
+        return -1;
+    }
+
+    wfile.fmt_ctx = avformat_alloc_context();
+    wfile.fmt_ctx->oformat = av_guess_format("mpegts", NULL, NULL);
+
+    desc = desc_load();
+    if (desc == nullptr) {
+        free_context();
+        return -1;
+    }
+    if (desc->video_index != -1) {
+        /* Profiles are always h264 */
+        if ((rnd != nullptr) || (chitm->ch_encode == "h264")) {
+            retcd = streams_video_h264();
+        } else {
+            retcd = streams_video_mpeg();
+        }
+        if (retcd < 0) {
+            free_context();
+            return -1;
+        }
+    }
+    if (desc->audio_index != -1) {
+        retcd = streams_audio();
+        if (retcd < 0) {
+            free_context();
+            return -1;
+        }
+    }
+
+    resp_image  =(unsigned char*) mymalloc(WEBUA_LEN_RESP * 10);
+    memset(resp_image,'\0',WEBUA_LEN_RESP);
+    resp_size = WEBUA_LEN_RESP;
+    resp_used = 0;
+
+    if ((chitm->ch_tsmux == false) || (open_tsmux() != 0)) {
+        if (open_lavf() != 0) {
+            return -1;
+        }
+    }
+
     stream_pos = 0;
     resp_used = 0;
 
-    indx_curr = chitm->pktarray->index_curr();
+    /* ?offset=-600 starts ten minutes in the past from the timeshift store */
+    if ((rnd == nullptr) && (chitm->timeshift != nullptr)) {
+        val = MHD_lookup_connection_value(connection, MHD_GET_ARGUMENT_KIND, "offset");
+        if (val != nullptr) {
+            offset = atoll(val);
+            if (offset < 0) {
+                ts_pos = chitm->timeshift->seek(offset);
+            }
+        }
+    }
+    if (ts_pos != -1) {
+        start_cnt = 1;
+        LOG_MSG(NTC, NO_ERRNO
+            , "%s: Starting %ld seconds back at %ld"
+            , chitm->ch_nbr.c_str(), (long)-offset, (long)ts_pos);
+        return 0;
+    }
+
+    indx_curr = pktarray->index_curr();
     if (indx_curr < 0) {
         indx_curr = 0;
     }
 
-    pkt_index = (int)(chitm->pktarray->count / 2) + indx_curr;
-    if (pkt_index > chitm->pktarray->count) {
-        pkt_index -= chitm->pktarray->count;
+    /* Join live and have the encoder send an IDR unless asked to start
+     * on a keyframe already in the ring
+    */
+    if ((chitm->ch_burst == 0) && (chitm->ch_joinkey == 0)) {
+        indx_join = pktarray->index_live(idnbr_join);
+        if (indx_join != -1) {
+            if (rnd == nullptr) {
+                chitm->ch_idr = true;
+            } else {
+                rnd->idr = true;
+            }
+        }
+    } else {
+        indx_join = pktarray->index_join(
+            chitm->ch_joinkey, chitm->ch_burst, idnbr_join);
+    }
+    if (indx_join != -1) {
+        pkt_index = indx_join;
+        pkt_idnbr = idnbr_join;
+        burst_on = (chitm->ch_burst > 0);
+    } else {
+        /* Start half of the prefill behind the newest packet */
+        pkt_index = indx_curr - (PKTARRAY_PREFILL / 2);
+        if (pkt_index < 0) {
+            pkt_index += pktarray->count;
+        }
+        pkt_idnbr = 1;
     }
-    pkt_idnbr = 1;
     start_cnt = 1;
 
     LOG_MSG(NTC, NO_ERRNO
@@ -898,6 +1050,11 @@ cls_webuts::cls_webuts(cls_app *p_app, cls_webua *p_webua)
     c_webu = p_app->webu;
     c_webua = p_webua;
     chitm = c_webua->chitm;
+    rnd = c_webua->rnd;
+    pktarray = chitm->pktarray;
+    if (rnd != nullptr) {
+        pktarray = rnd->pktarray;
+    }
 
     connection = c_webua->connection;
     resp_image    = nullptr;                     /* Buffer for sending the images */
@@ -911,11 +1068,11 @@ cls_webuts::cls_webuts(cls_app *p_app, cls_webua *p_webua)
     wfile.audio.codec_ctx = nullptr;
     wfile.audio.strm = nullptr;
     wfile.audio.base_pdts = 0;
+    myrescale_init(wfile.audio.rs_us, AVRational{0, 1}, AVRational{1, AV_TIME_BASE});
     wfile.video = wfile.audio;
     wfile.fmt_ctx = nullptr;
     wfile.time_start = -1;
 
-    file_cnt = 0;
     start_cnt = 50;
     stream_pos    = 0;                           /* Stream position of image being sent */
     stream_fps    = 300;                         /* Stream rate */
@@ -927,11 +1084,17 @@ cls_webuts::cls_webuts(cls_app *p_app, cls_webua *p_webua)
     pkt = nullptr;
     pkt_index = 0;
     pkt_idnbr =1;
-    pkt_start_pts=0;
-    pkt_timebase.num = 1;
-    pkt_timebase.den = 1000;
-    pkt_file_cnt = 0;
     pkt_key = false;
+    myrescale_init(rs_audio, AVRational{1, PKTARRAY_TIMEBASE}, AVRational{0, 1});
+    myrescale_init(rs_video, AVRational{1, PKTARRAY_TIMEBASE}, AVRational{0, 1});
+    time_open = 0;
+    ttff_done = false;
+    burst_on = false;
+    burst_bytes = 0;
+    tsmux = nullptr;
+    ts_pos = -1;
+    ts_origin_wall = -1;
+    ts_origin_pts = 0;
 
 }
 
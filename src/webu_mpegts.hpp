@@ -19,6 +19,8 @@
 
 #ifndef _INCLUDE_WEBU_MPEGTS_HPP_
 #define _INCLUDE_WEBU_MPEGTS_HPP_
+    #define WEBUTS_BURST_CHUNK (64 * 1024)  /* Bytes muxed per response while bursting */
+
     class cls_webuts {
         public:
             cls_webuts(cls_app *p_app, cls_webua *p_webua);
@@ -34,6 +36,8 @@
             cls_webu        *c_webu;
             cls_webua       *c_webua;
             cls_channel     *chitm;
+            cls_rendition   *rnd;
+            cls_pktarray    *pktarray;      /* Ring of the channel or of the profile */
 
             struct MHD_Connection       *connection;    /* The MHD connection value from the client */
 
@@ -43,7 +47,7 @@
             size_t                      resp_used;      /* The amount of the response page used */
             size_t                      aviobuf_sz;     /* The size of the mpegts avio buffer */
             ctx_file_info               wfile;
-            int64_t                     file_cnt;
+            cls_tsmux                   *tsmux;         /* Native packetizer used instead of the muxer */
             int                         start_cnt;
             uint64_t                    stream_pos;     /* Stream position of sent image */
             int                         stream_fps;     /* Stream rate per second */
@@ -53,22 +57,38 @@
             AVPacket                    *pkt;
             int                         pkt_index;
             int64_t                     pkt_idnbr;
-            int64_t                     pkt_start_pts;
-            AVRational                  pkt_timebase;
-            int64_t                     pkt_file_cnt;
             bool                        pkt_key;
+            ptr_stream_desc             desc;           /* Streams the muxer was set up from */
+            ctx_rescale                 rs_audio;       /* Channel timeline to the output streams */
+            ctx_rescale                 rs_video;
+            int64_t                     time_open;      /* When the client connected, for time to first frame */
+            bool                        ttff_done;
+            bool                        burst_on;       /* Sending the ring backlog faster than realtime */
+            int64_t                     burst_bytes;
+            int64_t                     ts_pos;         /* Position in the timeshift store or -1 when live */
+            int64_t                     ts_origin_wall; /* Wall clock and timeline of the first timeshift packet */
+            int64_t                     ts_origin_pts;
 
             void free_context();
             void resetpos();
             void packet_wait();
             void packet_pts();
+            ptr_stream_desc desc_load();
+            int64_t desc_gen();
+            void desc_update();
             void packet_write();
+            void ttff_update();
             void pkt_copy(int indx);
             bool pkt_get(int indx);
             void getimg();
+            void getimg_ts();
+            void getburst();
+            void burst_end();
             int streams_video_h264();
             int streams_video_mpeg();
             int streams_audio();
+            int open_tsmux();
+            int open_lavf();
             int open();
     };
 
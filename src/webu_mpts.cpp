@@ -0,0 +1,435 @@
+/*
+ *    This file is part of Restream.
+ *
+ *    Restream is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    Restream is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with Restream.  If not, see <https://www.gnu.org/licenses/>.
+ *
+*/
+
+#include "restream.hpp"
+#include "conf.hpp"
+#include "util.hpp"
+#include "logger.hpp"
+#include "channel.hpp"
+#include "infile.hpp"
+#include "pktarray.hpp"
+#include "ratectl.hpp"
+#include "rendition.hpp"
+#include "cache.hpp"
+#include "workpool.hpp"
+#include "pretrans.hpp"
+#include "pacer.hpp"
+#include "reactor.hpp"
+#include "inread.hpp"
+#include "uring.hpp"
+#include "timeshift.hpp"
+#include "recorder.hpp"
+#include "tsmux.hpp"
+#include "localout.hpp"
+#include "webu.hpp"
+#include "webu_ans.hpp"
+#include "webu_mpegts.hpp"
+#include "webu_mpts.hpp"
+
+static int webu_mpts_avio_buf(void *opaque, uint8_t *buf, int buf_size)
+{
+    return ((cls_webumpts *)opaque)->avio_buf(buf, buf_size);
+}
+
+static ssize_t webu_mpts_response(void *cls, uint64_t pos, char *buf, size_t max)
+{
+    return ((cls_webumpts *)cls)->response(pos, buf, max);
+}
+
+int cls_webumpts::avio_buf(uint8_t *buf, int buf_size)
+{
+    if (resp_size < (size_t)(buf_size + resp_used)) {
+        resp_size = (size_t)(buf_size + resp_used);
+        resp_image = (unsigned char*)realloc(
+            resp_image, resp_size);
+    }
+
+    memcpy(resp_image + resp_used, buf, buf_size);
+    resp_used += buf_size;
+
+    return buf_size;
+}
+
+void cls_webumpts::free_context()
+{
+    if (fmt_ctx != nullptr) {
+        if (fmt_ctx->pb != nullptr) {
+            if (fmt_ctx->pb->buffer != nullptr) {
+                av_free(fmt_ctx->pb->buffer);
+                fmt_ctx->pb->buffer = nullptr;
+            }
+            avio_context_free(&fmt_ctx->pb);
+            fmt_ctx->pb = nullptr;
+        }
+        avformat_free_context(fmt_ctx);
+        fmt_ctx = nullptr;
+    }
+}
+
+/* Add the streams of one channel as a program numbered after it */
+int cls_webumpts::streams_add(ctx_mpts_src &src)
+{
+    int prg_id;
+    AVProgram *prg;
+    AVStream *strm;
+
+    src.strm_video = -1;
+    src.strm_audio = -1;
+    src.desc = src.chitm->desc_get();
+    if (src.desc == nullptr) {
+        LOG_MSG(NTC, NO_ERRNO
+            , "Ch%s: Not ready for the multi program stream"
+            , src.chitm->ch_nbr.c_str());
+        return -1;
+    }
+
+    prg_id = atoi(src.chitm->ch_nbr.c_str());
+    prg = av_new_program(fmt_ctx, prg_id);
+    if (prg == nullptr) {
+        return -1;
+    }
+    av_dict_set(&prg->metadata, "service_name"
+        , ("Ch" + src.chitm->ch_nbr).c_str(), 0);
+    av_dict_set(&prg->metadata, "service_provider", "Restream", 0);
+
+    if ((src.desc->video_index != -1) && (src.desc->video_par != nullptr)) {
+        strm = avformat_new_stream(fmt_ctx, NULL);
+        if ((strm == nullptr) ||
+            (avcodec_parameters_copy(strm->codecpar, src.desc->video_par) < 0)) {
+            return -1;
+        }
+        strm->codecpar->codec_tag = 0;
+        strm->time_base = src.desc->video_strm_tb;
+        src.strm_video = strm->index;
+        av_program_add_stream_index(fmt_ctx, prg_id, (unsigned int)strm->index);
+    }
+    if ((src.desc->audio_index != -1) && (src.desc->audio_par != nullptr)) {
+        strm = avformat_new_stream(fmt_ctx, NULL);
+        if ((strm == nullptr) ||
+            (avcodec_parameters_copy(strm->codecpar, src.desc->audio_par) < 0)) {
+            return -1;
+        }
+        strm->codecpar->codec_tag = 0;
+        strm->time_base = src.desc->audio_tb;
+        src.strm_audio = strm->index;
+        av_program_add_stream_index(fmt_ctx, prg_id, (unsigned int)strm->index);
+    }
+
+    return 0;
+}
+
+int cls_webumpts::open()
+{
+    int retcd, indx;
+    char errstr[128];
+    unsigned char *buf_image;
+
+    time_open = av_gettime_relative();
+
+    avformat_alloc_output_context2(&fmt_ctx, NULL, "mpegts", NULL);
+    if (fmt_ctx == nullptr) {
+        return -1;
+    }
+    for (indx=0; indx < (int)srcs.size(); indx++) {
+        if (streams_add(srcs[indx]) != 0) {
+            free_context();
+            return -1;
+        }
+    }
+
+    resp_image = (unsigned char*)mymalloc(WEBUA_LEN_RESP * 10);
+    resp_size = WEBUA_LEN_RESP * 10;
+    resp_used = 0;
+
+    buf_image = (unsigned char*)av_malloc(WEBUA_LEN_RESP);
+    fmt_ctx->pb = avio_alloc_context(
+        buf_image, WEBUA_LEN_RESP, 1, this
+        , NULL, &webu_mpts_avio_buf, NULL);
+    fmt_ctx->flags = AVFMT_FLAG_CUSTOM_IO;
+
+    retcd = avformat_write_header(fmt_ctx, NULL);
+    if (retcd < 0) {
+        av_strerror(retcd, errstr, sizeof(errstr));
+        LOG_MSG(ERR, NO_ERRNO
+            , "Failed to write the multi program header: %s", errstr);
+        free_context();
+        return -1;
+    }
+
+    /* Join every channel live with an IDR */
+    for (indx=0; indx < (int)srcs.size(); indx++) {
+        ctx_mpts_src &src = srcs[indx];
+        if (src.strm_video != -1) {
+            myrescale_init(src.rs_video, AVRational{1, PKTARRAY_TIMEBASE}
+                , fmt_ctx->streams[src.strm_video]->time_base);
+        }
+        if (src.strm_audio != -1) {
+            myrescale_init(src.rs_audio, AVRational{1, PKTARRAY_TIMEBASE}
+                , fmt_ctx->streams[src.strm_audio]->time_base);
+        }
+        src.key_seen = (src.strm_video == -1);
+        src.pkt_index = src.chitm->pktarray->index_curr();
+        src.pkt_idnbr = 0;
+        if (src.pkt_index >= 0) {
+            pthread_mutex_lock(&src.chitm->pktarray->mtx);
+                src.pkt_idnbr = src.chitm->pktarray->array[src.pkt_index].idnbr;
+            pthread_mutex_unlock(&src.chitm->pktarray->mtx);
+        }
+        src.chitm->ch_idr = true;
+    }
+
+    return 0;
+}
+
+/* Copy the next packet of the channel's ring into pkt */
+bool cls_webumpts::pkt_get(ctx_mpts_src &src)
+{
+    int indx;
+    bool pktready;
+    cls_pktarray *pktarray;
+
+    pktarray = src.chitm->pktarray;
+    pktready = false;
+
+    pthread_mutex_lock(&pktarray->mtx);
+        if (pktarray->count > 0) {
+            indx = pktarray->index_valid(pktarray->index_next(src.pkt_index));
+            if ((pktarray->array[indx].packet != nullptr) &&
+                (pktarray->array[indx].idnbr > src.pkt_idnbr)) {
+                pkt = mypacket_alloc(pkt);
+                if (mycopy_packet(pkt, pktarray->array[indx].packet) == 0) {
+                    pktready = true;
+                }
+                src.pkt_index = indx;
+                src.pkt_idnbr = pktarray->array[indx].idnbr;
+            }
+        }
+    pthread_mutex_unlock(&pktarray->mtx);
+
+    return pktready;
+}
+
+/* Each channel's first packet is placed at the time since connecting so
+ * the programs share one clock and the muxer sees rising timestamps
+*/
+void cls_webumpts::packet_write(ctx_mpts_src &src)
+{
+    int retcd, strm, slot;
+    char errstr[128];
+    ctx_rescale *rs;
+
+    if (src.chitm->desc_gen != src.desc->generation) {
+        src.desc = src.chitm->desc_get();
+    }
+
+    if (pkt->stream_index == src.desc->video_index) {
+        strm = src.strm_video;
+        rs = &src.rs_video;
+        slot = 0;
+    } else if (pkt->stream_index == src.desc->audio_index) {
+        strm = src.strm_audio;
+        rs = &src.rs_audio;
+        slot = 1;
+    } else {
+        return;
+    }
+    if (strm == -1) {
+        return;
+    }
+
+    if (src.key_seen == false) {
+        if ((strm != src.strm_video) || ((pkt->flags & AV_PKT_FLAG_KEY) == 0)) {
+            return;
+        }
+        src.key_seen = true;
+    }
+    if (pkt->dts == AV_NOPTS_VALUE) {
+        return;
+    }
+
+    if (src.tl_origin == AV_NOPTS_VALUE) {
+        src.tl_origin = pkt->dts - PKTARRAY_TL_START -
+            av_rescale(av_gettime_relative() - time_open
+                , PKTARRAY_TIMEBASE, AV_TIME_BASE);
+    }
+    if (pkt->pts != AV_NOPTS_VALUE) {
+        pkt->pts = myrescale(*rs, pkt->pts - src.tl_origin);
+    }
+    pkt->dts = myrescale(*rs, pkt->dts - src.tl_origin);
+    if (pkt->duration > 0) {
+        pkt->duration = myrescale(*rs, pkt->duration);
+    }
+    if ((src.last_dts[slot] != AV_NOPTS_VALUE) &&
+        (pkt->dts <= src.last_dts[slot])) {
+        return;
+    }
+    src.last_dts[slot] = pkt->dts;
+    pkt->stream_index = strm;
+    pkt->pos = -1;
+
+    /* The rings are already in realtime order so no interleaving is needed */
+    retcd = av_write_frame(fmt_ctx, pkt);
+    if (retcd < 0) {
+        av_strerror(retcd, errstr, sizeof(errstr));
+        LOG_MSG(ERR, NO_ERRNO
+            , "Ch%s: Error writing to the multi program stream: %s"
+            , src.chitm->ch_nbr.c_str(), errstr);
+    }
+}
+
+/* Take what the rings have in turn until a chunk is muxed */
+void cls_webumpts::getimg()
+{
+    int indx, cnt, chk;
+    bool found;
+
+    chk = 0;
+    while ((resp_used < WEBUMPTS_CHUNK) &&
+        (c_webu->wb_finish == false) && (chk < 1000)) {
+        found = false;
+        for (cnt=0; cnt < (int)srcs.size(); cnt++) {
+            indx = (src_next + cnt) % (int)srcs.size();
+            if (pkt_get(srcs[indx]) == true) {
+                packet_write(srcs[indx]);
+                found = true;
+            }
+        }
+        src_next = (src_next + 1) % (int)srcs.size();
+        mypacket_free(pkt);
+        pkt = nullptr;
+
+        if (found == false) {
+            if (resp_used > 0) {
+                break;
+            }
+            SLEEP(0, WEBUMPTS_WAIT * 1000);
+            chk++;
+        }
+    }
+}
+
+ssize_t cls_webumpts::response(uint64_t pos, char *buf, size_t max)
+{
+    (void)pos;
+    size_t sent_bytes;
+
+    if (c_webu->wb_finish == true) {
+        return -1;
+    }
+
+    if ((stream_pos == 0) && (resp_used == 0)) {
+        getimg();
+    }
+
+    if (resp_used == 0) {
+        stream_pos = 0;
+        return 0;
+    }
+
+    if ((resp_used - stream_pos) > max) {
+        sent_bytes = max;
+    } else {
+        sent_bytes = resp_used - stream_pos;
+    }
+
+    memcpy(buf, resp_image + stream_pos, sent_bytes);
+
+    stream_pos = stream_pos + sent_bytes;
+    if (stream_pos >= resp_used) {
+        stream_pos = 0;
+        resp_used = 0;
+    }
+    return sent_bytes;
+}
+
+mhdrslt cls_webumpts::main()
+{
+    mhdrslt retcd;
+    struct MHD_Response *response;
+    std::list<ctx_params_item>::iterator    it;
+
+    if (c_webu->wb_finish == true) {
+        return MHD_NO;
+    }
+
+    if (open() == -1) {
+        return MHD_NO;
+    }
+
+    response = MHD_create_response_from_callback (MHD_SIZE_UNKNOWN
+        , 512, &webu_mpts_response, this, NULL);
+    if (response == nullptr) {
+        LOG_MSG(ERR, NO_ERRNO, "Invalid response");
+        return MHD_NO;
+    }
+
+    for (it  = c_webu->headers.params_array.begin();
+         it != c_webu->headers.params_array.end(); it++) {
+        MHD_add_response_header (response
+            , it->param_name.c_str(), it->param_value.c_str());
+    }
+
+    MHD_add_response_header(response, "Content-Transfer-Encoding", "BINARY");
+    MHD_add_response_header(response, "Content-Type", "application/octet-stream");
+
+    retcd = MHD_queue_response(connection, MHD_HTTP_OK, response);
+    MHD_destroy_response (response);
+
+    return retcd;
+}
+
+cls_webumpts::cls_webumpts(cls_app *p_app, cls_webua *p_webua)
+{
+    int indx;
+    ctx_mpts_src src;
+
+    c_webu = p_app->webu;
+    c_webua = p_webua;
+    connection = c_webua->connection;
+    fmt_ctx = nullptr;
+    pkt = nullptr;
+    resp_image = nullptr;
+    resp_size = 0;
+    resp_used = 0;
+    stream_pos = 0;
+    time_open = 0;
+    src_next = 0;
+
+    for (indx=0; indx < (int)c_webua->mpts_chs.size(); indx++) {
+        src.chitm = c_webua->mpts_chs[indx];
+        src.desc = nullptr;
+        src.strm_video = -1;
+        src.strm_audio = -1;
+        myrescale_init(src.rs_video, AVRational{1, PKTARRAY_TIMEBASE}, AVRational{0, 1});
+        myrescale_init(src.rs_audio, AVRational{1, PKTARRAY_TIMEBASE}, AVRational{0, 1});
+        src.tl_origin = AV_NOPTS_VALUE;
+        src.last_dts[0] = AV_NOPTS_VALUE;
+        src.last_dts[1] = AV_NOPTS_VALUE;
+        src.key_seen = false;
+        src.pkt_index = -1;
+        src.pkt_idnbr = 0;
+        srcs.push_back(src);
+    }
+}
+
+cls_webumpts::~cls_webumpts()
+{
+    mypacket_free(pkt);
+    myfree(&resp_image);
+    free_context();
+}
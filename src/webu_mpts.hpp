@@ -0,0 +1,75 @@
+/*
+ *    This file is part of Restream.
+ *
+ *    Restream is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    Restream is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with Restream.  If not, see <https://www.gnu.org/licenses/>.
+ *
+*/
+
+#ifndef _INCLUDE_WEBU_MPTS_HPP_
+#define _INCLUDE_WEBU_MPTS_HPP_
+    #define WEBUMPTS_CHUNK      (64 * 1024)     /* Bytes muxed per response */
+    #define WEBUMPTS_WAIT       5000            /* Microseconds to wait when no ring has a packet */
+
+    /* One channel of the multi program stream */
+    struct ctx_mpts_src {
+        cls_channel     *chitm;
+        ptr_stream_desc desc;
+        int             strm_video;     /* Output streams of the channel */
+        int             strm_audio;
+        ctx_rescale     rs_video;       /* Channel timeline to the output streams */
+        ctx_rescale     rs_audio;
+        int64_t         tl_origin;      /* Timeline position sent as the common start */
+        int64_t         last_dts[2];
+        bool            key_seen;
+        int             pkt_index;
+        int64_t         pkt_idnbr;
+    };
+
+    /* Muxes the rings of several channels into one transport stream with
+     * a program per channel.  The programs are aligned on the wall clock
+     * of the connection since every channel runs its own timeline
+    */
+    class cls_webumpts {
+        public:
+            cls_webumpts(cls_app *p_app, cls_webua *p_webua);
+            ~cls_webumpts();
+
+            int     avio_buf(uint8_t *buf, int buf_size);
+            ssize_t response(uint64_t pos, char *buf, size_t max);
+            mhdrslt main();
+
+        private:
+            cls_webu        *c_webu;
+            cls_webua       *c_webua;
+            struct MHD_Connection   *connection;
+
+            std::vector<ctx_mpts_src>   srcs;
+            AVFormatContext *fmt_ctx;
+            AVPacket        *pkt;
+            unsigned char   *resp_image;
+            size_t          resp_size;
+            size_t          resp_used;
+            uint64_t        stream_pos;
+            int64_t         time_open;
+            int             src_next;       /* Source polled first on the next pass */
+
+            void    free_context();
+            int     streams_add(ctx_mpts_src &src);
+            int     open();
+            bool    pkt_get(ctx_mpts_src &src);
+            void    packet_write(ctx_mpts_src &src);
+            void    getimg();
+    };
+
+#endif /* _INCLUDE_WEBU_MPTS_HPP_ */
@@ -0,0 +1,280 @@
+/*
+ *    This file is part of Restream.
+ *
+ *    Restream is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    Restream is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with Restream.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "restream.hpp"
+#include "conf.hpp"
+#include "util.hpp"
+#include "logger.hpp"
+#include "channel.hpp"
+#include "infile.hpp"
+#include "pktarray.hpp"
+#include "ratectl.hpp"
+#include "rendition.hpp"
+#include "cache.hpp"
+#include "workpool.hpp"
+#include "pretrans.hpp"
+#include "pacer.hpp"
+#include "reactor.hpp"
+#include "inread.hpp"
+#include "uring.hpp"
+#include "timeshift.hpp"
+#include "recorder.hpp"
+#include "tsmux.hpp"
+#include "localout.hpp"
+#include "webu.hpp"
+#include "webu_ans.hpp"
+#include "webu_mpegts.hpp"
+#include "webu_mpts.hpp"
+
+/* Workers submitting from inside a task keep the new task on their own
+ * queue.  Other threads spread their tasks over the queues
+*/
+static thread_local int workpool_self = -1;
+
+void cls_workpool::push(std::function<void()> task, bool back)
+{
+    int indx;
+
+    indx = workpool_self;
+    if ((indx < 0) || (indx >= threads)) {
+        indx = (next++ % threads);
+    }
+
+    pending++;
+    queues[indx]->mtx.lock();
+        if (back == true) {
+            queues[indx]->tasks.push_front(task);
+        } else {
+            queues[indx]->tasks.push_back(task);
+        }
+    queues[indx]->mtx.unlock();
+
+    mtx.lock();
+        queued++;
+    mtx.unlock();
+    cond.notify_all();
+}
+
+void cls_workpool::submit(std::function<void()> task)
+{
+    push(task, false);
+}
+
+/* Queue behind everything already waiting.  The owner pops this end
+ * last and other workers steal from it first
+*/
+void cls_workpool::submit_back(std::function<void()> task)
+{
+    push(task, true);
+}
+
+bool cls_workpool::task_get(int indx, std::function<void()> &task)
+{
+    int chk, victim;
+
+    queues[indx]->mtx.lock();
+        if (queues[indx]->tasks.empty() == false) {
+            task = queues[indx]->tasks.back();
+            queues[indx]->tasks.pop_back();
+            queues[indx]->mtx.unlock();
+            return true;
+        }
+    queues[indx]->mtx.unlock();
+
+    for (chk=1; chk < threads; chk++) {
+        victim = (indx + chk) % threads;
+        queues[victim]->mtx.lock();
+            if (queues[victim]->tasks.empty() == false) {
+                task = queues[victim]->tasks.front();
+                queues[victim]->tasks.pop_front();
+                queues[victim]->mtx.unlock();
+                return true;
+            }
+        queues[victim]->mtx.unlock();
+    }
+
+    return false;
+}
+
+void cls_workpool::worker(int indx)
+{
+    std::function<void()> task;
+
+    workpool_self = indx;
+    mythreadname_set(name.c_str(), indx, NULL);
+
+    while (true) {
+        if (task_get(indx, task) == true) {
+            mtx.lock();
+                queued--;
+            mtx.unlock();
+            task();
+            task = nullptr;
+            mtx.lock();
+                pending--;
+            mtx.unlock();
+            cond.notify_all();
+            continue;
+        }
+
+        /* A submit between task_get and here has already counted its
+         * task so the predicate keeps the worker from sleeping on it
+        */
+        std::unique_lock<std::mutex> lck(mtx);
+        if (finish == true) {
+            break;
+        }
+        cond.wait_for(lck, std::chrono::milliseconds(100)
+            , [this]() { return ((finish == true) || (queued > 0)); });
+        if (finish == true) {
+            break;
+        }
+    }
+}
+
+/* Block until every submitted task has finished */
+void cls_workpool::wait()
+{
+    std::unique_lock<std::mutex> lck(mtx);
+    while (pending > 0) {
+        cond.wait_for(lck, std::chrono::milliseconds(100));
+    }
+}
+
+/**************************************************/
+
+/* Run a few tasks and then go to the back of the pool again so one
+ * busy strand does not hold a worker.  The tasks queued before it on
+ * this worker run first unless another worker steals the strand
+*/
+void cls_strand::drain()
+{
+    int cnt;
+    std::function<void()> task;
+
+    for (cnt=0; cnt < 16; cnt++) {
+        mtx.lock();
+            if (tasks.empty() == true) {
+                running = false;
+                mtx.unlock();
+                cond.notify_all();
+                return;
+            }
+            task = tasks.front();
+            tasks.pop_front();
+        mtx.unlock();
+
+        task();
+        task = nullptr;
+        cond.notify_all();
+    }
+    pool->submit_back([this]() { drain(); });
+}
+
+void cls_strand::post(std::function<void()> task)
+{
+    bool start;
+
+    mtx.lock();
+        tasks.push_back(task);
+        start = (running == false);
+        running = true;
+    mtx.unlock();
+
+    if (start == true) {
+        pool->submit([this]() { drain(); });
+    }
+}
+
+/* Block until every posted task has run */
+void cls_strand::wait()
+{
+    std::unique_lock<std::mutex> lck(mtx);
+    while ((running == true) || (tasks.empty() == false)) {
+        cond.wait_for(lck, std::chrono::milliseconds(100));
+    }
+}
+
+/* Block while cnt or more tasks are waiting to run */
+void cls_strand::wait_below(size_t cnt)
+{
+    std::unique_lock<std::mutex> lck(mtx);
+    while (tasks.size() >= cnt) {
+        cond.wait_for(lck, std::chrono::milliseconds(100));
+    }
+}
+
+cls_strand::cls_strand(cls_workpool *p_pool)
+{
+    pool = p_pool;
+    running = false;
+}
+
+cls_strand::~cls_strand()
+{
+    wait();
+}
+
+/**************************************************/
+
+cls_workpool::cls_workpool(int p_threads, std::string p_name)
+{
+    int indx;
+
+    threads = p_threads;
+    if (threads < 1) {
+        threads = (int)std::thread::hardware_concurrency();
+        if (threads < 1) {
+            threads = 1;
+        }
+    }
+    name = p_name;
+    pending = 0;
+    queued = 0;
+    next = 0;
+    finish = false;
+
+    for (indx=0; indx < threads; indx++) {
+        queues.push_back(new ctx_workpool_queue);
+    }
+    for (indx=0; indx < threads; indx++) {
+        workers.push_back(std::thread(&cls_workpool::worker, this, indx));
+    }
+}
+
+cls_workpool::~cls_workpool()
+{
+    int indx;
+
+    wait();
+
+    mtx.lock();
+        finish = true;
+    mtx.unlock();
+    cond.notify_all();
+
+    for (indx=0; indx < (int)workers.size(); indx++) {
+        workers[indx].join();
+    }
+    workers.clear();
+
+    for (indx=0; indx < (int)queues.size(); indx++) {
+        delete queues[indx];
+    }
+    queues.clear();
+}
@@ -0,0 +1,78 @@
+/*
+ *    This file is part of Restream.
+ *
+ *    Restream is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    Restream is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with Restream.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef _INCLUDE_WORKPOOL_HPP_
+#define _INCLUDE_WORKPOOL_HPP_
+
+    /* One queue per worker.  A worker takes its newest task first and
+     * when its own queue is empty it steals the oldest task of another
+    */
+    struct ctx_workpool_queue {
+        std::mutex                          mtx;
+        std::deque<std::function<void()>>   tasks;
+    };
+
+    class cls_workpool {
+        public:
+            cls_workpool(int p_threads, std::string p_name);
+            ~cls_workpool();
+
+            int     threads;
+            void    submit(std::function<void()> task);
+            void    submit_back(std::function<void()> task);
+            void    wait();
+
+        private:
+            std::string     name;
+            std::vector<ctx_workpool_queue*>    queues;
+            std::vector<std::thread>            workers;
+            std::mutex                  mtx;
+            std::condition_variable     cond;
+            std::atomic<int>            pending;    /* Tasks submitted and not yet finished */
+            int                         queued;     /* Tasks not yet taken by a worker, under mtx */
+            std::atomic<int>            next;       /* Queue for the next outside submit */
+            bool                        finish;
+
+            void    push(std::function<void()> task, bool back);
+            bool    task_get(int indx, std::function<void()> &task);
+            void    worker(int indx);
+    };
+
+    /* Runs the tasks posted to it one at a time and in order on the pool
+     * so that work for one channel never runs concurrently
+    */
+    class cls_strand {
+        public:
+            cls_strand(cls_workpool *p_pool);
+            ~cls_strand();
+
+            void    post(std::function<void()> task);
+            void    wait();
+            void    wait_below(size_t cnt);
+
+        private:
+            cls_workpool    *pool;
+            std::mutex      mtx;
+            std::condition_variable     cond;
+            std::deque<std::function<void()>>   tasks;
+            bool            running;    /* A drain task is queued or running on the pool */
+
+            void    drain();
+    };
+
+#endif